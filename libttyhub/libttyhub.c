@@ -0,0 +1,515 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The tty side of libttyhub (see libttyhub.h): ports, module init and
+ * parameters, and the netlink interface of ttyhub_genl.h, which is replaced
+ * by an event handler.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/kernel.h>
+#include <linux/tty.h>
+#include "ttyhub.h"
+#include "ttyhub_genl.h"
+#include "libttyhub.h"
+
+/* the line discipline number of ttyhub (N_TTYHUB in ttyhub_core.c) */
+#define TTYHUB_LIB_LDISC        29
+
+/* size of the flip buffer of a port */
+#define TTYHUB_LIB_BUF_SIZE     4096
+
+struct ttyhub_port {
+        struct tty_struct tty;
+        struct list_head node;
+        int fd;
+        int own_fd;
+        /* termios of fd before ttyhub_port_open() */
+        struct termios saved;
+        /* bytes read but not accepted by the receive state machine yet */
+        unsigned char buf[TTYHUB_LIB_BUF_SIZE];
+        int len;
+};
+
+/* the initcalls and parameters of all modules (see ttyhub_shim.h) */
+extern const struct shim_initcall __start_shim_initcall[];
+extern const struct shim_initcall __stop_shim_initcall[];
+extern const struct shim_param __start_shim_param[];
+extern const struct shim_param __stop_shim_param[];
+
+static DEFINE_MUTEX(ttyhub_lib_lock);
+static LIST_HEAD(ttyhub_lib_ports);
+static int ttyhub_lib_initialized;
+
+static ttyhub_lib_event_handler ttyhub_lib_handler;
+static void *ttyhub_lib_handler_arg;
+
+/*
+ * Replacement of ttyhub_genl.c
+ */
+
+int ttyhub_genl_init(void)
+{
+        return 0;
+}
+
+void ttyhub_genl_exit(void)
+{
+}
+
+int ttyhub_genl_listening(void)
+{
+        return READ_ONCE(ttyhub_lib_handler) != NULL;
+}
+
+void ttyhub_genl_event(const char *tty, u32 event, s32 subsys, u64 value,
+                        u32 suppressed)
+{
+        ttyhub_lib_event_handler handler = READ_ONCE(ttyhub_lib_handler);
+
+        if (handler)
+                handler(tty, event, subsys, value, suppressed,
+                                ttyhub_lib_handler_arg);
+}
+
+void ttyhub_lib_set_event_handler(ttyhub_lib_event_handler handler,
+                        void *arg)
+{
+        ttyhub_lib_handler_arg = arg;
+        WRITE_ONCE(ttyhub_lib_handler, handler);
+}
+
+void ttyhub_lib_set_loglevel(int level)
+{
+        shim_loglevel = level;
+}
+
+void ttyhub_lib_dump(FILE *f)
+{
+        struct ttyhub_snapshot *snap;
+        int pos, i;
+
+        for (pos=0; (snap = ttyhub_snapshot(pos)) != NULL; pos++) {
+                fprintf(f, "%s: received %llu, discarded %llu, timed "
+                                "discards %llu, dropped %llu, aborted %llu, "
+                                "echo %llu (lost %llu)\n", snap->tty,
+                                snap->bytes_received, snap->bytes_discarded,
+                                snap->timed_discards, snap->frames_dropped,
+                                snap->frames_aborted, snap->echo_bytes,
+                                snap->echo_lost);
+                for (i=0; i < snap->nr_subsys; i++)
+                        fprintf(f, "  %2u %-16s %llu frames, %llu bytes, "
+                                        "%llu shed\n", snap->subsys[i].index,
+                                        snap->subsys[i].name,
+                                        snap->subsys[i].frames,
+                                        snap->subsys[i].bytes,
+                                        snap->subsys[i].frames_shed);
+                kfree(snap);
+        }
+}
+
+void ttyhub_lib_clock_advance(unsigned long long ns)
+{
+        shim_clock_advance(ns);
+}
+
+/*
+ * Modules
+ */
+
+int ttyhub_lib_param_set(const char *param, const char *value)
+{
+        const struct shim_param *p;
+        const char *name = strchr(param, '.');
+        char *end;
+        long n;
+
+        if (name == NULL)
+                return -EINVAL;
+        for (p=__start_shim_param; p < __stop_shim_param; p++) {
+                if (strncmp(p->module, param, name - param) ||
+                                p->module[name - param] ||
+                                strcmp(p->name, name + 1))
+                        continue;
+
+                if (p->type == SHIM_PARAM_bool) {
+                        if (strchr("1yY", value[0]))
+                                *(bool *)p->value = true;
+                        else if (strchr("0nN", value[0]))
+                                *(bool *)p->value = false;
+                        else
+                                return -EINVAL;
+                        return 0;
+                }
+                errno = 0;
+                n = strtol(value, &end, 0);
+                if (errno || end == value || *end ||
+                                (p->type == SHIM_PARAM_uint &&
+                                 (n < 0 || n > UINT_MAX)) ||
+                                (p->type == SHIM_PARAM_int &&
+                                 (n < INT_MIN || n > INT_MAX)))
+                        return -EINVAL;
+                *(int *)p->value = n;
+                return 0;
+        }
+        return -ENOENT;
+}
+
+/* run the exit functions of the modules whose init function was run */
+static void ttyhub_lib_exit_modules(const struct shim_initcall *inited[],
+                        int n)
+{
+        const struct shim_initcall *c;
+
+        while (n--) {
+                for (c=__start_shim_initcall; c < __stop_shim_initcall; c++)
+                        if (c->exit && !strcmp(c->module, inited[n]->module))
+                                c->exit();
+        }
+}
+
+/* the initcalls in the order they were run, ttyhub first */
+static const struct shim_initcall **ttyhub_lib_inited;
+static int ttyhub_lib_nr_inited;
+
+int ttyhub_lib_init(void)
+{
+        const struct shim_initcall *c;
+        int pass, n = 0, err;
+
+        mutex_lock(&ttyhub_lib_lock);
+        if (ttyhub_lib_initialized) {
+                err = -EBUSY;
+                goto out_unlock;
+        }
+        ttyhub_lib_inited = calloc(__stop_shim_initcall -
+                        __start_shim_initcall, sizeof(*ttyhub_lib_inited));
+        if (ttyhub_lib_inited == NULL) {
+                err = -ENOMEM;
+                goto out_unlock;
+        }
+        err = shim_start();
+        if (err)
+                goto error_free;
+
+        /* subsystems register with ttyhub, so it is initialized first */
+        for (pass=0; pass < 2; pass++) {
+                for (c=__start_shim_initcall; c < __stop_shim_initcall; c++) {
+                        if (c->init == NULL ||
+                                        !strcmp(c->module, "ttyhub") != !pass)
+                                continue;
+                        err = c->init();
+                        if (err) {
+                                printk(KERN_ERR "libttyhub: init of %s "
+                                                "failed (err = %d)\n",
+                                                c->module, err);
+                                goto error_exit;
+                        }
+                        ttyhub_lib_inited[n++] = c;
+                }
+        }
+        ttyhub_lib_nr_inited = n;
+        ttyhub_lib_initialized = 1;
+        mutex_unlock(&ttyhub_lib_lock);
+        return 0;
+
+error_exit:
+        ttyhub_lib_exit_modules(ttyhub_lib_inited, n);
+        shim_stop();
+error_free:
+        free(ttyhub_lib_inited);
+        ttyhub_lib_inited = NULL;
+out_unlock:
+        mutex_unlock(&ttyhub_lib_lock);
+        return err;
+}
+
+void ttyhub_lib_exit(void)
+{
+        struct ttyhub_port *port;
+
+        while (1) {
+                mutex_lock(&ttyhub_lib_lock);
+                port = list_first_entry_or_null(&ttyhub_lib_ports,
+                                struct ttyhub_port, node);
+                mutex_unlock(&ttyhub_lib_lock);
+                if (port == NULL)
+                        break;
+                ttyhub_port_close(port);
+        }
+
+        mutex_lock(&ttyhub_lib_lock);
+        if (ttyhub_lib_initialized) {
+                ttyhub_lib_exit_modules(ttyhub_lib_inited,
+                                ttyhub_lib_nr_inited);
+                shim_stop();
+                free(ttyhub_lib_inited);
+                ttyhub_lib_inited = NULL;
+                ttyhub_lib_initialized = 0;
+        }
+        mutex_unlock(&ttyhub_lib_lock);
+}
+
+/*
+ * Ports
+ */
+
+/* tty driver write() operation - never blocks, like a full UART FIFO
+   accepts nothing */
+static ssize_t ttyhub_port_tty_write(struct tty_struct *tty, const u8 *buf,
+                        size_t count)
+{
+        struct ttyhub_port *port = container_of(tty, struct ttyhub_port, tty);
+        ssize_t n;
+
+        n = write(port->fd, buf, count);
+        if (n < 0)
+                return errno == EAGAIN ? 0 : -errno;
+        return n;
+}
+
+static unsigned int ttyhub_port_tty_write_room(struct tty_struct *tty)
+{
+        struct ttyhub_port *port = container_of(tty, struct ttyhub_port, tty);
+        int queued;
+
+        if (ioctl(port->fd, TIOCOUTQ, &queued) || queued < 0)
+                queued = 0;
+        return queued < TTYHUB_LIB_BUF_SIZE ?
+                TTYHUB_LIB_BUF_SIZE - queued : 0;
+}
+
+static const struct tty_operations ttyhub_port_tty_ops = {
+        .write          = ttyhub_port_tty_write,
+        .write_room     = ttyhub_port_tty_write_room,
+};
+
+static speed_t ttyhub_port_speed(unsigned int baud)
+{
+        static const struct {
+                unsigned int baud;
+                speed_t speed;
+        } speeds[] = {
+                { 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 },
+                { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 },
+                { 57600, B57600 }, { 115200, B115200 },
+                { 230400, B230400 }, { 460800, B460800 },
+                { 500000, B500000 }, { 921600, B921600 },
+                { 1000000, B1000000 }, { 2000000, B2000000 },
+                { 3000000, B3000000 }, { 4000000, B4000000 },
+        };
+        unsigned int i;
+
+        for (i=0; i < ARRAY_SIZE(speeds); i++)
+                if (speeds[i].baud == baud)
+                        return speeds[i].speed;
+        return B0;
+}
+
+static struct ttyhub_port *ttyhub_port_create(int fd, const char *name,
+                        unsigned int baud)
+{
+        struct ttyhub_port *port;
+        struct tty_ldisc_ops *ldisc = shim_ldisc(TTYHUB_LIB_LDISC);
+        int flags, err;
+
+        if (ldisc == NULL) {
+                errno = ENODEV;
+                return NULL;
+        }
+        flags = fcntl(fd, F_GETFL);
+        if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+                return NULL;
+
+        port = calloc(1, sizeof(*port));
+        if (port == NULL)
+                return NULL;
+        port->fd = fd;
+        strscpy(port->tty.name, name, sizeof(port->tty.name));
+        port->tty.ops = &ttyhub_port_tty_ops;
+        port->tty.baud = baud;
+        port->tty.index = fd;
+
+        err = ldisc->open(&port->tty);
+        if (err) {
+                free(port);
+                errno = -err;
+                return NULL;
+        }
+
+        mutex_lock(&ttyhub_lib_lock);
+        list_add_tail(&port->node, &ttyhub_lib_ports);
+        mutex_unlock(&ttyhub_lib_lock);
+        return port;
+}
+
+struct ttyhub_port *ttyhub_port_attach(int fd, const char *name,
+                        unsigned int baud)
+{
+        char buf[16];
+
+        if (name == NULL) {
+                snprintf(buf, sizeof(buf), "fd%d", fd);
+                name = buf;
+        }
+        return ttyhub_port_create(fd, name, baud);
+}
+
+struct ttyhub_port *ttyhub_port_open(const char *path, unsigned int baud)
+{
+        struct ttyhub_port *port;
+        struct termios tio, saved;
+        const char *name = path;
+        speed_t speed = ttyhub_port_speed(baud);
+        int fd, err;
+
+        if (speed == B0) {
+                errno = EINVAL;
+                return NULL;
+        }
+        if (strncmp(name, "/dev/", 5) == 0)
+                name += 5;
+        fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (fd == -1)
+                return NULL;
+        if (tcgetattr(fd, &saved))
+                goto error_close;
+        tio = saved;
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+        if (cfsetspeed(&tio, speed) || tcsetattr(fd, TCSANOW, &tio))
+                goto error_close;
+
+        port = ttyhub_port_create(fd, name, baud);
+        if (port == NULL) {
+                err = errno;
+                tcsetattr(fd, TCSANOW, &saved);
+                close(fd);
+                errno = err;
+                return NULL;
+        }
+        port->own_fd = 1;
+        port->saved = saved;
+        return port;
+
+error_close:
+        err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+}
+
+void ttyhub_port_close(struct ttyhub_port *port)
+{
+        mutex_lock(&ttyhub_lib_lock);
+        list_del(&port->node);
+        mutex_unlock(&ttyhub_lib_lock);
+
+        shim_ldisc(TTYHUB_LIB_LDISC)->close(&port->tty);
+        if (port->own_fd) {
+                tcsetattr(port->fd, TCSANOW, &port->saved);
+                close(port->fd);
+        }
+        free(port);
+}
+
+int ttyhub_port_fd(struct ttyhub_port *port)
+{
+        return port->fd;
+}
+
+struct tty_struct *ttyhub_port_tty(struct ttyhub_port *port)
+{
+        return &port->tty;
+}
+
+unsigned int ttyhub_port_events(struct ttyhub_port *port)
+{
+        unsigned int events = EPOLLIN;
+
+        if (test_bit(TTY_DO_WRITE_WAKEUP, &port->tty.flags))
+                events |= EPOLLOUT;
+        return events;
+}
+
+int ttyhub_port_ioctl(struct ttyhub_port *port, unsigned int cmd, void *arg)
+{
+        return shim_ldisc(TTYHUB_LIB_LDISC)->ioctl(&port->tty, cmd,
+                        (unsigned long)arg);
+}
+
+size_t ttyhub_port_receive(struct ttyhub_port *port, const unsigned char *cp,
+                        const unsigned char *flags, size_t count)
+{
+        return shim_ldisc(TTYHUB_LIB_LDISC)->receive_buf2(&port->tty, cp,
+                        flags, count);
+}
+
+/* pass the bytes in the flip buffer of the port to the receive state
+   machine until it accepts no more */
+static void ttyhub_port_push(struct ttyhub_port *port)
+{
+        size_t n, done = 0;
+
+        while (done < port->len) {
+                n = ttyhub_port_receive(port, port->buf + done, NULL,
+                                port->len - done);
+                if (n == 0)
+                        break;
+                done += n;
+        }
+        if (done) {
+                memmove(port->buf, port->buf + done, port->len - done);
+                port->len -= done;
+        }
+}
+
+int ttyhub_port_read(struct ttyhub_port *port)
+{
+        ssize_t n;
+
+        /* bytes not accepted before are passed again first */
+        ttyhub_port_push(port);
+        if (port->len == TTYHUB_LIB_BUF_SIZE)
+                return -EAGAIN;
+
+        n = read(port->fd, port->buf + port->len,
+                        TTYHUB_LIB_BUF_SIZE - port->len);
+        if (n < 0)
+                /* a pty whose other side is closed reads EIO */
+                return errno == EIO ? 0 : -errno;
+        port->len += n;
+        ttyhub_port_push(port);
+        return n;
+}
+
+void ttyhub_port_writable(struct ttyhub_port *port)
+{
+        struct tty_ldisc_ops *ldisc = shim_ldisc(TTYHUB_LIB_LDISC);
+
+        if (test_bit(TTY_DO_WRITE_WAKEUP, &port->tty.flags))
+                ldisc->write_wakeup(&port->tty);
+}
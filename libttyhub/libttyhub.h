@@ -0,0 +1,106 @@
+#ifndef _LIBTTYHUB_H
+#define _LIBTTYHUB_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libttyhub - the receive engine of ttyhub and the subsystems testsubsys0
+ * and ttyhubref in user space, for hosts that can't load the kernel modules.
+ * The kernel sources are built unchanged against a small shim of the kernel
+ * API (see shim/ttyhub_shim.h), so the framing semantics are the same.
+ *
+ * A port takes the place of a tty using the line discipline: it reads from
+ * a file descriptor - usually a tty in raw mode - and passes the data to the
+ * receive state machine like the flip buffer of a tty does. The ioctls of
+ * ttyhub_ioctl.h are issued with ttyhub_port_ioctl() instead of ioctl().
+ * The library has no thread reading the ports; the application polls the
+ * file descriptors (e.g. with epoll) and calls ttyhub_port_read() and
+ * ttyhub_port_writable() when they are ready.
+ *
+ * Netlink is not available: events are passed to the handler set with
+ * ttyhub_lib_set_event_handler() and the counters of the ports are written
+ * by ttyhub_lib_dump().
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+
+struct ttyhub_port;
+struct tty_struct;
+
+/* called with the arguments of a TTYHUB_CMD_EVENT message (see
+   ttyhub_netlink.h) - from the receive path of a port, so the handler must
+   not call into the library */
+typedef void (*ttyhub_lib_event_handler)(const char *tty, unsigned int event,
+                        int subsys, unsigned long long value,
+                        unsigned int suppressed, void *arg);
+
+/* run the init functions of ttyhub and the subsystems - returns zero or a
+   negative error code */
+extern int ttyhub_lib_init(void);
+/* close all ports and run the exit functions */
+extern void ttyhub_lib_exit(void);
+
+/* set a module parameter given as "module.name", e.g. "ttyhub.max_subsys"
+   - most parameters are only read by ttyhub_lib_init() */
+extern int ttyhub_lib_param_set(const char *param, const char *value);
+/* messages with a lower priority than level (KERN_* 0..7) are dropped,
+   default 6 (KERN_INFO) */
+extern void ttyhub_lib_set_loglevel(int level);
+extern void ttyhub_lib_set_event_handler(ttyhub_lib_event_handler handler,
+                        void *arg);
+/* write the counters of all ports */
+extern void ttyhub_lib_dump(FILE *f);
+/* for tests - the clock of the library jumps forward by ns, so that
+   timeouts expire as if the time had passed */
+extern void ttyhub_lib_clock_advance(unsigned long long ns);
+
+/* open a tty, switch it to raw mode with the baud rate given and attach
+   ttyhub to it - returns NULL and sets errno on error */
+extern struct ttyhub_port *ttyhub_port_open(const char *path,
+                        unsigned int baud);
+/* attach ttyhub to an open file descriptor, which is switched to
+   nonblocking mode but not closed by ttyhub_port_close() - baud is only
+   used for timing (e.g. TTYHUB_FRAMING_GAP) */
+extern struct ttyhub_port *ttyhub_port_attach(int fd, const char *name,
+                        unsigned int baud);
+extern void ttyhub_port_close(struct ttyhub_port *port);
+
+extern int ttyhub_port_fd(struct ttyhub_port *port);
+extern struct tty_struct *ttyhub_port_tty(struct ttyhub_port *port);
+/* the EPOLLIN / EPOLLOUT events the port waits for */
+extern unsigned int ttyhub_port_events(struct ttyhub_port *port);
+
+/* issue an ioctl of ttyhub_ioctl.h - returns zero or a negative error
+   code */
+extern int ttyhub_port_ioctl(struct ttyhub_port *port, unsigned int cmd,
+                        void *arg);
+/* read the data available from the file descriptor and pass it to the
+   receive state machine - returns the number of bytes read, zero at the
+   end of the file or a negative error code (-EAGAIN when no data was
+   available) */
+extern int ttyhub_port_read(struct ttyhub_port *port);
+/* pass data to the receive state machine as if it had been read, flags
+   may be NULL or hold one TTY_* flag per byte - returns the number of
+   bytes accepted */
+extern size_t ttyhub_port_receive(struct ttyhub_port *port,
+                        const unsigned char *cp, const unsigned char *flags,
+                        size_t count);
+/* the file descriptor can accept more data */
+extern void ttyhub_port_writable(struct ttyhub_port *port);
+
+#endif /* _LIBTTYHUB_H */
@@ -0,0 +1,2 @@
+#include "../ttyhub_shim.h"
+#include <asm/ioctl.h>
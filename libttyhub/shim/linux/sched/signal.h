@@ -0,0 +1 @@
+#include "../../ttyhub_shim.h"
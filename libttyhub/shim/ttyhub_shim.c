@@ -0,0 +1,927 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the kernel API of ttyhub_shim.h. The timer thread and
+ * the work threads are started by shim_start() and stopped by shim_stop(),
+ * which libttyhub calls around the module init and exit functions.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include "ttyhub_shim.h"
+
+#define SHIM_WORK_THREADS       4
+
+int shim_loglevel = 6;
+
+const char hex_asc_upper[] = "0123456789ABCDEF";
+
+/*
+ * Logging and strings
+ */
+
+/*
+ * Strip a KERN_* level from the start of a message.
+ *
+ * Returns the level, 4 (KERN_WARNING) if there is none.
+ */
+static int shim_level(const char **s)
+{
+        const char *p = *s;
+
+        if (p[0] != KERN_SOH[0] || p[1] < '0' || p[1] > '7')
+                return 4;
+        *s = p + 2;
+        return p[1] - '0';
+}
+
+int printk(const char *fmt, ...)
+{
+        va_list ap;
+        int n;
+
+        if (shim_level(&fmt) > shim_loglevel)
+                return 0;
+
+        va_start(ap, fmt);
+        n = vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        return n;
+}
+
+void print_hex_dump(const char *level, const char *prefix, int prefix_type,
+                        int rowsize, int groupsize, const void *buf,
+                        size_t len, bool ascii)
+{
+        const unsigned char *p = buf;
+        char line[3 * 32 + 32 + 2];
+        size_t i, j;
+        int n;
+
+        if (shim_level(&level) > shim_loglevel)
+                return;
+        if (rowsize != 16 && rowsize != 32)
+                rowsize = 16;
+        for (i=0; i < len; i += rowsize) {
+                n = 0;
+                for (j=i; j < i + rowsize; j++)
+                        n += j < len ?
+                                sprintf(line + n, "%02x ", p[j]) :
+                                sprintf(line + n, "   ");
+                if (ascii) {
+                        for (j=i; j < i + rowsize && j < len; j++)
+                                line[n++] = p[j] >= 0x20 && p[j] < 0x7F ?
+                                        p[j] : '.';
+                }
+                line[n] = 0;
+                if (prefix_type == DUMP_PREFIX_NONE)
+                        fprintf(stderr, "%s%s\n", prefix, line);
+                else
+                        fprintf(stderr, "%s%08zx: %s\n", prefix, i, line);
+        }
+}
+
+ssize_t strscpy(char *dest, const char *src, size_t count)
+{
+        size_t len;
+
+        if (count == 0)
+                return -E2BIG;
+        len = strnlen(src, count);
+        if (len == count) {
+                memcpy(dest, src, count - 1);
+                dest[count - 1] = 0;
+                return -E2BIG;
+        }
+        memcpy(dest, src, len + 1);
+        return len;
+}
+
+int shim_warn_on(int cond, const char *file, int line)
+{
+        if (cond)
+                fprintf(stderr, "WARNING: %s:%d\n", file, line);
+        return cond;
+}
+
+/*
+ * Time
+ */
+
+/* added to the monotonic clock by shim_clock_advance() */
+static u64 shim_clock_offset;
+
+u64 ktime_get_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec +
+                __atomic_load_n(&shim_clock_offset, __ATOMIC_RELAXED);
+}
+
+u64 ktime_get_real_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+void usleep_range(unsigned long min, unsigned long max)
+{
+        struct timespec ts = {
+                .tv_sec = min / USEC_PER_SEC,
+                .tv_nsec = min % USEC_PER_SEC * NSEC_PER_USEC,
+        };
+
+        while (nanosleep(&ts, &ts) && errno == EINTR)
+                ;
+}
+
+void msleep(unsigned int msecs)
+{
+        usleep_range((unsigned long)msecs * USEC_PER_MSEC,
+                        (unsigned long)msecs * USEC_PER_MSEC);
+}
+
+/* absolute CLOCK_MONOTONIC time for pthread_cond_timedwait() */
+static struct timespec shim_timespec(ktime_t t)
+{
+        struct timespec ts;
+
+        t -= __atomic_load_n(&shim_clock_offset, __ATOMIC_RELAXED);
+        ts = (struct timespec) {
+                .tv_sec = t / NSEC_PER_SEC,
+                .tv_nsec = t % NSEC_PER_SEC,
+        };
+        return ts;
+}
+
+/*
+ * Memory pools
+ */
+
+mempool_t *mempool_create_kmalloc_pool(int min_nr, size_t size)
+{
+        mempool_t *pool = malloc(sizeof(*pool));
+
+        if (pool)
+                pool->size = size;
+        return pool;
+}
+
+void mempool_destroy(mempool_t *pool)
+{
+        free(pool);
+}
+
+/*
+ * RCU
+ */
+
+pthread_rwlock_t shim_rcu_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+void synchronize_rcu(void)
+{
+        pthread_rwlock_wrlock(&shim_rcu_lock);
+        pthread_rwlock_unlock(&shim_rcu_lock);
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *))
+{
+        synchronize_rcu();
+        func(head);
+}
+
+/*
+ * High resolution timers - armed timers are kept in a list sorted by
+ * expiry time, the timer thread runs their callbacks without holding the
+ * timer lock
+ */
+
+static pthread_mutex_t shim_timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shim_timer_cond;
+static pthread_cond_t shim_timer_done;
+static struct hrtimer *shim_timers;
+static struct hrtimer *shim_timer_running;
+static pthread_t shim_timer_thread;
+static int shim_timer_stop;
+
+/* timer lock held */
+static void shim_timer_dequeue(struct hrtimer *timer)
+{
+        struct hrtimer **p;
+
+        for (p=&shim_timers; *p; p = &(*p)->next) {
+                if (*p == timer) {
+                        *p = timer->next;
+                        break;
+                }
+        }
+        timer->queued = 0;
+}
+
+/* timer lock held */
+static void shim_timer_enqueue(struct hrtimer *timer)
+{
+        struct hrtimer **p;
+
+        for (p=&shim_timers; *p && (*p)->expires <= timer->expires;
+                        p = &(*p)->next)
+                ;
+        timer->next = *p;
+        *p = timer;
+        timer->queued = 1;
+        if (shim_timers == timer)
+                pthread_cond_signal(&shim_timer_cond);
+}
+
+static void *shim_timer_fn(void *arg)
+{
+        struct hrtimer *timer;
+        struct timespec ts;
+        enum hrtimer_restart restart;
+
+        pthread_mutex_lock(&shim_timer_lock);
+        while (!shim_timer_stop) {
+                timer = shim_timers;
+                if (timer == NULL) {
+                        pthread_cond_wait(&shim_timer_cond, &shim_timer_lock);
+                        continue;
+                }
+                if (timer->expires > (ktime_t)ktime_get_ns()) {
+                        ts = shim_timespec(timer->expires);
+                        pthread_cond_timedwait(&shim_timer_cond,
+                                        &shim_timer_lock, &ts);
+                        continue;
+                }
+
+                shim_timer_dequeue(timer);
+                shim_timer_running = timer;
+                pthread_mutex_unlock(&shim_timer_lock);
+                restart = timer->function(timer);
+                pthread_mutex_lock(&shim_timer_lock);
+                shim_timer_running = NULL;
+                if (restart == HRTIMER_RESTART && !timer->queued)
+                        shim_timer_enqueue(timer);
+                pthread_cond_broadcast(&shim_timer_done);
+        }
+        pthread_mutex_unlock(&shim_timer_lock);
+        return NULL;
+}
+
+void hrtimer_setup(struct hrtimer *timer,
+                        enum hrtimer_restart (*function)(struct hrtimer *),
+                        int clock, int mode)
+{
+        memset(timer, 0, sizeof(*timer));
+        timer->function = function;
+}
+
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, int mode)
+{
+        pthread_mutex_lock(&shim_timer_lock);
+        if (timer->queued)
+                shim_timer_dequeue(timer);
+        timer->expires = mode == HRTIMER_MODE_ABS ? tim :
+                (ktime_t)ktime_get_ns() + tim;
+        shim_timer_enqueue(timer);
+        pthread_mutex_unlock(&shim_timer_lock);
+}
+
+int hrtimer_try_to_cancel(struct hrtimer *timer)
+{
+        int ret = 0;
+
+        pthread_mutex_lock(&shim_timer_lock);
+        if (shim_timer_running == timer)
+                ret = -1;
+        else if (timer->queued) {
+                shim_timer_dequeue(timer);
+                ret = 1;
+        }
+        pthread_mutex_unlock(&shim_timer_lock);
+        return ret;
+}
+
+int hrtimer_cancel(struct hrtimer *timer)
+{
+        int ret = 0;
+
+        pthread_mutex_lock(&shim_timer_lock);
+        while (shim_timer_running == timer)
+                pthread_cond_wait(&shim_timer_done, &shim_timer_lock);
+        if (timer->queued) {
+                shim_timer_dequeue(timer);
+                ret = 1;
+        }
+        pthread_mutex_unlock(&shim_timer_lock);
+        return ret;
+}
+
+bool hrtimer_active(const struct hrtimer *timer)
+{
+        bool active;
+
+        pthread_mutex_lock(&shim_timer_lock);
+        active = timer->queued || shim_timer_running == timer;
+        pthread_mutex_unlock(&shim_timer_lock);
+        return active;
+}
+
+/* let the clock jump forward - timers expiring meanwhile are run */
+void shim_clock_advance(u64 ns)
+{
+        pthread_mutex_lock(&shim_timer_lock);
+        __atomic_add_fetch(&shim_clock_offset, ns, __ATOMIC_RELAXED);
+        pthread_cond_signal(&shim_timer_cond);
+        pthread_mutex_unlock(&shim_timer_lock);
+}
+
+/* nonzero while the timer waits for its expiry time */
+static int shim_timer_queued(const struct hrtimer *timer)
+{
+        int queued;
+
+        pthread_mutex_lock(&shim_timer_lock);
+        queued = timer->queued;
+        pthread_mutex_unlock(&shim_timer_lock);
+        return queued;
+}
+
+/*
+ * Work items - all work queues share one list and a few threads. Like in
+ * the kernel a work item is pending from queueing (or arming the timer of
+ * a delayed work item) until it starts running, and never runs on two
+ * threads at once.
+ */
+
+struct workqueue_struct {
+        const char *name;
+};
+
+static struct workqueue_struct shim_system_wq = { "events" };
+static struct workqueue_struct shim_system_unbound_wq = { "events_unbound" };
+struct workqueue_struct *system_wq = &shim_system_wq;
+struct workqueue_struct *system_unbound_wq = &shim_system_unbound_wq;
+
+static pthread_mutex_t shim_work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shim_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t shim_work_done = PTHREAD_COND_INITIALIZER;
+static LIST_HEAD(shim_works);
+static pthread_t shim_work_threads[SHIM_WORK_THREADS];
+static int shim_work_stop;
+
+static void *shim_work_fn(void *arg)
+{
+        struct work_struct *work;
+        int found;
+
+        pthread_mutex_lock(&shim_work_lock);
+        while (1) {
+                found = 0;
+                list_for_each_entry(work, &shim_works, entry) {
+                        if (!work->running) {
+                                found = 1;
+                                break;
+                        }
+                }
+                if (!found) {
+                        if (shim_work_stop)
+                                break;
+                        pthread_cond_wait(&shim_work_cond, &shim_work_lock);
+                        continue;
+                }
+
+                list_del_init(&work->entry);
+                work->pending = 0;
+                work->running = 1;
+                pthread_mutex_unlock(&shim_work_lock);
+                work->func(work);
+                pthread_mutex_lock(&shim_work_lock);
+                work->running = 0;
+                pthread_cond_broadcast(&shim_work_done);
+                if (!list_empty(&shim_works))
+                        /* the work may have been queued again meanwhile */
+                        pthread_cond_broadcast(&shim_work_cond);
+        }
+        pthread_mutex_unlock(&shim_work_lock);
+        return NULL;
+}
+
+/* work lock held */
+static void shim_work_insert(struct work_struct *work)
+{
+        if (list_empty(&work->entry))
+                list_add_tail(&work->entry, &shim_works);
+        pthread_cond_signal(&shim_work_cond);
+}
+
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work)
+{
+        bool queued = false;
+
+        pthread_mutex_lock(&shim_work_lock);
+        if (!work->pending) {
+                work->pending = 1;
+                shim_work_insert(work);
+                queued = true;
+        }
+        pthread_mutex_unlock(&shim_work_lock);
+        return queued;
+}
+
+/* the timer of a delayed work item expired - unless it has been armed
+   again meanwhile the work is queued */
+static enum hrtimer_restart shim_delayed_work_timer(struct hrtimer *timer)
+{
+        struct delayed_work *dwork = container_of(timer, struct delayed_work,
+                        timer);
+
+        pthread_mutex_lock(&shim_work_lock);
+        if (dwork->work.pending && !shim_timer_queued(timer))
+                shim_work_insert(&dwork->work);
+        pthread_mutex_unlock(&shim_work_lock);
+        return HRTIMER_NORESTART;
+}
+
+void shim_init_delayed_work(struct delayed_work *dwork, work_func_t func)
+{
+        INIT_WORK(&dwork->work, func);
+        hrtimer_setup(&dwork->timer, shim_delayed_work_timer, 0,
+                        HRTIMER_MODE_REL);
+        dwork->wq = NULL;
+}
+
+/* work lock held */
+static void shim_delayed_work_arm(struct workqueue_struct *wq,
+                        struct delayed_work *dwork, unsigned long delay)
+{
+        dwork->wq = wq;
+        dwork->work.pending = 1;
+        if (delay == 0)
+                shim_work_insert(&dwork->work);
+        else
+                hrtimer_start(&dwork->timer,
+                                (ktime_t)delay * (NSEC_PER_SEC / HZ),
+                                HRTIMER_MODE_REL);
+}
+
+bool queue_delayed_work(struct workqueue_struct *wq,
+                        struct delayed_work *dwork, unsigned long delay)
+{
+        bool queued = false;
+
+        pthread_mutex_lock(&shim_work_lock);
+        if (!dwork->work.pending) {
+                shim_delayed_work_arm(wq, dwork, delay);
+                queued = true;
+        }
+        pthread_mutex_unlock(&shim_work_lock);
+        return queued;
+}
+
+bool mod_delayed_work(struct workqueue_struct *wq,
+                        struct delayed_work *dwork, unsigned long delay)
+{
+        bool pending;
+
+        pthread_mutex_lock(&shim_work_lock);
+        pending = dwork->work.pending;
+        hrtimer_try_to_cancel(&dwork->timer);
+        if (!list_empty(&dwork->work.entry))
+                list_del_init(&dwork->work.entry);
+        shim_delayed_work_arm(wq, dwork, delay);
+        pthread_mutex_unlock(&shim_work_lock);
+        return pending;
+}
+
+/* work lock held */
+static bool shim_work_cancel(struct work_struct *work)
+{
+        bool pending = work->pending;
+
+        if (!list_empty(&work->entry))
+                list_del_init(&work->entry);
+        work->pending = 0;
+        while (work->running)
+                pthread_cond_wait(&shim_work_done, &shim_work_lock);
+        return pending;
+}
+
+bool cancel_work_sync(struct work_struct *work)
+{
+        bool pending;
+
+        pthread_mutex_lock(&shim_work_lock);
+        pending = shim_work_cancel(work);
+        pthread_mutex_unlock(&shim_work_lock);
+        return pending;
+}
+
+bool cancel_delayed_work_sync(struct delayed_work *dwork)
+{
+        bool pending;
+
+        /* the timer callback takes the work lock */
+        hrtimer_cancel(&dwork->timer);
+        pthread_mutex_lock(&shim_work_lock);
+        pending = shim_work_cancel(&dwork->work);
+        pthread_mutex_unlock(&shim_work_lock);
+        return pending;
+}
+
+bool flush_work(struct work_struct *work)
+{
+        bool waited = false;
+
+        pthread_mutex_lock(&shim_work_lock);
+        while (work->pending || work->running) {
+                pthread_cond_wait(&shim_work_done, &shim_work_lock);
+                waited = true;
+        }
+        pthread_mutex_unlock(&shim_work_lock);
+        return waited;
+}
+
+bool flush_delayed_work(struct delayed_work *dwork)
+{
+        pthread_mutex_lock(&shim_work_lock);
+        if (hrtimer_try_to_cancel(&dwork->timer) == 1)
+                shim_work_insert(&dwork->work);
+        pthread_mutex_unlock(&shim_work_lock);
+        return flush_work(&dwork->work);
+}
+
+/*
+ * Kernel threads
+ */
+
+struct task_struct {
+        pthread_t thread;
+        int (*threadfn)(void *data);
+        void *data;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        int woken;
+        int should_stop;
+        int cpu;
+        int ret;
+        char comm[16];
+};
+
+static __thread struct task_struct *shim_current;
+
+static void *shim_kthread_fn(void *arg)
+{
+        struct task_struct *task = arg;
+        cpu_set_t set;
+
+        shim_current = task;
+        pthread_mutex_lock(&task->lock);
+        while (!task->woken)
+                pthread_cond_wait(&task->cond, &task->lock);
+        task->woken = 0;
+        pthread_mutex_unlock(&task->lock);
+
+        if (__atomic_load_n(&task->should_stop, __ATOMIC_ACQUIRE)) {
+                task->ret = -EINTR;
+                return NULL;
+        }
+        if (task->cpu >= 0) {
+                CPU_ZERO(&set);
+                CPU_SET(task->cpu, &set);
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+        pthread_setname_np(pthread_self(), task->comm);
+        task->ret = task->threadfn(task->data);
+        return NULL;
+}
+
+struct task_struct *kthread_create(int (*threadfn)(void *data), void *data,
+                        const char *namefmt, ...)
+{
+        struct task_struct *task;
+        va_list ap;
+
+        task = calloc(1, sizeof(*task));
+        if (task == NULL)
+                return ERR_PTR(-ENOMEM);
+        task->threadfn = threadfn;
+        task->data = data;
+        task->cpu = -1;
+        pthread_mutex_init(&task->lock, NULL);
+        pthread_cond_init(&task->cond, NULL);
+        va_start(ap, namefmt);
+        vsnprintf(task->comm, sizeof(task->comm), namefmt, ap);
+        va_end(ap);
+
+        if (pthread_create(&task->thread, NULL, shim_kthread_fn, task)) {
+                free(task);
+                return ERR_PTR(-EAGAIN);
+        }
+        return task;
+}
+
+void kthread_bind(struct task_struct *task, unsigned int cpu)
+{
+        task->cpu = cpu;
+}
+
+int wake_up_process(struct task_struct *task)
+{
+        pthread_mutex_lock(&task->lock);
+        task->woken = 1;
+        pthread_cond_signal(&task->cond);
+        pthread_mutex_unlock(&task->lock);
+        return 1;
+}
+
+int kthread_stop(struct task_struct *task)
+{
+        int ret;
+
+        __atomic_store_n(&task->should_stop, 1, __ATOMIC_RELEASE);
+        wake_up_process(task);
+        pthread_join(task->thread, NULL);
+        ret = task->ret;
+        pthread_cond_destroy(&task->cond);
+        pthread_mutex_destroy(&task->lock);
+        free(task);
+        return ret;
+}
+
+bool kthread_should_stop(void)
+{
+        return shim_current &&
+                __atomic_load_n(&shim_current->should_stop, __ATOMIC_ACQUIRE);
+}
+
+/* wakeups between setting the state and calling schedule() are not lost -
+   they are remembered until the thread sleeps */
+void set_current_state(int state)
+{
+        smp_mb();
+}
+
+void schedule(void)
+{
+        struct task_struct *task = shim_current;
+
+        if (task == NULL) {
+                sched_yield();
+                return;
+        }
+        pthread_mutex_lock(&task->lock);
+        while (!task->woken)
+                pthread_cond_wait(&task->cond, &task->lock);
+        task->woken = 0;
+        pthread_mutex_unlock(&task->lock);
+}
+
+unsigned int num_online_cpus(void)
+{
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+        return n > 0 ? n : 1;
+}
+
+bool cpu_online(unsigned int cpu)
+{
+        return cpu < num_online_cpus();
+}
+
+/*
+ * xarray - a sorted array of entries, searched by bisection
+ */
+
+struct shim_xa_entry {
+        unsigned long index;
+        void *entry;
+};
+
+void xa_init(struct xarray *xa)
+{
+        pthread_mutex_init(&xa->lock, NULL);
+        xa->entries = NULL;
+        xa->count = 0;
+        xa->size = 0;
+}
+
+void xa_destroy(struct xarray *xa)
+{
+        free(xa->entries);
+        xa->entries = NULL;
+        xa->count = 0;
+        xa->size = 0;
+        pthread_mutex_destroy(&xa->lock);
+}
+
+/* xa lock held - returns the position of the first entry >= index */
+static unsigned long shim_xa_pos(struct xarray *xa, unsigned long index)
+{
+        unsigned long lo = 0, hi = xa->count, mid;
+
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (xa->entries[mid].index < index)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return lo;
+}
+
+void *xa_load(struct xarray *xa, unsigned long index)
+{
+        unsigned long pos;
+        void *entry = NULL;
+
+        pthread_mutex_lock(&xa->lock);
+        pos = shim_xa_pos(xa, index);
+        if (pos < xa->count && xa->entries[pos].index == index)
+                entry = xa->entries[pos].entry;
+        pthread_mutex_unlock(&xa->lock);
+        return entry;
+}
+
+void *xa_store(struct xarray *xa, unsigned long index, void *entry,
+                        gfp_t gfp)
+{
+        struct shim_xa_entry *entries;
+        unsigned long pos, size;
+        void *old = NULL;
+
+        if (entry == NULL)
+                return xa_erase(xa, index);
+
+        pthread_mutex_lock(&xa->lock);
+        pos = shim_xa_pos(xa, index);
+        if (pos < xa->count && xa->entries[pos].index == index) {
+                old = xa->entries[pos].entry;
+                xa->entries[pos].entry = entry;
+                goto out_unlock;
+        }
+        if (xa->count == xa->size) {
+                size = xa->size ? xa->size * 2 : 16;
+                entries = realloc(xa->entries, size * sizeof(*entries));
+                if (entries == NULL) {
+                        old = (void *)((unsigned long)-ENOMEM << 2 | 2);
+                        goto out_unlock;
+                }
+                xa->entries = entries;
+                xa->size = size;
+        }
+        memmove(xa->entries + pos + 1, xa->entries + pos,
+                        (xa->count - pos) * sizeof(*xa->entries));
+        xa->entries[pos].index = index;
+        xa->entries[pos].entry = entry;
+        xa->count++;
+
+out_unlock:
+        pthread_mutex_unlock(&xa->lock);
+        return old;
+}
+
+void *xa_erase(struct xarray *xa, unsigned long index)
+{
+        unsigned long pos;
+        void *old = NULL;
+
+        pthread_mutex_lock(&xa->lock);
+        pos = shim_xa_pos(xa, index);
+        if (pos < xa->count && xa->entries[pos].index == index) {
+                old = xa->entries[pos].entry;
+                memmove(xa->entries + pos, xa->entries + pos + 1,
+                                (xa->count - pos - 1) * sizeof(*xa->entries));
+                xa->count--;
+        }
+        pthread_mutex_unlock(&xa->lock);
+        return old;
+}
+
+/* the first entry at or (after) behind *index, for xa_for_each() */
+void *shim_xa_find(struct xarray *xa, unsigned long *index, bool after)
+{
+        unsigned long pos;
+        void *entry = NULL;
+
+        if (after && *index == ULONG_MAX)
+                return NULL;
+
+        pthread_mutex_lock(&xa->lock);
+        pos = shim_xa_pos(xa, after ? *index + 1 : *index);
+        if (pos < xa->count) {
+                *index = xa->entries[pos].index;
+                entry = xa->entries[pos].entry;
+        }
+        pthread_mutex_unlock(&xa->lock);
+        return entry;
+}
+
+/*
+ * Line disciplines
+ */
+
+static struct tty_ldisc_ops *shim_ldiscs[NR_LDISCS];
+
+int tty_register_ldisc(struct tty_ldisc_ops *new_ldisc)
+{
+        if (new_ldisc->num < 1 || new_ldisc->num >= NR_LDISCS)
+                return -EINVAL;
+        if (shim_ldiscs[new_ldisc->num])
+                return -EBUSY;
+        shim_ldiscs[new_ldisc->num] = new_ldisc;
+        return 0;
+}
+
+void tty_unregister_ldisc(struct tty_ldisc_ops *ldisc)
+{
+        shim_ldiscs[ldisc->num] = NULL;
+}
+
+struct tty_ldisc_ops *shim_ldisc(int num)
+{
+        return num >= 0 && num < NR_LDISCS ? shim_ldiscs[num] : NULL;
+}
+
+/*
+ * Threads of the shim
+ */
+
+int shim_start(void)
+{
+        pthread_condattr_t attr;
+        int i, err;
+
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&shim_timer_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_cond_init(&shim_timer_done, NULL);
+
+        shim_timer_stop = 0;
+        shim_work_stop = 0;
+        err = pthread_create(&shim_timer_thread, NULL, shim_timer_fn, NULL);
+        if (err)
+                return -err;
+        for (i=0; i < SHIM_WORK_THREADS; i++) {
+                err = pthread_create(&shim_work_threads[i], NULL,
+                                shim_work_fn, NULL);
+                if (err) {
+                        shim_work_stop = 1;
+                        while (i--)
+                                pthread_join(shim_work_threads[i], NULL);
+                        goto error_stop_timer;
+                }
+        }
+        return 0;
+
+error_stop_timer:
+        pthread_mutex_lock(&shim_timer_lock);
+        shim_timer_stop = 1;
+        pthread_cond_signal(&shim_timer_cond);
+        pthread_mutex_unlock(&shim_timer_lock);
+        pthread_join(shim_timer_thread, NULL);
+        return -err;
+}
+
+/* all work queued is run before the threads exit */
+void shim_stop(void)
+{
+        int i;
+
+        pthread_mutex_lock(&shim_work_lock);
+        shim_work_stop = 1;
+        pthread_cond_broadcast(&shim_work_cond);
+        pthread_mutex_unlock(&shim_work_lock);
+        for (i=0; i < SHIM_WORK_THREADS; i++)
+                pthread_join(shim_work_threads[i], NULL);
+
+        pthread_mutex_lock(&shim_timer_lock);
+        shim_timer_stop = 1;
+        pthread_cond_signal(&shim_timer_cond);
+        pthread_mutex_unlock(&shim_timer_lock);
+        pthread_join(shim_timer_thread, NULL);
+        pthread_cond_destroy(&shim_timer_cond);
+        pthread_cond_destroy(&shim_timer_done);
+}
@@ -0,0 +1,1031 @@
+#ifndef _TTYHUB_SHIM_H
+#define _TTYHUB_SHIM_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The part of the kernel API used by ttyhub and its subsystems, implemented
+ * on top of libc and pthreads so the unchanged kernel sources build as a
+ * user space library. Every <linux/...> header the sources include maps to
+ * this file (see shim/linux).
+ *
+ * Spinlocks and mutexes are pthread mutexes, the RCU read side is a read
+ * lock of a global rwlock. Timers (hrtimer, delayed work) are run by one
+ * timer thread, work items by a small thread pool and kernel threads are
+ * pthreads. There is no interrupt or softirq context: the _bh and _irqsave
+ * lock variants are the plain ones.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifndef KBUILD_MODNAME
+#define KBUILD_MODNAME "ttyhub"
+#endif
+
+/*
+ * Types
+ */
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef long long s64;
+typedef uint8_t __u8;
+typedef uint16_t __u16;
+typedef uint32_t __u32;
+typedef unsigned long long __u64;
+typedef int8_t __s8;
+typedef int16_t __s16;
+typedef int32_t __s32;
+typedef long long __s64;
+typedef uint16_t __be16;
+typedef uint32_t __be32;
+typedef uint16_t __le16;
+typedef uint32_t __le32;
+typedef unsigned int gfp_t;
+typedef s64 ktime_t;
+typedef u64 cycles_t;
+
+/*
+ * Compiler and annotations
+ */
+
+#define __user
+#define __rcu
+#define __init
+#define __exit
+#define __must_check
+#define __maybe_unused          __attribute__((unused))
+#define __used                  __attribute__((used))
+#ifndef __always_inline
+#define __always_inline         inline __attribute__((always_inline))
+#endif
+#define ____cacheline_aligned_in_smp __attribute__((aligned(64)))
+#define likely(x)               __builtin_expect(!!(x), 1)
+#define unlikely(x)             __builtin_expect(!!(x), 0)
+#define fallthrough             __attribute__((fallthrough))
+#define barrier()               __asm__ __volatile__("" ::: "memory")
+#define cpu_relax()             barrier()
+
+#define READ_ONCE(x)            (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)        (*(volatile __typeof__(x) *)&(x) = (v))
+#define smp_load_acquire(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define smp_mb()                __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb()               __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb()               __atomic_thread_fence(__ATOMIC_RELEASE)
+
+#define BUILD_BUG_ON(c)         _Static_assert(!(c), #c)
+#define BUG_ON(c)               do { if (unlikely(c)) abort(); } while (0)
+#define WARN_ON(c)              shim_warn_on(!!(c), __FILE__, __LINE__)
+#define WARN_ON_ONCE(c)         WARN_ON(c)
+
+#define ARRAY_SIZE(a)           (sizeof(a) / sizeof((a)[0]))
+#define container_of(p, t, m)   ((t *)((char *)(p) - offsetof(t, m)))
+#define min(a, b)               ((a) < (b) ? (a) : (b))
+#define max(a, b)               ((a) > (b) ? (a) : (b))
+#define min3(a, b, c)           min(min(a, b), c)
+#define min_t(t, a, b)          ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b)          ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp(v, lo, hi)        min(max(v, lo), hi)
+#define DIV_ROUND_UP(n, d)      (((n) + (d) - 1) / (d))
+#define IS_ALIGNED(x, a)        (((x) & ((__typeof__(x))(a) - 1)) == 0)
+#define BITS_PER_LONG           (sizeof(long) * 8)
+#define check_mul_overflow(a, b, d) __builtin_mul_overflow(a, b, d)
+#define check_add_overflow(a, b, d) __builtin_add_overflow(a, b, d)
+#define struct_size(p, member, n) \
+        (sizeof(*(p)) + sizeof((p)->member[0]) * (size_t)(n))
+
+#define U8_MAX                  0xFF
+#define U16_MAX                 0xFFFF
+#define U32_MAX                 0xFFFFFFFFU
+#define S32_MAX                 0x7FFFFFFF
+
+extern int shim_warn_on(int cond, const char *file, int line);
+
+static inline unsigned long roundup_pow_of_two(unsigned long n)
+{
+        return n <= 1 ? 1 : 1UL << (BITS_PER_LONG - __builtin_clzl(n - 1));
+}
+
+static inline u64 div_u64(u64 n, u32 d)
+{
+        return n / d;
+}
+
+static inline u64 div64_u64(u64 n, u64 d)
+{
+        return n / d;
+}
+
+/*
+ * Errors
+ */
+
+#define MAX_ERRNO               4095
+#define IS_ERR_VALUE(x)         ((unsigned long)(x) >= (unsigned long)-MAX_ERRNO)
+
+static inline void *ERR_PTR(long error)
+{
+        return (void *)error;
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+        return (long)ptr;
+}
+
+static inline bool IS_ERR(const void *ptr)
+{
+        return IS_ERR_VALUE(ptr);
+}
+
+static inline bool IS_ERR_OR_NULL(const void *ptr)
+{
+        return ptr == NULL || IS_ERR_VALUE(ptr);
+}
+
+static inline void *ERR_CAST(const void *ptr)
+{
+        return (void *)ptr;
+}
+
+/*
+ * Modules - module_init() functions, module_param() and EXPORT_SYMBOL()
+ * are collected in sections and run or set by the library
+ */
+
+struct module;
+#define THIS_MODULE             ((struct module *)0)
+#define MODULE_AUTHOR(x)
+#define MODULE_LICENSE(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_VERSION(x)
+#define MODULE_PARM_DESC(p, d)
+#define EXPORT_SYMBOL(s)
+#define EXPORT_SYMBOL_GPL(s)
+
+struct shim_initcall {
+        const char *module;
+        int (*init)(void);
+        void (*exit)(void);
+};
+
+#define SHIM_PARAM_int          0
+#define SHIM_PARAM_uint         1
+#define SHIM_PARAM_bool         2
+
+struct shim_param {
+        const char *module;
+        const char *name;
+        void *value;
+        int type;
+};
+
+#define module_init(fn) \
+        static const struct shim_initcall __shim_init_##fn __used \
+        __attribute__((section("shim_initcall"), aligned(sizeof(void *)))) = \
+        { KBUILD_MODNAME, fn, NULL }
+#define module_exit(fn) \
+        static const struct shim_initcall __shim_exit_##fn __used \
+        __attribute__((section("shim_initcall"), aligned(sizeof(void *)))) = \
+        { KBUILD_MODNAME, NULL, fn }
+#define module_param(name, type, perm) \
+        static const struct shim_param __shim_param_##name __used \
+        __attribute__((section("shim_param"), aligned(sizeof(void *)))) = \
+        { KBUILD_MODNAME, #name, &name, SHIM_PARAM_##type }
+
+static inline bool try_module_get(struct module *m)
+{
+        return true;
+}
+
+static inline void module_put(struct module *m)
+{
+}
+
+/*
+ * Logging
+ */
+
+#define KERN_SOH                "\001"
+#define KERN_EMERG              KERN_SOH "0"
+#define KERN_ALERT              KERN_SOH "1"
+#define KERN_CRIT               KERN_SOH "2"
+#define KERN_ERR                KERN_SOH "3"
+#define KERN_WARNING            KERN_SOH "4"
+#define KERN_NOTICE             KERN_SOH "5"
+#define KERN_INFO               KERN_SOH "6"
+#define KERN_DEBUG              KERN_SOH "7"
+
+#define DUMP_PREFIX_NONE        0
+#define DUMP_PREFIX_ADDRESS     1
+#define DUMP_PREFIX_OFFSET      2
+
+extern int shim_loglevel;
+
+extern int printk(const char *fmt, ...)
+        __attribute__((format(printf, 1, 2)));
+extern void print_hex_dump(const char *level, const char *prefix,
+                        int prefix_type, int rowsize, int groupsize,
+                        const void *buf, size_t len, bool ascii);
+#define print_hex_dump_bytes(prefix, type, buf, len) \
+        print_hex_dump(KERN_DEBUG, prefix, type, 16, 1, buf, len, true)
+#define printk_ratelimited(...) printk(__VA_ARGS__)
+#define pr_err(...)             printk(KERN_ERR __VA_ARGS__)
+#define pr_warn(...)            printk(KERN_WARNING __VA_ARGS__)
+#define pr_info(...)            printk(KERN_INFO __VA_ARGS__)
+#define pr_debug(...)           printk(KERN_DEBUG __VA_ARGS__)
+
+extern const char hex_asc_upper[];
+#define hex_asc_upper_lo(x)     hex_asc_upper[((x) & 0x0f)]
+#define hex_asc_upper_hi(x)     hex_asc_upper[((x) & 0xf0) >> 4]
+
+static inline int hex_to_bin(unsigned char ch)
+{
+        if (ch >= '0' && ch <= '9')
+                return ch - '0';
+        ch |= 0x20;
+        if (ch >= 'a' && ch <= 'f')
+                return ch - 'a' + 10;
+        return -1;
+}
+
+extern ssize_t strscpy(char *dest, const char *src, size_t count);
+
+/*
+ * Memory - the GFP flags don't matter in user space
+ */
+
+#define GFP_KERNEL              0x01U
+#define GFP_ATOMIC              0x02U
+#define GFP_NOWAIT              0x04U
+#define __GFP_ZERO              0x100U
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+        return flags & __GFP_ZERO ? calloc(1, size ? size : 1) :
+                malloc(size ? size : 1);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+        return calloc(1, size ? size : 1);
+}
+
+static inline void *kmalloc_array(size_t n, size_t size, gfp_t flags)
+{
+        size_t bytes;
+
+        if (__builtin_mul_overflow(n, size, &bytes))
+                return NULL;
+        return kmalloc(bytes, flags);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags)
+{
+        return kmalloc_array(n, size, flags | __GFP_ZERO);
+}
+
+static inline void kfree(const void *p)
+{
+        free((void *)p);
+}
+
+#define kvmalloc(size, flags)           kmalloc(size, flags)
+#define kvzalloc(size, flags)           kzalloc(size, flags)
+#define kvmalloc_array(n, size, flags)  kmalloc_array(n, size, flags)
+#define kvfree(p)                       kfree(p)
+#define vmalloc(size)                   kmalloc(size, GFP_KERNEL)
+#define vzalloc(size)                   kzalloc(size, GFP_KERNEL)
+#define vfree(p)                        kfree(p)
+
+/* a mempool never runs dry - allocations fail only with malloc() */
+typedef struct mempool_s {
+        size_t size;
+} mempool_t;
+
+extern mempool_t *mempool_create_kmalloc_pool(int min_nr, size_t size);
+extern void mempool_destroy(mempool_t *pool);
+
+static inline void *mempool_alloc(mempool_t *pool, gfp_t flags)
+{
+        return malloc(pool->size);
+}
+
+static inline void mempool_free(void *element, mempool_t *pool)
+{
+        free(element);
+}
+
+/*
+ * User space access - "user" pointers are plain pointers of the process
+ */
+
+#define access_ok(addr, size)           (true)
+#define u64_to_user_ptr(x)              ((void __user *)(uintptr_t)(x))
+
+static inline unsigned long copy_from_user(void *to, const void __user *from,
+                        unsigned long n)
+{
+        memcpy(to, from, n);
+        return 0;
+}
+
+static inline unsigned long copy_to_user(void __user *to, const void *from,
+                        unsigned long n)
+{
+        memcpy(to, from, n);
+        return 0;
+}
+
+#define CAP_NET_ADMIN           12
+#define CAP_SYS_ADMIN           21
+#define capable(cap)            (true)
+
+/*
+ * Unaligned access
+ */
+
+#define get_unaligned(p) ({ \
+        __typeof__(*(p)) __v; \
+        memcpy(&__v, (p), sizeof(__v)); \
+        __v; })
+
+static inline u16 get_unaligned_be16(const void *p)
+{
+        const u8 *b = p;
+        return (u16)(b[0] << 8 | b[1]);
+}
+
+static inline u32 get_unaligned_be32(const void *p)
+{
+        const u8 *b = p;
+        return (u32)b[0] << 24 | (u32)b[1] << 16 | (u32)b[2] << 8 | b[3];
+}
+
+static inline u16 get_unaligned_le16(const void *p)
+{
+        const u8 *b = p;
+        return (u16)(b[1] << 8 | b[0]);
+}
+
+static inline u32 get_unaligned_le32(const void *p)
+{
+        const u8 *b = p;
+        return (u32)b[3] << 24 | (u32)b[2] << 16 | (u32)b[1] << 8 | b[0];
+}
+
+/*
+ * Atomics and bit operations
+ */
+
+typedef struct {
+        int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i)          { (i) }
+#define atomic_read(v)          __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_set(v, i)        __atomic_store_n(&(v)->counter, i, __ATOMIC_RELAXED)
+#define atomic_inc(v)           ((void)__atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST))
+#define atomic_dec(v)           ((void)__atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST))
+#define atomic_add(i, v)        ((void)__atomic_add_fetch(&(v)->counter, i, __ATOMIC_SEQ_CST))
+#define atomic_inc_return(v)    __atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec_return(v)    __atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec_and_test(v)  (atomic_dec_return(v) == 0)
+
+static inline void set_bit(long nr, volatile unsigned long *addr)
+{
+        __atomic_fetch_or(addr + nr / BITS_PER_LONG,
+                        1UL << nr % BITS_PER_LONG, __ATOMIC_SEQ_CST);
+}
+
+static inline void clear_bit(long nr, volatile unsigned long *addr)
+{
+        __atomic_fetch_and(addr + nr / BITS_PER_LONG,
+                        ~(1UL << nr % BITS_PER_LONG), __ATOMIC_SEQ_CST);
+}
+
+static inline bool test_bit(long nr, const volatile unsigned long *addr)
+{
+        return __atomic_load_n(addr + nr / BITS_PER_LONG, __ATOMIC_RELAXED) &
+                1UL << nr % BITS_PER_LONG;
+}
+
+static inline bool test_and_set_bit(long nr, volatile unsigned long *addr)
+{
+        return __atomic_fetch_or(addr + nr / BITS_PER_LONG,
+                        1UL << nr % BITS_PER_LONG, __ATOMIC_SEQ_CST) &
+                1UL << nr % BITS_PER_LONG;
+}
+
+static inline bool test_and_clear_bit(long nr, volatile unsigned long *addr)
+{
+        return __atomic_fetch_and(addr + nr / BITS_PER_LONG,
+                        ~(1UL << nr % BITS_PER_LONG), __ATOMIC_SEQ_CST) &
+                1UL << nr % BITS_PER_LONG;
+}
+
+struct kref {
+        atomic_t refcount;
+};
+
+static inline void kref_init(struct kref *kref)
+{
+        atomic_set(&kref->refcount, 1);
+}
+
+static inline void kref_get(struct kref *kref)
+{
+        atomic_inc(&kref->refcount);
+}
+
+static inline int kref_put(struct kref *kref,
+                        void (*release)(struct kref *kref))
+{
+        if (atomic_dec_and_test(&kref->refcount)) {
+                release(kref);
+                return 1;
+        }
+        return 0;
+}
+
+/*
+ * Lists
+ */
+
+struct list_head {
+        struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name)    { &(name), &(name) }
+#define LIST_HEAD(name)         struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+        list->next = list;
+        list->prev = list;
+}
+
+static inline void __list_add(struct list_head *entry, struct list_head *prev,
+                        struct list_head *next)
+{
+        next->prev = entry;
+        entry->next = next;
+        entry->prev = prev;
+        prev->next = entry;
+}
+
+static inline void list_add(struct list_head *entry, struct list_head *head)
+{
+        __list_add(entry, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *entry,
+                        struct list_head *head)
+{
+        __list_add(entry, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+        entry->next->prev = entry->prev;
+        entry->prev->next = entry->next;
+        entry->next = NULL;
+        entry->prev = NULL;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+        entry->next->prev = entry->prev;
+        entry->prev->next = entry->next;
+        INIT_LIST_HEAD(entry);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+        return head->next == head;
+}
+
+#define list_entry(ptr, type, member)   container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+        list_entry((ptr)->next, type, member)
+#define list_first_entry_or_null(ptr, type, member) \
+        (list_empty(ptr) ? NULL : list_first_entry(ptr, type, member))
+#define list_next_entry(pos, member) \
+        list_entry((pos)->member.next, __typeof__(*(pos)), member)
+#define list_for_each_entry(pos, head, member) \
+        for (pos = list_first_entry(head, __typeof__(*pos), member); \
+                        &pos->member != (head); \
+                        pos = list_next_entry(pos, member))
+#define list_for_each_entry_safe(pos, n, head, member) \
+        for (pos = list_first_entry(head, __typeof__(*pos), member), \
+                        n = list_next_entry(pos, member); \
+                        &pos->member != (head); \
+                        pos = n, n = list_next_entry(n, member))
+
+/* lock-less singly linked list - any number of producers */
+struct llist_node {
+        struct llist_node *next;
+};
+
+struct llist_head {
+        struct llist_node *first;
+};
+
+static inline void init_llist_head(struct llist_head *list)
+{
+        list->first = NULL;
+}
+
+static inline bool llist_empty(const struct llist_head *head)
+{
+        return __atomic_load_n(&head->first, __ATOMIC_RELAXED) == NULL;
+}
+
+/* returns whether the list was empty */
+static inline bool llist_add(struct llist_node *node, struct llist_head *head)
+{
+        struct llist_node *first = __atomic_load_n(&head->first,
+                        __ATOMIC_RELAXED);
+
+        do {
+                node->next = first;
+        } while (!__atomic_compare_exchange_n(&head->first, &first, node,
+                                true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return first == NULL;
+}
+
+static inline struct llist_node *llist_del_all(struct llist_head *head)
+{
+        return __atomic_exchange_n(&head->first, NULL, __ATOMIC_ACQUIRE);
+}
+
+static inline struct llist_node *llist_reverse_order(struct llist_node *head)
+{
+        struct llist_node *new_head = NULL, *tmp;
+
+        while (head) {
+                tmp = head;
+                head = head->next;
+                tmp->next = new_head;
+                new_head = tmp;
+        }
+        return new_head;
+}
+
+#define llist_entry(ptr, type, member)  container_of(ptr, type, member)
+#define llist_for_each_entry_safe(pos, n, node, member) \
+        for (pos = (node) ? llist_entry(node, __typeof__(*pos), member) : \
+                        NULL; \
+                        pos && (n = pos->member.next ? llist_entry( \
+                                pos->member.next, __typeof__(*pos), \
+                                member) : NULL, 1); \
+                        pos = n)
+
+/*
+ * Locks
+ */
+
+typedef struct {
+        pthread_mutex_t m;
+} spinlock_t;
+
+struct mutex {
+        pthread_mutex_t m;
+};
+
+#define __SPIN_LOCK_UNLOCKED(x) { PTHREAD_MUTEX_INITIALIZER }
+#define DEFINE_SPINLOCK(x)      spinlock_t x = __SPIN_LOCK_UNLOCKED(x)
+#define DEFINE_MUTEX(x)         struct mutex x = { PTHREAD_MUTEX_INITIALIZER }
+
+#define spin_lock_init(l)       pthread_mutex_init(&(l)->m, NULL)
+#define spin_lock(l)            pthread_mutex_lock(&(l)->m)
+#define spin_unlock(l)          pthread_mutex_unlock(&(l)->m)
+#define spin_trylock(l)         (pthread_mutex_trylock(&(l)->m) == 0)
+#define spin_lock_bh(l)         spin_lock(l)
+#define spin_unlock_bh(l)       spin_unlock(l)
+#define spin_lock_irq(l)        spin_lock(l)
+#define spin_unlock_irq(l)      spin_unlock(l)
+#define spin_lock_irqsave(l, flags) \
+        do { (flags) = 0; spin_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, flags) \
+        do { (void)(flags); spin_unlock(l); } while (0)
+
+#define mutex_init(l)           pthread_mutex_init(&(l)->m, NULL)
+#define mutex_destroy(l)        pthread_mutex_destroy(&(l)->m)
+#define mutex_lock(l)           pthread_mutex_lock(&(l)->m)
+#define mutex_unlock(l)         pthread_mutex_unlock(&(l)->m)
+
+struct lock_class_key {
+        int unused;
+};
+
+#define lockdep_is_held(l)      (1)
+#define lockdep_assert_held(l)  do { } while (0)
+#define lockdep_set_class(l, k) do { (void)(k); } while (0)
+#define might_sleep()           do { } while (0)
+#define local_bh_disable()      do { } while (0)
+#define local_bh_enable()       do { } while (0)
+
+/* RCU - readers hold a global read lock, synchronize_rcu() waits until all
+   readers have left by taking it for writing once */
+extern pthread_rwlock_t shim_rcu_lock;
+
+#define rcu_read_lock()         pthread_rwlock_rdlock(&shim_rcu_lock)
+#define rcu_read_unlock()       pthread_rwlock_unlock(&shim_rcu_lock)
+#define rcu_dereference(p)      __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_access_pointer(p)   __atomic_load_n(&(p), __ATOMIC_RELAXED)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), v, __ATOMIC_RELEASE)
+#define RCU_INIT_POINTER(p, v)  ((p) = (v))
+
+struct rcu_head {
+        struct rcu_head *next;
+};
+
+extern void synchronize_rcu(void);
+extern void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *));
+#define kfree_rcu(p, member)    do { synchronize_rcu(); kfree(p); } while (0)
+
+/*
+ * Time - jiffies count milliseconds
+ */
+
+#define HZ                      1000
+#define NSEC_PER_USEC           1000L
+#define NSEC_PER_MSEC           1000000L
+#define NSEC_PER_SEC            1000000000L
+#define USEC_PER_MSEC           1000L
+#define USEC_PER_SEC            1000000L
+#define MSEC_PER_SEC            1000L
+
+extern u64 ktime_get_ns(void);
+extern u64 ktime_get_real_ns(void);
+/* for tests - the monotonic clock jumps forward by ns */
+extern void shim_clock_advance(u64 ns);
+
+#define jiffies                 ((unsigned long)(ktime_get_ns() / NSEC_PER_MSEC))
+#define time_after(a, b)        ((long)((b) - (a)) < 0)
+#define time_before(a, b)       time_after(b, a)
+#define time_after_eq(a, b)     ((long)((a) - (b)) >= 0)
+#define time_before_eq(a, b)    time_after_eq(b, a)
+
+static inline unsigned long msecs_to_jiffies(unsigned int m)
+{
+        return m;
+}
+
+static inline unsigned long usecs_to_jiffies(unsigned int u)
+{
+        return DIV_ROUND_UP(u, USEC_PER_MSEC);
+}
+
+static inline unsigned int jiffies_to_msecs(unsigned long j)
+{
+        return j;
+}
+
+static inline ktime_t ktime_get(void)
+{
+        return ktime_get_ns();
+}
+
+#define ktime_set(s, ns)        ((ktime_t)(s) * NSEC_PER_SEC + (ns))
+#define ktime_sub(a, b)         ((a) - (b))
+#define ktime_add(a, b)         ((a) + (b))
+#define ktime_add_ns(k, ns)     ((k) + (ns))
+#define ktime_to_ns(k)          ((s64)(k))
+#define ktime_to_us(k)          ((s64)(k) / NSEC_PER_USEC)
+#define ns_to_ktime(ns)         ((ktime_t)(ns))
+#define ktime_us_delta(a, b)    ktime_to_us(ktime_sub(a, b))
+#define ktime_after(a, b)       ((a) > (b))
+#define ktime_before(a, b)      ((a) < (b))
+
+/* the offset of the monotonic clock from the real time clock is sampled
+   at every call */
+static inline ktime_t ktime_mono_to_real(ktime_t mono)
+{
+        return mono + (ktime_t)(ktime_get_real_ns() - ktime_get_ns());
+}
+
+static inline cycles_t get_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc();
+#else
+        return 0;
+#endif
+}
+
+extern void msleep(unsigned int msecs);
+extern void usleep_range(unsigned long min, unsigned long max);
+#define udelay(us)              usleep_range(us, us)
+
+struct ratelimit_state {
+        int interval;
+        int burst;
+        int printed;
+        unsigned long begin;
+};
+
+#define DEFINE_RATELIMIT_STATE(name, i, b) \
+        struct ratelimit_state name = { (i), (b), 0, 0 }
+
+static inline void ratelimit_state_init(struct ratelimit_state *rs,
+                        int interval, int burst)
+{
+        rs->interval = interval;
+        rs->burst = burst;
+        rs->printed = 0;
+        rs->begin = 0;
+}
+
+/* the library never logs the callbacks suppressed */
+#define RATELIMIT_MSG_ON_RELEASE        1
+#define ratelimit_set_flags(rs, f)      do { (void)(rs); } while (0)
+
+static inline int __ratelimit(struct ratelimit_state *rs)
+{
+        if (!rs->interval)
+                return 1;
+        if (!rs->begin || time_after(jiffies, rs->begin + rs->interval)) {
+                rs->begin = jiffies;
+                rs->printed = 0;
+        }
+        if (rs->printed >= rs->burst)
+                return 0;
+        rs->printed++;
+        return 1;
+}
+
+/*
+ * Timers and work - run by the threads of the library
+ */
+
+enum hrtimer_restart {
+        HRTIMER_NORESTART,
+        HRTIMER_RESTART,
+};
+
+#define HRTIMER_MODE_ABS        0
+#define HRTIMER_MODE_REL        1
+#define HRTIMER_MODE_REL_SOFT   HRTIMER_MODE_REL
+#define HRTIMER_MODE_ABS_SOFT   HRTIMER_MODE_ABS
+
+struct hrtimer {
+        enum hrtimer_restart (*function)(struct hrtimer *);
+        struct hrtimer *next;   /* in the list of armed timers */
+        ktime_t expires;
+        int queued;
+};
+
+extern void hrtimer_setup(struct hrtimer *timer,
+                        enum hrtimer_restart (*function)(struct hrtimer *),
+                        int clock, int mode);
+extern void hrtimer_start(struct hrtimer *timer, ktime_t tim, int mode);
+extern int hrtimer_try_to_cancel(struct hrtimer *timer);
+extern int hrtimer_cancel(struct hrtimer *timer);
+extern bool hrtimer_active(const struct hrtimer *timer);
+
+struct workqueue_struct;
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+        work_func_t func;
+        struct list_head entry;
+        int pending;
+        int running;
+};
+
+struct delayed_work {
+        struct work_struct work;
+        struct hrtimer timer;
+        struct workqueue_struct *wq;
+};
+
+extern struct workqueue_struct *system_wq;
+extern struct workqueue_struct *system_unbound_wq;
+
+#define INIT_WORK(w, f) \
+        do { \
+                (w)->func = (f); \
+                INIT_LIST_HEAD(&(w)->entry); \
+                (w)->pending = 0; \
+                (w)->running = 0; \
+        } while (0)
+#define INIT_DELAYED_WORK(dw, f) shim_init_delayed_work(dw, f)
+#define to_delayed_work(w)      container_of(w, struct delayed_work, work)
+
+extern void shim_init_delayed_work(struct delayed_work *dwork,
+                        work_func_t func);
+extern bool queue_work(struct workqueue_struct *wq, struct work_struct *work);
+extern bool queue_delayed_work(struct workqueue_struct *wq,
+                        struct delayed_work *dwork, unsigned long delay);
+extern bool mod_delayed_work(struct workqueue_struct *wq,
+                        struct delayed_work *dwork, unsigned long delay);
+extern bool cancel_work_sync(struct work_struct *work);
+extern bool cancel_delayed_work_sync(struct delayed_work *dwork);
+extern bool flush_work(struct work_struct *work);
+extern bool flush_delayed_work(struct delayed_work *dwork);
+#define schedule_work(w)        queue_work(system_wq, w)
+#define schedule_delayed_work(dw, d) queue_delayed_work(system_wq, dw, d)
+#define queue_work_on(cpu, wq, w) queue_work(wq, w)
+
+/*
+ * Kernel threads
+ */
+
+#define TASK_RUNNING            0
+#define TASK_INTERRUPTIBLE      1
+#define TASK_UNINTERRUPTIBLE    2
+
+struct task_struct;
+
+extern struct task_struct *kthread_create(int (*threadfn)(void *data),
+                        void *data, const char *namefmt, ...)
+        __attribute__((format(printf, 3, 4)));
+extern void kthread_bind(struct task_struct *task, unsigned int cpu);
+extern int kthread_stop(struct task_struct *task);
+extern bool kthread_should_stop(void);
+extern int wake_up_process(struct task_struct *task);
+extern void set_current_state(int state);
+extern void schedule(void);
+#define __set_current_state(s)  set_current_state(s)
+#define cond_resched()          do { } while (0)
+/* there are no signals to deliver to the threads of the library */
+#define fatal_signal_pending(p) (0)
+
+extern bool cpu_online(unsigned int cpu);
+extern unsigned int num_online_cpus(void);
+#define nr_cpu_ids              num_online_cpus()
+
+/*
+ * Index to pointer map used for bus devices (see ttyhub_addr.c)
+ */
+
+struct xarray {
+        pthread_mutex_t lock;
+        struct shim_xa_entry *entries;
+        unsigned long count;
+        unsigned long size;
+};
+
+extern void xa_init(struct xarray *xa);
+extern void xa_destroy(struct xarray *xa);
+extern void *xa_load(struct xarray *xa, unsigned long index);
+extern void *xa_store(struct xarray *xa, unsigned long index, void *entry,
+                        gfp_t gfp);
+extern void *xa_erase(struct xarray *xa, unsigned long index);
+extern void *shim_xa_find(struct xarray *xa, unsigned long *index,
+                        bool after);
+
+/* stored entries are pointers, errors are tagged like in the kernel */
+static inline int xa_err(void *entry)
+{
+        return ((unsigned long)entry & 3) == 2 ?
+                (int)((long)entry >> 2) : 0;
+}
+
+#define xa_for_each(xa, index, entry) \
+        for (index = 0, entry = shim_xa_find(xa, &(index), false); entry; \
+                        entry = shim_xa_find(xa, &(index), true))
+
+/*
+ * tty layer - a tty is a file descriptor of the library (see libttyhub.h)
+ */
+
+#define N_TTY                   0
+#define NR_LDISCS               30
+
+#define TTY_NORMAL              0
+#define TTY_BREAK               1
+#define TTY_FRAME               2
+#define TTY_PARITY              3
+#define TTY_OVERRUN             4
+
+#define TTY_THROTTLED           0
+#define TTY_DO_WRITE_WAKEUP     5
+
+struct tty_struct;
+struct file;
+
+struct tty_operations {
+        ssize_t (*write)(struct tty_struct *tty, const u8 *buf, size_t count);
+        unsigned int (*write_room)(struct tty_struct *tty);
+};
+
+struct tty_struct {
+        char name[64];
+        const struct tty_operations *ops;
+        unsigned long flags;
+        void *disc_data;
+        void *driver_data;
+        unsigned int baud;
+        int index;
+};
+
+struct ktermios;
+
+struct tty_ldisc_ops {
+        char *name;
+        int num;
+        struct module *owner;
+        int (*open)(struct tty_struct *tty);
+        void (*close)(struct tty_struct *tty);
+        int (*ioctl)(struct tty_struct *tty, unsigned int cmd,
+                        unsigned long arg);
+        void (*set_termios)(struct tty_struct *tty,
+                        const struct ktermios *old);
+        void (*write_wakeup)(struct tty_struct *tty);
+        size_t (*receive_buf2)(struct tty_struct *tty, const u8 *cp,
+                        const u8 *fp, size_t count);
+        void (*lookahead_buf)(struct tty_struct *tty, const u8 *cp,
+                        const u8 *fp, size_t count);
+};
+
+extern int tty_register_ldisc(struct tty_ldisc_ops *new_ldisc);
+extern void tty_unregister_ldisc(struct tty_ldisc_ops *ldisc);
+extern struct tty_ldisc_ops *shim_ldisc(int num);
+
+static inline const char *tty_name(const struct tty_struct *tty)
+{
+        return tty ? tty->name : "NULL tty";
+}
+
+static inline unsigned int tty_get_baud_rate(struct tty_struct *tty)
+{
+        return tty->baud;
+}
+
+/*
+ * debugfs and seq_file - not available, subsystems go on without them
+ */
+
+struct dentry;
+struct inode {
+        void *i_private;
+};
+struct file {
+        void *private_data;
+};
+struct seq_file {
+        void *private;
+};
+
+struct file_operations {
+        struct module *owner;
+        int (*open)(struct inode *, struct file *);
+        int (*release)(struct inode *, struct file *);
+        ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+        ssize_t (*write)(struct file *, const char __user *, size_t,
+                        loff_t *);
+        loff_t (*llseek)(struct file *, loff_t, int);
+};
+
+#define debugfs_create_dir(name, parent)        ((struct dentry *)ERR_PTR(-ENODEV))
+#define debugfs_create_file(name, mode, parent, data, fops) \
+        ((void)(fops), (struct dentry *)ERR_PTR(-ENODEV))
+#define debugfs_remove_recursive(d)             do { } while (0)
+#define seq_printf(m, ...)                      do { } while (0)
+#define seq_read                                NULL
+#define seq_lseek                               NULL
+#define single_release                          NULL
+#define single_open(file, show, data)           ((void)(show), -ENODEV)
+
+/*
+ * Threads of the shim - started and stopped by the library
+ */
+
+extern int shim_start(void);
+extern void shim_stop(void);
+
+#endif /* _TTYHUB_SHIM_H */
@@ -0,0 +1,244 @@
+/* TTYHUB demux
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Usage:
+ *      ttyhub-demux [-b baud] [-l loglevel] [-p module.param=value]...
+ *                      <tty>... <subsystems>
+ *              Demultiplex the ttys with libttyhub instead of the line
+ *              discipline: every tty is opened in raw mode, the comma
+ *              separated subsystems are enabled on it and the data read
+ *              is passed to the receive state machine until SIGINT or
+ *              SIGTERM. With 'pty' as tty a new pseudo terminal is used,
+ *              '-' reads standard input (e.g. a pipe) until its end.
+ *              Events are printed as they arrive, the counters of all
+ *              ttys at the end.
+ *
+ * The subsystems of libttyhub are testsubsys0 and the four protocols of
+ * ttyhubref, registered in this order (e.g. 'ttyhubref.protocols=1' leaves
+ * only the fixed size protocol of ttyhubref).
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include "libttyhub.h"
+#include "../modules/include/ttyhub_ioctl.h"
+
+#define MAX_PORTS 16
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+        stop = 1;
+}
+
+static void on_event(const char *tty, unsigned int event, int subsys,
+                unsigned long long value, unsigned int suppressed, void *arg)
+{
+        printf("%s: event %u, subsystem %d, value %llu (%u suppressed)\n",
+                tty, event, subsys, value, suppressed);
+}
+
+/*
+ * Open a tty and enable the subsystems on it.
+ *
+ * Returns the port or NULL on error.
+ */
+static struct ttyhub_port *open_port(const char *name, unsigned int baud,
+                const char *subsystems)
+{
+        struct ttyhub_port *port;
+        char filenamebuf[256];
+        char *pSubsystems, *pToken;
+        int master, subsystem, retVal;
+
+        if (strcmp(name, "-") == 0)
+        {
+                /* standard input, e.g. a pipe */
+                name = "stdin";
+                port = ttyhub_port_attach(STDIN_FILENO, name, baud);
+        }
+        else
+        {
+                if (strcmp(name, "pty") == 0)
+                {
+                        /* new pseudo terminal - the master side stays
+                           open */
+                        master = posix_openpt(O_RDWR | O_NOCTTY);
+                        if (master == -1 || grantpt(master) == -1 ||
+                                unlockpt(master) == -1)
+                        {
+                                printf("Error: can't create pty - errno = "
+                                        "%d\n", errno);
+                                return NULL;
+                        }
+                        name = ptsname(master);
+                        printf("using pty '%s'\n", name);
+                }
+                else if (name[0] != '/')
+                {
+                        /* device filename without path */
+                        snprintf(filenamebuf, sizeof(filenamebuf), "/dev/%s",
+                                name);
+                        name = filenamebuf;
+                }
+                port = ttyhub_port_open(name, baud);
+        }
+        if (port == NULL)
+        {
+                printf("Error: can't open '%s' - errno = %d\n", name, errno);
+                return NULL;
+        }
+
+        pSubsystems = strdup(subsystems);
+        pToken = strtok(pSubsystems, ",");
+        while (pToken)
+        {
+                subsystem = atoi(pToken);
+                retVal = ttyhub_port_ioctl(port, TTYHUB_SUBSYS_ENABLE,
+                        &subsystem);
+                printf("%s: TTYHUB_SUBSYS_ENABLE %d returned %d\n", name,
+                        subsystem, retVal);
+                if (retVal < 0)
+                {
+                        free(pSubsystems);
+                        ttyhub_port_close(port);
+                        return NULL;
+                }
+                pToken = strtok(NULL, ",");
+        }
+        free(pSubsystems);
+        return port;
+}
+
+/* wait for the events the port needs next */
+static int watch_port(int epfd, int op, struct ttyhub_port *port)
+{
+        struct epoll_event ev;
+
+        ev.events = ttyhub_port_events(port);
+        ev.data.ptr = port;
+        return epoll_ctl(epfd, op, ttyhub_port_fd(port), &ev);
+}
+
+int main(int argc, char *argv[])
+{
+        struct epoll_event events[MAX_PORTS];
+        struct ttyhub_port *port;
+        unsigned int baud = 115200;
+        char *pValue;
+        int nr_ports = 0, open_ports, status = 1;
+        int epfd, opt, retVal, i, n;
+
+        while ((opt = getopt(argc, argv, "b:l:p:")) != -1)
+        {
+                switch (opt)
+                {
+                case 'b':
+                        baud = atoi(optarg);
+                        break;
+                case 'l':
+                        ttyhub_lib_set_loglevel(atoi(optarg));
+                        break;
+                case 'p':
+                        pValue = strchr(optarg, '=');
+                        if (pValue == NULL)
+                                goto usage;
+                        *pValue++ = 0;
+                        retVal = ttyhub_lib_param_set(optarg, pValue);
+                        if (retVal < 0)
+                        {
+                                printf("Error: can't set '%s' (err = %d)\n",
+                                        optarg, retVal);
+                                return 1;
+                        }
+                        break;
+                default:
+                        goto usage;
+                }
+        }
+        if (argc - optind < 2 || argc - optind - 1 > MAX_PORTS)
+                goto usage;
+
+        retVal = ttyhub_lib_init();
+        if (retVal < 0)
+        {
+                printf("Error: ttyhub_lib_init() returned %d\n", retVal);
+                return 1;
+        }
+        ttyhub_lib_set_event_handler(on_event, NULL);
+
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd == -1)
+                goto exit;
+        for (i = optind; i < argc - 1; i++)
+        {
+                port = open_port(argv[i], baud, argv[argc - 1]);
+                if (port == NULL)
+                        goto exit;
+                nr_ports++;
+                if (watch_port(epfd, EPOLL_CTL_ADD, port) == -1)
+                        goto exit;
+        }
+
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        status = 0;
+        open_ports = nr_ports;
+        while (!stop && open_ports)
+        {
+                n = epoll_wait(epfd, events, MAX_PORTS, 1000);
+                for (i = 0; i < n; i++)
+                {
+                        port = events[i].data.ptr;
+                        if (events[i].events & EPOLLOUT)
+                                ttyhub_port_writable(port);
+                        if (events[i].events & (EPOLLIN | EPOLLHUP))
+                        {
+                                retVal = ttyhub_port_read(port);
+                                if (retVal == 0 || (retVal < 0 &&
+                                        retVal != -EAGAIN))
+                                {
+                                        /* end of input - stop watching */
+                                        epoll_ctl(epfd, EPOLL_CTL_DEL,
+                                                ttyhub_port_fd(port), NULL);
+                                        open_ports--;
+                                        continue;
+                                }
+                        }
+                        watch_port(epfd, EPOLL_CTL_MOD, port);
+                }
+        }
+
+exit:
+        ttyhub_lib_dump(stdout);
+        ttyhub_lib_exit();
+        return status;
+
+usage:
+        printf("Usage: %s [-b baud] [-l loglevel] [-p module.param=value]... "
+                "<tty>... <subsystems>\n", argv[0]);
+        return 1;
+}
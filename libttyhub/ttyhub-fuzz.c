@@ -0,0 +1,737 @@
+/* TTYHUB fuzz
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Worst case cost of the receive state machine: hostile or corrupted input
+ * (near-miss prefixes probed again and again, single byte chunks, floods
+ * bouncing between discard and timed discard) costs much more per byte than
+ * well-formed frames. This harness measures the cycles per byte spent in
+ * receive_buf2() of libttyhub for such inputs, searches for the inputs that
+ * cost most and fails when one of them costs more than bound times as much
+ * per byte as well-formed frames.
+ *
+ * Usage:
+ *      ttyhub-fuzz [-B bound] [-t seconds] [-o dir] [-s seed] [file...]
+ *              Measure the built-in adversarial inputs and the files given
+ *              (e.g. the worst inputs of the last release, see worst/).
+ *              With -t the inputs are used as seeds of a search for more
+ *              costly inputs for the given time, guided by the coverage of
+ *              ttyhub when built with 'make fuzz'; the worst inputs found
+ *              are written to dir. The exit code is 1 when the worst input
+ *              costs more than bound (default 50) times as much per byte as
+ *              well-formed ref_fixed frames.
+ *
+ * Built with libFuzzer ('make fuzz FUZZER=libfuzzer CC=clang') this is a
+ * fuzz target instead - every input costing more than the bound given in
+ * TTYHUB_FUZZ_BOUND is reported as a crash.
+ *
+ * Input format:
+ *      byte 0  subsystems to enable, bit i enables subsystem i (0 is
+ *              testsubsys0, 1 to 4 are ref_fixed, ref_lenpfx, ref_delim and
+ *              ref_sized of ttyhubref), 0 enables all of them
+ *      chunks  a control byte followed by the bytes of the chunk - bits 0-5
+ *              are the length of the chunk minus one, bits 6-7 let the clock
+ *              jump forward by 0, 1ms, 100ms or 6s (longer than the silence
+ *              ending a timed discard) before the chunk is received
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include "libttyhub.h"
+#include "../modules/include/ttyhub_ioctl.h"
+
+#define NR_SUBSYSTEMS 5
+#define INPUT_MAX 4096
+#define MAX_CORPUS 4096
+#define NR_WORST 8
+#define MIN_BYTES 512
+#define COVERAGE_MAP_SIZE 65536
+
+/* subsystem numbers enabled by bit i of the first byte of an input */
+static const int subsystems[NR_SUBSYSTEMS] = { 0, 1, 2, 3, 4 };
+static const unsigned long long gaps[4] = { 0, 1000000ULL, 100000000ULL,
+        6000000000ULL };
+
+struct input {
+        unsigned char *data;
+        size_t size;
+        double cost;            /* cycles per byte */
+        char name[64];
+};
+
+static int nullfd = -1;
+static double baseline;
+
+/*
+ * Coverage
+ */
+
+/* hit counts of the edges of ttyhub, classified like AFL does */
+static unsigned char coverage_map[COVERAGE_MAP_SIZE];
+static unsigned char coverage_seen[COVERAGE_MAP_SIZE];
+static __thread int tracing;
+static __thread uintptr_t trace_prev;
+static int coverage_edges;
+
+#ifndef TTYHUB_LIBFUZZER
+/* called for every basic block of the objects built with
+   -fsanitize-coverage=trace-pc - only on the receive path of the harness,
+   not for the threads of the library */
+void __sanitizer_cov_trace_pc(void)
+{
+        uintptr_t pc;
+
+        if (!tracing)
+                return;
+        pc = (uintptr_t)__builtin_return_address(0);
+        pc = (pc ^ pc >> 15) * 0x9E3779B1U;
+        coverage_map[(pc ^ trace_prev) % COVERAGE_MAP_SIZE]++;
+        trace_prev = (pc % COVERAGE_MAP_SIZE) >> 1;
+}
+#endif
+
+static unsigned char coverage_bucket(unsigned char hits)
+{
+        if (hits <= 3)
+                return hits == 3 ? 4 : hits;
+        if (hits <= 7)
+                return 8;
+        if (hits <= 15)
+                return 16;
+        if (hits <= 31)
+                return 32;
+        if (hits <= 127)
+                return 64;
+        return 128;
+}
+
+/*
+ * Merge the coverage of the last input into the coverage seen so far.
+ *
+ * Returns 1 if the input reached a new edge or a new hit count bucket.
+ */
+static int coverage_merge(void)
+{
+        unsigned char b;
+        int i, new = 0;
+
+        for (i = 0; i < COVERAGE_MAP_SIZE; i++)
+        {
+                if (!coverage_map[i])
+                        continue;
+                b = coverage_bucket(coverage_map[i]);
+                if (b & ~coverage_seen[i])
+                {
+                        if (!coverage_seen[i])
+                                coverage_edges++;
+                        coverage_seen[i] |= b;
+                        new = 1;
+                }
+                coverage_map[i] = 0;
+        }
+        return new;
+}
+
+/*
+ * Measurement
+ */
+
+static inline unsigned long long cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc();
+#else
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * Pass an input to a new port and measure the cycles spent receiving it.
+ *
+ * Returns the cycles per byte or a negative value if the input holds no
+ * data.
+ */
+static double run(const unsigned char *data, size_t size)
+{
+        struct ttyhub_port *port;
+        unsigned long long spent = 0, bytes = 0, t0;
+        size_t pos, len, n, done;
+        int mask, i;
+
+        if (size < 3)
+                return -1;
+        port = ttyhub_port_attach(nullfd, "fuzz", 115200);
+        if (port == NULL)
+        {
+                printf("Error: can't attach port - errno = %d\n", errno);
+                exit(2);
+        }
+        mask = data[0] % (1 << NR_SUBSYSTEMS);
+        if (mask == 0)
+                mask = (1 << NR_SUBSYSTEMS) - 1;
+        for (i = 0; i < NR_SUBSYSTEMS; i++)
+                if (mask & 1 << i)
+                        ttyhub_port_ioctl(port, TTYHUB_SUBSYS_ENABLE,
+                                (void *)&subsystems[i]);
+
+        for (pos = 1; pos + 1 < size; pos += 1 + len)
+        {
+                len = (data[pos] & 0x3F) + 1;
+                if (len > size - pos - 1)
+                        len = size - pos - 1;
+                if (data[pos] >> 6)
+                        ttyhub_lib_clock_advance(gaps[data[pos] >> 6]);
+
+                /* bytes not accepted are passed again, like the flip
+                   buffer does */
+                tracing = 1;
+                trace_prev = 0;
+                t0 = cycles();
+                for (done = 0; done < len; done += n)
+                {
+                        n = ttyhub_port_receive(port, data + pos + 1 + done,
+                                NULL, len - done);
+                        if (n == 0)
+                                break;
+                }
+                spent += cycles() - t0;
+                tracing = 0;
+                bytes += len;
+        }
+        ttyhub_port_close(port);
+
+        /* the cost of short inputs is spread over MIN_BYTES, so that the
+           overhead of a single call doesn't count as worst case */
+        if (bytes == 0)
+                return -1;
+        return (double)spent / (bytes > MIN_BYTES ? bytes : MIN_BYTES);
+}
+
+/* the lowest cost of several runs - the others were disturbed */
+static double measure(const unsigned char *data, size_t size, int runs)
+{
+        double cost, best = -1;
+
+        while (runs--)
+        {
+                cost = run(data, size);
+                if (best < 0 || cost < best)
+                        best = cost;
+        }
+        coverage_merge();
+        return best;
+}
+
+/* append a chunk to an input - returns the new size */
+static size_t put_chunk(unsigned char *data, size_t size, int gap,
+                const unsigned char *cp, size_t len)
+{
+        if (len == 0 || len > 64 || size + 1 + len > INPUT_MAX)
+                return size;
+        data[size++] = gap << 6 | (len - 1);
+        memcpy(data + size, cp, len);
+        return size + len;
+}
+
+/* well-formed ref_fixed frames (see ttyhub_ref.h) in chunks of 64 bytes */
+static size_t make_frames(unsigned char *data, int mask)
+{
+        unsigned char stream[INPUT_MAX], sum;
+        size_t size = 1, len = 0, pos;
+        int seq, i;
+
+        data[0] = mask;
+        for (seq = 0; len + 16 <= sizeof(stream) * 63 / 65; seq++)
+        {
+                sum = stream[len++] = 0xF1;
+                sum += stream[len++] = seq;
+                for (i = 2; i < 15; i++)
+                        sum += stream[len++] = seq + i;
+                stream[len++] = 0xFF - sum;
+        }
+        for (pos = 0; pos < len; pos += 64)
+                size = put_chunk(data, size, 0, stream + pos,
+                        len - pos < 64 ? len - pos : 64);
+        return size;
+}
+
+#ifndef TTYHUB_LIBFUZZER
+/*
+ * Built-in adversarial inputs
+ */
+
+/* an input made of a pattern repeated in chunks of chunk bytes, the clock
+   jumps by gap before every chunk */
+static size_t make_flood(unsigned char *data, int mask, const char *pattern,
+                size_t pattern_len, size_t chunk, int gap)
+{
+        unsigned char buf[64];
+        size_t size = 1, i, p = 0;
+
+        data[0] = mask;
+        while (size + 1 + chunk <= INPUT_MAX)
+        {
+                for (i = 0; i < chunk; i++)
+                        buf[i] = pattern[p++ % pattern_len];
+                size = put_chunk(data, size, gap, buf, chunk);
+        }
+        return size;
+}
+
+static struct input corpus[MAX_CORPUS];
+static int corpus_len;
+static struct input worst[NR_WORST];
+
+/* remember the input if it is among the most costly ones */
+static void worst_add(const struct input *in)
+{
+        int i, min = 0;
+
+        for (i = 0; i < NR_WORST; i++)
+        {
+                if (worst[i].data == NULL)
+                {
+                        min = i;
+                        break;
+                }
+                if (worst[i].cost < worst[min].cost)
+                        min = i;
+        }
+        if (worst[min].data && worst[min].cost >= in->cost)
+                return;
+        free(worst[min].data);
+        worst[min] = *in;
+        worst[min].data = malloc(in->size);
+        memcpy(worst[min].data, in->data, in->size);
+}
+
+static int corpus_add(const unsigned char *data, size_t size, double cost,
+                const char *name)
+{
+        struct input *in;
+        int i;
+
+        if (cost < 0)
+                return -1;
+        if (corpus_len < MAX_CORPUS)
+                in = &corpus[corpus_len++];
+        else
+        {
+                /* full - the cheaper of two inputs makes room */
+                in = &corpus[rand() % corpus_len];
+                if (corpus[i = rand() % corpus_len].cost < in->cost)
+                        in = &corpus[i];
+                free(in->data);
+        }
+        in->data = malloc(size);
+        memcpy(in->data, data, size);
+        in->size = size;
+        in->cost = cost;
+        snprintf(in->name, sizeof(in->name), "%s", name);
+        worst_add(in);
+        return 0;
+}
+
+static void add_seeds(void)
+{
+        static const struct {
+                const char *name;
+                int mask;
+                const char *pattern;
+                size_t chunk;
+                int gap;
+        } seeds[] = {
+                /* near-miss prefixes of testsubsys0, probed at every byte */
+                { "near-miss-!AA", 0, "!AAx", 1, 0 },
+                { "near-miss-!AA-64", 0, "!AAx", 64, 0 },
+                { "near-miss-!", 0, "!", 1, 0 },
+                /* sync bytes of ttyhubref without valid frames */
+                { "sync-F1", 0, "\xF1", 1, 0 },
+                { "sync-F2", 0, "\xF2\x03", 1, 0 },
+                { "sync-$", 0, "$", 1, 0 },
+                { "sync-F4", 0, "\xF4\x02", 1, 0 },
+                /* size known from probe_size() - discarded */
+                { "probe-size", 1, "!Zxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx", 7, 0 },
+                /* nothing recognized - the probe buffer fills, then timed
+                   discard, and the silence ends it again */
+                { "timed-discard", 0, "xyz", 64, 3 },
+                { "timed-discard-1", 0, "xyz", 1, 3 },
+                /* long frames of testsubsys0 without end marker */
+                { "marker", 1, "!CCCxxxxxxxxxxxxxxxxxxxxxxxxxxxxx", 64, 0 },
+        };
+        unsigned char data[INPUT_MAX];
+        unsigned int i;
+        size_t size;
+
+        for (i = 0; i < sizeof(seeds) / sizeof(seeds[0]); i++)
+        {
+                size = make_flood(data, seeds[i].mask, seeds[i].pattern,
+                        strlen(seeds[i].pattern), seeds[i].chunk,
+                        seeds[i].gap);
+                corpus_add(data, size, measure(data, size, 3), seeds[i].name);
+        }
+        size = make_frames(data, 0);
+        corpus_add(data, size, measure(data, size, 3), "frames");
+        for (i = 0; i < 256; i++)
+                data[i] = i;
+        size = make_flood(data, 0, (char *)data, 256, 1, 0);
+        corpus_add(data, size, measure(data, size, 3), "all-bytes");
+}
+
+static int add_file(const char *filename)
+{
+        unsigned char data[INPUT_MAX];
+        const char *name = strrchr(filename, '/');
+        size_t size;
+        FILE *f;
+
+        f = fopen(filename, "rb");
+        if (f == NULL)
+        {
+                printf("Error: can't open '%s' - errno = %d\n", filename,
+                        errno);
+                return -1;
+        }
+        size = fread(data, 1, sizeof(data), f);
+        fclose(f);
+        return corpus_add(data, size, measure(data, size, 3),
+                name ? name + 1 : filename);
+}
+
+/* add a file or every file in a directory */
+static int add_path(const char *path)
+{
+        char filename[512];
+        struct dirent *de;
+        struct stat st;
+        DIR *dir;
+
+        if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+        {
+                dir = opendir(path);
+                if (dir == NULL)
+                        return -1;
+                while ((de = readdir(dir)) != NULL)
+                {
+                        if (de->d_name[0] == '.')
+                                continue;
+                        snprintf(filename, sizeof(filename), "%s/%s", path,
+                                de->d_name);
+                        add_file(filename);
+                }
+                closedir(dir);
+                return 0;
+        }
+        return add_file(path);
+}
+
+/*
+ * Search
+ */
+
+static const char *const tokens[] = {
+        "!", "!A", "!AA", "!AAA", "!B", "!B9", "!CCC", "$", "\n", "\xF1",
+        "\xF2", "\xF4", "$0", "\x7E", "\x7D", "\x00",
+};
+
+/* change the input in place - returns the new size */
+static size_t mutate(unsigned char *data, size_t size)
+{
+        const struct input *other;
+        const char *token;
+        size_t pos, len, n;
+        int rounds = 1 + rand() % 4;
+
+        while (rounds--)
+        {
+                pos = 1 + rand() % (size - 1);
+                switch (rand() % 8)
+                {
+                case 0:
+                        /* flip a bit */
+                        data[pos] ^= 1 << rand() % 8;
+                        break;
+                case 1:
+                        /* random byte */
+                        data[pos] = rand();
+                        break;
+                case 2:
+                        /* token of a protocol */
+                        token = tokens[rand() % (sizeof(tokens) /
+                                sizeof(tokens[0]))];
+                        len = token[0] ? strlen(token) : 1;
+                        if (pos + len <= size)
+                                memcpy(data + pos, token, len);
+                        break;
+                case 3:
+                        /* chunk length and clock jump */
+                        data[pos] = rand() % 4 << 6 | (rand() % 2 ?
+                                0 : rand() % 64);
+                        break;
+                case 4:
+                        /* copy a range within the input */
+                        n = 1 + rand() % (size - 1);
+                        len = 1 + rand() % 64;
+                        if (pos + len <= size && n + len <= size)
+                                memmove(data + pos, data + n, len);
+                        break;
+                case 5:
+                        /* duplicate a range at the end */
+                        len = 1 + rand() % (size - pos);
+                        if (len > INPUT_MAX - size)
+                                len = INPUT_MAX - size;
+                        memcpy(data + size, data + pos, len);
+                        size += len;
+                        break;
+                case 6:
+                        /* cut the end */
+                        if (pos > 2)
+                                size = pos;
+                        break;
+                default:
+                        /* splice with another input */
+                        other = &corpus[rand() % corpus_len];
+                        len = other->size - 1;
+                        if (len > INPUT_MAX - pos)
+                                len = INPUT_MAX - pos;
+                        memcpy(data + pos, other->data + 1, len);
+                        if (pos + len > size)
+                                size = pos + len;
+                        break;
+                }
+        }
+        return size;
+}
+
+/* the input to mutate next - the more costly of two */
+static const struct input *pick(void)
+{
+        const struct input *a = &corpus[rand() % corpus_len];
+        const struct input *b = &corpus[rand() % corpus_len];
+
+        return a->cost > b->cost ? a : b;
+}
+
+static void search(unsigned int seconds)
+{
+        unsigned char data[INPUT_MAX];
+        const struct input *parent;
+        char name[64];
+        time_t end = time(NULL) + seconds, report = time(NULL);
+        unsigned long execs = 0;
+        int new;
+        double cost;
+        size_t size;
+
+        while (time(NULL) < end && corpus_len)
+        {
+                parent = pick();
+                memcpy(data, parent->data, parent->size);
+                size = mutate(data, parent->size);
+                cost = run(data, size);
+                execs++;
+                if (cost < 0)
+                        continue;
+
+                new = coverage_merge();
+                if (new || cost > parent->cost)
+                {
+                        /* measured again, so noise doesn't rule */
+                        cost = measure(data, size, 3);
+                        snprintf(name, sizeof(name), "search-%lu", execs);
+                        if (new || cost > parent->cost)
+                                corpus_add(data, size, cost, name);
+                }
+                if (time(NULL) >= report + 10)
+                {
+                        report = time(NULL);
+                        printf("%lu execs, %d inputs, %d edges\n", execs,
+                                corpus_len, coverage_edges);
+                }
+        }
+}
+
+static int compare_cost(const void *a, const void *b)
+{
+        const struct input *x = a, *y = b;
+
+        if (x->data == NULL || y->data == NULL)
+                return (x->data == NULL) - (y->data == NULL);
+        return x->cost < y->cost ? 1 : x->cost > y->cost ? -1 : 0;
+}
+
+static void write_worst(const char *dir)
+{
+        char filename[512];
+        FILE *f;
+        int i;
+
+        mkdir(dir, 0755);
+        for (i = 0; i < NR_WORST && worst[i].data; i++)
+        {
+                snprintf(filename, sizeof(filename), "%s/worst-%d", dir, i);
+                f = fopen(filename, "wb");
+                if (f == NULL)
+                {
+                        printf("Error: can't write '%s' - errno = %d\n",
+                                filename, errno);
+                        continue;
+                }
+                fwrite(worst[i].data, 1, worst[i].size, f);
+                fclose(f);
+        }
+}
+
+#endif /* TTYHUB_LIBFUZZER */
+
+static int setup(void)
+{
+        unsigned char data[INPUT_MAX];
+        size_t size;
+
+        ttyhub_lib_set_loglevel(0);
+        ttyhub_lib_param_set("testsubsys0.verbose", "0");
+        if (ttyhub_lib_init() < 0)
+                return -1;
+        nullfd = open("/dev/null", O_RDWR);
+        if (nullfd == -1)
+                return -1;
+
+        /* well-formed frames with all subsystems enabled */
+        size = make_frames(data, 0);
+        baseline = measure(data, size, 9);
+        return baseline > 0 ? 0 : -1;
+}
+
+#ifdef TTYHUB_LIBFUZZER
+static double bound = 50;
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+        const char *env = getenv("TTYHUB_FUZZ_BOUND");
+
+        if (env)
+                bound = atof(env);
+        if (setup() < 0)
+                abort();
+        return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+        double cost;
+
+        if (size > INPUT_MAX)
+                return 0;
+        cost = run(data, size);
+        if (cost > bound * baseline)
+        {
+                cost = measure(data, size, 5);
+                if (cost > bound * baseline)
+                {
+                        printf("cost %.1f cycles/byte is %.1f x the cost of "
+                                "frames (bound %.1f)\n", cost,
+                                cost / baseline, bound);
+                        abort();
+                }
+        }
+        return 0;
+}
+#else
+int main(int argc, char *argv[])
+{
+        unsigned char data[INPUT_MAX];
+        const char *dir = NULL;
+        unsigned int seconds = 0, seed = 1;
+        double bound = 50, cost;
+        size_t size;
+        int opt, i, status = 0;
+
+        while ((opt = getopt(argc, argv, "B:t:o:s:")) != -1)
+        {
+                switch (opt)
+                {
+                case 'B':
+                        bound = atof(optarg);
+                        break;
+                case 't':
+                        seconds = atoi(optarg);
+                        break;
+                case 'o':
+                        dir = optarg;
+                        break;
+                case 's':
+                        seed = atoi(optarg);
+                        break;
+                default:
+                        printf("Usage: %s [-B bound] [-t seconds] [-o dir] "
+                                "[-s seed] [file...]\n", argv[0]);
+                        return 2;
+                }
+        }
+
+        if (setup() < 0)
+        {
+                printf("Error: can't set up libttyhub\n");
+                return 2;
+        }
+        srand(seed);
+        add_seeds();
+        for (i = optind; i < argc; i++)
+                add_path(argv[i]);
+        if (seconds)
+                search(seconds);
+        qsort(worst, NR_WORST, sizeof(worst[0]), compare_cost);
+        if (dir)
+                write_worst(dir);
+
+        /* measured again with more runs than during the search, right
+           after the frames, so both see the same clock speed */
+        size = make_frames(data, 0);
+        baseline = measure(data, size, 25);
+        for (i = 0; i < NR_WORST && worst[i].data; i++)
+                worst[i].cost = measure(worst[i].data, worst[i].size, 9);
+        qsort(worst, NR_WORST, sizeof(worst[0]), compare_cost);
+
+        printf("well-formed frames: %.1f cycles/byte\n", baseline);
+        for (i = 0; i < NR_WORST && worst[i].data; i++)
+        {
+                cost = worst[i].cost;
+                printf("%-20s %5zu bytes %8.1f cycles/byte %6.1f x%s\n",
+                        worst[i].name, worst[i].size, cost, cost / baseline,
+                        cost > bound * baseline ? "  OVER BOUND" : "");
+                if (cost > bound * baseline)
+                        status = 1;
+        }
+        printf("%s: bound %.1f x\n", status ? "FAIL" : "PASS", bound);
+
+        ttyhub_lib_exit();
+        return status;
+}
+#endif
@@ -19,6 +19,62 @@
 
 #include <linux/module.h>
 #include <linux/tty.h>
+#include <linux/kref.h>
+#include <linux/list.h>
+#include <linux/llist.h>
+#include <linux/ktime.h>
+
+struct ttyhub_frame_pool;
+struct ttyhub_addr;
+
+/* framing of a subsystem (see ttyhub_subsystem.framing) */
+#define TTYHUB_FRAMING_NONE     0       /* do_receive() delimits frames */
+#define TTYHUB_FRAMING_HDLC     1       /* 0x7E flags, 0x7D escapes */
+#define TTYHUB_FRAMING_SLIP     2       /* RFC 1055 */
+#define TTYHUB_FRAMING_COBS     3       /* COBS, frames end with 0x00 */
+#define TTYHUB_FRAMING_GAP      4       /* frames end with a silent gap */
+
+/* complete frame assembled by ttyhub - handed to the receive_frame()
+   operation of a subsystem, which then owns one reference to it */
+struct ttyhub_frame {
+        struct kref ref;
+        struct ttyhub_frame_pool *pool;
+
+        /* free for use by the owner of the frame, e.g. for queueing */
+        struct list_head list;
+
+        /* used by ttyhub while the frame is queued in a bond */
+        struct llist_node bond_node;
+
+        /* state of the bus device that sent the frame when the subsystem
+           uses addresses (see ttyhub_subsystem.addr_size), else NULL */
+        struct ttyhub_addr *addr;
+
+        /* arrival time (ktime_get()) of the chunks holding the first and
+           the last byte of the frame */
+        ktime_t ts_first;
+        ktime_t ts_last;
+
+        /* number of valid bytes in data */
+        int len;
+
+        /* capacity of data */
+        int size;
+
+        unsigned char data[];
+};
+
+/* state of one bus device kept by ttyhub for subsystems using addresses */
+struct ttyhub_addr {
+        u32 addr;
+
+        /* free for use by the subsystem */
+        void *priv;
+
+        /* frames and bytes received from the device */
+        unsigned long frames;
+        unsigned long bytes;
+};
 
 struct ttyhub_subsystem {
         const char *name;
@@ -27,10 +83,97 @@ struct ttyhub_subsystem {
         /* subsystem operations called by ttyhub */
         int (*attach)(void **, struct tty_struct *);
         void (*detach)(void *);
+
+        /* probe_data(), probe_size() and do_receive() are called from the
+           receive path of the tty in atomic context - with the receive lock
+           of the tty held and bottom halves disabled - and must not sleep */
         int (*probe_data)(void *, const unsigned char *, int);
         int (*probe_size)(void *, const unsigned char *, int);
         int (*do_receive)(void *, const unsigned char *, int);
 
+        /* optional - called instead of do_receive() with the arrival time
+           (ktime_get()) of the first byte of the frame and of the last byte
+           passed; the time is taken once for every chunk received by the
+           tty, so subsystems don't need to read the clock themselves; like
+           do_receive() it must not sleep */
+        int (*do_receive_ts)(void *, const unsigned char *, int, ktime_t,
+                        ktime_t);
+
+        /* optional - when set, ttyhub collects all bytes consumed by
+           do_receive() for one frame in a ttyhub_frame and passes it to this
+           operation once do_receive() signals the end of the frame; the
+           reference to the frame is passed on to the subsystem. It is called
+           from the receive path and must not sleep, unless the frames are
+           passed by a worker thread (see worker) or the work item of a bond
+           (see bond_attach), which run in process context */
+        void (*receive_frame)(void *, struct ttyhub_frame *);
+
+        /* maximum size of frames passed to receive_frame() - zero selects the
+           default frame size of ttyhub */
+        int frame_max_size;
+
+        /* when not TTYHUB_FRAMING_NONE ttyhub finds the end of each frame
+           accepted by probe_data(), removes the byte stuffing and passes the
+           decoded frame to receive_frame() - do_receive() is not called;
+           leading delimiters are skipped, the delimiter ending a frame is
+           left in the data probed for the next frame; with
+           TTYHUB_FRAMING_GAP the frame ends when no data has arrived for
+           framing_gap_us */
+        int framing;
+
+        /* silence ending a frame with TTYHUB_FRAMING_GAP - zero derives it
+           from the baud rate like Modbus RTU (3.5 characters, at least
+           1750us) */
+        int framing_gap_us;
+
+        /* optional - called when the tty driver can accept more data after
+           the subsystem has set TTY_DO_WRITE_WAKEUP */
+        void (*write_wakeup)(void *);
+
+        /* optional - lets the subsystem currently receiving a frame, or
+           while probing waits for more data the subsystems not probed yet,
+           peek at data that ttyhub has not accepted yet because the probe
+           buffer is full; the data follows what has been passed to
+           probe_data() so far and is passed to probe_data() or
+           do_receive() again later; called from the receive path, it must
+           not sleep */
+        void (*lookahead)(void *, const unsigned char *, int);
+
+        /* optional - called when the frame the subsystem is receiving is
+           aborted because the tty driver flagged one of its bytes with an
+           error (TTY_PARITY, TTY_FRAME, TTY_OVERRUN or TTY_BREAK); called
+           from the receive path, it must not sleep */
+        void (*frame_error)(void *, char);
+
+        /* when nonzero every complete frame starts with the address of a bus
+           device in a big endian field of addr_size (1 to 4) bytes at
+           addr_offset - ttyhub sets the addr field of the frame to the
+           state it keeps for the device */
+        int addr_offset;
+        int addr_size;
+
+        /* optional - called for every bus device when the subsystem is
+           disabled on the tty, e.g. to free the priv field */
+        void (*addr_release)(void *, struct ttyhub_addr *);
+
+        /* when nonzero frames are passed to receive_frame() by a kernel
+           thread bound to CPU worker_cpu instead of the receive path of the
+           tty - probing and framing stay on the receive path */
+        int worker;
+        int worker_cpu;
+
+        /* optional - create and destroy the instance shared by all ttys of
+           a bond (see TTYHUB_BOND_JOIN), it is passed to probe_data(),
+           receive_frame() and write_wakeup() of every member tty; frames
+           of all members are passed to receive_frame() from one work item.
+           Only subsystems framed by ttyhub (framing != TTYHUB_FRAMING_NONE)
+           can be bonded, as do_receive() would keep the state of a frame
+           in the shared instance. The receive paths of the members run
+           concurrently, so probe_data(), probe_size(), lookahead() and
+           frame_error() must be reentrant for the shared instance */
+        int (*bond_attach)(void **);
+        void (*bond_detach)(void *);
+
         /* minimum bytes received before probing the submodule */
         int probe_data_minimum_bytes;
 
@@ -46,5 +189,25 @@ struct ttyhub_subsystem {
 extern int ttyhub_register_subsystem(struct ttyhub_subsystem *subs);
 extern int ttyhub_unregister_subsystem(int index);
 
+/* write data to a tty using ttyhub - subsystems use this instead of the
+   write() operation of the tty driver, so that the echo of the data can be
+   cancelled on half-duplex lines (see TTYHUB_ECHO_SET); returns the number
+   of bytes written like the driver operation */
+extern int ttyhub_write(struct tty_struct *tty, const unsigned char *buf,
+                        int count);
+
+extern struct ttyhub_frame *ttyhub_frame_get(struct ttyhub_frame *frame);
+extern void ttyhub_frame_put(struct ttyhub_frame *frame);
+
+/* receive state of ttyhub - a child context runs a receive state machine of
+   its own on data passed by a subsystem, e.g. the payload of its frames */
+struct ttyhub_state;
+
+extern struct ttyhub_state *ttyhub_child_create(struct tty_struct *tty);
+extern void ttyhub_child_destroy(struct ttyhub_state *child);
+extern int ttyhub_child_enable(struct ttyhub_state *child, int index);
+extern int ttyhub_child_receive(struct ttyhub_state *child,
+                        const unsigned char *cp, int count);
+
 #endif /* _TTYHUB_H */
 
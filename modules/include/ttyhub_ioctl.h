@@ -17,9 +17,149 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <linux/types.h>
+
 #define TTYHUB_IOCTL_TYPE_ID 0xFF
 
+/* match rules - a rule matches when all of its match conditions are true
+   for the data at the beginning of an unidentified frame */
+#define TTYHUB_RULES_MAX                64
+#define TTYHUB_RULE_MAX_MATCHES         4
+
+/* match operations: the field of 1, 2 or 4 bytes at offset is read (big
+   endian unless TTYHUB_MATCH_LE is set) and masked before comparing */
+#define TTYHUB_MATCH_EQ                 1       /* field == value */
+#define TTYHUB_MATCH_RANGE              2       /* value <= field <= value2 */
+
+#define TTYHUB_MATCH_LE                 0x80    /* flag in width fields */
+
+struct ttyhub_match {
+        __u16 offset;
+        __u8 width;
+        __u8 op;
+        __u32 mask;
+        __u32 value;
+        __u32 value2;
+};
+
+/* rule actions */
+#define TTYHUB_RULE_ACCEPT              1       /* pass frame to subsys */
+#define TTYHUB_RULE_DISCARD             2       /* discard frame */
+
+/* the length of a matched frame is len_adjust when len_width is zero,
+   otherwise the value of the len_width byte field at len_offset plus
+   len_adjust - frames with a length of zero or above len_max don't match */
+struct ttyhub_rule {
+        __u8 action;
+        __u8 nmatch;
+        __u8 len_width;
+        __u8 reserved;
+        __u16 subsys;
+        __u16 len_offset;
+        __s32 len_adjust;
+        __u32 len_max;
+        struct ttyhub_match match[TTYHUB_RULE_MAX_MATCHES];
+};
+
+/* argument of TTYHUB_RULES_LOAD - loading zero rules removes all rules */
+struct ttyhub_rules_load {
+        __u64 rules;            /* pointer to array of struct ttyhub_rule */
+        __u32 count;
+        __u32 reserved;
+};
+
+/* argument of TTYHUB_BOND_JOIN - all ttys that join the bond with the same
+   id enable the subsystem with one shared instance; frames are reordered by
+   the big endian sequence number of seq_width bytes (0 = no reordering)
+   at seq_offset; only subsystems framed by ttyhub can be bonded */
+struct ttyhub_bond_join {
+        __u32 bond;
+        __s32 subsys;
+        __u16 seq_offset;
+        __u8 seq_width;
+        __u8 reserved;
+};
+
+/* argument of TTYHUB_ADDR_STATS - statistics of the bus device addr of a
+   subsystem using addresses */
+struct ttyhub_addr_stats {
+        __s32 subsys;
+        __u32 addr;
+        __u64 frames;
+        __u64 bytes;
+};
+
+/* flags of struct ttyhub_qos_config */
+#define TTYHUB_QOS_CRITICAL     0x01    /* probed first, never shed */
+
+/* argument of TTYHUB_QOS_SET - receive budget of a subsystem on the tty;
+   each rate of zero disables the bucket, a burst of zero defaults to the
+   rate of one second; frames arriving while a bucket is exhausted are shed;
+   all fields zero remove the budget */
+struct ttyhub_qos_config {
+        __s32 subsys;
+        __u32 flags;
+        __u32 bytes_per_sec;
+        __u32 bytes_burst;
+        __u32 frames_per_sec;
+        __u32 frames_burst;
+        __u32 cpu_us_per_sec;   /* time in do_receive()/receive_frame() */
+        __u32 cpu_burst_us;
+};
+
+/* argument of TTYHUB_QOS_STATS - frames of a subsystem admitted and shed
+   since the budget was set */
+struct ttyhub_qos_stats {
+        __s32 subsys;
+        __u32 reserved;
+        __u64 frames_admitted;
+        __u64 frames_shed;
+};
+
+/* argument of TTYHUB_INJECT - data is passed to the receive state machine
+   as if the tty driver had received it, in chunks of the given sizes, to
+   benchmark ttyhub without the overhead of a driver; needs CAP_SYS_ADMIN */
+#define TTYHUB_INJECT_MAX       (16 << 20)
+
+struct ttyhub_inject {
+        __u64 data;             /* pointer to len bytes of data */
+        __u64 chunks;           /* pointer to nr_chunks __u32 chunk sizes
+                                   adding up to len, 0 for a single chunk */
+        __u32 len;
+        __u32 nr_chunks;
+        __u32 repeat;           /* number of times the data is injected,
+                                   0 is the same as 1 */
+        __u32 reserved;
+
+        /* results */
+        __u64 accepted;         /* bytes accepted by the state machine */
+        __u64 ns;               /* time spent receiving */
+        __u64 cycles;           /* get_cycles() - 0 where not supported */
+};
+
+/* argument of TTYHUB_ECHO_SET - on half-duplex lines (e.g. 2-wire RS-485)
+   every byte written with ttyhub_write() is received again; up to size of
+   these bytes are remembered and stripped from the received data before it
+   is probed; an echo that has not arrived within timeout_us of the last
+   write or of the last echoed byte is given up; a size of zero disables
+   echo cancellation, a timeout of zero selects TTYHUB_ECHO_TIMEOUT_US */
+#define TTYHUB_ECHO_MAX_SIZE    65536
+#define TTYHUB_ECHO_TIMEOUT_US  20000
+
+struct ttyhub_echo_config {
+        __u32 size;
+        __u32 timeout_us;
+};
+
 #define TTYHUB_SUBSYS_ENABLE _IOW(TTYHUB_IOCTL_TYPE_ID, 1, int)
+#define TTYHUB_RULES_LOAD _IOW(TTYHUB_IOCTL_TYPE_ID, 2, struct ttyhub_rules_load)
+#define TTYHUB_BOND_JOIN _IOW(TTYHUB_IOCTL_TYPE_ID, 3, struct ttyhub_bond_join)
+#define TTYHUB_ADDR_STATS _IOWR(TTYHUB_IOCTL_TYPE_ID, 4, struct ttyhub_addr_stats)
+#define TTYHUB_QOS_SET _IOW(TTYHUB_IOCTL_TYPE_ID, 5, struct ttyhub_qos_config)
+#define TTYHUB_QOS_STATS _IOWR(TTYHUB_IOCTL_TYPE_ID, 6, struct ttyhub_qos_stats)
+#define TTYHUB_SUBSYS_DISABLE _IOW(TTYHUB_IOCTL_TYPE_ID, 7, int)
+#define TTYHUB_INJECT _IOWR(TTYHUB_IOCTL_TYPE_ID, 8, struct ttyhub_inject)
+#define TTYHUB_ECHO_SET _IOW(TTYHUB_IOCTL_TYPE_ID, 9, struct ttyhub_echo_config)
 
 #endif /* _TTYHUB_IOCTL_H */
 
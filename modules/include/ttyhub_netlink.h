@@ -0,0 +1,95 @@
+#ifndef _TTYHUB_NETLINK_H
+#define _TTYHUB_NETLINK_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/types.h>
+
+/*
+ * Generic netlink family of ttyhub. TTYHUB_CMD_GET_TTY dumps one message
+ * per tty using ttyhub; every message holds the counters of the tty and one
+ * nested TTYHUB_A_SUBSYS attribute per subsystem enabled on it. Events are
+ * sent as TTYHUB_CMD_EVENT to the multicast group TTYHUB_GENL_MCGRP_EVENTS.
+ */
+
+#define TTYHUB_GENL_NAME                "ttyhub"
+#define TTYHUB_GENL_VERSION             1
+#define TTYHUB_GENL_MCGRP_EVENTS        "events"
+
+enum {
+        TTYHUB_CMD_UNSPEC,
+        TTYHUB_CMD_GET_TTY,             /* dump only */
+        TTYHUB_CMD_EVENT,               /* multicast only */
+        __TTYHUB_CMD_MAX,
+};
+#define TTYHUB_CMD_MAX (__TTYHUB_CMD_MAX - 1)
+
+enum {
+        TTYHUB_A_UNSPEC,
+        TTYHUB_A_PAD,
+        TTYHUB_A_TTY,                   /* string */
+        TTYHUB_A_RECV_STATE,            /* s32, subsystem index or < 0 */
+        TTYHUB_A_BYTES_RECEIVED,        /* u64 */
+        TTYHUB_A_BYTES_DISCARDED,       /* u64 */
+        TTYHUB_A_TIMED_DISCARDS,        /* u64 */
+        TTYHUB_A_FRAMES_DROPPED,        /* u64 */
+        TTYHUB_A_SUBSYS,                /* nested, TTYHUB_SA_* */
+        TTYHUB_A_EVENT,                 /* u32, TTYHUB_EVENT_* */
+        TTYHUB_A_EVENT_SUBSYS,          /* s32 */
+        TTYHUB_A_EVENT_VALUE,           /* u64 */
+        TTYHUB_A_EVENTS_SUPPRESSED,     /* u32, by rate limit since the
+                                           last event of the tty */
+        /* bytes flagged with an error by the tty driver */
+        TTYHUB_A_ERRORS_BREAK,          /* u64 */
+        TTYHUB_A_ERRORS_FRAME,          /* u64 */
+        TTYHUB_A_ERRORS_PARITY,         /* u64 */
+        TTYHUB_A_ERRORS_OVERRUN,        /* u64 */
+        TTYHUB_A_FRAMES_ABORTED,        /* u64, frames containing such a
+                                           byte */
+        /* echo cancellation (see TTYHUB_ECHO_SET) */
+        TTYHUB_A_ECHO_BYTES,            /* u64, echoed bytes stripped */
+        TTYHUB_A_ECHO_LOST,             /* u64, bytes written that were
+                                           not echoed in time or wrong */
+        __TTYHUB_A_MAX,
+};
+#define TTYHUB_A_MAX (__TTYHUB_A_MAX - 1)
+
+enum {
+        TTYHUB_SA_UNSPEC,
+        TTYHUB_SA_PAD,
+        TTYHUB_SA_INDEX,                /* u32 */
+        TTYHUB_SA_NAME,                 /* string */
+        TTYHUB_SA_FRAMES,               /* u64, frames identified */
+        TTYHUB_SA_BYTES,                /* u64 */
+        TTYHUB_SA_FRAMES_SHED,          /* u64, by the receive budget */
+        __TTYHUB_SA_MAX,
+};
+#define TTYHUB_SA_MAX (__TTYHUB_SA_MAX - 1)
+
+/* events - the value depends on the event */
+enum {
+        TTYHUB_EVENT_TIMED_DISCARD = 1, /* unidentified data is discarded
+                                           until the line is silent */
+        TTYHUB_EVENT_RESYNC,            /* probing again after a timed
+                                           discard, value = bytes discarded */
+        TTYHUB_EVENT_SUBSYS_ENABLE,
+        TTYHUB_EVENT_SUBSYS_DISABLE,
+        TTYHUB_EVENT_OVERRUN,           /* a complete frame was dropped,
+                                           value = frames dropped so far */
+};
+
+#endif /* _TTYHUB_NETLINK_H */
@@ -0,0 +1,137 @@
+#ifndef _TTYHUB_REF_H
+#define _TTYHUB_REF_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Frame formats of the reference protocols received by ttyhubref and
+ * generated by ttyhubvuart. Every frame carries an 8 bit sequence number
+ * and a payload derived from it, so the receiver can tell corrupted frames
+ * from lost ones.
+ *
+ *  fixed   F1 seq payload... sum                   (ttyhubref fixed_size)
+ *  lenpfx  F2 len seq payload... sum               (len = whole frame)
+ *  delim   '$' seq(2 hex) payload... sum(2 hex) '\n'
+ *  sized   F4 len seq payload...                   (skipped by size)
+ *
+ * The binary payload byte at offset i is seq + i, the sum byte makes the
+ * sum of all bytes of the frame 0xFF. The payload of delim frames is lower
+ * case letters 'a' + (seq + i) % 26 and the sum covers all bytes between
+ * '$' and the sum.
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+#define TTYHUB_REF_FIXED        0
+#define TTYHUB_REF_LENPFX       1
+#define TTYHUB_REF_DELIM        2
+#define TTYHUB_REF_SIZED        3
+#define TTYHUB_REF_PROTOCOLS    4
+
+#define TTYHUB_REF_SYNC_FIXED   0xF1
+#define TTYHUB_REF_SYNC_LENPFX  0xF2
+#define TTYHUB_REF_SYNC_DELIM   '$'
+#define TTYHUB_REF_SYNC_SIZED   0xF4
+#define TTYHUB_REF_DELIMITER    '\n'
+
+/* default size of fixed frames */
+#define TTYHUB_REF_FIXED_SIZE   16
+
+/* limits of the frame size of every protocol */
+#define TTYHUB_REF_FIXED_MIN    3
+#define TTYHUB_REF_LENPFX_MIN   4
+#define TTYHUB_REF_DELIM_MIN    6
+#define TTYHUB_REF_SIZED_MIN    3
+#define TTYHUB_REF_SIZE_MAX     255
+
+static inline u8 ttyhub_ref_payload(u8 seq, int offset)
+{
+        return seq + offset;
+}
+
+static inline u8 ttyhub_ref_delim_payload(u8 seq, int offset)
+{
+        return 'a' + (seq + offset) % 26;
+}
+
+static inline int ttyhub_ref_is_sync(unsigned char c)
+{
+        return c == TTYHUB_REF_SYNC_FIXED || c == TTYHUB_REF_SYNC_LENPFX ||
+                c == TTYHUB_REF_SYNC_DELIM || c == TTYHUB_REF_SYNC_SIZED;
+}
+
+/*
+ * Build a frame of a reference protocol. The size is clamped to the limits
+ * of the protocol.
+ *
+ * Returns the size of the frame written to buf, which must hold
+ * TTYHUB_REF_SIZE_MAX bytes.
+ */
+static inline int ttyhub_ref_build(int proto, u8 seq, int size,
+                        unsigned char *buf)
+{
+        static const int min[TTYHUB_REF_PROTOCOLS] = {
+                TTYHUB_REF_FIXED_MIN, TTYHUB_REF_LENPFX_MIN,
+                TTYHUB_REF_DELIM_MIN, TTYHUB_REF_SIZED_MIN };
+        u8 sum = 0;
+        int i, hdr;
+
+        size = clamp(size, min[proto], TTYHUB_REF_SIZE_MAX);
+
+        if (proto == TTYHUB_REF_DELIM) {
+                buf[0] = TTYHUB_REF_SYNC_DELIM;
+                buf[1] = hex_asc_upper_hi(seq);
+                buf[2] = hex_asc_upper_lo(seq);
+                for (i=3; i < size - 3; i++)
+                        buf[i] = ttyhub_ref_delim_payload(seq, i);
+                for (i=1; i < size - 3; i++)
+                        sum += buf[i];
+                buf[size - 3] = hex_asc_upper_hi(sum);
+                buf[size - 2] = hex_asc_upper_lo(sum);
+                buf[size - 1] = TTYHUB_REF_DELIMITER;
+                return size;
+        }
+
+        switch (proto) {
+        case TTYHUB_REF_FIXED:
+                buf[0] = TTYHUB_REF_SYNC_FIXED;
+                hdr = 1;
+                break;
+        case TTYHUB_REF_LENPFX:
+                buf[0] = TTYHUB_REF_SYNC_LENPFX;
+                buf[1] = size;
+                hdr = 2;
+                break;
+        default:
+                buf[0] = TTYHUB_REF_SYNC_SIZED;
+                buf[1] = size;
+                hdr = 2;
+                break;
+        }
+        buf[hdr] = seq;
+        for (i=hdr + 1; i < size; i++)
+                buf[i] = ttyhub_ref_payload(seq, i);
+        if (proto != TTYHUB_REF_SIZED) {
+                for (i=0; i < size - 1; i++)
+                        sum += buf[i];
+                buf[size - 1] = 0xFF - sum;
+        }
+        return size;
+}
+
+#endif /* _TTYHUB_REF_H */
@@ -1,3 +1,6 @@
 #!/bin/sh
 insmod ttyhub/ttyhub.ko debug=255
 insmod testsubsys0/testsubsys0.ko
+insmod ttyhubref/ttyhubref.ko
+insmod ttyhubnet/ttyhubnet.ko
+insmod ttyhubvuart/ttyhubvuart.ko
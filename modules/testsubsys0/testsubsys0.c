@@ -17,11 +17,18 @@
 
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/tty.h>
 #include <linux/slab.h>
 #include "ttyhub.h"
+#ifndef TTYHUB_STATIC_BUILD
 MODULE_AUTHOR("Alexander F. Mayer");
 MODULE_LICENSE("GPL");
+#endif
+
+static int verbose = 1;
+module_param(verbose, int, 0644);
+MODULE_PARM_DESC(verbose, "Log every probe and receive operation");
 
 struct testsubsys0_data {
         struct tty_struct *tty;
@@ -67,8 +74,9 @@ int testsubsys0_probe_data(void *data, const unsigned char *cp, int count)
         int recognized = 0;
         (void)d;
 
-        print_hex_dump_bytes("testsubsys0: invoked probe_data() - ",
-                        DUMP_PREFIX_OFFSET, cp, count);
+        if (verbose)
+                print_hex_dump_bytes("testsubsys0: invoked probe_data() - ",
+                                DUMP_PREFIX_OFFSET, cp, count);
 
         /* data recognition rules:
          *      1) when the first 4 bytes are "!AAA" -> size = 4
@@ -91,13 +99,14 @@ int testsubsys0_probe_data(void *data, const unsigned char *cp, int count)
                 recognized = 1;
         }
         else if (cp[1] == 'C' && cp[2] == 'C' && cp[3] == 'C') {
-                printk("testsubsys0: receive_until_marker_mode on\n");
+                if (verbose)
+                        printk("testsubsys0: receive_until_marker_mode on\n");
                 d->receive_until_marker_mode = 1;
                 recognized = 1;
         }
 
 exit:
-        if (recognized)
+        if (recognized && verbose)
                 printk("testsubsys0: data recognized\n");
 
         return recognized;
@@ -109,8 +118,9 @@ int testsubsys0_probe_size(void *data, const unsigned char *cp, int count)
         struct testsubsys0_data *d = (struct testsubsys0_data *)data;
         (void)d;
 
-        print_hex_dump_bytes("testsubsys0: invoked probe_size() - ",
-                        DUMP_PREFIX_OFFSET, cp, count);
+        if (verbose)
+                print_hex_dump_bytes("testsubsys0: invoked probe_size() - ",
+                                DUMP_PREFIX_OFFSET, cp, count);
 
         // TODO recognize size of every packet beginning with ! <lowcase letter> similarly to !B
 
@@ -119,8 +129,9 @@ int testsubsys0_probe_size(void *data, const unsigned char *cp, int count)
                 size = cp[16] - '@';
                 if (size <= 0)
                         size = count;
-                printk("testsubsys0: size recognized as %d ('%c')\n", size,
-                        cp[16]);
+                if (verbose)
+                        printk("testsubsys0: size recognized as %d ('%c')\n",
+                                size, cp[16]);
         }
 
         return size;
@@ -132,19 +143,23 @@ int testsubsys0_do_receive(void *data, const unsigned char *cp, int count)
         int ret;
         (void)d;
 
-        print_hex_dump_bytes("testsubsys0: invoked do_receive() - ",
-                        DUMP_PREFIX_OFFSET, cp, count);
-
-        printk("testsubsys0:    receive_until_marker_mode=%d, "
-                "receive_remain=%d, count=%d\n", d->receive_until_marker_mode,
-                d->receive_remain, count);
+        if (verbose) {
+                print_hex_dump_bytes("testsubsys0: invoked do_receive() - ",
+                                DUMP_PREFIX_OFFSET, cp, count);
+                printk("testsubsys0:    receive_until_marker_mode=%d, "
+                        "receive_remain=%d, count=%d\n",
+                        d->receive_until_marker_mode, d->receive_remain,
+                        count);
+        }
         if (d->receive_until_marker_mode) {
                 /* receive everything until and including '$' character */
                 int n = 0;
                 while (count--) {
                         if (cp[n++] == '$') {
-                                printk("testsubsys0: found '$' --> "
-                                        "receive_until_marker_mode off\n");
+                                if (verbose)
+                                        printk("testsubsys0: found '$' --> "
+                                                "receive_until_marker_mode "
+                                                "off\n");
                                 d->receive_until_marker_mode = 0;
                                 ret = n;
                                 goto exit;
@@ -164,7 +179,8 @@ int testsubsys0_do_receive(void *data, const unsigned char *cp, int count)
         }
 
 exit:
-        printk("testsubsys0: exit do_receive() with %d\n", ret);
+        if (verbose)
+                printk("testsubsys0: exit do_receive() with %d\n", ret);
         return ret;
 }
 
@@ -192,17 +208,50 @@ static int __init testsubsys0_init(void)
         return 0;
 }
 
-static void __exit testsubsys0_exit(void)
+static void testsubsys0_unregister(void)
 {
         int status = 0;
 
         if (subsys_number >= 0)
                 status = ttyhub_unregister_subsystem(subsys_number);
+        subsys_number = -1;
 
         if (status != 0)
                 printk("testsubsys0: could not unregister subsystem\n");
 }
 
+#ifdef TTYHUB_STATIC_BUILD
+/* entry points for ttyhub when linked into ttyhub.ko (see ttyhub_static.h) */
+int __init testsubsys0_static_init(void)
+{
+        int status = testsubsys0_init();
+        return status < 0 ? status : subsys_number;
+}
+
+void testsubsys0_static_exit(void)
+{
+        testsubsys0_unregister();
+}
+
+/* the dispatch benchmark must not time the log messages */
+static int testsubsys0_verbose_saved;
+
+void __init testsubsys0_static_bench(int running)
+{
+        if (running) {
+                testsubsys0_verbose_saved = verbose;
+                verbose = 0;
+        }
+        else
+                verbose = testsubsys0_verbose_saved;
+}
+#else
+static void __exit testsubsys0_exit(void)
+{
+        testsubsys0_unregister();
+}
+
 module_init(testsubsys0_init);
 module_exit(testsubsys0_exit);
+#endif
 
@@ -0,0 +1,149 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * State of the devices on a multi-drop bus. Every tty and subsystem using
+ * addresses has a table indexed by the address field of the frames. The
+ * table is a radix tree (XArray), so finding the state of a device takes the
+ * same time no matter how many devices are on the bus.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/xarray.h>
+#include "ttyhub_addr.h"
+
+static int addr_max_devices = 4096;
+module_param(addr_max_devices, int, 0644);
+MODULE_PARM_DESC(addr_max_devices, "Maximum number of bus devices tracked "
+                "per tty and subsystem");
+
+struct ttyhub_addr_table {
+        struct xarray devices;
+        int count;
+
+        /* frames too short for the address field or from devices that could
+           not be tracked */
+        unsigned long frames_unknown;
+};
+
+/* Returns a new, empty table or NULL if memory is short. */
+struct ttyhub_addr_table *ttyhub_addr_table_create(void)
+{
+        struct ttyhub_addr_table *table;
+
+        table = kzalloc(sizeof(*table), GFP_KERNEL);
+        if (table == NULL)
+                return NULL;
+        xa_init(&table->devices);
+        return table;
+}
+
+/*
+ * Free a table and the state of all devices in it. The addr_release()
+ * operation of the subsystem is called for every device.
+ * No frames referring to the devices may be in use anymore.
+ */
+void ttyhub_addr_table_destroy(struct ttyhub_addr_table *table,
+                        struct ttyhub_subsystem *subs, void *data)
+{
+        struct ttyhub_addr *addr;
+        unsigned long index;
+
+        xa_for_each(&table->devices, index, addr) {
+                if (subs->addr_release)
+                        subs->addr_release(data, addr);
+                kfree(addr);
+        }
+        xa_destroy(&table->devices);
+        kfree(table);
+}
+
+/*
+ * Set the addr field of a complete frame to the state of the device that
+ * sent it and update the statistics of the device. The state is created
+ * when the first frame of a device arrives. Frames without a valid address
+ * keep a NULL addr field.
+ *
+ * Locks:
+ *      The receive lock of the tty is assumed to be held already - it
+ *      serializes all changes to the table.
+ */
+void ttyhub_addr_resolve(struct ttyhub_addr_table *table,
+                        struct ttyhub_subsystem *subs,
+                        struct ttyhub_frame *frame)
+{
+        struct ttyhub_addr *addr;
+        u32 value = 0;
+        int i;
+
+        frame->addr = NULL;
+        if (frame->len < subs->addr_offset + subs->addr_size) {
+                table->frames_unknown++;
+                return;
+        }
+        for (i=0; i < subs->addr_size; i++)
+                value = value << 8 | frame->data[subs->addr_offset + i];
+
+        addr = xa_load(&table->devices, value);
+        if (addr == NULL) {
+                if (table->count >= addr_max_devices)
+                        goto unknown;
+                addr = kzalloc(sizeof(*addr), GFP_ATOMIC);
+                if (addr == NULL)
+                        goto unknown;
+                addr->addr = value;
+                if (xa_err(xa_store(&table->devices, value, addr,
+                                                GFP_ATOMIC))) {
+                        kfree(addr);
+                        goto unknown;
+                }
+                table->count++;
+        }
+
+        addr->frames++;
+        addr->bytes += frame->len;
+        frame->addr = addr;
+        return;
+
+unknown:
+        table->frames_unknown++;
+}
+
+/*
+ * Fill in the statistics of one device.
+ *
+ * Locks:
+ *      The receive lock of the tty is assumed to be held already.
+ *
+ * Returns zero on success or -ENOENT if no frame of the device has arrived
+ * yet.
+ */
+int ttyhub_addr_get_stats(struct ttyhub_addr_table *table,
+                        struct ttyhub_addr_stats *stats)
+{
+        struct ttyhub_addr *addr;
+
+        addr = xa_load(&table->devices, stats->addr);
+        if (addr == NULL)
+                return -ENOENT;
+        stats->frames = addr->frames;
+        stats->bytes = addr->bytes;
+        return 0;
+}
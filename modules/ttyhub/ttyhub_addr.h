@@ -0,0 +1,34 @@
+#ifndef _TTYHUB_ADDR_H
+#define _TTYHUB_ADDR_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ttyhub.h"
+#include "ttyhub_ioctl.h"
+
+struct ttyhub_addr_table;
+
+extern struct ttyhub_addr_table *ttyhub_addr_table_create(void);
+extern void ttyhub_addr_table_destroy(struct ttyhub_addr_table *table,
+                        struct ttyhub_subsystem *subs, void *data);
+extern void ttyhub_addr_resolve(struct ttyhub_addr_table *table,
+                        struct ttyhub_subsystem *subs,
+                        struct ttyhub_frame *frame);
+extern int ttyhub_addr_get_stats(struct ttyhub_addr_table *table,
+                        struct ttyhub_addr_stats *stats);
+
+#endif /* _TTYHUB_ADDR_H */
@@ -0,0 +1,389 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A bond groups several ttys under one instance of a subsystem. Every member
+ * tty pushes its complete frames to its own lock free list, so the receive
+ * paths of the members never contend. One work item per bond collects the
+ * frames of all members, optionally puts them back into the order of their
+ * sequence numbers and passes them to the subsystem.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/llist.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/err.h>
+#include <asm/unaligned.h>
+#include "ttyhub_bond.h"
+
+/* number of frames a bond can hold back while waiting for a missing
+   sequence number - must be a power of two not above 256 */
+#define TTYHUB_BOND_WINDOW      64
+
+static int bond_reorder_timeout = 10;
+module_param(bond_reorder_timeout, int, 0644);
+MODULE_PARM_DESC(bond_reorder_timeout, "Milliseconds a bond waits for a "
+                "missing sequence number before skipping it");
+
+struct ttyhub_bond {
+        struct list_head list;
+        u32 id;
+        struct ttyhub_subsystem *subs;
+        void *data;
+
+        /* number of members - protected by ttyhub_bonds_mutex */
+        int members;
+
+        /* members the merge work collects frames from */
+        struct list_head member_list;
+        spinlock_t member_lock;
+
+        struct work_struct merge_work;
+        struct delayed_work flush_work;
+
+        /* reordering state - protected by reorder_mutex */
+        struct mutex reorder_mutex;
+        u16 seq_offset;
+        u8 seq_width;
+        int seq_valid;
+        u32 seq_next;
+        int held;
+        struct ttyhub_frame *window[TTYHUB_BOND_WINDOW];
+        unsigned long frames_late;
+};
+
+struct ttyhub_bond_member {
+        struct list_head list;
+        struct ttyhub_bond *bond;
+        struct llist_head ingest;
+};
+
+static LIST_HEAD(ttyhub_bonds);
+static DEFINE_MUTEX(ttyhub_bonds_mutex);
+
+static u32 ttyhub_bond_seq_mask(struct ttyhub_bond *bond)
+{
+        return bond->seq_width == 4 ? 0xFFFFFFFF :
+                (1U << bond->seq_width * 8) - 1;
+}
+
+/*
+ * Pass frames that are held back to the subsystem as long as their sequence
+ * numbers follow each other without a gap.
+ * This is a helper function for the merge and flush work.
+ */
+static void ttyhub_bond_release(struct ttyhub_bond *bond)
+{
+        struct ttyhub_frame *frame;
+        int slot;
+
+        while (bond->held) {
+                slot = bond->seq_next % TTYHUB_BOND_WINDOW;
+                frame = bond->window[slot];
+                if (frame == NULL)
+                        break;
+                bond->window[slot] = NULL;
+                bond->held--;
+                bond->seq_next = (bond->seq_next + 1) &
+                        ttyhub_bond_seq_mask(bond);
+                bond->subs->receive_frame(bond->data, frame);
+        }
+}
+
+/*
+ * Give up waiting for missing sequence numbers up to the next frame that is
+ * held back and release the frames following it.
+ * This is a helper function for the merge and flush work.
+ */
+static void ttyhub_bond_skip(struct ttyhub_bond *bond)
+{
+        if (bond->held == 0)
+                return;
+        while (bond->window[bond->seq_next % TTYHUB_BOND_WINDOW] == NULL)
+                bond->seq_next = (bond->seq_next + 1) &
+                        ttyhub_bond_seq_mask(bond);
+        ttyhub_bond_release(bond);
+}
+
+/*
+ * Sort one frame into the reorder window. Frames without a sequence number
+ * and frames that arrive after their sequence number has been skipped are
+ * passed on immediately.
+ * This is a helper function for ttyhub_bond_merge().
+ */
+static void ttyhub_bond_reorder(struct ttyhub_bond *bond,
+                        struct ttyhub_frame *frame)
+{
+        const unsigned char *p = frame->data + bond->seq_offset;
+        u32 mask = ttyhub_bond_seq_mask(bond);
+        u32 seq, diff;
+        int slot;
+
+        if (bond->seq_width == 0 ||
+                        frame->len < bond->seq_offset + bond->seq_width) {
+                bond->subs->receive_frame(bond->data, frame);
+                return;
+        }
+
+        switch (bond->seq_width) {
+        case 1:
+                seq = p[0];
+                break;
+        case 2:
+                seq = get_unaligned_be16(p);
+                break;
+        default:
+                seq = get_unaligned_be32(p);
+                break;
+        }
+
+        if (!bond->seq_valid) {
+                bond->seq_next = seq;
+                bond->seq_valid = 1;
+        }
+
+        diff = (seq - bond->seq_next) & mask;
+        if (diff > mask / 2) {
+                /* sequence number already skipped */
+                bond->frames_late++;
+                bond->subs->receive_frame(bond->data, frame);
+                return;
+        }
+
+        /* too far ahead to be held back - skip missing sequence numbers */
+        while (diff >= TTYHUB_BOND_WINDOW) {
+                if (bond->held)
+                        ttyhub_bond_skip(bond);
+                else
+                        bond->seq_next = (seq - TTYHUB_BOND_WINDOW + 1) &
+                                mask;
+                diff = (seq - bond->seq_next) & mask;
+        }
+
+        slot = seq % TTYHUB_BOND_WINDOW;
+        if (bond->window[slot]) {
+                /* duplicate sequence number */
+                bond->frames_late++;
+                ttyhub_frame_put(frame);
+                return;
+        }
+        bond->window[slot] = frame;
+        bond->held++;
+        ttyhub_bond_release(bond);
+}
+
+/* Work collecting the frames of all members of a bond. */
+static void ttyhub_bond_merge(struct work_struct *work)
+{
+        struct ttyhub_bond *bond = container_of(work, struct ttyhub_bond,
+                        merge_work);
+        struct ttyhub_bond_member *member;
+        struct ttyhub_frame *frame, *next;
+        struct llist_node *nodes;
+        LIST_HEAD(frames);
+
+        /* frames of one member stay in the order they were received */
+        spin_lock_bh(&bond->member_lock);
+        list_for_each_entry(member, &bond->member_list, list) {
+                nodes = llist_reverse_order(llist_del_all(&member->ingest));
+                llist_for_each_entry_safe(frame, next, nodes, bond_node)
+                        list_add_tail(&frame->list, &frames);
+        }
+        spin_unlock_bh(&bond->member_lock);
+
+        mutex_lock(&bond->reorder_mutex);
+        list_for_each_entry_safe(frame, next, &frames, list) {
+                list_del_init(&frame->list);
+                ttyhub_bond_reorder(bond, frame);
+        }
+        if (bond->held)
+                mod_delayed_work(system_wq, &bond->flush_work,
+                                msecs_to_jiffies(bond_reorder_timeout));
+        mutex_unlock(&bond->reorder_mutex);
+}
+
+/* Work releasing frames held back for too long. */
+static void ttyhub_bond_flush(struct work_struct *work)
+{
+        struct ttyhub_bond *bond = container_of(to_delayed_work(work),
+                        struct ttyhub_bond, flush_work);
+
+        mutex_lock(&bond->reorder_mutex);
+        while (bond->held)
+                ttyhub_bond_skip(bond);
+        mutex_unlock(&bond->reorder_mutex);
+}
+
+/*
+ * This is a helper function for ttyhub_bond_join().
+ * Create a bond and the subsystem instance shared by its members.
+ *
+ * Locks:
+ *      ttyhub_bonds_mutex is assumed to be held already.
+ *
+ * Returns the new bond or an ERR_PTR() value.
+ */
+static struct ttyhub_bond *ttyhub_bond_create(struct ttyhub_subsystem *subs,
+                        const struct ttyhub_bond_join *join)
+{
+        struct ttyhub_bond *bond;
+        int err;
+
+        bond = kzalloc(sizeof(*bond), GFP_KERNEL);
+        if (bond == NULL)
+                return ERR_PTR(-ENOMEM);
+
+        err = subs->bond_attach(&bond->data);
+        if (err < 0) {
+                kfree(bond);
+                return ERR_PTR(err);
+        }
+
+        bond->id = join->bond;
+        bond->subs = subs;
+        INIT_LIST_HEAD(&bond->member_list);
+        spin_lock_init(&bond->member_lock);
+        INIT_WORK(&bond->merge_work, ttyhub_bond_merge);
+        INIT_DELAYED_WORK(&bond->flush_work, ttyhub_bond_flush);
+        mutex_init(&bond->reorder_mutex);
+        bond->seq_offset = join->seq_offset;
+        bond->seq_width = join->seq_width;
+        list_add(&bond->list, &ttyhub_bonds);
+        return bond;
+}
+
+/*
+ * Add a tty to a bond. The bond is created when the first tty joins.
+ * *data is set to the subsystem instance of the bond.
+ *
+ * Locks:
+ *      ttyhub_bonds_mutex is held while searching and changing bonds.
+ *
+ * Returns the new member or an ERR_PTR() value.
+ */
+struct ttyhub_bond_member *ttyhub_bond_join(struct ttyhub_subsystem *subs,
+                        const struct ttyhub_bond_join *join, void **data)
+{
+        struct ttyhub_bond *bond;
+        struct ttyhub_bond_member *member;
+
+        if (subs->bond_attach == NULL || subs->receive_frame == NULL)
+                return ERR_PTR(-EINVAL);
+        if (join->seq_width != 0 && join->seq_width != 1 &&
+                        join->seq_width != 2 && join->seq_width != 4)
+                return ERR_PTR(-EINVAL);
+
+        member = kzalloc(sizeof(*member), GFP_KERNEL);
+        if (member == NULL)
+                return ERR_PTR(-ENOMEM);
+        init_llist_head(&member->ingest);
+
+        mutex_lock(&ttyhub_bonds_mutex);
+        list_for_each_entry(bond, &ttyhub_bonds, list) {
+                if (bond->id == join->bond && bond->subs == subs)
+                        goto found;
+        }
+        bond = ttyhub_bond_create(subs, join);
+        if (IS_ERR(bond)) {
+                mutex_unlock(&ttyhub_bonds_mutex);
+                kfree(member);
+                return ERR_CAST(bond);
+        }
+
+found:
+        if (bond->seq_offset != join->seq_offset ||
+                        bond->seq_width != join->seq_width) {
+                /* all members must number their frames the same way */
+                mutex_unlock(&ttyhub_bonds_mutex);
+                kfree(member);
+                return ERR_PTR(-EINVAL);
+        }
+
+        member->bond = bond;
+        bond->members++;
+        spin_lock_bh(&bond->member_lock);
+        list_add_tail(&member->list, &bond->member_list);
+        spin_unlock_bh(&bond->member_lock);
+        *data = bond->data;
+        mutex_unlock(&ttyhub_bonds_mutex);
+
+        return member;
+}
+
+/*
+ * Remove a tty from its bond. Frames received so far are still passed to the
+ * subsystem. The bond and its subsystem instance are destroyed when the last
+ * member leaves.
+ *
+ * Locks:
+ *      ttyhub_bonds_mutex is held while changing the bond.
+ */
+void ttyhub_bond_leave(struct ttyhub_bond_member *member)
+{
+        struct ttyhub_bond *bond = member->bond;
+        struct ttyhub_frame *frame, *next;
+        struct llist_node *nodes;
+        int i;
+
+        mutex_lock(&ttyhub_bonds_mutex);
+
+        queue_work(system_wq, &bond->merge_work);
+        flush_work(&bond->merge_work);
+        spin_lock_bh(&bond->member_lock);
+        list_del(&member->list);
+        spin_unlock_bh(&bond->member_lock);
+
+        /* frames that arrived after the merge */
+        nodes = llist_del_all(&member->ingest);
+        llist_for_each_entry_safe(frame, next, nodes, bond_node)
+                ttyhub_frame_put(frame);
+        kfree(member);
+
+        if (--bond->members == 0) {
+                list_del(&bond->list);
+                cancel_work_sync(&bond->merge_work);
+                cancel_delayed_work_sync(&bond->flush_work);
+                for (i=0; i < TTYHUB_BOND_WINDOW; i++)
+                        if (bond->window[i])
+                                ttyhub_frame_put(bond->window[i]);
+                if (bond->subs->bond_detach)
+                        bond->subs->bond_detach(bond->data);
+                kfree(bond);
+        }
+
+        mutex_unlock(&ttyhub_bonds_mutex);
+}
+
+/*
+ * Queue a complete frame received by a member tty. The reference to the
+ * frame is passed on to the bond.
+ * This is called from the receive path of the member tty - the frame is only
+ * added to the lock free list of the member.
+ */
+void ttyhub_bond_ingest(struct ttyhub_bond_member *member,
+                        struct ttyhub_frame *frame)
+{
+        llist_add(&frame->bond_node, &member->ingest);
+        queue_work(system_wq, &member->bond->merge_work);
+}
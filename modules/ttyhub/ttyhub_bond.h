@@ -0,0 +1,32 @@
+#ifndef _TTYHUB_BOND_H
+#define _TTYHUB_BOND_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ttyhub.h"
+#include "ttyhub_ioctl.h"
+
+struct ttyhub_bond_member;
+
+extern struct ttyhub_bond_member *ttyhub_bond_join(
+                        struct ttyhub_subsystem *subs,
+                        const struct ttyhub_bond_join *join, void **data);
+extern void ttyhub_bond_leave(struct ttyhub_bond_member *member);
+extern void ttyhub_bond_ingest(struct ttyhub_bond_member *member,
+                        struct ttyhub_frame *frame);
+
+#endif /* _TTYHUB_BOND_H */
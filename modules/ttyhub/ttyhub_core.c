@@ -0,0 +1,3414 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/tty.h>
+#include <linux/ioctl.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/jiffies.h>
+#include <linux/mempool.h>
+#include <linux/rcupdate.h>
+#include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/ratelimit.h>
+#include <linux/workqueue.h>
+#include <linux/capability.h>
+#include <linux/timex.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include "ttyhub.h"
+#include "ttyhub_ioctl.h"
+#include "ttyhub_rules.h"
+#include "ttyhub_framing.h"
+#include "ttyhub_bond.h"
+#include "ttyhub_worker.h"
+#include "ttyhub_addr.h"
+#include "ttyhub_qos.h"
+#include "ttyhub_echo.h"
+#include "ttyhub_genl.h"
+#include "ttyhub_static.h"
+MODULE_AUTHOR("Alexander F. Mayer");
+MODULE_LICENSE("GPL");
+
+#define TTYHUB_VERSION "0.20"
+
+/* N_DEVELOPMENT - reserved for line disciplines not (yet) in mainline */
+#define N_TTYHUB 29
+#if N_TTYHUB >= NR_LDISCS
+#error N_TTYHUB is larger than the maximum allowed value
+#endif
+
+static int max_subsys = 16;
+module_param(max_subsys, int, 0);
+MODULE_PARM_DESC(max_subsys, "Maximum number of TTYHUB subsystems");
+
+static int probe_buf_size = 32;
+module_param(probe_buf_size, int, 0);
+MODULE_PARM_DESC(probe_buf_size, "Size of the TTYHUB receive probe buffer");
+
+static int frame_size = 512;
+module_param(frame_size, int, 0);
+MODULE_PARM_DESC(frame_size, "Default maximum size of frames assembled by TTYHUB");
+
+static int frame_pool_min = 16;
+module_param(frame_pool_min, int, 0);
+MODULE_PARM_DESC(frame_pool_min, "Number of frames reserved per tty and subsystem");
+
+static int event_interval_ms = 1000;
+module_param(event_interval_ms, int, 0644);
+MODULE_PARM_DESC(event_interval_ms, "Interval of the rate limit of netlink "
+                "events per tty");
+
+static int event_burst = 10;
+module_param(event_burst, int, 0644);
+MODULE_PARM_DESC(event_burst, "Netlink events per tty and interval");
+
+static int disable_grace_ms = 1000;
+module_param(disable_grace_ms, int, 0644);
+MODULE_PARM_DESC(disable_grace_ms, "Time a disabled subsystem may finish the "
+                "frame it is receiving before the frame is cut off");
+
+#ifdef DEBUG
+static unsigned int debug = 0;
+module_param(debug, uint, 0);
+MODULE_PARM_DESC(debug, "Each bit controls a debug output category");
+
+#define TTYHUB_DEBUG_LDISC_OPS_USER                     1
+#define TTYHUB_DEBUG_RECV_STATE_MACHINE                 2
+#define TTYHUB_DEBUG_RECV_STATE_MACHINE_DUMP_PROBE_BUF  4
+#endif /* DEBUG */
+
+// TODO List what is protected by ttyhub_subsystems_lock
+//      e.g. state->enabled_subsystems, subsystems list,
+//           subsys->enabled_refcount, subs->enable_in_progress,
+//           updates of state->rules
+
+/* counters of a subsystem on a tty */
+struct ttyhub_subsys_counters {
+        unsigned long frames;
+        unsigned long bytes;
+};
+
+/* what the receive path needs to probe a subsystem - copied from the
+   subsystem when the plan is built */
+struct ttyhub_plan_entry {
+        struct ttyhub_subsystem *subs;
+        int index;
+        int probe_data_minimum_bytes;
+        int framing;
+        int framing_gap_us;
+};
+
+/*
+ * Dispatch plan of a tty - its enabled subsystems in the order they are
+ * probed, critical subsystems first. A plan is never changed once it is
+ * built; ttys with the same enabled subsystems and the same critical budgets
+ * share one plan (see ttyhub_plan_get()). The subsystems of a plan can't be
+ * unregistered while a tty uses it, as they are enabled on that tty.
+ */
+struct ttyhub_plan {
+        /* entry in ttyhub_plans - users is protected by ttyhub_plans_lock */
+        struct list_head node;
+        int users;
+        struct rcu_head rcu;
+
+        /* the subsystem for ttyhub_receive_single() if it is the only one,
+           else -1 */
+        int single;
+        int nr_critical;
+        int nr;
+        struct ttyhub_plan_entry entries[];
+};
+
+struct ttyhub_state {
+        struct tty_struct *tty;
+
+        /* entry in ttyhub_states while the line discipline is open */
+        struct list_head node;
+
+        /* serializes the receive state machine between receive_buf2() and
+           the gap timer */
+        spinlock_t recv_lock;
+        void **subsys_data;
+        unsigned long timed_discard_min_silence; // TODO make this configurable in ioctl()
+
+        int recv_subsys;
+
+        /* the only subsystem enabled when ttyhub_receive_single() can be
+           used, else -1 (see ttyhub_single_update()) */
+        int single;
+
+        unsigned char *probed_subsystems;
+        unsigned char *enabled_subsystems;
+
+        /* subsystems disabled by TTYHUB_SUBSYS_DISABLE that are not yet
+           detached - one of them may still receive its last frame until
+           drain_upto (see ttyhub_subsystem_disable_async()) */
+        unsigned char *draining_subsystems;
+        int draining;
+        unsigned long drain_upto;
+        struct delayed_work drain_work;
+        int discard_bytes_remaining;
+        unsigned long timed_discard_upto;
+        unsigned long timed_discard_count;
+
+        unsigned char *probe_buf;
+        int probe_buf_consumed;
+        int probe_buf_count;
+
+        /* arrival time of every byte in the probe buffer */
+        ktime_t *probe_buf_ts;
+
+        int cp_consumed;
+
+        struct ttyhub_frame_pool **frame_pools;
+        struct ttyhub_bond_member **bond_members;
+        struct ttyhub_worker **workers;
+        struct ttyhub_addr_table **addr_tables;
+
+        /* receive budgets of the subsystems */
+        struct ttyhub_qos **qos;
+
+        /* the subsystems probed by the receive path, NULL when none is
+           enabled - replaced with the receive lock held, plan_lock
+           serializes building and replacing it (see ttyhub_plan_build()) */
+        struct ttyhub_plan __rcu *plan;
+        struct mutex plan_lock;
+
+        /* budget charged for the frame currently received, NULL when the
+           frame is shed or the subsystem has no budget */
+        struct ttyhub_qos *recv_qos;
+        int recv_shed;
+
+        struct ttyhub_frame *recv_frame;
+        int recv_frame_drop;
+        int recv_frame_remain;
+        struct ttyhub_unstuff unstuff;
+        u64 recv_gap_ns;
+        ktime_t recv_last;
+
+        /* arrival time of the first and of the last consumed byte of the
+           frame currently received */
+        ktime_t recv_ts_first;
+        ktime_t recv_ts_last;
+        struct hrtimer gap_timer;
+        unsigned long frames_dropped;
+
+        struct ttyhub_rules __rcu *rules;
+        int rules_probed;
+
+        /* echo of the bytes written with ttyhub_write() on half-duplex
+           lines, NULL when disabled - replaced with both the receive lock
+           and the echo lock held, the write path takes the echo lock only */
+        spinlock_t echo_lock;
+        struct ttyhub_echo *echo;
+
+        /* counters reported by netlink - protected by recv_lock */
+        struct ttyhub_subsys_counters *counters;
+        u64 bytes_received;
+        u64 bytes_discarded;
+        unsigned long timed_discards;
+        unsigned long errors_break;
+        unsigned long errors_frame;
+        unsigned long errors_parity;
+        unsigned long errors_overrun;
+        unsigned long frames_aborted;
+        struct ratelimit_state event_rs;
+        unsigned int events_suppressed;
+};
+
+/* all ttys using ttyhub */
+static LIST_HEAD(ttyhub_states);
+static DEFINE_MUTEX(ttyhub_states_lock);
+
+/* dispatch plans used by at least one tty */
+static LIST_HEAD(ttyhub_plans);
+static DEFINE_MUTEX(ttyhub_plans_lock);
+
+/* frames are allocated from a mempool per tty and subsystem - the pool is
+   reference counted by every frame allocated from it, so frames held by a
+   subsystem stay valid after the subsystem has been disabled on the tty */
+struct ttyhub_frame_pool {
+        struct kref ref;
+        mempool_t *mempool;
+        int frame_size;
+};
+
+static struct ttyhub_subsystem **ttyhub_subsystems;
+static spinlock_t ttyhub_subsystems_lock;
+
+#ifdef DEBUG
+const char *ttyhub_debug_state_to_string(struct ttyhub_state *state)
+{
+        if (state->recv_subsys >= 0) {
+                return ttyhub_subsystems[state->recv_subsys]->name;
+        }
+        else {
+                switch (state->recv_subsys) {
+                case -1:
+                        return "PROBE_DATA";
+                case -2:
+                        return "PROBE_SIZE";
+                case -3:
+                        return "DISCARD_DATA";
+                case -4:
+                        return "TIMED_DISCARD";
+                }
+        }
+
+        return "";
+}
+
+void ttyhub_debug_dump_probe_buf(struct ttyhub_state *state)
+{
+        if (debug & TTYHUB_DEBUG_RECV_STATE_MACHINE_DUMP_PROBE_BUF) {
+                printk(KERN_INFO "ttyhub: receive_buf() probe_buf: count=%d, "
+                        "consumed=%d\n", state-> probe_buf_count,
+                        state->probe_buf_consumed);
+                print_hex_dump(KERN_INFO, "ttyhub: receive_buf()    |",
+                        DUMP_PREFIX_OFFSET, 16, 1, state->probe_buf,
+                        probe_buf_size, true);
+        }
+}
+#endif /* DEBUG */
+
+/*
+ * Send an event about a tty to netlink listeners. The events of every tty
+ * are rate limited - the number of events suppressed is reported with the
+ * next event sent.
+ *
+ * Locks:
+ *      The receive lock of the state is assumed to be held already.
+ */
+static void ttyhub_event(struct ttyhub_state *state, u32 event, int subsys,
+                        u64 value)
+{
+        if (!ttyhub_genl_listening())
+                return;
+        if (!__ratelimit(&state->event_rs)) {
+                state->events_suppressed++;
+                return;
+        }
+        ttyhub_genl_event(state->tty ? tty_name(state->tty) : "", event,
+                        subsys, value, state->events_suppressed);
+        state->events_suppressed = 0;
+}
+
+static struct ttyhub_frame_pool *ttyhub_frame_pool_create(int size)
+{
+        struct ttyhub_frame_pool *pool;
+
+        pool = kmalloc(sizeof(*pool), GFP_KERNEL);
+        if (pool == NULL)
+                return NULL;
+
+        pool->mempool = mempool_create_kmalloc_pool(frame_pool_min,
+                        sizeof(struct ttyhub_frame) + size);
+        if (pool->mempool == NULL) {
+                kfree(pool);
+                return NULL;
+        }
+        kref_init(&pool->ref);
+        pool->frame_size = size;
+        return pool;
+}
+
+static void ttyhub_frame_pool_release(struct kref *ref)
+{
+        struct ttyhub_frame_pool *pool =
+                container_of(ref, struct ttyhub_frame_pool, ref);
+        mempool_destroy(pool->mempool);
+        kfree(pool);
+}
+
+static void ttyhub_frame_pool_put(struct ttyhub_frame_pool *pool)
+{
+        kref_put(&pool->ref, ttyhub_frame_pool_release);
+}
+
+/*
+ * Allocate an empty frame from a frame pool.
+ * This may be called in atomic context - the reserved elements of the
+ * mempool are used when the regular allocation fails.
+ *
+ * Returns a frame with a reference count of one or NULL when the pool
+ * is exhausted.
+ */
+static struct ttyhub_frame *ttyhub_frame_alloc(struct ttyhub_frame_pool *pool)
+{
+        struct ttyhub_frame *frame;
+
+        frame = mempool_alloc(pool->mempool, GFP_ATOMIC);
+        if (frame == NULL)
+                return NULL;
+
+        kref_init(&frame->ref);
+        kref_get(&pool->ref);
+        frame->pool = pool;
+        frame->addr = NULL;
+        frame->ts_first = 0;
+        frame->ts_last = 0;
+        frame->len = 0;
+        frame->size = pool->frame_size;
+        return frame;
+}
+
+static void ttyhub_frame_release(struct kref *ref)
+{
+        struct ttyhub_frame *frame =
+                container_of(ref, struct ttyhub_frame, ref);
+        struct ttyhub_frame_pool *pool = frame->pool;
+
+        mempool_free(frame, pool->mempool);
+        ttyhub_frame_pool_put(pool);
+}
+
+/*
+ * Take an additional reference to a frame.
+ * Returns the frame passed to the function.
+ */
+struct ttyhub_frame *ttyhub_frame_get(struct ttyhub_frame *frame)
+{
+        kref_get(&frame->ref);
+        return frame;
+}
+EXPORT_SYMBOL_GPL(ttyhub_frame_get);
+
+/*
+ * Release a reference to a frame.
+ * The frame is returned to its pool when the last reference is gone. This may
+ * be called from any context.
+ */
+void ttyhub_frame_put(struct ttyhub_frame *frame)
+{
+        kref_put(&frame->ref, ttyhub_frame_release);
+}
+EXPORT_SYMBOL_GPL(ttyhub_frame_put);
+
+/*
+ * Register a new subsystem.
+ * The subsystem structure passed to this function is owned by the caller
+ * and may not be modified from the outside once it is registered.
+ *
+ * Locks:
+ *      The subsystems lock (ttyhub_subsystems_lock) is held while searching
+ *      for a free index and inserting the subsystem to the list.
+ *
+ * Returns:
+ *      On success the index of the registered subsystem is returned. When
+ *      an error occurs -1 is returned.
+ */
+int ttyhub_register_subsystem(struct ttyhub_subsystem *subs)
+{
+        unsigned long flags;
+        int i;
+
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        for (i=0; i < max_subsys; i++) {
+                if (ttyhub_subsystems[i] == NULL)
+                        break;
+        }
+        if (i == max_subsys)
+                /* no more space for this subsystem */
+                goto error_unlock;
+
+        ttyhub_subsystems[i] = subs;
+        subs->enabled_refcount = 0;
+        subs->enable_in_progress = 0;
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+        printk(KERN_INFO "ttyhub: registered subsystem '%s' as #%d\n",
+                subs->name, i);
+        return i;
+
+error_unlock:
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+        return -1;
+}
+EXPORT_SYMBOL_GPL(ttyhub_register_subsystem);
+
+/*
+ * Unregister a subsystem.
+ *
+ * Locks:
+ *      The subsystems lock (ttyhub_subsystems_lock) is held while removing
+ *      the subsystem from the list.
+ *
+ * Returns:
+ *      On success zero is returned. When an error occurs -1 is returned.
+ */
+int ttyhub_unregister_subsystem(int index)
+{
+        unsigned long flags;
+        struct ttyhub_subsystem *subs;
+
+        if (index >= max_subsys || index < 0)
+                return -1;
+
+        subs = ttyhub_subsystems[index];
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        if (subs == NULL)
+                goto error_unlock;
+        if (subs->enabled_refcount != 0)
+                goto error_unlock;
+        ttyhub_subsystems[index] = NULL;
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+        printk(KERN_INFO "ttyhub: unregistered subsystem '%s'\n", subs->name);
+        return 0;
+
+error_unlock:
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+        return -1;
+}
+EXPORT_SYMBOL_GPL(ttyhub_unregister_subsystem);
+
+/*
+ * Find the dispatch plan probing the subsystems in order, of which the first
+ * nr_critical have a critical budget, or build it if no tty uses it yet.
+ * This is a helper function for ttyhub_plan_build().
+ *
+ * Locks:
+ *      The plans lock (ttyhub_plans_lock) is held while searching and adding
+ *      the plan, the subsystems lock (ttyhub_subsystems_lock) while the
+ *      entries of a new plan are copied from the subsystems.
+ *
+ * Returns the plan with a reference taken or NULL if memory is short.
+ */
+static struct ttyhub_plan *ttyhub_plan_get(const int *order, int nr,
+                        int nr_critical)
+{
+        unsigned long flags;
+        struct ttyhub_plan *plan;
+        struct ttyhub_plan_entry *e;
+        struct ttyhub_subsystem *subs;
+        int k;
+
+        mutex_lock(&ttyhub_plans_lock);
+        list_for_each_entry(plan, &ttyhub_plans, node) {
+                if (plan->nr != nr || plan->nr_critical != nr_critical)
+                        continue;
+                for (k=0; k < nr; k++) {
+                        if (plan->entries[k].index != order[k])
+                                break;
+                }
+                if (k == nr) {
+                        plan->users++;
+                        goto out_unlock;
+                }
+        }
+
+        plan = kmalloc(struct_size(plan, entries, nr), GFP_KERNEL);
+        if (plan == NULL)
+                goto out_unlock;
+        plan->users = 1;
+        plan->nr_critical = nr_critical;
+        plan->nr = nr;
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        for (k=0; k < nr; k++) {
+                subs = ttyhub_subsystems[order[k]];
+                e = &plan->entries[k];
+                e->subs = subs;
+                e->index = order[k];
+                e->probe_data_minimum_bytes = subs->probe_data_minimum_bytes;
+                e->framing = subs->framing;
+                e->framing_gap_us = subs->framing_gap_us;
+        }
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+        plan->single = nr == 1 && plan->entries[0].framing !=
+                TTYHUB_FRAMING_GAP ? plan->entries[0].index : -1;
+        list_add(&plan->node, &ttyhub_plans);
+
+out_unlock:
+        mutex_unlock(&ttyhub_plans_lock);
+        return plan;
+}
+
+/*
+ * Drop a reference to a dispatch plan. The last tty using it frees it after
+ * an RCU grace period.
+ *
+ * Locks:
+ *      The plans lock (ttyhub_plans_lock) is held while the reference is
+ *      dropped.
+ */
+static void ttyhub_plan_put(struct ttyhub_plan *plan)
+{
+        int unused;
+
+        if (plan == NULL)
+                return;
+
+        mutex_lock(&ttyhub_plans_lock);
+        unused = --plan->users == 0;
+        if (unused)
+                list_del(&plan->node);
+        mutex_unlock(&ttyhub_plans_lock);
+
+        if (unused)
+                kfree_rcu(plan, rcu);
+}
+
+/*
+ * Get the dispatch plan of the subsystems enabled on a tty and its critical
+ * budgets. Subsystem index is taken as enabled if enable is nonzero and as
+ * disabled otherwise, whatever its bit in the enabled subsystems says - the
+ * caller changes it when replacing the plan. Pass -1 to take the enabled
+ * subsystems as they are.
+ * This is a helper function for ttyhub_qos_set() and the functions enabling
+ * and disabling subsystems.
+ *
+ * Locks:
+ *      The plan lock of the state must be held until the plan is replaced.
+ *      The receive lock of the state and the subsystems lock
+ *      (ttyhub_subsystems_lock) are held while reading the budgets and the
+ *      enabled subsystems.
+ *
+ * Returns the plan, NULL if no subsystem is enabled or ERR_PTR(-ENOMEM).
+ */
+static struct ttyhub_plan *ttyhub_plan_build(struct ttyhub_state *state,
+                        int index, int enable)
+{
+        unsigned long flags;
+        struct ttyhub_plan *plan;
+        int i, pass, critical, nr = 0, nr_critical = 0, *order;
+
+        order = kmalloc(sizeof(*order) * max_subsys, GFP_KERNEL);
+        if (order == NULL)
+                return ERR_PTR(-ENOMEM);
+
+        spin_lock_bh(&state->recv_lock);
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        for (pass=1; pass >= 0; pass--) {
+                for (i=0; i < max_subsys; i++) {
+                        if (i == index ? !enable :
+                                        !(state->enabled_subsystems[i/8] &
+                                        1 << i%8))
+                                continue;
+                        critical = state->qos[i] &&
+                                state->qos[i]->flags & TTYHUB_QOS_CRITICAL;
+                        if (critical != pass)
+                                continue;
+                        order[nr++] = i;
+                        nr_critical += critical;
+                }
+        }
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+        spin_unlock_bh(&state->recv_lock);
+
+        plan = NULL;
+        if (nr) {
+                plan = ttyhub_plan_get(order, nr, nr_critical);
+                if (plan == NULL)
+                        plan = ERR_PTR(-ENOMEM);
+        }
+        kfree(order);
+        return plan;
+}
+
+/*
+ * Select the receive path of a tty. ttyhub_receive_single() is used when
+ * the plan holds exactly one subsystem and neither match rules, a receive
+ * budget nor TTYHUB_FRAMING_GAP are involved. Must be called whenever one of
+ * these changes.
+ *
+ * The receive lock of the state is assumed to be held already.
+ */
+static void ttyhub_single_update(struct ttyhub_state *state)
+{
+        struct ttyhub_plan *plan = rcu_dereference_protected(state->plan,
+                        lockdep_is_held(&state->recv_lock));
+        int single = plan ? plan->single : -1;
+
+        if (single >= 0 && (rcu_access_pointer(state->rules) ||
+                                state->qos[single]))
+                single = -1;
+        state->single = single;
+}
+
+/*
+ * Replace the dispatch plan of a tty and select its receive path.
+ *
+ * Locks:
+ *      The plan lock and the receive lock of the state are assumed to be
+ *      held already.
+ *
+ * Returns the old plan, which the caller puts once the locks are released.
+ */
+static struct ttyhub_plan *ttyhub_plan_replace(struct ttyhub_state *state,
+                        struct ttyhub_plan *plan)
+{
+        struct ttyhub_plan *old;
+
+        old = rcu_dereference_protected(state->plan,
+                        lockdep_is_held(&state->recv_lock));
+        rcu_assign_pointer(state->plan, plan);
+        ttyhub_single_update(state);
+        return old;
+}
+
+/*
+ * Enable a subsystem on a given tty. When join is not NULL the tty joins a
+ * bond and shares the subsystem instance of the bond instead of calling the
+ * subsystem's attach() operation - only subsystems framed by ttyhub can be
+ * bonded.
+ * This is a helper function for ttyhub_ldisc_ioctl().
+ *
+ * Locks:
+ *      The subsystems lock (ttyhub_subsystems_lock) is held while actually
+ *      enabling a subsystem, but not while the call to the subsystem's
+ *      attach() operation or while joining the bond. The plan lock of the
+ *      state is held from building the new dispatch plan until it replaces
+ *      the old one.
+ *
+ * Returns:
+ *      The return value can be directly used as the return value to the
+ *      line discipline ioctl() operation. It is either a negative error code
+ *      or a nonnegative value on success. The subsystem's attach() operation
+ *      directly decides the return code if everything went well until that
+ *      point. If it doesn't exist, zero is returned on success.
+ */
+static int ttyhub_subsystem_enable(struct ttyhub_state *state, int index,
+                        const struct ttyhub_bond_join *join)
+{
+        unsigned long flags;
+        int err = 0;
+        struct ttyhub_subsystem *subs = ttyhub_subsystems[index];
+        struct ttyhub_frame_pool *pool = NULL;
+        struct ttyhub_bond_member *member = NULL;
+        struct ttyhub_worker *worker = NULL;
+        struct ttyhub_addr_table *table = NULL;
+        struct ttyhub_plan *plan;
+
+        if (index >= max_subsys || index < 0)
+                return -EINVAL;
+
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+
+        if (subs == NULL) {
+                err = -EINVAL;
+                goto error_unlock;
+        }
+        if (subs->framing != TTYHUB_FRAMING_NONE && (subs->framing >
+                                TTYHUB_FRAMING_GAP || !subs->receive_frame)) {
+                err = -EINVAL;
+                goto error_unlock;
+        }
+        if (join && subs->framing == TTYHUB_FRAMING_NONE) {
+                /* do_receive() would parse the frames of all members with
+                   the one shared instance */
+                err = -EINVAL;
+                goto error_unlock;
+        }
+        if (subs->addr_size != 0 && (subs->addr_size < 0 ||
+                                subs->addr_size > 4 || subs->addr_offset < 0 ||
+                                !subs->receive_frame || join)) {
+                /* bus devices are tracked per tty - not in bonds */
+                err = -EINVAL;
+                goto error_unlock;
+        }
+        if (!try_module_get(subs->owner)) {
+                err = -EBUSY;
+                goto error_unlock;
+        }
+
+        if (subs->enable_in_progress) {
+                err = -EBUSY;
+                goto error_putmodule;
+        }
+        if (state->enabled_subsystems[index/8] & 1 << index%8) {
+                err = -EINVAL;
+                goto error_putmodule;
+        }
+        if (state->draining_subsystems[index/8] & 1 << index%8) {
+                /* still detaching from an asynchronous disable */
+                err = -EBUSY;
+                goto error_putmodule;
+        }
+        subs->enable_in_progress = 1;
+
+        /* prevent subsystem unregistering while enable is in progress */
+        subs->enabled_refcount++;
+
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+
+        /* subsystems receiving complete frames get their own frame pool */
+        if (subs->receive_frame) {
+                pool = ttyhub_frame_pool_create(subs->frame_max_size > 0 ?
+                                subs->frame_max_size : frame_size);
+                if (pool == NULL) {
+                        err = -ENOMEM;
+                        goto error_decr_refcount;
+                }
+        }
+
+        if (subs->addr_size) {
+                table = ttyhub_addr_table_create();
+                if (table == NULL) {
+                        err = -ENOMEM;
+                        goto error_put_pool;
+                }
+        }
+
+        /* invoking the subsystem's attach() operation must happen before
+           the bit in the enabled_subsystems array is set */
+        if (join) {
+                member = ttyhub_bond_join(subs, join,
+                                &state->subsys_data[index]);
+                if (IS_ERR(member))
+                        err = PTR_ERR(member);
+        }
+        else if (subs->attach)
+                err = subs->attach(&state->subsys_data[index], state->tty);
+        if (err < 0)
+                goto error_destroy_table;
+
+        /* bonds pass frames on from a work item already */
+        if (subs->worker && member == NULL) {
+                worker = ttyhub_worker_create(subs, state->subsys_data[index],
+                                state->tty->name);
+                if (IS_ERR(worker)) {
+                        err = PTR_ERR(worker);
+                        goto error_detach;
+                }
+        }
+
+        mutex_lock(&state->plan_lock);
+        plan = ttyhub_plan_build(state, index, 1);
+        if (IS_ERR(plan)) {
+                mutex_unlock(&state->plan_lock);
+                err = PTR_ERR(plan);
+                goto error_destroy_worker;
+        }
+
+        spin_lock_bh(&state->recv_lock);
+        state->counters[index].frames = 0;
+        state->counters[index].bytes = 0;
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        state->frame_pools[index] = pool;
+        state->bond_members[index] = member;
+        state->workers[index] = worker;
+        state->addr_tables[index] = table;
+        state->enabled_subsystems[index/8] |= 1 << index%8;
+        subs->enable_in_progress = 0;
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+        plan = ttyhub_plan_replace(state, plan);
+        ttyhub_event(state, TTYHUB_EVENT_SUBSYS_ENABLE, index, 0);
+        spin_unlock_bh(&state->recv_lock);
+        mutex_unlock(&state->plan_lock);
+
+        ttyhub_plan_put(plan);
+        return err;
+
+error_destroy_worker:
+        if (worker)
+                ttyhub_worker_destroy(worker);
+error_detach:
+        if (member)
+                ttyhub_bond_leave(member);
+        else if (subs->detach)
+                subs->detach(state->subsys_data[index]);
+error_destroy_table:
+        if (table)
+                ttyhub_addr_table_destroy(table, subs, NULL);
+error_put_pool:
+        if (pool)
+                ttyhub_frame_pool_put(pool);
+error_decr_refcount:
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        subs->enabled_refcount--;
+        subs->enable_in_progress = 0;
+error_putmodule:
+        module_put(ttyhub_subsystems[index]->owner);
+error_unlock:
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+        return err;
+}
+
+/*
+ * Abort the frame currently received. What has been assembled so far is
+ * dropped, the subsystem isn't told - callers decide that. recv_subsys is
+ * left unchanged.
+ * This is a helper function for ttyhub_line_error() and for disabling the
+ * receiving subsystem.
+ *
+ * The receive lock of the state is assumed to be held already.
+ */
+static void ttyhub_frame_abort(struct ttyhub_state *state)
+{
+        if (state->recv_frame)
+                ttyhub_frame_put(state->recv_frame);
+        state->recv_frame = NULL;
+        state->recv_frame_drop = 0;
+        state->recv_shed = 0;
+        state->recv_frame_remain = 0;
+        state->recv_qos = NULL;
+        ttyhub_unstuff_reset(&state->unstuff, TTYHUB_FRAMING_NONE);
+        if (state->recv_gap_ns) {
+                /* the timer finds recv_gap_ns cleared if it is already
+                   waiting for the receive lock */
+                hrtimer_try_to_cancel(&state->gap_timer);
+                state->recv_gap_ns = 0;
+        }
+        state->frames_aborted++;
+}
+
+/*
+ * Detach a subsystem that the receive path can't reach anymore - it is
+ * neither enabled nor receiving a frame. Frames queued for a worker are
+ * passed on before the subsystem's detach() operation is called.
+ * This is a helper function for ttyhub_subsystem_disable() and
+ * ttyhub_drain_work().
+ *
+ * Locks:
+ *      The subsystems lock (ttyhub_subsystems_lock) is held while taking the
+ *      frame pool, bond member and worker of the subsystem, the receive lock
+ *      of the state while taking the bus device table.
+ */
+static void ttyhub_subsystem_release(struct ttyhub_state *state, int index)
+{
+        unsigned long flags;
+        struct ttyhub_subsystem *subs = ttyhub_subsystems[index];
+        struct ttyhub_frame_pool *pool;
+        struct ttyhub_bond_member *member;
+        struct ttyhub_worker *worker;
+        struct ttyhub_addr_table *table;
+
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        pool = state->frame_pools[index];
+        state->frame_pools[index] = NULL;
+        member = state->bond_members[index];
+        state->bond_members[index] = NULL;
+        worker = state->workers[index];
+        state->workers[index] = NULL;
+        subs->enabled_refcount--;
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+
+        /* the worker passes all frames queued so far before it stops */
+        if (worker)
+                ttyhub_worker_destroy(worker);
+
+        /* the receive path looks up bus devices under the receive lock */
+        spin_lock_bh(&state->recv_lock);
+        table = state->addr_tables[index];
+        state->addr_tables[index] = NULL;
+        ttyhub_event(state, TTYHUB_EVENT_SUBSYS_DISABLE, index, 0);
+        spin_unlock_bh(&state->recv_lock);
+        if (table)
+                ttyhub_addr_table_destroy(table, subs,
+                                state->subsys_data[index]);
+
+        if (member)
+                ttyhub_bond_leave(member);
+        else if (subs->detach)
+                subs->detach(state->subsys_data[index]);
+
+        /* frames still held by the subsystem keep the pool alive */
+        if (pool)
+                ttyhub_frame_pool_put(pool);
+
+        module_put(subs->owner);
+}
+
+/*
+ * Disable a subsystem on a given tty and wait until it is detached. A frame
+ * the subsystem is receiving is cut off. A subsystem that is still draining
+ * after ttyhub_subsystem_disable_async() is detached right away.
+ * This is a helper function for ttyhub_state_destroy(), so no enable can run
+ * on the state concurrently and enable_in_progress needn't be checked: the
+ * tty layer doesn't call ioctl() and close() at once and subsystems must not
+ * enable subsystems on a child context they destroy.
+ *
+ * Locks:
+ *      The receive lock of the state and the subsystems lock
+ *      (ttyhub_subsystems_lock) are held while the subsystem is removed from
+ *      the enabled subsystems, but not while it is detached. The plan lock of
+ *      the state is held until the dispatch plan without the subsystem
+ *      replaces the old one.
+ *
+ * Returns zero if the subsystem was detached or -1 if it was not enabled.
+ */
+static int ttyhub_subsystem_disable(struct ttyhub_state *state, int index)
+{
+        unsigned long flags;
+        struct ttyhub_plan *plan;
+
+        if (index >= max_subsys || index < 0)
+                return -1;
+
+        /* spare building a plan for subsystems that were never enabled */
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        if (!((state->enabled_subsystems[index/8] |
+                                state->draining_subsystems[index/8]) &
+                                1 << index%8)) {
+                spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+                return -1;
+        }
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+
+        mutex_lock(&state->plan_lock);
+        plan = ttyhub_plan_build(state, index, 0);
+        if (IS_ERR(plan)) {
+                /* the tty is going away - it may as well stop probing */
+                plan = NULL;
+        }
+
+        spin_lock_bh(&state->recv_lock);
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        if (state->enabled_subsystems[index/8] & 1 << index%8) {
+                state->enabled_subsystems[index/8] &= ~(1 << index%8);
+        }
+        else if (state->draining_subsystems[index/8] & 1 << index%8) {
+                state->draining_subsystems[index/8] &= ~(1 << index%8);
+                state->draining--;
+        }
+        else
+                goto error_unlock;
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+
+        if (state->recv_subsys == index) {
+                ttyhub_frame_abort(state);
+                state->recv_subsys = -1;
+        }
+        plan = ttyhub_plan_replace(state, plan);
+        spin_unlock_bh(&state->recv_lock);
+        mutex_unlock(&state->plan_lock);
+
+        ttyhub_plan_put(plan);
+        ttyhub_subsystem_release(state, index);
+        return 0;
+
+error_unlock:
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+        spin_unlock_bh(&state->recv_lock);
+        mutex_unlock(&state->plan_lock);
+        ttyhub_plan_put(plan);
+        return -1;
+}
+
+/*
+ * Disable a subsystem on a given tty without waiting. The subsystem is
+ * neither probed nor matched by rules anymore, while all other subsystems
+ * keep receiving. If it is receiving a frame right now, the frame may
+ * complete within disable_grace_ms and is cut off afterwards. The subsystem
+ * is detached by ttyhub_drain_work() once the receive path can't reference
+ * it anymore - until then it can't be enabled again.
+ * This is a helper function for ttyhub_ldisc_ioctl().
+ *
+ * Locks:
+ *      The receive lock of the state and the subsystems lock
+ *      (ttyhub_subsystems_lock) are held while the subsystem is moved from
+ *      the enabled to the draining subsystems. The plan lock of the state is
+ *      held until the dispatch plan without the subsystem replaces the old
+ *      one.
+ *
+ * Returns zero on success, -EINVAL if the subsystem is not enabled or
+ * -ENOMEM.
+ */
+static int ttyhub_subsystem_disable_async(struct ttyhub_state *state,
+                        int index)
+{
+        unsigned long flags, delay = 0;
+        struct ttyhub_plan *plan;
+
+        if (index >= max_subsys || index < 0)
+                return -EINVAL;
+
+        mutex_lock(&state->plan_lock);
+        plan = ttyhub_plan_build(state, index, 0);
+        if (IS_ERR(plan)) {
+                mutex_unlock(&state->plan_lock);
+                return PTR_ERR(plan);
+        }
+
+        spin_lock_bh(&state->recv_lock);
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        if (!(state->enabled_subsystems[index/8] & 1 << index%8)) {
+                spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+                spin_unlock_bh(&state->recv_lock);
+                mutex_unlock(&state->plan_lock);
+                ttyhub_plan_put(plan);
+                return -EINVAL;
+        }
+        state->enabled_subsystems[index/8] &= ~(1 << index%8);
+        state->draining_subsystems[index/8] |= 1 << index%8;
+        state->draining++;
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+
+        if (state->recv_subsys == index) {
+                delay = msecs_to_jiffies(disable_grace_ms);
+                state->drain_upto = jiffies + delay;
+        }
+        plan = ttyhub_plan_replace(state, plan);
+        spin_unlock_bh(&state->recv_lock);
+        mutex_unlock(&state->plan_lock);
+
+        ttyhub_plan_put(plan);
+        mod_delayed_work(system_wq, &state->drain_work, delay);
+        return 0;
+}
+
+/*
+ * Work item detaching the draining subsystems of a tty. A subsystem whose
+ * last frame is still being received is detached after its frame completed
+ * (the receive path queues this work again, see ttyhub_drain_kick()) or
+ * after the frame has been cut off when the grace period is over.
+ *
+ * Locks:
+ *      The receive lock of the state and the subsystems lock
+ *      (ttyhub_subsystems_lock) are held while a subsystem is removed from
+ *      the draining subsystems, but not while it is detached. It is removed
+ *      only after it has been detached, so ttyhub_subsystem_enable() can't
+ *      attach it again meanwhile.
+ */
+static void ttyhub_drain_work(struct work_struct *work)
+{
+        struct ttyhub_state *state = container_of(to_delayed_work(work),
+                        struct ttyhub_state, drain_work);
+        unsigned long flags;
+        int i;
+
+        for (i=0; i < max_subsys; i++) {
+                spin_lock_bh(&state->recv_lock);
+                if (!(state->draining_subsystems[i/8] & 1 << i%8)) {
+                        spin_unlock_bh(&state->recv_lock);
+                        continue;
+                }
+                if (state->recv_subsys == i) {
+                        if (time_before(jiffies, state->drain_upto)) {
+                                /* frame in flight - wait for its end */
+                                mod_delayed_work(system_wq, &state->drain_work,
+                                                state->drain_upto - jiffies);
+                                spin_unlock_bh(&state->recv_lock);
+                                continue;
+                        }
+                        /* grace period is over - cut the frame off */
+                        ttyhub_frame_abort(state);
+                        state->recv_subsys = -1;
+                }
+                spin_unlock_bh(&state->recv_lock);
+
+                ttyhub_subsystem_release(state, i);
+
+                spin_lock_bh(&state->recv_lock);
+                spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+                state->draining_subsystems[i/8] &= ~(1 << i%8);
+                state->draining--;
+                spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+                spin_unlock_bh(&state->recv_lock);
+        }
+}
+
+/*
+ * Queue the work item detaching draining subsystems when none of them is
+ * receiving a frame anymore.
+ * This is a helper function for the receive path.
+ *
+ * The receive lock of the state is assumed to be held already.
+ */
+static inline void ttyhub_drain_kick(struct ttyhub_state *state)
+{
+        int i = state->recv_subsys;
+
+        if (likely(!state->draining))
+                return;
+        if (i < 0 || !(state->draining_subsystems[i/8] & 1 << i%8))
+                mod_delayed_work(system_wq, &state->drain_work, 0);
+}
+
+/*
+ * Arrival time of a byte of the received data - offset counts from the
+ * head of the data as returned by ttyhub_get_recvd_data_head(). Bytes kept
+ * in the probe buffer carry the time of the chunk they arrived with, all
+ * others arrived with the chunk being received.
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ */
+static inline ktime_t ttyhub_recvd_data_ts(struct ttyhub_state *state,
+                        int offset)
+{
+        int i = state->probe_buf_consumed + offset;
+
+        if (i < state->probe_buf_count)
+                return state->probe_buf_ts[i];
+        return state->recv_last;
+}
+
+/*
+ * Check if a frame matched by a rule can be passed to a subsystem - the
+ * subsystem must be enabled and receive complete frames.
+ *
+ * Locks:
+ *      The subsystems lock (ttyhub_subsystems_lock) is held while checking.
+ */
+static int ttyhub_rules_target_ok(struct ttyhub_state *state, int index)
+{
+        unsigned long flags;
+        struct ttyhub_subsystem *subs;
+        int ok = 0;
+
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        subs = ttyhub_subsystems[index];
+        if (subs && subs->receive_frame && state->frame_pools[index] &&
+                        state->enabled_subsystems[index/8] & 1 << index%8)
+                ok = 1;
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+
+        return ok;
+}
+
+/*
+ * Run the match rules loaded for a tty on a received data chunk.
+ * The recv_subsys field of the ttyhub_state structure and the fields
+ * describing the frame length are changed when a rule matches. The rules
+ * are only run once per frame - rules_probed is set when no rule matched.
+ * This is a helper function for ttyhub_probe_subsystems().
+ *
+ * Returns:
+ *  0   a rule has matched - state machine must continue in this call
+ *  1   more data is needed to evaluate the rules - wait for more data
+ *  -1  no rule matched - continue probing the subsystems
+ */
+static int ttyhub_probe_rules(struct ttyhub_state *state,
+                        const unsigned char *cp, int count)
+{
+        struct ttyhub_rules *rules;
+        int verdict = TTYHUB_RULES_NOMATCH, subsys = 0, len = 0;
+
+        rcu_read_lock();
+        rules = rcu_dereference(state->rules);
+        if (rules)
+                verdict = ttyhub_rules_run(rules, cp, count, &subsys, &len);
+        rcu_read_unlock();
+
+        switch (verdict) {
+        case TTYHUB_RULES_NEED_MORE:
+                return 1;
+        case TTYHUB_RULES_DISCARD:
+                state->recv_subsys = -3;
+                state->discard_bytes_remaining = len;
+                return 0;
+        case TTYHUB_RULES_ACCEPT:
+                if (!ttyhub_rules_target_ok(state, subsys))
+                        break;
+                state->counters[subsys].frames++;
+                state->recv_qos = state->qos[subsys];
+                if (state->recv_qos && ttyhub_qos_exhausted(state->recv_qos)) {
+                        /* over budget - the length is known, so the frame
+                           is skipped without assembling it */
+                        state->recv_qos->frames_shed++;
+                        state->recv_qos = NULL;
+                        state->recv_subsys = -3;
+                        state->discard_bytes_remaining = len;
+                        return 0;
+                }
+                if (state->recv_qos)
+                        ttyhub_qos_admit(state->recv_qos);
+                state->recv_subsys = subsys;
+                state->recv_frame_remain = len;
+                state->recv_ts_first = ttyhub_recvd_data_ts(state, 0);
+                return 0;
+        }
+
+        state->rules_probed = 1;
+        return -1;
+}
+
+/*
+ * Get the silence that ends a frame with TTYHUB_FRAMING_GAP. Without an
+ * explicit gap it lasts 3.5 characters of 11 bits at the current baud rate,
+ * but at least 1750us as required by Modbus RTU for more than 19200 baud.
+ */
+static u64 ttyhub_gap_ns(struct tty_struct *tty, int gap_us)
+{
+        unsigned int baud;
+
+        if (gap_us > 0)
+                return (u64)gap_us * NSEC_PER_USEC;
+
+        baud = tty ? tty_get_baud_rate(tty) : 0;
+        if (baud == 0 || baud > 19200)
+                return 1750 * NSEC_PER_USEC;
+        return div_u64(35ULL * 11 * NSEC_PER_SEC / 10, baud);
+}
+
+/*
+ * Check the receive budget of a subsystem that has identified a frame. When
+ * the budget is exhausted the frame is shed: frames of known size are
+ * skipped, other frames are delimited as usual but never assembled or passed
+ * to the subsystem. Frames only do_receive() can delimit are received
+ * anyway.
+ * This is a helper function for ttyhub_probe_subsystems().
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ *
+ * Returns 1 if the frame is skipped or 0 if it is received.
+ */
+static int ttyhub_frame_admit(struct ttyhub_state *state, int index,
+                        struct ttyhub_subsystem *subs,
+                        const unsigned char *cp, int count)
+{
+        struct ttyhub_qos *qos = state->qos[index];
+        int size;
+
+        state->recv_qos = NULL;
+        if (ttyhub_qos_exhausted(qos)) {
+                if (subs->probe_size) {
+                        size = ttyhub_call_probe_size(index, subs,
+                                        state->subsys_data[index], cp, count);
+                        if (size > 0) {
+                                qos->frames_shed++;
+                                state->recv_subsys = -3;
+                                state->discard_bytes_remaining = size;
+                                return 1;
+                        }
+                }
+                if (subs->receive_frame) {
+                        qos->frames_shed++;
+                        state->recv_frame_drop = 1;
+                        state->recv_shed = 1;
+                        return 0;
+                }
+        }
+
+        ttyhub_qos_admit(qos);
+        state->recv_qos = qos;
+        return 0;
+}
+
+/*
+ * Probe subsystems if they can identify a received data chunk.
+ * The recv_subsys field and the array pointed to by probed_subsystems
+ * of the ttyhub_state structure is changed according to the probe results,
+ * but the probe buffer is not filled in case more data is needed.
+ * This is a helper function for ttyhub_ldisc_receive_buf().
+ *
+ * Locks:
+ *      The receive lock of the state is assumed to be held already, so the
+ *      dispatch plan of the state and the subsystems in it can't change.
+ *
+ * Returns:
+ *  0   either a subsystem has identified the data or all subsystems have
+ *      already been probed - state machine must continue in this call
+ *  1   the received data has not been identified - wait for more data
+ */
+static int ttyhub_probe_subsystems(struct ttyhub_state *state,
+                        const unsigned char *cp, int count)
+{
+        struct ttyhub_plan *plan = rcu_dereference_protected(state->plan,
+                        lockdep_is_held(&state->recv_lock));
+        const struct ttyhub_plan_entry *e;
+        int i, j, k, status, subsys_remaining = 0;
+
+        /* match rules are evaluated before the subsystems are probed */
+        if (!state->rules_probed) {
+                status = ttyhub_probe_rules(state, cp, count);
+                if (status >= 0)
+                        return status;
+        }
+
+        for (k=0; plan && k < plan->nr; k++) {
+                e = &plan->entries[k];
+                i = e->index;
+                if (state->probed_subsystems[i/8] & 1 << i%8)
+                        continue;
+                if (e->probe_data_minimum_bytes > count) {
+                        /* waiting is pointless when the data needed can't
+                           fit into the probe buffer */
+                        if (e->probe_data_minimum_bytes <= probe_buf_size)
+                                subsys_remaining = 1;
+                        continue;
+                }
+                if (ttyhub_call_probe_data(i, e->subs, state->subsys_data[i],
+                                        cp, count)) {
+                        /* data identified by subsystem */
+                        state->counters[i].frames++;
+                        for (j=0; j < (max_subsys-1)/8 + 1; j++)
+                                state->probed_subsystems[j] = 0;
+                        state->rules_probed = 0;
+                        if (state->qos[i] && ttyhub_frame_admit(state, i,
+                                                e->subs, cp, count))
+                                return 0;
+                        state->recv_subsys = i;
+                        state->recv_ts_first = ttyhub_recvd_data_ts(state, 0);
+                        if (e->framing == TTYHUB_FRAMING_GAP)
+                                state->recv_gap_ns = ttyhub_gap_ns(state->tty,
+                                                e->framing_gap_us);
+                        else if (e->framing != TTYHUB_FRAMING_NONE)
+                                ttyhub_unstuff_reset(&state->unstuff,
+                                                e->framing);
+                        return 0;
+                }
+                state->probed_subsystems[i/8] |= 1 << i%8;
+        }
+
+        if (!subsys_remaining) {
+                state->recv_subsys = -2;
+                for (j=0; j < (max_subsys-1)/8 + 1; j++)
+                        state->probed_subsystems[j] = 0;
+                state->rules_probed = 0;
+        }
+
+        return subsys_remaining;
+}
+
+/*
+ * Probe subsystems if they can identify the size of a received data chunk.
+ * The recv_subsys and discard_bytes_remaining fields of the ttyhub_state 
+ * structure are changed according to the probe results, but the probe buffer
+ * is not filled in case more data is needed.
+ * This is a helper function for ttyhub_ldisc_receive_buf().
+ *
+ * Locks:
+ *      The receive lock of the state is assumed to be held already, so the
+ *      dispatch plan of the state and the subsystems in it can't change.
+ *
+ * Returns:
+ *  0   either a subsystem has identified the size or the probe buffer is
+ *      full - state machine must continue in this call
+ *  1   the received data has not been identified and there is still space
+ *      in the probe buffer left - wait for more data
+ */
+// TODO when timed drop packet mode is implemented change documentation
+//      (an additional field in the state is changed)
+static int ttyhub_probe_subsystems_size(struct ttyhub_state *state,
+                        const unsigned char *cp, int count)
+{
+        struct ttyhub_plan *plan = rcu_dereference_protected(state->plan,
+                        lockdep_is_held(&state->recv_lock));
+        int i, k, status, probe_buf_room;
+        struct ttyhub_subsystem *subs;
+
+        for (k=0; plan && k < plan->nr; k++) {
+                i = plan->entries[k].index;
+                subs = plan->entries[k].subs;
+                if (subs->probe_size)
+                        status = ttyhub_call_probe_size(i, subs,
+                                        state->subsys_data[i], cp, count);
+                else
+                        status = 0;
+                if (status > 0) {
+                        /* size recognized */
+                        state->recv_subsys = -3;
+                        state->discard_bytes_remaining = status;
+                        return 0;
+                }
+                else if (status < 0) {
+                        // TODO size not recognized but subsystem can identify
+                        //      end of data - implement! (set recv_subsys to i)
+                }
+        }
+
+        probe_buf_room = probe_buf_size - state->probe_buf_count +
+                state->probe_buf_consumed;
+        if ((state->probe_buf_count - state->probe_buf_consumed == 0 &&
+                        count >= probe_buf_size) || probe_buf_room == 0) {
+                /* no more space in the probe buffer to wait for more data (or
+                   probe buffer is unused but received data is larger than
+                   the probe buffer) --> timed discard mode */
+                state->recv_subsys = -4;
+                state->timed_discard_upto = jiffies +
+                        state->timed_discard_min_silence;
+                state->timed_discards++;
+                ttyhub_event(state, TTYHUB_EVENT_TIMED_DISCARD, -1, 0);
+                return 0;
+        }
+
+        /* wait for more data - there is still space in the probe buffer */
+        return 1;
+}
+
+/*
+ * Append data to probe buffer.
+ * Buffer is packed before appending when parts of the data
+ * have already been consumed.
+ * This is a helper function for ttyhub_ldisc_receive_buf().
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ *
+ * Returns the number of bytes that were copied to the probe buffer.
+ */
+static int ttyhub_probebuf_push(struct ttyhub_state *state,
+                        const unsigned char *cp, int count)
+{
+#ifdef DEBUG
+        int debug_packed = 0;
+#endif
+
+        int room, n, i;
+        if (state->probe_buf_consumed) {
+                /* probe buffer in use and partly consumed - pack */
+                int offset = state->probe_buf_consumed;
+                int max = state->probe_buf_count - offset;
+                for (i=0; i < max; i++) {
+                        state->probe_buf[i] = state->probe_buf[i + offset];
+                        state->probe_buf_ts[i] = state->probe_buf_ts[i +
+                                offset];
+                }
+                state->probe_buf_count -= offset;
+                state->probe_buf_consumed = 0;
+#ifdef DEBUG
+                if (max != 0)
+                        debug_packed = 1;
+#endif
+        }
+        room = probe_buf_size - state->probe_buf_count;
+        n = count > room ? room : count;
+        memcpy(state->probe_buf + state->probe_buf_count, cp, n);
+        for (i=state->probe_buf_count; i < state->probe_buf_count + n; i++)
+                state->probe_buf_ts[i] = state->recv_last;
+        state->probe_buf_count += n;
+        state->cp_consumed += n;
+
+#ifdef DEBUG
+        if (debug & TTYHUB_DEBUG_RECV_STATE_MACHINE) {
+                printk(KERN_INFO "ttyhub: receive_buf() pushed %d bytes to "
+                        "probe buffer%s (%d requested)\n", n, debug_packed ?
+                        " (after pack)" : "", count);
+                ttyhub_debug_dump_probe_buf(state);
+        }
+#endif
+
+        return n;
+}
+
+/*
+ * Get pointer to and length of received data.
+ * This gets either a pointer to the probe buffer read head (when it is at
+ * least partially filled) or a pointer to unread data in cp. The amount of
+ * consumed data is considered for both situations.
+ * This is a helper function for ttyhub_ldisc_receive_buf().
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ */
+static void ttyhub_get_recvd_data_head(struct ttyhub_state *state,
+                        const unsigned char *cp, int count,
+                        const unsigned char **out_cp, int *out_count)
+{
+        int probe_buf_fillstate = state->probe_buf_count -
+                state->probe_buf_consumed;
+        if (probe_buf_fillstate) {
+                /* probe buffer in use */
+                *out_cp = state->probe_buf + state->probe_buf_consumed;
+                *out_count = probe_buf_fillstate;
+        }
+        else {
+                /* probe buffer not in use */
+                *out_cp = cp + state->cp_consumed;
+                *out_count = count - state->cp_consumed;
+        }
+}
+
+/*
+ * Mark received data as consumed - advance pointers for the next read access.
+ * This is a helper function for ttyhub_ldisc_receive_buf().
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ */
+static void ttyhub_recvd_data_consumed(struct ttyhub_state *state, int count)
+{
+#ifdef DEBUG
+        int debug_probe_buf_in_use = 0;
+#endif
+
+        if (state->recv_subsys >= 0 && count)
+                state->recv_ts_last = ttyhub_recvd_data_ts(state, count - 1);
+
+        if (state->probe_buf_count - state->probe_buf_consumed) {
+                /* probe buffer in use */
+#ifdef DEBUG
+                debug_probe_buf_in_use = 1;
+#endif
+                state->probe_buf_consumed += count;
+        }
+        else {
+                /* probe buffer not in use */
+                state->cp_consumed += count;
+        }
+
+        if (state->recv_subsys >= 0) {
+                state->counters[state->recv_subsys].bytes += count;
+                if (state->recv_qos)
+                        ttyhub_qos_charge_bytes(state->recv_qos, count);
+        }
+
+#ifdef DEBUG
+        if (debug & TTYHUB_DEBUG_RECV_STATE_MACHINE) {
+                printk(KERN_INFO "ttyhub: receive_buf() consumed %d bytes from"
+                        " %s\n", count, debug_probe_buf_in_use ? "probe buffer"
+                        : "cp");
+                if (debug_probe_buf_in_use)
+                        ttyhub_debug_dump_probe_buf(state);
+        }
+#endif
+}
+
+/*
+ * Get the frame currently being assembled. The frame is allocated from the
+ * frame pool of the receiving subsystem when the first data arrives.
+ * This is a helper function for ttyhub_ldisc_receive_buf().
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ *
+ * Returns the frame or NULL if the frame is dropped.
+ */
+static struct ttyhub_frame *ttyhub_frame_current(struct ttyhub_state *state)
+{
+        if (state->recv_frame_drop)
+                return NULL;
+
+        if (state->recv_frame == NULL) {
+                state->recv_frame = ttyhub_frame_alloc(
+                                state->frame_pools[state->recv_subsys]);
+                if (state->recv_frame == NULL)
+                        state->recv_frame_drop = 1;
+        }
+        return state->recv_frame;
+}
+
+/*
+ * Drop the frame currently being assembled.
+ * This is a helper function for ttyhub_ldisc_receive_buf().
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ */
+static void ttyhub_frame_drop(struct ttyhub_state *state)
+{
+        if (state->recv_frame)
+                ttyhub_frame_put(state->recv_frame);
+        state->recv_frame = NULL;
+        state->recv_frame_drop = 1;
+}
+
+/*
+ * Append received data to the frame currently being assembled.
+ * When no frame can be allocated or the data does not fit into the frame the
+ * whole frame is dropped.
+ * This is a helper function for ttyhub_ldisc_receive_buf().
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ */
+static void ttyhub_frame_append(struct ttyhub_state *state,
+                        const unsigned char *cp, int count)
+{
+        struct ttyhub_frame *frame = ttyhub_frame_current(state);
+
+        if (frame == NULL)
+                return;
+
+        if (count > frame->size - frame->len) {
+                ttyhub_frame_drop(state);
+                return;
+        }
+
+        memcpy(frame->data + frame->len, cp, count);
+        frame->len += count;
+}
+
+/*
+ * Pass the assembled frame to the receiving subsystem.
+ * This is a helper function for ttyhub_ldisc_receive_buf().
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ */
+static void ttyhub_frame_complete(struct ttyhub_state *state,
+                        struct ttyhub_subsystem *subs)
+{
+        struct ttyhub_frame *frame = state->recv_frame;
+
+        state->recv_frame = NULL;
+        if (frame) {
+                frame->ts_first = state->recv_ts_first;
+                frame->ts_last = state->recv_ts_last;
+        }
+        if (state->recv_frame_drop && state->recv_shed) {
+                /* shed by the receive budget - counted there */
+                state->recv_frame_drop = 0;
+                state->recv_shed = 0;
+                return;
+        }
+        if (state->recv_frame_drop) {
+                state->recv_frame_drop = 0;
+                state->frames_dropped++;
+                ttyhub_event(state, TTYHUB_EVENT_OVERRUN, state->recv_subsys,
+                                state->frames_dropped);
+#ifdef DEBUG
+                if (debug & TTYHUB_DEBUG_RECV_STATE_MACHINE)
+                        printk(KERN_INFO "ttyhub: receive_buf() dropped "
+                                "frame for '%s' (%lu dropped so far)\n",
+                                subs->name, state->frames_dropped);
+#endif
+                return;
+        }
+
+        if (state->addr_tables[state->recv_subsys])
+                ttyhub_addr_resolve(state->addr_tables[state->recv_subsys],
+                                subs, frame);
+
+        if (state->bond_members[state->recv_subsys])
+                ttyhub_bond_ingest(state->bond_members[state->recv_subsys],
+                                frame);
+        else if (state->workers[state->recv_subsys]) {
+                if (ttyhub_worker_queue(state->workers[state->recv_subsys],
+                                        frame) < 0) {
+                        /* the worker can't keep up */
+                        ttyhub_frame_put(frame);
+                        state->frames_dropped++;
+                        ttyhub_event(state, TTYHUB_EVENT_OVERRUN,
+                                        state->recv_subsys,
+                                        state->frames_dropped);
+                }
+        }
+        else if (ttyhub_qos_cpu(state->recv_qos)) {
+                u64 start = ktime_get_ns();
+                subs->receive_frame(state->subsys_data[state->recv_subsys],
+                                frame);
+                ttyhub_qos_charge_cpu(state->recv_qos,
+                                ktime_get_ns() - start);
+        }
+        else
+                subs->receive_frame(state->subsys_data[state->recv_subsys],
+                                frame);
+}
+
+/*
+ * Decode received data of a subsystem that uses a framing of ttyhub into the
+ * frame currently being assembled. Frames that are aborted, truncated or too
+ * large are dropped, empty frames are silently ignored.
+ * This is a helper function for ttyhub_ldisc_receive_buf().
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ *
+ * Returns the number of bytes consumed from cp. *end is set to 1 once the
+ * frame has ended.
+ */
+static int ttyhub_frame_unstuff(struct ttyhub_state *state,
+                        const unsigned char *cp, int count, int *end)
+{
+        struct ttyhub_frame *frame = ttyhub_frame_current(state);
+        int n;
+
+        if (frame)
+                n = ttyhub_unstuff(&state->unstuff, cp, count, frame->data,
+                                &frame->len, frame->size, end);
+        else
+                n = ttyhub_unstuff(&state->unstuff, cp, count, NULL, NULL, 0,
+                                end);
+
+        if (state->unstuff.error && !state->recv_frame_drop)
+                ttyhub_frame_drop(state);
+        else if (*end && frame && frame->len == 0) {
+                ttyhub_frame_put(frame);
+                state->recv_frame = NULL;
+        }
+        return n;
+}
+
+/*
+ * Finish a frame with TTYHUB_FRAMING_GAP after the line has been silent.
+ * This is a helper function for ttyhub_ldisc_receive_buf() and
+ * ttyhub_gap_timer().
+ *
+ * The receive lock of the state is assumed to be held already.
+ */
+static void ttyhub_gap_frame_end(struct ttyhub_state *state)
+{
+        if (state->recv_frame || state->recv_frame_drop)
+                ttyhub_frame_complete(state,
+                                ttyhub_subsystems[state->recv_subsys]);
+        state->recv_gap_ns = 0;
+        state->recv_subsys = -1;
+}
+
+/*
+ * Timer ending frames with TTYHUB_FRAMING_GAP when no more data arrives.
+ * The timer is restarted for every chunk of received data, so it only
+ * expires after a silent gap. Data that arrived while the timer expired is
+ * detected by its timestamp.
+ */
+static enum hrtimer_restart ttyhub_gap_timer(struct hrtimer *timer)
+{
+        struct ttyhub_state *state = container_of(timer, struct ttyhub_state,
+                        gap_timer);
+
+        spin_lock(&state->recv_lock);
+        if (state->recv_gap_ns && ktime_to_ns(ktime_sub(ktime_get(),
+                                state->recv_last)) >= state->recv_gap_ns)
+                ttyhub_gap_frame_end(state);
+        ttyhub_drain_kick(state);
+        spin_unlock(&state->recv_lock);
+
+        return HRTIMER_NORESTART;
+}
+
+/*
+ * Replace the receive budget of a subsystem. The subsystem does not need to
+ * be enabled - the budget applies whenever it is. Critical subsystems are
+ * moved to the front of the probe order by a new dispatch plan.
+ * This is a helper function for ttyhub_ldisc_ioctl().
+ *
+ * Locks:
+ *      The receive lock of the state is held while the budget and the
+ *      dispatch plan are replaced, the plan lock of the state from replacing
+ *      the budget until the new plan is in place.
+ *
+ * Returns zero on success or a negative error code.
+ */
+static int ttyhub_qos_set(struct ttyhub_state *state,
+                        struct ttyhub_qos_config *config)
+{
+        struct ttyhub_qos *qos = NULL, *old;
+        struct ttyhub_plan *plan;
+
+        if (config->subsys < 0 || config->subsys >= max_subsys)
+                return -EINVAL;
+
+        if (config->flags || config->bytes_per_sec ||
+                        config->frames_per_sec || config->cpu_us_per_sec) {
+                qos = ttyhub_qos_create(config);
+                if (IS_ERR(qos))
+                        return PTR_ERR(qos);
+        }
+
+        mutex_lock(&state->plan_lock);
+        spin_lock_bh(&state->recv_lock);
+        old = state->qos[config->subsys];
+        state->qos[config->subsys] = qos;
+        if (old && state->recv_qos == old)
+                state->recv_qos = NULL;
+        ttyhub_single_update(state);
+        spin_unlock_bh(&state->recv_lock);
+
+        plan = ttyhub_plan_build(state, -1, 0);
+        if (IS_ERR(plan)) {
+                /* put the old budget back */
+                spin_lock_bh(&state->recv_lock);
+                state->qos[config->subsys] = old;
+                if (qos && state->recv_qos == qos)
+                        state->recv_qos = NULL;
+                ttyhub_single_update(state);
+                spin_unlock_bh(&state->recv_lock);
+                mutex_unlock(&state->plan_lock);
+                kfree(qos);
+                return PTR_ERR(plan);
+        }
+
+        spin_lock_bh(&state->recv_lock);
+        plan = ttyhub_plan_replace(state, plan);
+        spin_unlock_bh(&state->recv_lock);
+        mutex_unlock(&state->plan_lock);
+
+        ttyhub_plan_put(plan);
+        kfree(old);
+        return 0;
+}
+
+/*
+ * Replace the echo cancellation of a tty. The echo still expected by the
+ * old configuration is given up.
+ * This is a helper function for ttyhub_ldisc_ioctl().
+ *
+ * Locks:
+ *      The receive lock and the echo lock of the state are held while
+ *      replacing the echo buffer.
+ *
+ * Returns zero on success or a negative error code.
+ */
+static int ttyhub_echo_set(struct ttyhub_state *state,
+                        struct ttyhub_echo_config *config)
+{
+        struct ttyhub_echo *echo = NULL, *old;
+        unsigned long flags;
+
+        if (config->size) {
+                echo = ttyhub_echo_create(config);
+                if (IS_ERR(echo))
+                        return PTR_ERR(echo);
+        }
+
+        spin_lock_bh(&state->recv_lock);
+        spin_lock_irqsave(&state->echo_lock, flags);
+        old = state->echo;
+        state->echo = echo;
+        spin_unlock_irqrestore(&state->echo_lock, flags);
+        spin_unlock_bh(&state->recv_lock);
+
+        kfree(old);
+        return 0;
+}
+
+/*
+ * Get the statistics of the receive budget of a subsystem.
+ * This is a helper function for ttyhub_ldisc_ioctl().
+ *
+ * Locks:
+ *      The receive lock of the state is held while reading the statistics.
+ *
+ * Returns zero on success or -EINVAL if the subsystem has no budget.
+ */
+static int ttyhub_qos_stats(struct ttyhub_state *state,
+                        struct ttyhub_qos_stats *stats)
+{
+        int err = -EINVAL;
+
+        if (stats->subsys < 0 || stats->subsys >= max_subsys)
+                return -EINVAL;
+
+        spin_lock_bh(&state->recv_lock);
+        if (state->qos[stats->subsys]) {
+                ttyhub_qos_get_stats(state->qos[stats->subsys], stats);
+                err = 0;
+        }
+        spin_unlock_bh(&state->recv_lock);
+
+        return err;
+}
+
+/*
+ * Get the statistics of a bus device of a subsystem using addresses.
+ * This is a helper function for ttyhub_ldisc_ioctl().
+ *
+ * Locks:
+ *      The receive lock of the state is held while reading the statistics.
+ *
+ * Returns zero on success or a negative error code.
+ */
+static int ttyhub_addr_stats(struct ttyhub_state *state,
+                        struct ttyhub_addr_stats *stats)
+{
+        int err = -EINVAL;
+
+        if (stats->subsys < 0 || stats->subsys >= max_subsys)
+                return -EINVAL;
+
+        spin_lock_bh(&state->recv_lock);
+        if (state->addr_tables[stats->subsys])
+                err = ttyhub_addr_get_stats(state->addr_tables[stats->subsys],
+                                stats);
+        spin_unlock_bh(&state->recv_lock);
+
+        return err;
+}
+
+/*
+ * Load a new set of match rules for a tty.
+ * This is a helper function for ttyhub_ldisc_ioctl().
+ *
+ * Locks:
+ *      The subsystems lock (ttyhub_subsystems_lock) is held while replacing
+ *      the rules. The old rules are freed after an RCU grace period, so
+ *      the receive path never sees freed rules.
+ *
+ * Returns zero on success or a negative error code.
+ */
+static int ttyhub_rules_load(struct ttyhub_state *state,
+                        const struct ttyhub_rules_load *load)
+{
+        unsigned long flags;
+        struct ttyhub_rule *rules;
+        struct ttyhub_rules *prog = NULL, *old;
+
+        if (load->reserved || load->count > TTYHUB_RULES_MAX)
+                return -EINVAL;
+
+        if (load->count) {
+                rules = kmalloc(sizeof(*rules) * load->count, GFP_KERNEL);
+                if (rules == NULL)
+                        return -ENOMEM;
+                if (copy_from_user(rules,
+                                (void __user *)(unsigned long)load->rules,
+                                sizeof(*rules) * load->count)) {
+                        kfree(rules);
+                        return -EFAULT;
+                }
+                prog = ttyhub_rules_compile(rules, load->count,
+                                probe_buf_size, max_subsys);
+                kfree(rules);
+                if (IS_ERR(prog))
+                        return PTR_ERR(prog);
+        }
+
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        old = rcu_dereference_protected(state->rules,
+                        lockdep_is_held(&ttyhub_subsystems_lock));
+        rcu_assign_pointer(state->rules, prog);
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+
+        spin_lock_bh(&state->recv_lock);
+        ttyhub_single_update(state);
+        spin_unlock_bh(&state->recv_lock);
+
+        if (old) {
+                synchronize_rcu();
+                ttyhub_rules_free(old);
+        }
+
+        return 0;
+}
+
+/*
+ * Allocate and initialize the receive state of a tty or of a child context.
+ * This is a helper function for ttyhub_ldisc_open() and
+ * ttyhub_child_create().
+ *
+ * Returns the new state or NULL if memory is short.
+ */
+static struct ttyhub_state *ttyhub_state_create(struct tty_struct *tty)
+{
+        struct ttyhub_state *state;
+
+        state = kmalloc(sizeof(*state), GFP_KERNEL);
+        if (state == NULL)
+                return NULL;
+
+        state->tty = tty;
+        spin_lock_init(&state->recv_lock);
+
+        /* allocate space for one pointer for every possible subsystem */
+        state->subsys_data = kzalloc(sizeof(void *) * max_subsys, GFP_KERNEL);
+        if (state->subsys_data == NULL)
+                goto error_cleanup_state;
+
+        state->timed_discard_min_silence = 5*HZ; // TODO choose a reasonable default time!
+        state->recv_subsys = -1;
+        state->single = -1;
+        state->discard_bytes_remaining = 0;
+        state->timed_discard_upto = 0;
+        state->timed_discard_count = 0;
+
+        /* allocate probe buffer */
+        state->probe_buf = kmalloc(probe_buf_size, GFP_KERNEL);
+        if (state->probe_buf == NULL)
+                goto error_cleanup_subsys_data;
+        state->probe_buf_consumed = 0;
+        state->probe_buf_count = 0;
+        state->probe_buf_ts = kmalloc(sizeof(*state->probe_buf_ts) *
+                        probe_buf_size, GFP_KERNEL);
+        if (state->probe_buf_ts == NULL)
+                goto error_cleanup_probebuf;
+
+        /* allocate space for one frame pool pointer for every possible
+           subsystem */
+        state->frame_pools = kzalloc(sizeof(*state->frame_pools) * max_subsys,
+                        GFP_KERNEL);
+        if (state->frame_pools == NULL)
+                goto error_cleanup_probebuf_ts;
+
+        /* allocate space for one bond member pointer for every possible
+           subsystem */
+        state->bond_members = kzalloc(sizeof(*state->bond_members) *
+                        max_subsys, GFP_KERNEL);
+        if (state->bond_members == NULL)
+                goto error_cleanup_frame_pools;
+
+        /* allocate space for one worker pointer for every possible
+           subsystem */
+        state->workers = kzalloc(sizeof(*state->workers) * max_subsys,
+                        GFP_KERNEL);
+        if (state->workers == NULL)
+                goto error_cleanup_bond_members;
+
+        /* allocate space for one bus device table pointer for every possible
+           subsystem */
+        state->addr_tables = kzalloc(sizeof(*state->addr_tables) * max_subsys,
+                        GFP_KERNEL);
+        if (state->addr_tables == NULL)
+                goto error_cleanup_workers;
+
+        /* allocate space for one receive budget pointer for every possible
+           subsystem */
+        state->qos = kzalloc(sizeof(*state->qos) * max_subsys, GFP_KERNEL);
+        if (state->qos == NULL)
+                goto error_cleanup_addr_tables;
+        RCU_INIT_POINTER(state->plan, NULL);
+        mutex_init(&state->plan_lock);
+
+        /* allocate counters for every possible subsystem */
+        state->counters = kzalloc(sizeof(*state->counters) * max_subsys,
+                        GFP_KERNEL);
+        if (state->counters == NULL)
+                goto error_cleanup_qos;
+        INIT_LIST_HEAD(&state->node);
+        state->bytes_received = 0;
+        state->bytes_discarded = 0;
+        state->timed_discards = 0;
+        state->errors_break = 0;
+        state->errors_frame = 0;
+        state->errors_parity = 0;
+        state->errors_overrun = 0;
+        state->frames_aborted = 0;
+        ratelimit_state_init(&state->event_rs,
+                        msecs_to_jiffies(event_interval_ms), event_burst);
+        /* the suppressed events are counted in the next event - nothing is
+           logged from the receive path */
+        ratelimit_set_flags(&state->event_rs, RATELIMIT_MSG_ON_RELEASE);
+        state->events_suppressed = 0;
+        state->recv_qos = NULL;
+        state->recv_shed = 0;
+        state->recv_frame = NULL;
+        state->recv_frame_drop = 0;
+        state->recv_frame_remain = 0;
+        ttyhub_unstuff_reset(&state->unstuff, TTYHUB_FRAMING_NONE);
+        state->recv_gap_ns = 0;
+        state->recv_last = 0;
+        state->recv_ts_first = 0;
+        state->recv_ts_last = 0;
+        hrtimer_setup(&state->gap_timer, ttyhub_gap_timer, CLOCK_MONOTONIC,
+                        HRTIMER_MODE_REL_SOFT);
+        state->frames_dropped = 0;
+        RCU_INIT_POINTER(state->rules, NULL);
+        state->rules_probed = 0;
+        spin_lock_init(&state->echo_lock);
+        state->echo = NULL;
+
+        /* allocate 3x char array with 1 bit per subsystem each */
+        state->probed_subsystems = kzalloc(3*((max_subsys-1)/8+1), GFP_KERNEL);
+        if (state->probed_subsystems == NULL)
+                goto error_cleanup_counters;
+        state->enabled_subsystems = state->probed_subsystems +
+                (max_subsys-1)/8 + 1;
+        state->draining_subsystems = state->enabled_subsystems +
+                (max_subsys-1)/8 + 1;
+        state->draining = 0;
+        state->drain_upto = 0;
+        INIT_DELAYED_WORK(&state->drain_work, ttyhub_drain_work);
+
+        return state;
+
+error_cleanup_counters:
+        kfree(state->counters);
+error_cleanup_qos:
+        kfree(state->qos);
+error_cleanup_addr_tables:
+        kfree(state->addr_tables);
+error_cleanup_workers:
+        kfree(state->workers);
+error_cleanup_bond_members:
+        kfree(state->bond_members);
+error_cleanup_frame_pools:
+        kfree(state->frame_pools);
+error_cleanup_probebuf_ts:
+        kfree(state->probe_buf_ts);
+error_cleanup_probebuf:
+        kfree(state->probe_buf);
+error_cleanup_subsys_data:
+        kfree(state->subsys_data);
+error_cleanup_state:
+        kfree(state);
+        return NULL;
+}
+
+/*
+ * Disable all subsystems of a receive state and free it.
+ * This is a helper function for ttyhub_ldisc_close() and
+ * ttyhub_child_destroy().
+ */
+static void ttyhub_state_destroy(struct ttyhub_state *state)
+{
+        int i;
+
+        /* no new data arrives anymore */
+        hrtimer_cancel(&state->gap_timer);
+        cancel_delayed_work_sync(&state->drain_work);
+
+        /* disable all subsystems that are enabled or still draining on this
+           tty */
+        for (i=0; i < max_subsys; i++)
+                ttyhub_subsystem_disable(state, i);
+
+        /* drop a partially assembled frame */
+        if (state->recv_frame)
+                ttyhub_frame_put(state->recv_frame);
+
+        /* the receive path can't run anymore - no grace period needed */
+        if (rcu_access_pointer(state->rules))
+                ttyhub_rules_free(rcu_dereference_protected(state->rules, 1));
+
+        for (i=0; i < max_subsys; i++)
+                kfree(state->qos[i]);
+
+        kfree(state->echo);
+        kfree(state->probed_subsystems);
+        kfree(state->counters);
+        kfree(state->qos);
+        kfree(state->addr_tables);
+        kfree(state->workers);
+        kfree(state->bond_members);
+        kfree(state->frame_pools);
+        kfree(state->probe_buf_ts);
+        kfree(state->probe_buf);
+        kfree(state->subsys_data);
+        kfree(state);
+}
+
+/*
+ * Copy the counters and the receive state of a tty for a netlink dump.
+ *
+ * Locks:
+ *      The list of ttys is locked while searching the tty, its receive lock
+ *      and the subsystems lock while copying.
+ *
+ * Returns the snapshot of the tty at position pos in the list of ttys using
+ * ttyhub or NULL if there is no such tty or memory is short. The caller
+ * frees the snapshot.
+ */
+struct ttyhub_snapshot *ttyhub_snapshot(int pos)
+{
+        struct ttyhub_snapshot *snap;
+        struct ttyhub_state *state;
+        struct ttyhub_snapshot_subsys *s;
+        unsigned long flags;
+        int i;
+
+        snap = kzalloc(sizeof(*snap) + sizeof(snap->subsys[0]) * max_subsys,
+                        GFP_KERNEL);
+        if (snap == NULL)
+                return NULL;
+
+        mutex_lock(&ttyhub_states_lock);
+        list_for_each_entry(state, &ttyhub_states, node) {
+                if (pos-- == 0)
+                        goto found;
+        }
+        mutex_unlock(&ttyhub_states_lock);
+        kfree(snap);
+        return NULL;
+
+found:
+        spin_lock_bh(&state->recv_lock);
+        strscpy(snap->tty, tty_name(state->tty), sizeof(snap->tty));
+        snap->recv_state = state->recv_subsys;
+        snap->bytes_received = state->bytes_received;
+        snap->bytes_discarded = state->bytes_discarded;
+        snap->timed_discards = state->timed_discards;
+        snap->frames_dropped = state->frames_dropped;
+        snap->errors_break = state->errors_break;
+        snap->errors_frame = state->errors_frame;
+        snap->errors_parity = state->errors_parity;
+        snap->errors_overrun = state->errors_overrun;
+        snap->frames_aborted = state->frames_aborted;
+        if (state->echo) {
+                snap->echo_bytes = state->echo->bytes;
+                snap->echo_lost = state->echo->lost;
+        }
+
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        for (i=0; i < max_subsys; i++) {
+                if (ttyhub_subsystems[i] == NULL ||
+                                !(state->enabled_subsystems[i/8] & 1 << i%8))
+                        continue;
+                s = &snap->subsys[snap->nr_subsys++];
+                s->index = i;
+                strscpy(s->name, ttyhub_subsystems[i]->name, sizeof(s->name));
+                s->frames = state->counters[i].frames;
+                s->bytes = state->counters[i].bytes;
+                if (state->qos[i])
+                        s->frames_shed = state->qos[i]->frames_shed;
+        }
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+        spin_unlock_bh(&state->recv_lock);
+        mutex_unlock(&ttyhub_states_lock);
+
+        return snap;
+}
+
+/* Line discipline open() operation */
+static int ttyhub_ldisc_open(struct tty_struct *tty)
+{
+        struct ttyhub_state *state;
+        int err = 0;
+
+#ifdef DEBUG
+        if (debug & TTYHUB_DEBUG_LDISC_OPS_USER)
+                printk(KERN_INFO "ttyhub: ldisc open(tty=%s) enter\n",
+                                tty->name);
+#endif
+
+        state = ttyhub_state_create(tty);
+        if (state == NULL)
+                err = -ENOBUFS;
+        else {
+                tty->disc_data = state;
+                mutex_lock(&ttyhub_states_lock);
+                list_add_tail(&state->node, &ttyhub_states);
+                mutex_unlock(&ttyhub_states_lock);
+        }
+
+#ifdef DEBUG
+        if (debug & TTYHUB_DEBUG_LDISC_OPS_USER)
+                printk(KERN_INFO "ttyhub: ldisc open() exit = %d\n", err);
+#endif
+
+        return err;
+}
+
+/* Line discipline close() operation */
+static void ttyhub_ldisc_close(struct tty_struct *tty)
+{
+        struct ttyhub_state *state = tty->disc_data;
+
+#ifdef DEBUG
+        if (debug & TTYHUB_DEBUG_LDISC_OPS_USER)
+                printk(KERN_INFO "ttyhub: ldisc close(tty=%s) enter\n",
+                                tty->name);
+#endif
+
+        if (state != NULL) {
+                mutex_lock(&ttyhub_states_lock);
+                list_del(&state->node);
+                mutex_unlock(&ttyhub_states_lock);
+                ttyhub_state_destroy(state);
+        }
+
+#ifdef DEBUG
+        if (debug & TTYHUB_DEBUG_LDISC_OPS_USER)
+                printk(KERN_INFO "ttyhub: ldisc close() exit\n");
+#endif
+}
+
+/* Line discipline ioctl() operation */
+/* defined with the receive path below */
+static int ttyhub_inject(struct ttyhub_state *state,
+                        struct ttyhub_inject *inj);
+
+static int ttyhub_ldisc_ioctl(struct tty_struct *tty, unsigned int cmd,
+                        unsigned long arg)
+{
+        int err = 0;
+        struct ttyhub_state *state = tty->disc_data;
+        unsigned int direction = _IOC_DIR(cmd);
+        unsigned int type = _IOC_TYPE(cmd);
+        unsigned int size = _IOC_SIZE(cmd);
+        unsigned char arg_buf[64];
+
+#ifdef DEBUG
+        if (debug & TTYHUB_DEBUG_LDISC_OPS_USER) {
+                unsigned int nr = _IOC_NR(cmd);
+                char *debug_dir = (direction==_IOC_NONE) ? "none" :
+                                (direction==_IOC_READ) ? "read" :
+                                (direction==_IOC_WRITE) ? "write" : "r+w";
+                printk(KERN_INFO "ttyhub: ldisc ioctl(tty=%s, "
+                                "cmd=%s/0x%02x/%u/%ubytes, arg=0x%lx) enter\n",
+                                tty->name, debug_dir, type, nr, size, arg);
+        }
+#endif
+
+        if (type != TTYHUB_IOCTL_TYPE_ID || size > sizeof(arg_buf)) {
+                /* ioctl commands with incorrect type as well as commands that
+                   have a larger payload than fits in the buffer are ignored */
+                err = -ENOTTY;
+                goto copy_and_exit;
+        }
+
+        if (direction & _IOC_READ) {
+                /* read or read+write */
+                if (!access_ok((void __user *)arg, size)) {
+                        err = -EFAULT;
+                        goto copy_and_exit;
+                }
+        }
+        else if (direction & _IOC_WRITE) {
+                /* write only */
+                if (!access_ok((void __user *)arg, size)) {
+                        err = -EFAULT;
+                        goto copy_and_exit;
+                }
+        }
+
+        if (direction & _IOC_WRITE) {
+                /* write or read+write */
+                if (copy_from_user(arg_buf, (void __user *)arg, size)) {
+                        err = -EFAULT;
+                        goto copy_and_exit;
+                }
+#ifdef DEBUG
+                if (debug & TTYHUB_DEBUG_LDISC_OPS_USER)
+                        print_hex_dump(KERN_INFO, "ttyhub: ldisc ioctl() arg "
+                                        "from user: ", DUMP_PREFIX_OFFSET, 16,
+                                        1, arg_buf, size, true);
+#endif
+        }
+
+        switch (cmd) {
+        case TTYHUB_SUBSYS_ENABLE:
+                /* enable subsystem */
+                err = ttyhub_subsystem_enable(state, *((int *)arg_buf),
+                                NULL);
+                goto copy_and_exit;
+        case TTYHUB_SUBSYS_DISABLE:
+                /* disable subsystem - detached in the background */
+                err = ttyhub_subsystem_disable_async(state,
+                                *((int *)arg_buf));
+                goto copy_and_exit;
+        case TTYHUB_BOND_JOIN:
+                /* enable subsystem as member of a bond */
+                {
+                        struct ttyhub_bond_join join;
+                        memcpy(&join, arg_buf, sizeof(join));
+                        err = ttyhub_subsystem_enable(state, join.subsys,
+                                        &join);
+                }
+                goto copy_and_exit;
+        case TTYHUB_ADDR_STATS:
+                /* statistics of a bus device */
+                {
+                        struct ttyhub_addr_stats stats;
+                        memcpy(&stats, arg_buf, sizeof(stats));
+                        err = ttyhub_addr_stats(state, &stats);
+                        memcpy(arg_buf, &stats, sizeof(stats));
+                }
+                goto copy_and_exit;
+        case TTYHUB_QOS_SET:
+                /* replace the receive budget of a subsystem */
+                {
+                        struct ttyhub_qos_config config;
+                        memcpy(&config, arg_buf, sizeof(config));
+                        err = ttyhub_qos_set(state, &config);
+                }
+                goto copy_and_exit;
+        case TTYHUB_QOS_STATS:
+                /* statistics of a receive budget */
+                {
+                        struct ttyhub_qos_stats stats;
+                        memcpy(&stats, arg_buf, sizeof(stats));
+                        err = ttyhub_qos_stats(state, &stats);
+                        memcpy(arg_buf, &stats, sizeof(stats));
+                }
+                goto copy_and_exit;
+        case TTYHUB_ECHO_SET:
+                /* configure echo cancellation */
+                {
+                        struct ttyhub_echo_config config;
+                        memcpy(&config, arg_buf, sizeof(config));
+                        err = ttyhub_echo_set(state, &config);
+                }
+                goto copy_and_exit;
+        case TTYHUB_INJECT:
+                /* receive data from user space */
+                {
+                        struct ttyhub_inject inj;
+                        memcpy(&inj, arg_buf, sizeof(inj));
+                        err = ttyhub_inject(state, &inj);
+                        memcpy(arg_buf, &inj, sizeof(inj));
+                }
+                goto copy_and_exit;
+        case TTYHUB_RULES_LOAD:
+                /* replace match rules */
+                {
+                        struct ttyhub_rules_load load;
+                        memcpy(&load, arg_buf, sizeof(load));
+                        err = ttyhub_rules_load(state, &load);
+                }
+                goto copy_and_exit;
+        default:
+                err = -ENOTTY;
+                goto copy_and_exit;
+        }
+
+copy_and_exit:
+        if (err >= 0 && direction & _IOC_READ) {
+                /* read or read+write */
+#ifdef DEBUG
+                if (debug & TTYHUB_DEBUG_LDISC_OPS_USER)
+                        print_hex_dump(KERN_INFO, "ttyhub: ldisc ioctl() arg "
+                                        "to user:   ", DUMP_PREFIX_OFFSET, 16,
+                                        1, arg_buf, size, true);
+#endif
+                if (copy_to_user((void __user *)arg, arg_buf, size)) {
+                        err = -EFAULT;
+                }
+        }
+
+#ifdef DEBUG
+        if (debug & TTYHUB_DEBUG_LDISC_OPS_USER)
+                printk(KERN_INFO "ttyhub: ldisc ioctl() exit = %d\n", err);
+#endif
+        return err;
+}
+
+/*
+ * Run the receive state machine of a tty or of a child context (see
+ * ttyhub_child_create()) on newly received data that arrived at time now.
+ * This is a helper function for ttyhub_ldisc_receive_buf() and
+ * ttyhub_child_receive().
+ *
+ * Locks:
+ *      The receive lock of the state is assumed to be held already.
+ *      Functions called here may lock the subsystems lock.
+ *
+ * Returns the number of bytes accepted from cp.
+ */
+static int ttyhub_receive(struct ttyhub_state *state,
+                        const unsigned char *cp, int count, ktime_t now)
+{
+        const unsigned char *r_cp;
+        int r_count, wait = 0;
+
+        /* Receive state machine:
+         * The relevant fields in the ttyhub_state struct are:
+         *   1) recv_subsys
+         *        values from 0 to (max_subsys-1):
+         *              addressed subsystem is known, proceed with receiving
+         *              data immediately
+         *        value -1:
+         *              addressed subsystem is unknown and has to be probed
+         *        value -2:
+         *              addressed subsystem is unknown and all registered
+         *              subsystems have already been probed - probe for size
+         *        value -3:
+         *              addressed subsystem is unknown, size of packet has
+         *              been recognized
+         *   2) probed_subsystems
+         *        This is a pointer to an unsigned char array containing one
+         *        bit for every possible subsystem. When the recv_subsys is
+         *        -1 a set bit indicates that the subsystem has already been
+         *        probed and should not be probed again.
+         *   3) discard_bytes_remaining
+         *        When recv_subsys is -3 this stores the number of bytes to
+         *        be discarded. Decremented after data has been received.
+         *   4) timed_discard_upto
+         *        // TODO describe timed_discard_upto, timed_discard_count, timed_discard_min_silence
+         *   TODO describe probe_buf management related fields
+         *   5) recv_frame
+         *        When the receiving subsystem has a receive_frame()
+         *        operation all data consumed by its do_receive() operation
+         *        is collected in this frame. It is passed to the subsystem
+         *        when do_receive() signals the end of the frame.
+         *   6) recv_frame_remain
+         *        When a match rule has identified the frame this stores the
+         *        number of bytes of the frame not yet received. The frame
+         *        is assembled by ttyhub without invoking do_receive().
+         *   7) rules_probed
+         *        Set when the match rules have not matched the frame at the
+         *        head of the received data, so they aren't evaluated again
+         *        while the subsystems are probed.
+         *   8) unstuff
+         *        When the receiving subsystem uses a framing of ttyhub this
+         *        holds the state of the decoder. The frame is assembled by
+         *        ttyhub without invoking do_receive() and ends with the next
+         *        delimiter, which is left for probing the next frame.
+         *   9) recv_gap_ns
+         *        When the receiving subsystem uses TTYHUB_FRAMING_GAP this
+         *        stores the silence ending the frame. All received data is
+         *        added to the frame until no data arrived for that long -
+         *        checked with the timestamp of every chunk of data and by a
+         *        timer when no more data arrives.
+         * Data from cp is either consumed by a subsystem or goes to the
+         * probe buffer. What doesn't fit into the probe buffer is not
+         * accepted and stays in the flip buffer of the tty.
+         * The state machine continues until either...
+         *   ...more data is needed for probing
+         *      --> received data is kept in the probe buffer between calls
+         *    OR
+         *   ...the probe buffer and cp are completely consumed
+         */
+
+        /* a frame delimited by silence has ended if the timer didn't
+           notice yet */
+        if (state->recv_gap_ns && ktime_to_ns(ktime_sub(now,
+                                state->recv_last)) >= state->recv_gap_ns)
+                ttyhub_gap_frame_end(state);
+        state->recv_last = now;
+
+        /* when cp is read partially, this is used as an offset */
+        state->cp_consumed = 0;
+
+#ifdef DEBUG
+        if (debug & TTYHUB_DEBUG_RECV_STATE_MACHINE)
+                printk(KERN_INFO "ttyhub: receive_buf() initial recv_subsys "
+                                "= %d (%s)\n", state->recv_subsys,
+                                ttyhub_debug_state_to_string(state));
+#endif
+
+        while (1) {
+#ifdef DEBUG
+                int debug_old_recv_subsys = state->recv_subsys;
+#endif
+
+                if (state->probe_buf_count - state->probe_buf_consumed == 0 &&
+                                count - state->cp_consumed == 0) {
+                        /* all data consumed */
+#ifdef DEBUG
+                        if (debug & TTYHUB_DEBUG_RECV_STATE_MACHINE)
+                                printk(KERN_INFO "ttyhub: receive_buf() "
+                                                "exit (all data consumed)\n");
+#endif
+                        return count;
+                }
+
+                /* if there is data remaining in the probe buffer as well as in
+                   cp fill up the buffer (this is relevant after data has been
+                   consumed and before probing) */
+                if (state->probe_buf_count - state->probe_buf_consumed != 0 &&
+                                count - state->cp_consumed != 0)
+                        ttyhub_probebuf_push(state, cp +
+                                state->cp_consumed, count -
+                                state->cp_consumed);
+
+                ttyhub_get_recvd_data_head(state, cp, count, &r_cp, &r_count);
+                if (state->recv_subsys == -1) {
+                        wait = ttyhub_probe_subsystems(state, r_cp, r_count);
+                }
+                else if (state->recv_subsys == -2) {
+                        wait = ttyhub_probe_subsystems_size(state, r_cp,
+                                        r_count);
+                }
+                else if (state->recv_subsys == -3) {
+                        int n;
+                        n = r_count > state->discard_bytes_remaining ?
+                                state->discard_bytes_remaining : r_count;
+                        ttyhub_recvd_data_consumed(state, n);
+                        state->discard_bytes_remaining -= n;
+                        state->bytes_discarded += n;
+#ifdef DEBUG
+                        if (debug & TTYHUB_DEBUG_RECV_STATE_MACHINE)
+                                printk(KERN_INFO "ttyhub: receive_buf() "
+                                        "discard_bytes_remaining = %d",
+                                        state->discard_bytes_remaining);
+#endif
+                        if (state->discard_bytes_remaining == 0)
+                                state->recv_subsys = -1;
+                }
+                else if (state->recv_subsys == -4) {
+                        if (time_after(jiffies, state->timed_discard_upto)) {
+                                printk(KERN_WARNING "ttyhub: discarded %lu " // TODO make this warning configurable and rewrite 'based on time'
+                                        "unrecognized bytes based on time\n",
+                                        state->timed_discard_count);
+                                ttyhub_event(state, TTYHUB_EVENT_RESYNC, -1,
+                                                state->timed_discard_count);
+                                state->timed_discard_count = 0;
+                                state->recv_subsys = -1;
+                        }
+                        else {
+                                /* not enough time elapsed  - discard all
+                                   data and reset timeout */
+                                ttyhub_recvd_data_consumed(state, r_count);
+                                state->timed_discard_count += r_count;
+                                state->bytes_discarded += r_count;
+                                state->timed_discard_upto = jiffies +
+                                        state->timed_discard_min_silence;
+                        }
+                }
+                else if (state->recv_subsys >= 0 && state->recv_frame_remain) {
+                        /* frame length known from a match rule */
+                        int n;
+                        n = r_count > state->recv_frame_remain ?
+                                state->recv_frame_remain : r_count;
+                        ttyhub_frame_append(state, r_cp, n);
+                        ttyhub_recvd_data_consumed(state, n);
+                        state->recv_frame_remain -= n;
+                        if (state->recv_frame_remain == 0) {
+                                ttyhub_frame_complete(state,
+                                        ttyhub_subsystems[state->recv_subsys]);
+                                state->recv_subsys = -1;
+                        }
+                }
+                else if (state->recv_subsys >= 0 && state->recv_gap_ns) {
+                        /* frame delimited by silence - (re)start the timer
+                           ending it */
+                        ttyhub_frame_append(state, r_cp, r_count);
+                        ttyhub_recvd_data_consumed(state, r_count);
+                        hrtimer_start(&state->gap_timer,
+                                        ns_to_ktime(state->recv_gap_ns),
+                                        HRTIMER_MODE_REL_SOFT);
+                }
+                else if (state->recv_subsys >= 0 &&
+                                state->unstuff.mode != TTYHUB_FRAMING_NONE) {
+                        /* frame delimited and decoded by ttyhub */
+                        int n, end;
+                        n = ttyhub_frame_unstuff(state, r_cp, r_count, &end);
+                        ttyhub_recvd_data_consumed(state, n);
+                        if (end) {
+                                if (state->recv_frame || state->recv_frame_drop)
+                                        ttyhub_frame_complete(state,
+                                                ttyhub_subsystems[
+                                                        state->recv_subsys]);
+                                state->unstuff.mode = TTYHUB_FRAMING_NONE;
+                                state->recv_subsys = -1;
+                        }
+                }
+                else if (state->recv_subsys >= 0) {
+                        int n;
+                        u64 start = 0;
+                        struct ttyhub_subsystem *subs =
+                                ttyhub_subsystems[state->recv_subsys];
+                        if (ttyhub_qos_cpu(state->recv_qos))
+                                start = ktime_get_ns();
+                        if (subs->do_receive_ts)
+                                n = subs->do_receive_ts(
+                                        state->subsys_data[state->recv_subsys],
+                                        r_cp, r_count, state->recv_ts_first,
+                                        ttyhub_recvd_data_ts(state,
+                                                r_count - 1));
+                        else
+                                n = ttyhub_call_do_receive(state->recv_subsys,
+                                        subs,
+                                        state->subsys_data[state->recv_subsys],
+                                        r_cp, r_count);
+                        if (start)
+                                ttyhub_qos_charge_cpu(state->recv_qos,
+                                                ktime_get_ns() - start);
+                        if (subs->receive_frame)
+                                ttyhub_frame_append(state, r_cp,
+                                                n < 0 ? r_count : n);
+                        if (n < 0) {
+                                /* subsystem expects more data */
+                                ttyhub_recvd_data_consumed(state, r_count);
+                        }
+                        else {
+                                /* subsystem finished receiving */
+                                ttyhub_recvd_data_consumed(state, n);
+                                if (subs->receive_frame)
+                                        ttyhub_frame_complete(state, subs);
+                                state->recv_subsys = -1;
+                        }
+                }
+
+#ifdef DEBUG
+                if (debug & TTYHUB_DEBUG_RECV_STATE_MACHINE &&
+                                state->recv_subsys != debug_old_recv_subsys)
+                        printk(KERN_INFO "ttyhub: receive_buf() new recv_"
+                                "subsys = %d (%s)\n", state->recv_subsys,
+                                ttyhub_debug_state_to_string(state));
+#endif
+
+                if (wait) {
+                        /* wait for data to probe more subsystems - only the
+                           part of cp that fits into the probe buffer is
+                           accepted */
+                        if (count - state->cp_consumed != 0)
+                                ttyhub_probebuf_push(state, cp +
+                                        state->cp_consumed, count -
+                                        state->cp_consumed);
+#ifdef DEBUG
+                        if (debug & TTYHUB_DEBUG_RECV_STATE_MACHINE)
+                                printk(KERN_INFO "ttyhub: receive_buf() "
+                                                "exit (more data needed, %d "
+                                                "of %d bytes accepted)\n",
+                                                state->cp_consumed, count);
+#endif
+                        return state->cp_consumed;
+                }
+        }
+}
+
+/*
+ * Receive state machine of a tty with a single enabled subsystem (see
+ * ttyhub_single_update()). Data is streamed straight from cp to the
+ * subsystem and the start of every frame is probed in place - there are no
+ * other subsystems, rules or budgets to consider. Whatever needs the probe
+ * buffer or the discard logic, e.g. resynchronizing after data the
+ * subsystem doesn't recognize, is left to ttyhub_receive() with the same
+ * result as if it had handled all data.
+ * This is a helper function for ttyhub_ldisc_receive_buf() and
+ * ttyhub_child_receive().
+ *
+ * Locks:
+ *      The receive lock of the state is assumed to be held already.
+ *
+ * Returns the number of bytes accepted from cp.
+ */
+static int ttyhub_receive_single(struct ttyhub_state *state,
+                        const unsigned char *cp, int count, ktime_t now)
+{
+        int i = state->single, pos = 0, n, end;
+        struct ttyhub_subsystem *subs = ttyhub_subsystems[i];
+        void *data = state->subsys_data[i];
+
+        if (state->probe_buf_count != state->probe_buf_consumed ||
+                        (state->recv_subsys != -1 && state->recv_subsys != i))
+                return ttyhub_receive(state, cp, count, now);
+
+        state->recv_last = now;
+        while (pos < count) {
+                if (state->recv_subsys < 0) {
+                        /* start of a frame */
+                        if (count - pos < subs->probe_data_minimum_bytes)
+                                break;
+                        if (!ttyhub_call_probe_data(i, subs, data, cp + pos,
+                                                count - pos)) {
+                                /* ttyhub_receive() goes on with probing the
+                                   size */
+                                state->probed_subsystems[i/8] |= 1 << i%8;
+                                break;
+                        }
+                        state->counters[i].frames++;
+                        state->recv_subsys = i;
+                        state->recv_ts_first = now;
+                        if (subs->framing != TTYHUB_FRAMING_NONE)
+                                ttyhub_unstuff_reset(&state->unstuff,
+                                                subs->framing);
+                }
+
+                if (subs->framing != TTYHUB_FRAMING_NONE) {
+                        /* frame delimited and decoded by ttyhub */
+                        n = ttyhub_frame_unstuff(state, cp + pos, count - pos,
+                                        &end);
+                }
+                else {
+                        if (subs->do_receive_ts)
+                                n = subs->do_receive_ts(data, cp + pos,
+                                                count - pos,
+                                                state->recv_ts_first, now);
+                        else
+                                n = ttyhub_call_do_receive(i, subs, data,
+                                                cp + pos, count - pos);
+                        end = n >= 0;
+                        if (n < 0)
+                                n = count - pos;
+                        if (subs->receive_frame)
+                                ttyhub_frame_append(state, cp + pos, n);
+                }
+
+                pos += n;
+                state->counters[i].bytes += n;
+                if (n)
+                        state->recv_ts_last = now;
+                if (end) {
+                        if (subs->framing == TTYHUB_FRAMING_NONE ?
+                                        subs->receive_frame != NULL :
+                                        state->recv_frame ||
+                                        state->recv_frame_drop)
+                                ttyhub_frame_complete(state, subs);
+                        state->unstuff.mode = TTYHUB_FRAMING_NONE;
+                        state->recv_subsys = -1;
+                }
+        }
+
+        if (pos < count)
+                pos += ttyhub_receive(state, cp + pos, count - pos, now);
+        return pos;
+}
+
+/*
+ * Find the first byte flagged with an error by the tty driver. The flags are
+ * read a machine word at a time, as errors are rare.
+ * This is a helper function for ttyhub_receive_flagged().
+ *
+ * Returns the offset of the first flag other than TTY_NORMAL or count if
+ * there is none.
+ */
+static int ttyhub_fp_scan(const u8 *fp, int count)
+{
+        int i = 0;
+
+        while (i < count && !IS_ALIGNED((unsigned long)(fp + i),
+                                sizeof(unsigned long))) {
+                if (fp[i] != TTY_NORMAL)
+                        return i;
+                i++;
+        }
+        while (i + (int)sizeof(unsigned long) <= count &&
+                        *(const unsigned long *)(fp + i) == 0)
+                i += sizeof(unsigned long);
+        while (i < count && fp[i] == TTY_NORMAL)
+                i++;
+        return i;
+}
+
+/*
+ * Handle a byte the tty driver has flagged with an error. The byte is
+ * dropped, the frame it belongs to is aborted and probing starts again with
+ * the next byte. A timed discard continues - it ends with silence anyway.
+ * This is a helper function for ttyhub_receive_flagged().
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ */
+static void ttyhub_line_error(struct ttyhub_state *state, u8 flag)
+{
+        struct ttyhub_subsystem *subs;
+        int j;
+
+        switch (flag) {
+        case TTY_BREAK:
+                state->errors_break++;
+                break;
+        case TTY_FRAME:
+                state->errors_frame++;
+                break;
+        case TTY_PARITY:
+                state->errors_parity++;
+                break;
+        default:
+                state->errors_overrun++;
+                break;
+        }
+        state->bytes_discarded++;
+
+        if (state->recv_subsys == -4)
+                return;
+
+        if (state->recv_subsys >= 0) {
+                subs = ttyhub_subsystems[state->recv_subsys];
+                ttyhub_frame_abort(state);
+                if (subs->frame_error)
+                        subs->frame_error(
+                                state->subsys_data[state->recv_subsys], flag);
+        }
+
+        /* data kept for probing belongs to the corrupted frame */
+        state->probe_buf_count = 0;
+        state->probe_buf_consumed = 0;
+        for (j=0; j < (max_subsys-1)/8 + 1; j++)
+                state->probed_subsystems[j] = 0;
+        state->rules_probed = 0;
+        state->discard_bytes_remaining = 0;
+        state->recv_subsys = -1;
+}
+
+/*
+ * Run the receive state machine on data with error flags. The data between
+ * flagged bytes is passed to ttyhub_receive() in one piece.
+ * This is a helper function for ttyhub_ldisc_receive_buf().
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ *
+ * Returns the number of bytes accepted from cp.
+ */
+static int ttyhub_receive_flagged(struct ttyhub_state *state,
+                        const unsigned char *cp, const u8 *fp, int count,
+                        ktime_t now)
+{
+        int done = 0, end, n;
+
+        while (done < count) {
+                end = done + ttyhub_fp_scan(fp + done, count - done);
+                if (end > done) {
+                        n = ttyhub_receive(state, cp + done, end - done,
+                                        now);
+                        done += n;
+                        if (done < end)
+                                /* the rest stays in the flip buffer */
+                                break;
+                }
+                if (end == count)
+                        break;
+                ttyhub_line_error(state, fp[end]);
+                done++;
+        }
+
+        return done;
+}
+
+/*
+ * Run the receive state machine on a chunk of data received by the tty.
+ * This is a helper function for ttyhub_ldisc_receive_buf() and
+ * ttyhub_receive_echo().
+ *
+ * All locks to involved data structures are asssumed to be held already.
+ *
+ * Returns the number of bytes accepted from cp.
+ */
+static int ttyhub_receive_chunk(struct ttyhub_state *state,
+                        const unsigned char *cp, const u8 *fp, int count,
+                        ktime_t now)
+{
+        if (fp)
+                return ttyhub_receive_flagged(state, cp, fp, count, now);
+        else if (state->single >= 0)
+                return ttyhub_receive_single(state, cp, count, now);
+        return ttyhub_receive(state, cp, count, now);
+}
+
+/*
+ * Run the receive state machine on data received by a half-duplex tty. The
+ * echo of the bytes written is stripped in one piece before the data is
+ * probed (see ttyhub_echo_strip()), the data around it is passed on.
+ * This is a helper function for ttyhub_ldisc_receive_buf().
+ *
+ * Locks:
+ *      The receive lock is assumed to be held already, the echo lock is
+ *      held while stripping.
+ *
+ * Returns the number of bytes accepted from cp, including the echo.
+ */
+static int ttyhub_receive_echo(struct ttyhub_state *state,
+                        const unsigned char *cp, const u8 *fp, int count,
+                        ktime_t now)
+{
+        unsigned long flags;
+        int done = 0, len, n;
+
+        while (done < count) {
+                spin_lock_irqsave(&state->echo_lock, flags);
+                done += ttyhub_echo_strip(state->echo, cp + done,
+                                fp ? fp + done : NULL, count - done, now,
+                                &len);
+                spin_unlock_irqrestore(&state->echo_lock, flags);
+                if (len == 0)
+                        continue;
+
+                n = ttyhub_receive_chunk(state, cp + done,
+                                fp ? fp + done : NULL, len, now);
+                done += n;
+                if (n < len)
+                        /* the rest stays in the flip buffer */
+                        break;
+        }
+
+        return done;
+}
+
+/*
+ * Line discipline receive_buf2() operation
+ * Called by the tty buffer code when new data arrives.
+ *
+ * Locks:
+ *      The receive lock of the state is held while the state machine runs.
+ *
+ * Returns the number of bytes accepted from cp. Bytes that are not accepted
+ * stay in the flip buffer of the tty and are passed again later.
+ */
+static size_t ttyhub_ldisc_receive_buf(struct tty_struct *tty, const u8 *cp,
+                        const u8 *fp, size_t size)
+{
+        struct ttyhub_state *state = tty->disc_data;
+        int count = size;
+        int accepted;
+        /* the arrival time of the chunk - taken once for all frames in it */
+        ktime_t now = ktime_get();
+
+#ifdef DEBUG
+        if (debug & TTYHUB_DEBUG_RECV_STATE_MACHINE) {
+                printk(KERN_INFO "ttyhub: receive_buf(tty=%s, cp=0x%p, "
+                                "fp=0x%p, count=%d) enter\n", tty->name, cp,
+                                fp, count);
+                print_hex_dump(KERN_INFO, "ttyhub: receive_buf() cp: ",
+                                DUMP_PREFIX_OFFSET, 16, 1, cp, count, true);
+                if (fp)
+                        print_hex_dump(KERN_INFO, "ttyhub: receive_buf()"
+                                        " fp: ", DUMP_PREFIX_OFFSET, 16, 1, fp,
+                                        count, true);
+        }
+#endif
+
+        spin_lock_bh(&state->recv_lock);
+        if (state->echo)
+                accepted = ttyhub_receive_echo(state, cp, fp, count, now);
+        else
+                accepted = ttyhub_receive_chunk(state, cp, fp, count, now);
+        state->bytes_received += accepted;
+        ttyhub_drain_kick(state);
+        spin_unlock_bh(&state->recv_lock);
+
+        return accepted;
+}
+
+/*
+ * Pass data from user space to the receive state machine of a tty in the
+ * chunks given, as if the tty driver had received it. Like the flip buffer,
+ * bytes that are not accepted are passed again with the next chunk. The
+ * time spent in ttyhub_ldisc_receive_buf() is returned in inj. A fatal
+ * signal stops the injection after the current pass over the data.
+ * This is a helper function for ttyhub_ldisc_ioctl().
+ *
+ * Locks:
+ *      The receive lock of the state is held for every chunk.
+ *
+ * Returns zero on success, -EINTR if a fatal signal is pending or another
+ * negative error code.
+ */
+static int ttyhub_inject(struct ttyhub_state *state,
+                        struct ttyhub_inject *inj)
+{
+        unsigned char *data;
+        u32 *chunks = NULL;
+        u32 i, round, rounds, pos, end, n;
+        u64 sum = 0, start_ns;
+        cycles_t start_cycles;
+        int err = 0;
+
+        if (!capable(CAP_SYS_ADMIN))
+                return -EPERM;
+        if (inj->reserved || inj->len == 0 || inj->len > TTYHUB_INJECT_MAX ||
+                        inj->nr_chunks > inj->len)
+                return -EINVAL;
+
+        data = kvmalloc(inj->len, GFP_KERNEL);
+        if (data == NULL)
+                return -ENOMEM;
+        if (copy_from_user(data, u64_to_user_ptr(inj->data), inj->len)) {
+                err = -EFAULT;
+                goto out_free_data;
+        }
+
+        if (inj->nr_chunks) {
+                chunks = kvmalloc_array(inj->nr_chunks, sizeof(*chunks),
+                                GFP_KERNEL);
+                if (chunks == NULL) {
+                        err = -ENOMEM;
+                        goto out_free_data;
+                }
+                if (copy_from_user(chunks, u64_to_user_ptr(inj->chunks),
+                                        sizeof(*chunks) * inj->nr_chunks)) {
+                        err = -EFAULT;
+                        goto out_free_chunks;
+                }
+                for (i=0; i < inj->nr_chunks; i++)
+                        sum += chunks[i];
+                if (sum != inj->len) {
+                        err = -EINVAL;
+                        goto out_free_chunks;
+                }
+        }
+
+        rounds = inj->repeat ? inj->repeat : 1;
+        inj->accepted = 0;
+        start_cycles = get_cycles();
+        start_ns = ktime_get_ns();
+        for (round=0; round < rounds; round++) {
+                pos = 0;
+                end = 0;
+                for (i=0; i < (chunks ? inj->nr_chunks : 1); i++) {
+                        end = chunks ? end + chunks[i] : inj->len;
+                        while (pos < end) {
+                                n = ttyhub_ldisc_receive_buf(state->tty,
+                                                data + pos, NULL, end - pos);
+                                if (n == 0)
+                                        break;
+                                pos += n;
+                        }
+                }
+                inj->accepted += pos;
+                if (fatal_signal_pending(current)) {
+                        err = -EINTR;
+                        goto out_free_chunks;
+                }
+                cond_resched();
+        }
+        inj->ns = ktime_get_ns() - start_ns;
+        inj->cycles = get_cycles() - start_cycles;
+
+out_free_chunks:
+        kvfree(chunks);
+out_free_data:
+        kvfree(data);
+        return err;
+}
+
+/* the receive lock of a child context is taken with the receive lock of its
+   parent held - lockdep must not take them for one lock */
+static struct lock_class_key ttyhub_child_recv_lock_key;
+
+/*
+ * Create a child context - a receive state machine of its own with its own
+ * enabled subsystems, probe buffer and discard logic. A subsystem whose
+ * payload is itself a multiplexed byte stream feeds the payload to its child
+ * context with ttyhub_child_receive(). Subsystems enabled on the child are
+ * attached to tty, which is usually the tty of the parent. Child contexts
+ * are not nested - a subsystem enabled on a child context must not feed a
+ * child context of its own.
+ *
+ * Returns the child context or NULL if memory is short.
+ */
+struct ttyhub_state *ttyhub_child_create(struct tty_struct *tty)
+{
+        struct ttyhub_state *child = ttyhub_state_create(tty);
+
+        if (child)
+                lockdep_set_class(&child->recv_lock,
+                                &ttyhub_child_recv_lock_key);
+        return child;
+}
+EXPORT_SYMBOL_GPL(ttyhub_child_create);
+
+/*
+ * Disable all subsystems of a child context and free it. No data may be
+ * passed to the child context anymore and no subsystem may be enabled on it
+ * at the same time.
+ */
+void ttyhub_child_destroy(struct ttyhub_state *child)
+{
+        ttyhub_state_destroy(child);
+}
+EXPORT_SYMBOL_GPL(ttyhub_child_destroy);
+
+/*
+ * Enable a subsystem on a child context.
+ *
+ * Returns a negative error code or the nonnegative return value of the
+ * subsystem's attach() operation.
+ */
+int ttyhub_child_enable(struct ttyhub_state *child, int index)
+{
+        return ttyhub_subsystem_enable(child, index, NULL);
+}
+EXPORT_SYMBOL_GPL(ttyhub_child_enable);
+
+/*
+ * Pass data to the receive state machine of a child context. The data is
+ * read in place - only what a subsystem needs for probing is copied to the
+ * probe buffer of the child context. There is no flip buffer behind a child
+ * context, so the state machine is run until all data is accepted.
+ *
+ * Locks:
+ *      The receive lock of the child context is held while the state machine
+ *      runs. This may be called from the receive path of the parent.
+ *
+ * Returns the number of bytes accepted, which is count unless the state
+ * machine stops making progress.
+ */
+int ttyhub_child_receive(struct ttyhub_state *child, const unsigned char *cp,
+                        int count)
+{
+        int n, accepted = 0;
+        ktime_t now = ktime_get();
+
+        spin_lock_bh(&child->recv_lock);
+        while (accepted < count) {
+                if (child->single >= 0)
+                        n = ttyhub_receive_single(child, cp + accepted,
+                                        count - accepted, now);
+                else
+                        n = ttyhub_receive(child, cp + accepted,
+                                        count - accepted, now);
+                if (n == 0)
+                        break;
+                accepted += n;
+        }
+        child->bytes_received += accepted;
+        ttyhub_drain_kick(child);
+        spin_unlock_bh(&child->recv_lock);
+
+        return accepted;
+}
+EXPORT_SYMBOL_GPL(ttyhub_child_receive);
+
+/*
+ * Line discipline lookahead_buf() operation
+ * Called by the tty buffer code for data that has not been accepted by
+ * receive_buf2() yet. ttyhub_receive() accepts less than it is given only
+ * while probing waits for more data and the probe buffer is full, so the
+ * data is offered to the subsystems that have not been probed yet - it
+ * follows the data in the probe buffer and is passed to receive_buf2()
+ * again later. The flags in fp are not looked at: a byte flagged with an
+ * error is handled when receive_buf2() gets to it.
+ *
+ * Locks:
+ *      The receive lock of the state is held while the subsystems peek at
+ *      the data.
+ */
+static void ttyhub_ldisc_lookahead_buf(struct tty_struct *tty, const u8 *cp,
+                        const u8 *fp, size_t count)
+{
+        struct ttyhub_state *state = tty->disc_data;
+        const struct ttyhub_plan_entry *e;
+        struct ttyhub_subsystem *subs;
+        struct ttyhub_plan *plan;
+        int i, k;
+
+        if (state == NULL)
+                return;
+
+        spin_lock_bh(&state->recv_lock);
+        plan = rcu_dereference_protected(state->plan,
+                        lockdep_is_held(&state->recv_lock));
+        if (state->recv_subsys >= 0) {
+                subs = ttyhub_subsystems[state->recv_subsys];
+                if (subs->lookahead)
+                        subs->lookahead(state->subsys_data[state->recv_subsys],
+                                        cp, count);
+        }
+        else if (state->recv_subsys == -1) {
+                for (k=0; plan && k < plan->nr; k++) {
+                        e = &plan->entries[k];
+                        i = e->index;
+                        if (state->probed_subsystems[i/8] & 1 << i%8)
+                                continue;
+                        if (e->subs->lookahead)
+                                e->subs->lookahead(state->subsys_data[i], cp,
+                                                count);
+                }
+        }
+        spin_unlock_bh(&state->recv_lock);
+}
+
+/*
+ * Write data to a tty using ttyhub. When echo cancellation is enabled on the
+ * tty the bytes are remembered before they are passed to the driver, so
+ * that their echo is stripped from the received data even if it arrives
+ * before the driver returns (e.g. on a loopback). The bytes the driver does
+ * not accept are forgotten again afterwards.
+ *
+ * Locks:
+ *      The echo lock of the tty is held while remembering and forgetting the
+ *      bytes, but not while calling the driver.
+ *
+ * Returns the number of bytes written or a negative error code.
+ */
+int ttyhub_write(struct tty_struct *tty, const unsigned char *buf, int count)
+{
+        struct ttyhub_state *state = tty->disc_data;
+        struct ttyhub_echo *echo = NULL;
+        unsigned long flags;
+        u64 end = 0;
+        int written;
+
+        if (state && count > 0) {
+                spin_lock_irqsave(&state->echo_lock, flags);
+                echo = state->echo;
+                if (echo) {
+                        ttyhub_echo_record(echo, buf, count, ktime_get());
+                        end = echo->recorded;
+                }
+                spin_unlock_irqrestore(&state->echo_lock, flags);
+        }
+
+        written = tty->ops->write(tty, buf, count);
+
+        if (echo && written < count) {
+                spin_lock_irqsave(&state->echo_lock, flags);
+                /* the echo has not been replaced meanwhile */
+                if (state->echo == echo)
+                        ttyhub_echo_trim(echo, end,
+                                        count - max(written, 0));
+                spin_unlock_irqrestore(&state->echo_lock, flags);
+        }
+
+        return written;
+}
+EXPORT_SYMBOL_GPL(ttyhub_write);
+
+/*
+ * Line discipline write_wakeup() operation
+ * Called by the hardware driver when it can accept more data. Every enabled
+ * subsystem that has a write_wakeup() operation is notified - subsystems
+ * write with ttyhub_write(), so the echo of the data can be cancelled.
+ *
+ * Locks:
+ *      The subsystems lock (ttyhub_subsystems_lock) is held while searching
+ *      for subsystems to notify, but not while notifying a subsystem.
+ */
+static void ttyhub_ldisc_write_wakeup(struct tty_struct *tty)
+{
+        struct ttyhub_state *state = tty->disc_data;
+        struct ttyhub_subsystem *subs;
+        unsigned long flags;
+        int i;
+
+        if (state == NULL)
+                return;
+
+        spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        for (i=0; i < max_subsys; i++) {
+                subs = ttyhub_subsystems[i];
+                if (subs == NULL || subs->write_wakeup == NULL)
+                        continue;
+                if (!(state->enabled_subsystems[i/8] & 1 << i%8))
+                        continue;
+                spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+                subs->write_wakeup(state->subsys_data[i]);
+                spin_lock_irqsave(&ttyhub_subsystems_lock, flags);
+        }
+        spin_unlock_irqrestore(&ttyhub_subsystems_lock, flags);
+}
+
+static struct tty_ldisc_ops ttyhub_ldisc =
+{
+        .owner         = THIS_MODULE,
+        .num           = N_TTYHUB,
+        .name          = "ttyhub",
+        .open          = ttyhub_ldisc_open,
+        .close         = ttyhub_ldisc_close,
+        .ioctl         = ttyhub_ldisc_ioctl,
+        .receive_buf2  = ttyhub_ldisc_receive_buf,
+        .lookahead_buf = ttyhub_ldisc_lookahead_buf,
+        .write_wakeup  = ttyhub_ldisc_write_wakeup
+};
+
+/* module init/exit functions */
+static int __init ttyhub_init(void)
+{
+        int status;
+
+        if (max_subsys < 2)
+                max_subsys = 2;
+
+        if (probe_buf_size < 16)
+                probe_buf_size = 16;
+
+        if (frame_size < 16)
+                frame_size = 16;
+
+        if (frame_pool_min < 1)
+                frame_pool_min = 1;
+
+        printk(KERN_INFO "ttyhub: version %s, max. subsystems = %d, probe "
+                "bufsize = %d"
+#ifdef DEBUG
+                " (debug build)"
+#endif
+                "\n", TTYHUB_VERSION, max_subsys, probe_buf_size);
+
+        /* allocate space for pointers to subsystems and init lock */
+        ttyhub_subsystems = kzalloc(
+                sizeof(struct ttyhub_subsystem *) * max_subsys,
+                GFP_KERNEL);
+        if (ttyhub_subsystems == NULL)
+                return -ENOMEM;
+        spin_lock_init(&ttyhub_subsystems_lock);
+
+        /* subsystems linked into ttyhub.ko get the lowest indices */
+        status = ttyhub_static_init();
+        if (status != 0) {
+                kfree(ttyhub_subsystems);
+                return status;
+        }
+
+        status = ttyhub_genl_init();
+        if (status != 0) {
+                ttyhub_static_exit();
+                kfree(ttyhub_subsystems);
+                printk(KERN_ERR "ttyhub: can't register netlink family "
+                        "(err = %d)\n", status);
+                return status;
+        }
+
+        /* register line discipline */
+        status = tty_register_ldisc(&ttyhub_ldisc); // TODO dynamic LDISC nr
+        if (status != 0) {
+                ttyhub_genl_exit();
+                ttyhub_static_exit();
+                kfree(ttyhub_subsystems);
+                printk(KERN_ERR "ttyhub: can't register line discipline "
+                        "(err = %d)\n", status);
+        }
+        return status;
+}
+
+static void __exit ttyhub_exit(void)
+{
+        tty_unregister_ldisc(&ttyhub_ldisc);
+        ttyhub_genl_exit();
+        ttyhub_static_exit();
+
+        kfree(ttyhub_subsystems);
+}
+
+module_init(ttyhub_init);
+module_exit(ttyhub_exit);
+
+
+#ifdef TTYHUB_KUNIT_TEST
+#include "ttyhub_test.c"
+#endif
@@ -0,0 +1,239 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Echo cancellation for half-duplex lines. On a 2-wire RS-485 bus the
+ * receiver of a tty hears its own transmitter, so every byte written is
+ * received again. The bytes written with ttyhub_write() are remembered in a
+ * ring buffer and stripped from the received data before it reaches the
+ * probe stage - subsystems never see their own frames.
+ *
+ * Data received before the echo (e.g. the end of a frame of another device
+ * that was still in the flip buffer when writing) is passed on - the echo is
+ * only searched for in data that arrived after the write. Once the
+ * first byte of the echo has been found the rest must follow without gaps:
+ * a byte that differs means a collision on the bus, the remaining echo is
+ * given up and the data is passed on unchanged. So is an echo that doesn't
+ * arrive within the timeout, e.g. because the transceiver doesn't echo.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/string.h>
+#include <linux/tty.h>
+#include <linux/overflow.h>
+#include "ttyhub_echo.h"
+
+/*
+ * Create the echo buffer of a tty.
+ *
+ * Returns the new buffer or an ERR_PTR() value.
+ */
+struct ttyhub_echo *ttyhub_echo_create(const struct ttyhub_echo_config *config)
+{
+        struct ttyhub_echo *echo;
+
+        if (config->size == 0 || config->size > TTYHUB_ECHO_MAX_SIZE)
+                return ERR_PTR(-EINVAL);
+
+        echo = kzalloc(struct_size(echo, buf, config->size), GFP_KERNEL);
+        if (echo == NULL)
+                return ERR_PTR(-ENOMEM);
+        echo->size = config->size;
+        echo->timeout_ns = (u64)(config->timeout_us ? config->timeout_us :
+                        TTYHUB_ECHO_TIMEOUT_US) * NSEC_PER_USEC;
+        return echo;
+}
+
+/*
+ * Give up the echo still expected.
+ * This is a helper function for ttyhub_echo_record(), ttyhub_echo_trim()
+ * and ttyhub_echo_strip().
+ */
+static void ttyhub_echo_reset(struct ttyhub_echo *echo)
+{
+        echo->lost += echo->len;
+        echo->len = 0;
+        echo->started = 0;
+}
+
+/*
+ * Remember bytes written to the tty. When the buffer is full the oldest
+ * bytes are given up - their echo can't be recognized anymore.
+ *
+ * Locks:
+ *      The echo lock of the tty is assumed to be held already.
+ */
+void ttyhub_echo_record(struct ttyhub_echo *echo, const unsigned char *buf,
+                        int count, ktime_t now)
+{
+        int tail, n;
+
+        if (count <= 0)
+                return;
+
+        echo->recorded += count;
+        if (count >= echo->size) {
+                ttyhub_echo_reset(echo);
+                echo->lost += count - echo->size;
+                buf += count - echo->size;
+                count = echo->size;
+                echo->head = 0;
+        }
+        else if (echo->len + count > echo->size) {
+                n = echo->len + count - echo->size;
+                echo->head = (echo->head + n) % echo->size;
+                echo->len -= n;
+                echo->lost += n;
+                echo->started = 0;
+        }
+
+        if (echo->len == 0)
+                echo->sent = now;
+        tail = (echo->head + echo->len) % echo->size;
+        n = min(count, echo->size - tail);
+        memcpy(echo->buf + tail, buf, n);
+        memcpy(echo->buf, buf + n, count - n);
+        echo->len += count;
+        echo->last = now;
+}
+
+/*
+ * Forget the last count bytes recorded because the tty driver did not
+ * accept them. end is the value of recorded right after the bytes had been
+ * recorded - when other bytes have been recorded since, the bytes not
+ * written can't be told apart anymore and the whole echo is given up.
+ *
+ * Locks:
+ *      The echo lock of the tty is assumed to be held already.
+ */
+void ttyhub_echo_trim(struct ttyhub_echo *echo, u64 end, int count)
+{
+        if (count <= 0)
+                return;
+
+        if (echo->recorded != end) {
+                ttyhub_echo_reset(echo);
+                return;
+        }
+        echo->recorded -= count;
+        echo->len -= min(count, echo->len);
+        if (echo->len == 0)
+                echo->started = 0;
+}
+
+/*
+ * Compare received data with the echo expected. Bytes flagged with an error
+ * never match. The ring buffer is compared in up to two contiguous pieces,
+ * byte by byte only where memcmp() finds a difference.
+ * This is a helper function for ttyhub_echo_strip().
+ *
+ * Returns the number of bytes at the beginning of cp that match.
+ */
+static int ttyhub_echo_match(struct ttyhub_echo *echo,
+                        const unsigned char *cp, const u8 *fp, int count)
+{
+        int pos = echo->head, done = 0, n, i;
+
+        count = min(count, echo->len);
+        while (done < count) {
+                n = min(count - done, echo->size - pos);
+                if (memcmp(cp + done, echo->buf + pos, n)) {
+                        for (i=0; cp[done + i] == echo->buf[pos + i]; i++)
+                                ;
+                        n = i;
+                        count = done + n;
+                }
+                done += n;
+                pos = 0;
+        }
+
+        if (fp) {
+                for (i=0; i < done; i++) {
+                        if (fp[i] != TTY_NORMAL)
+                                return i;
+                }
+        }
+        return done;
+}
+
+/*
+ * Strip the echo expected from the beginning of received data. When the
+ * echo has not started yet, it is searched for in data that arrived after
+ * the write: the bytes before the first position that matches the echo up
+ * to the end of the echo or of the data are left to the receive state
+ * machine.
+ *
+ * Locks:
+ *      The echo lock of the tty is assumed to be held already.
+ *
+ * Returns the number of echoed bytes at the beginning of cp. The number of
+ * bytes following them that must be passed to the receive state machine
+ * before calling again is returned in len - the sum of both is at least one
+ * if count is not zero.
+ */
+int ttyhub_echo_strip(struct ttyhub_echo *echo, const unsigned char *cp,
+                        const u8 *fp, int count, ktime_t now, int *len)
+{
+        const unsigned char *p;
+        int off = 0, n;
+
+        *len = count;
+        if (echo->len == 0)
+                return 0;
+        if (ktime_after(now, ktime_add_ns(echo->last, echo->timeout_ns))) {
+                ttyhub_echo_reset(echo);
+                return 0;
+        }
+
+        if (!echo->started) {
+                if (ktime_before(now, echo->sent))
+                        return 0;
+                while (1) {
+                        p = memchr(cp + off, echo->buf[echo->head],
+                                        count - off);
+                        if (p == NULL)
+                                return 0;
+                        off = p - cp;
+                        n = ttyhub_echo_match(echo, p, fp ? fp + off : NULL,
+                                        count - off);
+                        if (n == min(echo->len, count - off))
+                                break;
+                        off++;
+                }
+                if (off > 0) {
+                        *len = off;
+                        return 0;
+                }
+        }
+        else
+                n = ttyhub_echo_match(echo, cp, fp, count);
+
+        echo->head = (echo->head + n) % echo->size;
+        echo->len -= n;
+        echo->bytes += n;
+        echo->started = echo->len > 0;
+        if (n > 0)
+                echo->last = now;
+        if (n < count && echo->len > 0)
+                /* collision - the rest of the echo won't arrive */
+                ttyhub_echo_reset(echo);
+
+        *len = count - n;
+        return n;
+}
@@ -0,0 +1,62 @@
+#ifndef _TTYHUB_ECHO_H
+#define _TTYHUB_ECHO_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include "ttyhub_ioctl.h"
+
+/* bytes written to a half-duplex tty whose echo has not been received yet,
+   kept in a ring buffer */
+struct ttyhub_echo {
+        u64 timeout_ns;
+
+        /* time of the write of the oldest byte expected - data received
+           before can't be its echo */
+        ktime_t sent;
+
+        /* time of the last write or of the last echoed byte */
+        ktime_t last;
+
+        int size;
+        int head;
+        int len;
+
+        /* part of the pending echo has been received - the rest must follow
+           right after it */
+        int started;
+
+        /* bytes recorded so far - tells ttyhub_echo_trim() whether the bytes
+           of a write are still the last ones recorded */
+        u64 recorded;
+
+        u64 bytes;
+        u64 lost;
+        unsigned char buf[];
+};
+
+extern struct ttyhub_echo *ttyhub_echo_create(
+                        const struct ttyhub_echo_config *config);
+extern void ttyhub_echo_record(struct ttyhub_echo *echo,
+                        const unsigned char *buf, int count, ktime_t now);
+extern void ttyhub_echo_trim(struct ttyhub_echo *echo, u64 end, int count);
+extern int ttyhub_echo_strip(struct ttyhub_echo *echo,
+                        const unsigned char *cp, const u8 *fp, int count,
+                        ktime_t now, int *len);
+
+#endif /* _TTYHUB_ECHO_H */
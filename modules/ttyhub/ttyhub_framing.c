@@ -0,0 +1,266 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Decoder for byte stuffed frames. Runs of ordinary bytes are found one
+ * machine word at a time and copied to the frame in one piece, only the
+ * delimiter and escape bytes are handled byte by byte.
+ */
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include "ttyhub.h"
+#include "ttyhub_framing.h"
+
+#define TTYHUB_HDLC_FLAG        0x7E
+#define TTYHUB_HDLC_ESC         0x7D
+#define TTYHUB_HDLC_XOR         0x20
+
+#define TTYHUB_SLIP_END         0xC0
+#define TTYHUB_SLIP_ESC         0xDB
+#define TTYHUB_SLIP_ESC_END     0xDC
+#define TTYHUB_SLIP_ESC_ESC     0xDD
+
+#define TTYHUB_COBS_DELIM       0x00
+#define TTYHUB_COBS_MAX_CODE    0xFF
+
+#define TTYHUB_WORD_ONES        (~0UL / 0xFF)
+#define TTYHUB_WORD_HIGHS       (TTYHUB_WORD_ONES * 0x80)
+
+/* nonzero if any byte of v is zero */
+static inline unsigned long ttyhub_word_haszero(unsigned long v)
+{
+        return (v - TTYHUB_WORD_ONES) & ~v & TTYHUB_WORD_HIGHS;
+}
+
+/*
+ * Find the first byte that equals a or b.
+ *
+ * Returns the index of the byte or count if there is none.
+ */
+static int ttyhub_scan2(const unsigned char *cp, int count,
+                        unsigned char a, unsigned char b)
+{
+        unsigned long pa = TTYHUB_WORD_ONES * a;
+        unsigned long pb = TTYHUB_WORD_ONES * b;
+        int i = 0;
+
+        while (count - i >= (int)sizeof(unsigned long)) {
+                unsigned long v = get_unaligned((unsigned long *)(cp + i));
+                if (ttyhub_word_haszero(v ^ pa) | ttyhub_word_haszero(v ^ pb))
+                        break;
+                i += sizeof(unsigned long);
+        }
+        for (; i < count; i++)
+                if (cp[i] == a || cp[i] == b)
+                        break;
+        return i;
+}
+
+/*
+ * Find the first zero byte.
+ *
+ * Returns the index of the byte or count if there is none.
+ */
+static int ttyhub_scan_zero(const unsigned char *cp, int count)
+{
+        int i = 0;
+
+        while (count - i >= (int)sizeof(unsigned long)) {
+                unsigned long v = get_unaligned((unsigned long *)(cp + i));
+                if (ttyhub_word_haszero(v))
+                        break;
+                i += sizeof(unsigned long);
+        }
+        for (; i < count; i++)
+                if (cp[i] == 0)
+                        break;
+        return i;
+}
+
+/*
+ * Append decoded bytes to the output buffer. Frames which don't fit into the
+ * buffer are marked as invalid. Without an output buffer the bytes are
+ * dropped.
+ */
+static inline void ttyhub_unstuff_emit(struct ttyhub_unstuff *u,
+                        const unsigned char *cp, int count,
+                        unsigned char *out, int *out_len, int out_size)
+{
+        if (out == NULL || u->error || count == 0)
+                return;
+        if (*out_len + count > out_size) {
+                u->error = 1;
+                return;
+        }
+        memcpy(out + *out_len, cp, count);
+        *out_len += count;
+}
+
+/*
+ * This is a helper function for ttyhub_unstuff().
+ * Decode HDLC and SLIP frames. An escape byte followed by the delimiter
+ * aborts the frame.
+ */
+static int ttyhub_unstuff_escaped(struct ttyhub_unstuff *u,
+                        const unsigned char *cp, int count, unsigned char *out,
+                        int *out_len, int out_size, int *end)
+{
+        unsigned char delim, esc;
+        int i = 0, n;
+
+        if (u->mode == TTYHUB_FRAMING_HDLC) {
+                delim = TTYHUB_HDLC_FLAG;
+                esc = TTYHUB_HDLC_ESC;
+        } else {
+                delim = TTYHUB_SLIP_END;
+                esc = TTYHUB_SLIP_ESC;
+        }
+
+        if (!u->started) {
+                while (i < count && cp[i] == delim)
+                        i++;
+                if (i == count)
+                        return i;
+                u->started = 1;
+        }
+
+        while (i < count) {
+                if (u->escape) {
+                        unsigned char c = cp[i];
+
+                        u->escape = 0;
+                        if (c == delim) {
+                                u->error = 1;
+                                *end = 1;
+                                return i;
+                        }
+                        if (u->mode == TTYHUB_FRAMING_HDLC)
+                                c ^= TTYHUB_HDLC_XOR;
+                        else if (c == TTYHUB_SLIP_ESC_END)
+                                c = TTYHUB_SLIP_END;
+                        else if (c == TTYHUB_SLIP_ESC_ESC)
+                                c = TTYHUB_SLIP_ESC;
+                        ttyhub_unstuff_emit(u, &c, 1, out, out_len, out_size);
+                        i++;
+                        continue;
+                }
+
+                n = ttyhub_scan2(cp + i, count - i, delim, esc);
+                ttyhub_unstuff_emit(u, cp + i, n, out, out_len, out_size);
+                i += n;
+                if (i == count)
+                        break;
+                if (cp[i] == delim) {
+                        *end = 1;
+                        return i;
+                }
+                u->escape = 1;
+                i++;
+        }
+        return i;
+}
+
+/*
+ * This is a helper function for ttyhub_unstuff().
+ * Decode COBS frames. Each block starts with a code byte that gives the
+ * number of bytes up to the next zero byte of the decoded frame. A delimiter
+ * inside a block truncates the frame.
+ */
+static int ttyhub_unstuff_cobs(struct ttyhub_unstuff *u,
+                        const unsigned char *cp, int count, unsigned char *out,
+                        int *out_len, int out_size, int *end)
+{
+        static const unsigned char zero = 0;
+        int i = 0, n, z;
+
+        if (!u->started) {
+                while (i < count && cp[i] == TTYHUB_COBS_DELIM)
+                        i++;
+                if (i == count)
+                        return i;
+                u->started = 1;
+        }
+
+        while (i < count) {
+                if (u->cobs_remain == 0) {
+                        if (cp[i] == TTYHUB_COBS_DELIM) {
+                                /* the zero after the last block is implied */
+                                *end = 1;
+                                return i;
+                        }
+                        if (u->cobs_zero)
+                                ttyhub_unstuff_emit(u, &zero, 1, out, out_len,
+                                                out_size);
+                        u->cobs_remain = cp[i] - 1;
+                        u->cobs_zero = cp[i] != TTYHUB_COBS_MAX_CODE;
+                        i++;
+                        continue;
+                }
+
+                n = min(u->cobs_remain, count - i);
+                z = ttyhub_scan_zero(cp + i, n);
+                ttyhub_unstuff_emit(u, cp + i, z, out, out_len, out_size);
+                i += z;
+                if (z < n) {
+                        u->error = 1;
+                        *end = 1;
+                        return i;
+                }
+                u->cobs_remain -= n;
+        }
+        return i;
+}
+
+/* Prepare the decoder for a new frame. */
+void ttyhub_unstuff_reset(struct ttyhub_unstuff *u, int mode)
+{
+        memset(u, 0, sizeof(*u));
+        u->mode = mode;
+}
+
+/*
+ * Decode the next part of a frame. Decoded bytes are appended to out, which
+ * holds *out_len of out_size bytes. When out is NULL the frame is decoded
+ * but its content is dropped.
+ * Once the delimiter ending the frame is found *end is set to 1. The
+ * delimiter itself is not consumed. u->error is set when the frame must be
+ * dropped because it was aborted, truncated or too large.
+ *
+ * Returns the number of bytes consumed from cp.
+ */
+int ttyhub_unstuff(struct ttyhub_unstuff *u, const unsigned char *cp,
+                        int count, unsigned char *out, int *out_len,
+                        int out_size, int *end)
+{
+        *end = 0;
+        switch (u->mode) {
+        case TTYHUB_FRAMING_HDLC:
+        case TTYHUB_FRAMING_SLIP:
+                return ttyhub_unstuff_escaped(u, cp, count, out, out_len,
+                                out_size, end);
+        case TTYHUB_FRAMING_COBS:
+                return ttyhub_unstuff_cobs(u, cp, count, out, out_len,
+                                out_size, end);
+        }
+
+        /* unknown framing - drop everything */
+        u->error = 1;
+        *end = 1;
+        return count;
+}
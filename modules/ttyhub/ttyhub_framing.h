@@ -0,0 +1,45 @@
+#ifndef _TTYHUB_FRAMING_H
+#define _TTYHUB_FRAMING_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* state of the delimiter based frame decoder (TTYHUB_FRAMING_HDLC,
+   TTYHUB_FRAMING_SLIP and TTYHUB_FRAMING_COBS) for one frame */
+struct ttyhub_unstuff {
+        int mode;
+
+        /* leading delimiters have been skipped */
+        int started;
+
+        /* the last byte was an escape byte (HDLC and SLIP) */
+        int escape;
+
+        /* remaining bytes of the current block and whether a zero byte
+           follows it (COBS) */
+        int cobs_remain;
+        int cobs_zero;
+
+        /* the frame is invalid or doesn't fit into the output buffer */
+        int error;
+};
+
+extern void ttyhub_unstuff_reset(struct ttyhub_unstuff *u, int mode);
+extern int ttyhub_unstuff(struct ttyhub_unstuff *u, const unsigned char *cp,
+                        int count, unsigned char *out, int *out_len,
+                        int out_size, int *end);
+
+#endif /* _TTYHUB_FRAMING_H */
@@ -0,0 +1,221 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Generic netlink family "ttyhub" (see ttyhub_netlink.h). Monitoring tools
+ * read the counters of all ttys with one dump and follow events through a
+ * multicast group instead of polling every tty.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <net/genetlink.h>
+#include "ttyhub_genl.h"
+
+enum {
+        TTYHUB_MCGRP_EVENTS,
+};
+
+static const struct genl_multicast_group ttyhub_genl_mcgrps[] = {
+        [TTYHUB_MCGRP_EVENTS] = { .name = TTYHUB_GENL_MCGRP_EVENTS, },
+};
+
+static struct genl_family ttyhub_genl_family;
+
+/*
+ * Add the counters of one subsystem as a nested attribute.
+ * This is a helper function for ttyhub_genl_fill_tty().
+ */
+static int ttyhub_genl_fill_subsys(struct sk_buff *skb,
+                        const struct ttyhub_snapshot_subsys *s)
+{
+        struct nlattr *nest;
+
+        nest = nla_nest_start(skb, TTYHUB_A_SUBSYS);
+        if (nest == NULL)
+                return -EMSGSIZE;
+        if (nla_put_u32(skb, TTYHUB_SA_INDEX, s->index) ||
+                        nla_put_string(skb, TTYHUB_SA_NAME, s->name) ||
+                        nla_put_u64_64bit(skb, TTYHUB_SA_FRAMES, s->frames,
+                                TTYHUB_SA_PAD) ||
+                        nla_put_u64_64bit(skb, TTYHUB_SA_BYTES, s->bytes,
+                                TTYHUB_SA_PAD) ||
+                        nla_put_u64_64bit(skb, TTYHUB_SA_FRAMES_SHED,
+                                s->frames_shed, TTYHUB_SA_PAD)) {
+                nla_nest_cancel(skb, nest);
+                return -EMSGSIZE;
+        }
+        nla_nest_end(skb, nest);
+        return 0;
+}
+
+/*
+ * Add one message with the counters of a tty to a dump.
+ * This is a helper function for ttyhub_genl_dump_tty().
+ *
+ * Returns zero on success or -EMSGSIZE if the message doesn't fit.
+ */
+static int ttyhub_genl_fill_tty(struct sk_buff *skb,
+                        struct netlink_callback *cb,
+                        const struct ttyhub_snapshot *snap)
+{
+        void *hdr;
+        int i;
+
+        hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid,
+                        cb->nlh->nlmsg_seq, &ttyhub_genl_family, NLM_F_MULTI,
+                        TTYHUB_CMD_GET_TTY);
+        if (hdr == NULL)
+                return -EMSGSIZE;
+
+        if (nla_put_string(skb, TTYHUB_A_TTY, snap->tty) ||
+                        nla_put_s32(skb, TTYHUB_A_RECV_STATE,
+                                snap->recv_state) ||
+                        nla_put_u64_64bit(skb, TTYHUB_A_BYTES_RECEIVED,
+                                snap->bytes_received, TTYHUB_A_PAD) ||
+                        nla_put_u64_64bit(skb, TTYHUB_A_BYTES_DISCARDED,
+                                snap->bytes_discarded, TTYHUB_A_PAD) ||
+                        nla_put_u64_64bit(skb, TTYHUB_A_TIMED_DISCARDS,
+                                snap->timed_discards, TTYHUB_A_PAD) ||
+                        nla_put_u64_64bit(skb, TTYHUB_A_FRAMES_DROPPED,
+                                snap->frames_dropped, TTYHUB_A_PAD) ||
+                        nla_put_u64_64bit(skb, TTYHUB_A_ERRORS_BREAK,
+                                snap->errors_break, TTYHUB_A_PAD) ||
+                        nla_put_u64_64bit(skb, TTYHUB_A_ERRORS_FRAME,
+                                snap->errors_frame, TTYHUB_A_PAD) ||
+                        nla_put_u64_64bit(skb, TTYHUB_A_ERRORS_PARITY,
+                                snap->errors_parity, TTYHUB_A_PAD) ||
+                        nla_put_u64_64bit(skb, TTYHUB_A_ERRORS_OVERRUN,
+                                snap->errors_overrun, TTYHUB_A_PAD) ||
+                        nla_put_u64_64bit(skb, TTYHUB_A_FRAMES_ABORTED,
+                                snap->frames_aborted, TTYHUB_A_PAD) ||
+                        nla_put_u64_64bit(skb, TTYHUB_A_ECHO_BYTES,
+                                snap->echo_bytes, TTYHUB_A_PAD) ||
+                        nla_put_u64_64bit(skb, TTYHUB_A_ECHO_LOST,
+                                snap->echo_lost, TTYHUB_A_PAD))
+                goto error_cancel;
+
+        for (i=0; i < snap->nr_subsys; i++) {
+                if (ttyhub_genl_fill_subsys(skb, &snap->subsys[i]))
+                        goto error_cancel;
+        }
+
+        genlmsg_end(skb, hdr);
+        return 0;
+
+error_cancel:
+        genlmsg_cancel(skb, hdr);
+        return -EMSGSIZE;
+}
+
+/*
+ * Dump the counters of all ttys, one message per tty. cb->args[0] holds the
+ * position of the next tty when the dump continues in another skb.
+ */
+static int ttyhub_genl_dump_tty(struct sk_buff *skb,
+                        struct netlink_callback *cb)
+{
+        struct ttyhub_snapshot *snap;
+        int pos = cb->args[0];
+
+        while ((snap = ttyhub_snapshot(pos)) != NULL) {
+                if (ttyhub_genl_fill_tty(skb, cb, snap)) {
+                        kfree(snap);
+                        break;
+                }
+                kfree(snap);
+                pos++;
+        }
+
+        cb->args[0] = pos;
+        return skb->len;
+}
+
+static const struct genl_small_ops ttyhub_genl_ops[] = {
+        {
+                .cmd = TTYHUB_CMD_GET_TTY,
+                .dumpit = ttyhub_genl_dump_tty,
+                .flags = GENL_ADMIN_PERM,
+        },
+};
+
+static struct genl_family ttyhub_genl_family = {
+        .name = TTYHUB_GENL_NAME,
+        .version = TTYHUB_GENL_VERSION,
+        .maxattr = TTYHUB_A_MAX,
+        .module = THIS_MODULE,
+        .small_ops = ttyhub_genl_ops,
+        .n_small_ops = ARRAY_SIZE(ttyhub_genl_ops),
+        .resv_start_op = TTYHUB_CMD_EVENT + 1,
+        .mcgrps = ttyhub_genl_mcgrps,
+        .n_mcgrps = ARRAY_SIZE(ttyhub_genl_mcgrps),
+};
+
+int ttyhub_genl_init(void)
+{
+        return genl_register_family(&ttyhub_genl_family);
+}
+
+void ttyhub_genl_exit(void)
+{
+        genl_unregister_family(&ttyhub_genl_family);
+}
+
+/* Returns nonzero when somebody has joined the event group. */
+int ttyhub_genl_listening(void)
+{
+        return genl_has_listeners(&ttyhub_genl_family, &init_net,
+                        TTYHUB_MCGRP_EVENTS);
+}
+
+/*
+ * Send an event to the event group. This may be called in atomic context;
+ * events that can't be allocated are lost.
+ */
+void ttyhub_genl_event(const char *tty, u32 event, s32 subsys, u64 value,
+                        u32 suppressed)
+{
+        struct sk_buff *skb;
+        void *hdr;
+
+        skb = genlmsg_new(NLMSG_GOODSIZE, GFP_ATOMIC);
+        if (skb == NULL)
+                return;
+
+        hdr = genlmsg_put(skb, 0, 0, &ttyhub_genl_family, 0,
+                        TTYHUB_CMD_EVENT);
+        if (hdr == NULL)
+                goto error_free;
+
+        if (nla_put_string(skb, TTYHUB_A_TTY, tty) ||
+                        nla_put_u32(skb, TTYHUB_A_EVENT, event) ||
+                        nla_put_s32(skb, TTYHUB_A_EVENT_SUBSYS, subsys) ||
+                        nla_put_u64_64bit(skb, TTYHUB_A_EVENT_VALUE, value,
+                                TTYHUB_A_PAD) ||
+                        nla_put_u32(skb, TTYHUB_A_EVENTS_SUPPRESSED,
+                                suppressed))
+                goto error_free;
+
+        genlmsg_end(skb, hdr);
+        genlmsg_multicast(&ttyhub_genl_family, skb, 0, TTYHUB_MCGRP_EVENTS,
+                        GFP_ATOMIC);
+        return;
+
+error_free:
+        nlmsg_free(skb);
+}
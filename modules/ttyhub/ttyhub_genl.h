@@ -0,0 +1,61 @@
+#ifndef _TTYHUB_GENL_H
+#define _TTYHUB_GENL_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/types.h>
+#include "ttyhub_netlink.h"
+
+/* counters of a subsystem on a tty copied for a dump */
+struct ttyhub_snapshot_subsys {
+        u32 index;
+        char name[32];
+        u64 frames;
+        u64 bytes;
+        u64 frames_shed;
+};
+
+/* counters and receive state of a tty copied for a dump */
+struct ttyhub_snapshot {
+        char tty[64];
+        s32 recv_state;
+        u64 bytes_received;
+        u64 bytes_discarded;
+        u64 timed_discards;
+        u64 frames_dropped;
+        u64 errors_break;
+        u64 errors_frame;
+        u64 errors_parity;
+        u64 errors_overrun;
+        u64 frames_aborted;
+        u64 echo_bytes;
+        u64 echo_lost;
+        int nr_subsys;
+        struct ttyhub_snapshot_subsys subsys[];
+};
+
+extern int ttyhub_genl_init(void);
+extern void ttyhub_genl_exit(void);
+extern int ttyhub_genl_listening(void);
+extern void ttyhub_genl_event(const char *tty, u32 event, s32 subsys,
+                        u64 value, u32 suppressed);
+
+/* implemented by ttyhub_core.c - returns the snapshot of the tty at
+   position pos of all ttys using ttyhub, NULL after the last one */
+extern struct ttyhub_snapshot *ttyhub_snapshot(int pos);
+
+#endif /* _TTYHUB_GENL_H */
@@ -0,0 +1,138 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Receive budgets of subsystems. Every budget has up to three token buckets:
+ * bytes and frames received and the time spent in the subsystem. A frame is
+ * admitted when no bucket is exhausted - its cost is charged afterwards, so
+ * a bucket can run into debt by one frame. Frames arriving while a bucket is
+ * in debt are shed by the receive path until the bucket has been refilled.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/overflow.h>
+#include "ttyhub_qos.h"
+
+/*
+ * Set up a token bucket. The bucket starts full.
+ * This is a helper function for ttyhub_qos_create().
+ */
+static void ttyhub_qos_bucket_init(struct ttyhub_qos_bucket *b, u32 rate,
+                        u32 burst)
+{
+        b->rate = rate;
+        b->max = (s64)(burst ? burst : rate) * NSEC_PER_SEC;
+        b->tokens = b->max;
+}
+
+/*
+ * Add the tokens earned since the last refill.
+ * This is a helper function for ttyhub_qos_exhausted().
+ */
+static void ttyhub_qos_bucket_refill(struct ttyhub_qos_bucket *b, u64 elapsed)
+{
+        u64 add;
+
+        if (b->rate == 0 || b->tokens >= b->max)
+                return;
+        if (check_mul_overflow(b->rate, elapsed, &add) ||
+                        add >= (u64)(b->max - b->tokens))
+                b->tokens = b->max;
+        else
+                b->tokens += add;
+}
+
+/*
+ * Create a receive budget.
+ *
+ * Returns the new budget or an ERR_PTR() value.
+ */
+struct ttyhub_qos *ttyhub_qos_create(const struct ttyhub_qos_config *config)
+{
+        struct ttyhub_qos *qos;
+
+        if (config->flags & ~TTYHUB_QOS_CRITICAL)
+                return ERR_PTR(-EINVAL);
+
+        qos = kzalloc(sizeof(*qos), GFP_KERNEL);
+        if (qos == NULL)
+                return ERR_PTR(-ENOMEM);
+        qos->flags = config->flags;
+        qos->last_ns = ktime_get_ns();
+        ttyhub_qos_bucket_init(&qos->bytes, config->bytes_per_sec,
+                        config->bytes_burst);
+        ttyhub_qos_bucket_init(&qos->frames, config->frames_per_sec,
+                        config->frames_burst);
+        ttyhub_qos_bucket_init(&qos->cpu, config->cpu_us_per_sec,
+                        config->cpu_burst_us);
+        return qos;
+}
+
+/*
+ * Refill the buckets of a budget and check them before a frame that has
+ * just been identified is received. Critical subsystems are never
+ * exhausted.
+ *
+ * Locks:
+ *      The receive lock of the tty is assumed to be held already.
+ *
+ * Returns nonzero if the frame should be shed.
+ */
+int ttyhub_qos_exhausted(struct ttyhub_qos *qos)
+{
+        u64 now = ktime_get_ns();
+        u64 elapsed = now - qos->last_ns;
+
+        qos->last_ns = now;
+        ttyhub_qos_bucket_refill(&qos->bytes, elapsed);
+        ttyhub_qos_bucket_refill(&qos->frames, elapsed);
+        ttyhub_qos_bucket_refill(&qos->cpu, elapsed);
+
+        if (qos->flags & TTYHUB_QOS_CRITICAL)
+                return 0;
+        return qos->bytes.tokens < 0 || qos->frames.tokens < 0 ||
+                qos->cpu.tokens < 0;
+}
+
+/*
+ * Charge a frame that is received.
+ *
+ * Locks:
+ *      The receive lock of the tty is assumed to be held already.
+ */
+void ttyhub_qos_admit(struct ttyhub_qos *qos)
+{
+        if (qos->frames.rate)
+                qos->frames.tokens -= NSEC_PER_SEC;
+        qos->frames_admitted++;
+}
+
+/*
+ * Fill in the statistics of a budget.
+ *
+ * Locks:
+ *      The receive lock of the tty is assumed to be held already.
+ */
+void ttyhub_qos_get_stats(struct ttyhub_qos *qos,
+                        struct ttyhub_qos_stats *stats)
+{
+        stats->frames_admitted = qos->frames_admitted;
+        stats->frames_shed = qos->frames_shed;
+}
@@ -0,0 +1,69 @@
+#ifndef _TTYHUB_QOS_H
+#define _TTYHUB_QOS_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/types.h>
+#include <linux/time64.h>
+#include "ttyhub_ioctl.h"
+
+/* token bucket - tokens are scaled by NSEC_PER_SEC, so refilling them at a
+   rate per second takes a multiplication only */
+struct ttyhub_qos_bucket {
+        u64 rate;
+        s64 tokens;
+        s64 max;
+};
+
+/* receive budget of a subsystem on one tty */
+struct ttyhub_qos {
+        u32 flags;
+        u64 last_ns;
+        struct ttyhub_qos_bucket bytes;
+        struct ttyhub_qos_bucket frames;
+        struct ttyhub_qos_bucket cpu;
+
+        unsigned long frames_admitted;
+        unsigned long frames_shed;
+};
+
+extern struct ttyhub_qos *ttyhub_qos_create(
+                        const struct ttyhub_qos_config *config);
+extern int ttyhub_qos_exhausted(struct ttyhub_qos *qos);
+extern void ttyhub_qos_admit(struct ttyhub_qos *qos);
+extern void ttyhub_qos_get_stats(struct ttyhub_qos *qos,
+                        struct ttyhub_qos_stats *stats);
+
+static inline void ttyhub_qos_charge_bytes(struct ttyhub_qos *qos, int count)
+{
+        if (qos->bytes.rate)
+                qos->bytes.tokens -= (s64)count * NSEC_PER_SEC;
+}
+
+/* nonzero when the time spent in the subsystem must be measured */
+static inline int ttyhub_qos_cpu(struct ttyhub_qos *qos)
+{
+        return qos && qos->cpu.rate;
+}
+
+/* the cpu bucket counts microseconds */
+static inline void ttyhub_qos_charge_cpu(struct ttyhub_qos *qos, u64 ns)
+{
+        qos->cpu.tokens -= ns * (NSEC_PER_SEC / NSEC_PER_USEC);
+}
+
+#endif /* _TTYHUB_QOS_H */
@@ -0,0 +1,368 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Match rules loaded from user space are compiled to a small program for a
+ * machine with one 32 bit accumulator. All jumps go forward, so a program
+ * executes every instruction at most once and the cost of classifying a
+ * frame is bounded by the program length.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include "ttyhub_rules.h"
+
+/* instruction codes */
+#define TTYHUB_OP_LD    1       /* A = field of width at off */
+#define TTYHUB_OP_LDI   2       /* A = k */
+#define TTYHUB_OP_AND   3       /* A &= k */
+#define TTYHUB_OP_ADD   4       /* A += k */
+#define TTYHUB_OP_JEQ   5       /* skip jt instructions if A == k, else jf */
+#define TTYHUB_OP_JGE   6       /* skip jt instructions if A >= k, else jf */
+#define TTYHUB_OP_JGT   7       /* skip jt instructions if A > k, else jf */
+#define TTYHUB_OP_RET   8       /* return verdict off, subsystem k, length A */
+
+/* jump target placeholder for the beginning of the next rule */
+#define TTYHUB_JUMP_NEXT_RULE   0xFFFF
+
+/* maximum number of instructions generated for one rule */
+#define TTYHUB_RULE_MAX_INSNS   (TTYHUB_RULE_MAX_MATCHES * 4 + 5)
+
+struct ttyhub_insn {
+        u8 code;
+        u8 width;
+        u16 off;
+        u16 jt;
+        u16 jf;
+        u32 k;
+};
+
+struct ttyhub_rules {
+        int len;
+        struct ttyhub_insn insns[];
+};
+
+static int ttyhub_rules_width_valid(u8 width)
+{
+        width &= ~TTYHUB_MATCH_LE;
+        return width == 1 || width == 2 || width == 4;
+}
+
+static u32 ttyhub_rules_width_mask(u8 width)
+{
+        switch (width & ~TTYHUB_MATCH_LE) {
+        case 1:
+                return 0xFF;
+        case 2:
+                return 0xFFFF;
+        }
+        return 0xFFFFFFFF;
+}
+
+/*
+ * Check a rule passed from user space.
+ * Every field read by the rule must fit into max_offset bytes, so a rule can
+ * always be decided once the probe buffer is full.
+ *
+ * Returns zero when the rule is valid, -EINVAL otherwise.
+ */
+static int ttyhub_rules_check(const struct ttyhub_rule *rule, int max_offset,
+                        int max_subsys)
+{
+        const struct ttyhub_match *m;
+        int i;
+
+        if (rule->reserved)
+                return -EINVAL;
+        if (rule->action == TTYHUB_RULE_ACCEPT) {
+                if (rule->subsys >= max_subsys)
+                        return -EINVAL;
+        }
+        else if (rule->action != TTYHUB_RULE_DISCARD) {
+                return -EINVAL;
+        }
+
+        if (rule->nmatch > TTYHUB_RULE_MAX_MATCHES)
+                return -EINVAL;
+        for (i=0; i < rule->nmatch; i++) {
+                m = &rule->match[i];
+                if (!ttyhub_rules_width_valid(m->width))
+                        return -EINVAL;
+                if (m->offset + (m->width & ~TTYHUB_MATCH_LE) > max_offset)
+                        return -EINVAL;
+                if (m->op == TTYHUB_MATCH_RANGE) {
+                        if (m->value > m->value2)
+                                return -EINVAL;
+                }
+                else if (m->op != TTYHUB_MATCH_EQ) {
+                        return -EINVAL;
+                }
+        }
+
+        if (rule->len_max == 0 || rule->len_max > INT_MAX / 2)
+                return -EINVAL;
+        if (rule->len_width) {
+                if (!ttyhub_rules_width_valid(rule->len_width))
+                        return -EINVAL;
+                if (rule->len_offset + (rule->len_width & ~TTYHUB_MATCH_LE) >
+                                max_offset)
+                        return -EINVAL;
+        }
+        else if (rule->len_adjust <= 0) {
+                return -EINVAL;
+        }
+
+        return 0;
+}
+
+static struct ttyhub_insn *ttyhub_rules_emit(struct ttyhub_rules *prog,
+                        u8 code, u8 width, u16 off, u32 k)
+{
+        struct ttyhub_insn *insn = &prog->insns[prog->len++];
+
+        insn->code = code;
+        insn->width = width;
+        insn->off = off;
+        insn->jt = 0;
+        insn->jf = 0;
+        insn->k = k;
+        return insn;
+}
+
+/*
+ * Compile one rule.
+ * Jumps to the next rule are emitted with the TTYHUB_JUMP_NEXT_RULE
+ * placeholder and resolved once the length of the rule is known.
+ */
+static void ttyhub_rules_compile_rule(struct ttyhub_rules *prog,
+                        const struct ttyhub_rule *rule)
+{
+        const struct ttyhub_match *m;
+        struct ttyhub_insn *insn;
+        int i, start = prog->len;
+
+        for (i=0; i < rule->nmatch; i++) {
+                m = &rule->match[i];
+                ttyhub_rules_emit(prog, TTYHUB_OP_LD, m->width, m->offset, 0);
+                if (m->mask != ttyhub_rules_width_mask(m->width))
+                        ttyhub_rules_emit(prog, TTYHUB_OP_AND, 0, 0, m->mask);
+                if (m->op == TTYHUB_MATCH_EQ) {
+                        insn = ttyhub_rules_emit(prog, TTYHUB_OP_JEQ, 0, 0,
+                                        m->value);
+                        insn->jf = TTYHUB_JUMP_NEXT_RULE;
+                }
+                else {
+                        insn = ttyhub_rules_emit(prog, TTYHUB_OP_JGE, 0, 0,
+                                        m->value);
+                        insn->jf = TTYHUB_JUMP_NEXT_RULE;
+                        insn = ttyhub_rules_emit(prog, TTYHUB_OP_JGT, 0, 0,
+                                        m->value2);
+                        insn->jt = TTYHUB_JUMP_NEXT_RULE;
+                }
+        }
+
+        /* frame length - out of range lengths (including negative lengths
+           after adding len_adjust) don't match */
+        if (rule->len_width) {
+                ttyhub_rules_emit(prog, TTYHUB_OP_LD, rule->len_width,
+                                rule->len_offset, 0);
+                ttyhub_rules_emit(prog, TTYHUB_OP_ADD, 0, 0,
+                                (u32)rule->len_adjust);
+        }
+        else {
+                ttyhub_rules_emit(prog, TTYHUB_OP_LDI, 0, 0,
+                                (u32)rule->len_adjust);
+        }
+        insn = ttyhub_rules_emit(prog, TTYHUB_OP_JEQ, 0, 0, 0);
+        insn->jt = TTYHUB_JUMP_NEXT_RULE;
+        insn = ttyhub_rules_emit(prog, TTYHUB_OP_JGT, 0, 0, rule->len_max);
+        insn->jt = TTYHUB_JUMP_NEXT_RULE;
+
+        ttyhub_rules_emit(prog, TTYHUB_OP_RET, 0, rule->action,
+                        rule->action == TTYHUB_RULE_ACCEPT ? rule->subsys : 0);
+
+        /* resolve jumps to the next rule */
+        for (i=start; i < prog->len; i++) {
+                insn = &prog->insns[i];
+                if (insn->jt == TTYHUB_JUMP_NEXT_RULE)
+                        insn->jt = prog->len - i - 1;
+                if (insn->jf == TTYHUB_JUMP_NEXT_RULE)
+                        insn->jf = prog->len - i - 1;
+        }
+}
+
+/*
+ * Verify a compiled program.
+ * Jumps must stay inside the program, loads must stay inside max_offset
+ * bytes and the last instruction must be a return.
+ *
+ * Returns zero when the program is valid, -EINVAL otherwise.
+ */
+static int ttyhub_rules_verify(const struct ttyhub_rules *prog, int max_offset)
+{
+        const struct ttyhub_insn *insn;
+        int pc;
+
+        if (prog->len == 0 ||
+                        prog->insns[prog->len - 1].code != TTYHUB_OP_RET)
+                return -EINVAL;
+
+        for (pc=0; pc < prog->len; pc++) {
+                insn = &prog->insns[pc];
+                switch (insn->code) {
+                case TTYHUB_OP_LD:
+                        if (!ttyhub_rules_width_valid(insn->width) ||
+                                        insn->off + (insn->width &
+                                        ~TTYHUB_MATCH_LE) > max_offset)
+                                return -EINVAL;
+                        break;
+                case TTYHUB_OP_JEQ:
+                case TTYHUB_OP_JGE:
+                case TTYHUB_OP_JGT:
+                        if (pc + 1 + insn->jt >= prog->len ||
+                                        pc + 1 + insn->jf >= prog->len)
+                                return -EINVAL;
+                        break;
+                case TTYHUB_OP_LDI:
+                case TTYHUB_OP_AND:
+                case TTYHUB_OP_ADD:
+                case TTYHUB_OP_RET:
+                        break;
+                default:
+                        return -EINVAL;
+                }
+        }
+
+        return 0;
+}
+
+/*
+ * Compile a set of match rules.
+ * The rules are checked and translated into a program that evaluates them
+ * in the given order. max_offset is the size of the probe buffer and
+ * max_subsys the number of possible subsystems.
+ *
+ * Returns the compiled program or an ERR_PTR() value on error.
+ */
+struct ttyhub_rules *ttyhub_rules_compile(const struct ttyhub_rule *rules,
+                        int count, int max_offset, int max_subsys)
+{
+        struct ttyhub_rules *prog;
+        int i, err;
+
+        if (count <= 0 || count > TTYHUB_RULES_MAX)
+                return ERR_PTR(-EINVAL);
+
+        for (i=0; i < count; i++) {
+                err = ttyhub_rules_check(&rules[i], max_offset, max_subsys);
+                if (err < 0)
+                        return ERR_PTR(err);
+        }
+
+        prog = kmalloc(sizeof(*prog) + sizeof(struct ttyhub_insn) *
+                        (count * TTYHUB_RULE_MAX_INSNS + 1), GFP_KERNEL);
+        if (prog == NULL)
+                return ERR_PTR(-ENOMEM);
+        prog->len = 0;
+
+        for (i=0; i < count; i++)
+                ttyhub_rules_compile_rule(prog, &rules[i]);
+        ttyhub_rules_emit(prog, TTYHUB_OP_RET, 0, TTYHUB_RULES_NOMATCH, 0);
+
+        err = ttyhub_rules_verify(prog, max_offset);
+        if (err < 0) {
+                kfree(prog);
+                return ERR_PTR(err);
+        }
+
+        return prog;
+}
+
+void ttyhub_rules_free(struct ttyhub_rules *prog)
+{
+        kfree(prog);
+}
+
+static u32 ttyhub_rules_load(const unsigned char *cp, u8 width)
+{
+        switch (width) {
+        case 1:
+        case 1 | TTYHUB_MATCH_LE:
+                return cp[0];
+        case 2:
+                return cp[0] << 8 | cp[1];
+        case 2 | TTYHUB_MATCH_LE:
+                return cp[1] << 8 | cp[0];
+        case 4:
+                return (u32)cp[0] << 24 | cp[1] << 16 | cp[2] << 8 | cp[3];
+        }
+        return (u32)cp[3] << 24 | cp[2] << 16 | cp[1] << 8 | cp[0];
+}
+
+/*
+ * Run a compiled program on the data at the beginning of a frame.
+ * This may be called in atomic context.
+ *
+ * Returns:
+ *      TTYHUB_RULES_NOMATCH    no rule matched
+ *      TTYHUB_RULES_ACCEPT     frame of *len bytes for subsystem *subsys
+ *      TTYHUB_RULES_DISCARD    frame of *len bytes must be discarded
+ *      TTYHUB_RULES_NEED_MORE  more data is needed to decide
+ */
+int ttyhub_rules_run(const struct ttyhub_rules *prog, const unsigned char *cp,
+                        int count, int *subsys, int *len)
+{
+        const struct ttyhub_insn *insn = prog->insns;
+        u32 a = 0;
+
+        while (1) {
+                switch (insn->code) {
+                case TTYHUB_OP_LD:
+                        if (insn->off + (insn->width & ~TTYHUB_MATCH_LE) >
+                                        count)
+                                return TTYHUB_RULES_NEED_MORE;
+                        a = ttyhub_rules_load(cp + insn->off, insn->width);
+                        break;
+                case TTYHUB_OP_LDI:
+                        a = insn->k;
+                        break;
+                case TTYHUB_OP_AND:
+                        a &= insn->k;
+                        break;
+                case TTYHUB_OP_ADD:
+                        a += insn->k;
+                        break;
+                case TTYHUB_OP_JEQ:
+                        insn += a == insn->k ? insn->jt : insn->jf;
+                        break;
+                case TTYHUB_OP_JGE:
+                        insn += a >= insn->k ? insn->jt : insn->jf;
+                        break;
+                case TTYHUB_OP_JGT:
+                        insn += a > insn->k ? insn->jt : insn->jf;
+                        break;
+                case TTYHUB_OP_RET:
+                        *subsys = insn->k;
+                        *len = a;
+                        return insn->off;
+                default:
+                        return TTYHUB_RULES_NOMATCH;
+                }
+                insn++;
+        }
+}
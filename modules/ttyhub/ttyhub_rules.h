@@ -0,0 +1,37 @@
+#ifndef _TTYHUB_RULES_H
+#define _TTYHUB_RULES_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ttyhub_ioctl.h"
+
+/* return values of ttyhub_rules_run() */
+#define TTYHUB_RULES_NOMATCH            0
+#define TTYHUB_RULES_ACCEPT             TTYHUB_RULE_ACCEPT
+#define TTYHUB_RULES_DISCARD            TTYHUB_RULE_DISCARD
+#define TTYHUB_RULES_NEED_MORE          3
+
+struct ttyhub_rules;
+
+extern struct ttyhub_rules *ttyhub_rules_compile(const struct ttyhub_rule *rules,
+                        int count, int max_offset, int max_subsys);
+extern void ttyhub_rules_free(struct ttyhub_rules *prog);
+extern int ttyhub_rules_run(const struct ttyhub_rules *prog,
+                        const unsigned char *cp, int count,
+                        int *subsys, int *len);
+
+#endif /* _TTYHUB_RULES_H */
@@ -0,0 +1,131 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include "ttyhub_static.h"
+
+static int static_bench = 0;
+module_param(static_bench, int, 0);
+MODULE_PARM_DESC(static_bench, "Number of frames for the static subsystem "
+                "dispatch benchmark run at load time (0 = off)");
+
+/*
+ * Compare direct and indirect calls of the hot path operations of a static
+ * subsystem. Every frame is probed and received once per iteration.
+ */
+static void __init __maybe_unused ttyhub_static_bench(const char *name,
+                        int index, void (*bench)(int),
+                        int (*attach)(void **, struct tty_struct *),
+                        void (*detach)(void *),
+                        int (*probe_data)(void *, const unsigned char *, int),
+                        int (*do_receive)(void *, const unsigned char *, int),
+                        const unsigned char *frame, int len)
+{
+        int (* volatile indirect_probe_data)(void *, const unsigned char *,
+                        int) = probe_data;
+        int (* volatile indirect_do_receive)(void *, const unsigned char *,
+                        int) = do_receive;
+        void *data = NULL;
+        u64 start, direct_ns, indirect_ns;
+        int i;
+
+        bench(1);
+        if (attach(&data, NULL) < 0) {
+                bench(0);
+                return;
+        }
+
+        start = ktime_get_ns();
+        for (i=0; i < static_bench; i++) {
+                ttyhub_call_probe_data(index, NULL, data, frame, len);
+                ttyhub_call_do_receive(index, NULL, data, frame, len);
+        }
+        direct_ns = ktime_get_ns() - start;
+
+        start = ktime_get_ns();
+        for (i=0; i < static_bench; i++) {
+                indirect_probe_data(data, frame, len);
+                indirect_do_receive(data, frame, len);
+        }
+        indirect_ns = ktime_get_ns() - start;
+
+        detach(data);
+        bench(0);
+
+        printk(KERN_INFO "ttyhub: dispatch benchmark '%s' (%d frames): "
+                "direct %llu ps/frame, indirect %llu ps/frame\n", name,
+                static_bench, div_u64(direct_ns * 1000, static_bench),
+                div_u64(indirect_ns * 1000, static_bench));
+}
+
+static int __init __maybe_unused ttyhub_static_check(const char *name,
+                        int index, int status)
+{
+        if (status == index)
+                return 0;
+
+        printk(KERN_ERR "ttyhub: can't register static subsystem '%s' as "
+                "#%d\n", name, index);
+        return status < 0 ? status : -EINVAL;
+}
+
+/*
+ * Register all static subsystems.
+ * This must be called before any other subsystem can be registered.
+ *
+ * Returns zero on success or a negative error code.
+ */
+int __init ttyhub_static_init(void)
+{
+#define TTYHUB_STATIC_INIT(name, frame) \
+        { \
+                int status = ttyhub_static_check(#name, \
+                                TTYHUB_STATIC_INDEX(name), \
+                                name##_static_init()); \
+                if (status < 0) { \
+                        ttyhub_static_exit(); \
+                        return status; \
+                } \
+        }
+        TTYHUB_STATIC_SUBSYSTEMS(TTYHUB_STATIC_INIT)
+#undef TTYHUB_STATIC_INIT
+
+        if (static_bench > 0) {
+#define TTYHUB_STATIC_BENCH(name, frame) \
+                ttyhub_static_bench(#name, TTYHUB_STATIC_INDEX(name), \
+                        name##_static_bench, name##_attach, name##_detach, \
+                        name##_probe_data, name##_do_receive, \
+                        (const unsigned char *)frame, sizeof(frame) - 1);
+                TTYHUB_STATIC_SUBSYSTEMS(TTYHUB_STATIC_BENCH)
+#undef TTYHUB_STATIC_BENCH
+        }
+
+        return 0;
+}
+
+/* Unregister all static subsystems that are registered. */
+void ttyhub_static_exit(void)
+{
+#define TTYHUB_STATIC_EXIT(name, frame) \
+        name##_static_exit();
+        TTYHUB_STATIC_SUBSYSTEMS(TTYHUB_STATIC_EXIT)
+#undef TTYHUB_STATIC_EXIT
+}
@@ -0,0 +1,118 @@
+#ifndef _TTYHUB_STATIC_H
+#define _TTYHUB_STATIC_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Subsystems linked into ttyhub.ko at build time (see the Makefile).
+ * They are registered before the line discipline, so they always get the
+ * indices 0 to TTYHUB_NR_STATIC-1 and the receive path calls their
+ * operations directly. All other subsystems are called through the function
+ * pointers in struct ttyhub_subsystem.
+ * A static subsystem must implement attach(), detach(), probe_data(),
+ * probe_size() and do_receive() and provide <name>_static_init() returning
+ * its subsystem index and <name>_static_exit(). <name>_static_bench() is
+ * called with 1 before and with 0 after the dispatch benchmark, e.g. to
+ * switch off logging.
+ */
+
+#include "ttyhub.h"
+
+#ifdef TTYHUB_STATIC_TESTSUBSYS0
+#define TTYHUB_STATIC_TESTSUBSYS0_ENTRY(X) X(testsubsys0, "!AAA")
+#else
+#define TTYHUB_STATIC_TESTSUBSYS0_ENTRY(X)
+#endif
+
+/* X(name, frame) for every static subsystem - frame is a string recognized by
+   the subsystem that is used for the dispatch benchmark */
+#define TTYHUB_STATIC_SUBSYSTEMS(X) \
+        TTYHUB_STATIC_TESTSUBSYS0_ENTRY(X)
+
+#define TTYHUB_STATIC_DECLARE(name, frame) \
+        extern int name##_static_init(void); \
+        extern void name##_static_exit(void); \
+        extern void name##_static_bench(int); \
+        extern int name##_attach(void **, struct tty_struct *); \
+        extern void name##_detach(void *); \
+        extern int name##_probe_data(void *, const unsigned char *, int); \
+        extern int name##_probe_size(void *, const unsigned char *, int); \
+        extern int name##_do_receive(void *, const unsigned char *, int);
+TTYHUB_STATIC_SUBSYSTEMS(TTYHUB_STATIC_DECLARE)
+#undef TTYHUB_STATIC_DECLARE
+
+#define TTYHUB_STATIC_INDEX(name) TTYHUB_STATIC_INDEX_##name
+
+enum {
+#define TTYHUB_STATIC_ENUM(name, frame) TTYHUB_STATIC_INDEX(name),
+        TTYHUB_STATIC_SUBSYSTEMS(TTYHUB_STATIC_ENUM)
+#undef TTYHUB_STATIC_ENUM
+        TTYHUB_NR_STATIC
+};
+
+#define TTYHUB_STATIC_CASE_PROBE_DATA(name, frame) \
+        case TTYHUB_STATIC_INDEX(name): \
+                return name##_probe_data(data, cp, count);
+#define TTYHUB_STATIC_CASE_PROBE_SIZE(name, frame) \
+        case TTYHUB_STATIC_INDEX(name): \
+                return name##_probe_size(data, cp, count);
+#define TTYHUB_STATIC_CASE_DO_RECEIVE(name, frame) \
+        case TTYHUB_STATIC_INDEX(name): \
+                return name##_do_receive(data, cp, count);
+
+/* hot path operations - direct calls for static subsystems, indirect calls
+   for all others */
+static inline int ttyhub_call_probe_data(int index,
+                        struct ttyhub_subsystem *subs, void *data,
+                        const unsigned char *cp, int count)
+{
+        switch (index) {
+        TTYHUB_STATIC_SUBSYSTEMS(TTYHUB_STATIC_CASE_PROBE_DATA)
+        default:
+                break;
+        }
+        return subs->probe_data(data, cp, count);
+}
+
+static inline int ttyhub_call_probe_size(int index,
+                        struct ttyhub_subsystem *subs, void *data,
+                        const unsigned char *cp, int count)
+{
+        switch (index) {
+        TTYHUB_STATIC_SUBSYSTEMS(TTYHUB_STATIC_CASE_PROBE_SIZE)
+        default:
+                break;
+        }
+        return subs->probe_size(data, cp, count);
+}
+
+static inline int ttyhub_call_do_receive(int index,
+                        struct ttyhub_subsystem *subs, void *data,
+                        const unsigned char *cp, int count)
+{
+        switch (index) {
+        TTYHUB_STATIC_SUBSYSTEMS(TTYHUB_STATIC_CASE_DO_RECEIVE)
+        default:
+                break;
+        }
+        return subs->do_receive(data, cp, count);
+}
+
+extern int ttyhub_static_init(void);
+extern void ttyhub_static_exit(void);
+
+#endif /* _TTYHUB_STATIC_H */
@@ -0,0 +1,981 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * KUnit tests and microbenchmarks of the receive state machine.
+ *
+ * This file is included by ttyhub_core.c when built with
+ * TTYHUB_KUNIT_TEST=y (or CONFIG_TTYHUB_KUNIT_TEST, see Kconfig), so the
+ * tests drive ttyhub_ldisc_receive_buf() directly with a mock tty and mock
+ * subsystems. The suite runs when ttyhub.ko is loaded into a kernel with
+ * CONFIG_KUNIT, or with kunit.py under UML or QEMU when the modules
+ * directory is part of the kernel tree:
+ *      ./tools/testing/kunit/kunit.py run --kunitconfig=<dir>/ttyhub
+ *
+ * The mock subsystems speak these protocols:
+ *  L   'L' len(2 decimal digits) payload...    do_receive() delimits
+ *  F   'F' len(2 decimal digits) payload...    do_receive() delimits,
+ *                                              receive_frame() delivers
+ *  D   'D' len(2 decimal digits) payload...    skipped by probe_size()
+ *  H   HDLC framed, 0x7E flags, 0x7D escapes   ttyhub delimits
+ * L, F and D payloads are lower case letters. Any other byte is skipped
+ * one at a time by the probe_size() operation of D, so the state machine
+ * resynchronizes on the next frame without a timed discard.
+ *
+ * Every delivered frame is appended to a log, which must equal the log
+ * expected by the stream generator no matter how the stream is split into
+ * chunks.
+ */
+
+#include <linux/ctype.h>
+#include <linux/delay.h>
+#include <kunit/test.h>
+
+#define TTYHUB_TEST_STREAM_MIX          0
+#define TTYHUB_TEST_STREAM_HDLC         1
+#define TTYHUB_TEST_STREAM_L            2       /* L frames only */
+
+/* masks of the mock subsystems to enable */
+#define TTYHUB_TEST_L                   0x01
+#define TTYHUB_TEST_H                   0x08
+#define TTYHUB_TEST_ALL                 0x0F
+
+/* log entries are tag, 16 bit length and the frame data */
+struct ttyhub_test_log {
+        u8 *buf;
+        int len;
+        int size;
+        int overflow;
+        unsigned long frames;
+        unsigned long frame_errors;
+        ktime_t ts_first;       /* of the last frame from receive_frame() */
+        ktime_t ts_last;
+};
+
+struct ttyhub_test_stream {
+        u8 *data;
+        int len;
+        struct ttyhub_test_log expect;
+        int error_off;
+        unsigned int subsystems;
+};
+
+/* per tty data of the mock subsystems */
+struct ttyhub_test_recv {
+        struct ttyhub_test_log *log;
+        char tag;
+        int remain;
+        int len;
+        u8 frame[3 + 99];
+};
+
+struct ttyhub_test_ctx {
+        struct tty_struct *tty;
+        int index[4];
+};
+
+/* log of the state created next - the tests run one at a time */
+static struct ttyhub_test_log *ttyhub_test_log_current;
+
+static u32 ttyhub_test_rand(u32 *seed)
+{
+        *seed = *seed * 1103515245 + 12345;
+        return *seed >> 16;
+}
+
+static void ttyhub_test_log_init(struct kunit *test,
+                        struct ttyhub_test_log *log, int size)
+{
+        log->buf = size ? kunit_kzalloc(test, size, GFP_KERNEL) : NULL;
+        if (size)
+                KUNIT_ASSERT_NOT_NULL(test, log->buf);
+        log->len = 0;
+        log->size = size;
+        log->overflow = 0;
+        log->frames = 0;
+        log->frame_errors = 0;
+        log->ts_first = 0;
+        log->ts_last = 0;
+}
+
+/* a log without a buffer only counts the frames (used by the benchmarks) */
+static void ttyhub_test_log_append(struct ttyhub_test_log *log, char tag,
+                        const void *data, int len)
+{
+        log->frames++;
+        if (log->buf == NULL)
+                return;
+        if (log->len + 3 + len > log->size) {
+                log->overflow = 1;
+                return;
+        }
+        log->buf[log->len++] = tag;
+        log->buf[log->len++] = len & 0xFF;
+        log->buf[log->len++] = len >> 8;
+        memcpy(log->buf + log->len, data, len);
+        log->len += len;
+}
+
+static int ttyhub_test_log_equal(const struct ttyhub_test_log *a,
+                        const struct ttyhub_test_log *b)
+{
+        if (a->overflow || b->overflow || a->frames != b->frames)
+                return 0;
+        if (a->buf == NULL || b->buf == NULL)
+                return 1;
+        return a->len == b->len && memcmp(a->buf, b->buf, a->len) == 0;
+}
+
+/*
+ * Mock subsystems
+ */
+
+static int ttyhub_test_attach(void **data, char tag)
+{
+        struct ttyhub_test_recv *recv;
+
+        recv = kzalloc(sizeof(*recv), GFP_KERNEL);
+        if (recv == NULL)
+                return -ENOMEM;
+        recv->log = ttyhub_test_log_current;
+        recv->tag = tag;
+        *data = recv;
+        return 0;
+}
+
+static int ttyhub_test_attach_l(void **data, struct tty_struct *tty)
+{
+        return ttyhub_test_attach(data, 'L');
+}
+
+static int ttyhub_test_attach_f(void **data, struct tty_struct *tty)
+{
+        return ttyhub_test_attach(data, 'F');
+}
+
+static int ttyhub_test_attach_d(void **data, struct tty_struct *tty)
+{
+        return ttyhub_test_attach(data, 'D');
+}
+
+static int ttyhub_test_attach_h(void **data, struct tty_struct *tty)
+{
+        return ttyhub_test_attach(data, 'H');
+}
+
+static void ttyhub_test_detach(void *data)
+{
+        kfree(data);
+}
+
+/* length of a frame with a decimal length field - zero if cp is no frame
+   of the tag */
+static int ttyhub_test_frame_len(char tag, const unsigned char *cp, int count)
+{
+        if (cp[0] != tag || !isdigit(cp[1]) || !isdigit(cp[2]))
+                return 0;
+        return 3 + (cp[1] - '0') * 10 + (cp[2] - '0');
+}
+
+static int ttyhub_test_probe_data(void *data, const unsigned char *cp,
+                        int count)
+{
+        struct ttyhub_test_recv *recv = data;
+
+        if (recv->tag == 'H')
+                return cp[0] == 0x7E;
+        if (recv->tag == 'D')
+                return 0;
+        recv->remain = ttyhub_test_frame_len(recv->tag, cp, count);
+        recv->len = 0;
+        return recv->remain != 0;
+}
+
+static int ttyhub_test_probe_size(void *data, const unsigned char *cp,
+                        int count)
+{
+        if (cp[0] != 'D')
+                /* garbage - skip a single byte */
+                return 1;
+        if (count < 3)
+                return 0;
+        return ttyhub_test_frame_len('D', cp, count);
+}
+
+static int ttyhub_test_do_receive(void *data, const unsigned char *cp,
+                        int count)
+{
+        struct ttyhub_test_recv *recv = data;
+        int n = min(count, recv->remain);
+
+        memcpy(recv->frame + recv->len, cp, n);
+        recv->len += n;
+        recv->remain -= n;
+        if (recv->remain)
+                return -1;
+        if (recv->tag == 'L')
+                ttyhub_test_log_append(recv->log, 'L', recv->frame,
+                                recv->len);
+        return n;
+}
+
+static void ttyhub_test_receive_frame(void *data, struct ttyhub_frame *frame)
+{
+        struct ttyhub_test_recv *recv = data;
+
+        ttyhub_test_log_append(recv->log, recv->tag, frame->data, frame->len);
+        recv->log->ts_first = frame->ts_first;
+        recv->log->ts_last = frame->ts_last;
+        ttyhub_frame_put(frame);
+}
+
+static void ttyhub_test_frame_error(void *data, char flag)
+{
+        struct ttyhub_test_recv *recv = data;
+
+        recv->log->frame_errors++;
+}
+
+static struct ttyhub_subsystem ttyhub_test_subsystems[4] = {
+        {
+                .name = "kunit_l",
+                .owner = THIS_MODULE,
+                .attach = ttyhub_test_attach_l,
+                .detach = ttyhub_test_detach,
+                .probe_data = ttyhub_test_probe_data,
+                .do_receive = ttyhub_test_do_receive,
+                .frame_error = ttyhub_test_frame_error,
+                .probe_data_minimum_bytes = 3,
+        },
+        {
+                .name = "kunit_f",
+                .owner = THIS_MODULE,
+                .attach = ttyhub_test_attach_f,
+                .detach = ttyhub_test_detach,
+                .probe_data = ttyhub_test_probe_data,
+                .do_receive = ttyhub_test_do_receive,
+                .receive_frame = ttyhub_test_receive_frame,
+                .frame_error = ttyhub_test_frame_error,
+                .probe_data_minimum_bytes = 3,
+        },
+        {
+                .name = "kunit_d",
+                .owner = THIS_MODULE,
+                .attach = ttyhub_test_attach_d,
+                .detach = ttyhub_test_detach,
+                .probe_data = ttyhub_test_probe_data,
+                .probe_size = ttyhub_test_probe_size,
+                .do_receive = ttyhub_test_do_receive,
+                .probe_data_minimum_bytes = 1,
+        },
+        {
+                .name = "kunit_h",
+                .owner = THIS_MODULE,
+                .attach = ttyhub_test_attach_h,
+                .detach = ttyhub_test_detach,
+                .probe_data = ttyhub_test_probe_data,
+                .do_receive = ttyhub_test_do_receive,
+                .receive_frame = ttyhub_test_receive_frame,
+                .frame_error = ttyhub_test_frame_error,
+                .framing = TTYHUB_FRAMING_HDLC,
+                .probe_data_minimum_bytes = 1,
+        },
+};
+
+/*
+ * Stream generator
+ */
+
+/* frame with a decimal length field and a lower case payload */
+static int ttyhub_test_gen_frame(u32 *seed, char tag, u8 *buf)
+{
+        int i, n = ttyhub_test_rand(seed) % 61;
+
+        buf[0] = tag;
+        buf[1] = '0' + n / 10;
+        buf[2] = '0' + n % 10;
+        for (i=0; i < n; i++)
+                buf[3 + i] = 'a' + ttyhub_test_rand(seed) % 26;
+        return 3 + n;
+}
+
+/* HDLC frame without its closing flag - payload written to payload */
+static int ttyhub_test_gen_hdlc(u32 *seed, u8 *buf, u8 *payload, int *len)
+{
+        int i, k = 0, n = 1 + ttyhub_test_rand(seed) % 40;
+        u8 c;
+
+        buf[k++] = 0x7E;
+        /* sometimes a frame starts with more than one flag */
+        if (ttyhub_test_rand(seed) % 8 == 0)
+                buf[k++] = 0x7E;
+        for (i=0; i < n; i++) {
+                /* favour the bytes that need escaping */
+                c = ttyhub_test_rand(seed) % 4 == 0 ?
+                        0x7D + ttyhub_test_rand(seed) % 2 :
+                        ttyhub_test_rand(seed);
+                payload[i] = c;
+                if (c == 0x7E || c == 0x7D) {
+                        buf[k++] = 0x7D;
+                        c ^= 0x20;
+                }
+                buf[k++] = c;
+        }
+        *len = n;
+        return k;
+}
+
+/*
+ * Generate a stream of about size bytes of the given kind and the log of
+ * the frames the mock subsystems deliver for it. When error_frame is not
+ * negative, that frame is left out of the expected log and the offset of a
+ * byte within it is stored in error_off (only for TTYHUB_TEST_STREAM_MIX).
+ */
+static void ttyhub_test_gen(struct kunit *test, struct ttyhub_test_stream *s,
+                        int kind, u32 seed, int size, int error_frame)
+{
+        u8 item[2 * 41 + 2], payload[41];
+        int n, len, frame = 0;
+        u32 r;
+
+        s->data = kunit_kzalloc(test, size, GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, s->data);
+        ttyhub_test_log_init(test, &s->expect, 2 * size);
+        s->len = 0;
+        s->error_off = -1;
+        s->subsystems = TTYHUB_TEST_ALL;
+
+        while (1) {
+                r = ttyhub_test_rand(&seed) % 8;
+                if (kind == TTYHUB_TEST_STREAM_HDLC) {
+                        n = ttyhub_test_gen_hdlc(&seed, item, payload, &len);
+                        /* room for the closing flag */
+                        if (s->len + n + 1 > size)
+                                break;
+                        ttyhub_test_log_append(&s->expect, 'H', payload, len);
+                }
+                else if (r < 3 || r == 7 || kind == TTYHUB_TEST_STREAM_L) {
+                        n = ttyhub_test_gen_frame(&seed, r == 7 &&
+                                        kind == TTYHUB_TEST_STREAM_MIX ?
+                                        'F' : 'L', item);
+                        if (s->len + n > size)
+                                break;
+                        if (error_frame >= 0 && frame >= error_frame &&
+                                        n > 3) {
+                                s->error_off = s->len + 3 +
+                                        ttyhub_test_rand(&seed) % (n - 3);
+                                error_frame = -1;
+                        }
+                        else
+                                ttyhub_test_log_append(&s->expect, item[0],
+                                                item, n);
+                        frame++;
+                }
+                else if (r < 6) {
+                        n = ttyhub_test_gen_frame(&seed, 'D', item);
+                        if (s->len + n > size)
+                                break;
+                }
+                else {
+                        /* garbage */
+                        n = 1 + ttyhub_test_rand(&seed) % 4;
+                        memset(item, '0' + ttyhub_test_rand(&seed) % 10, n);
+                        if (s->len + n > size)
+                                break;
+                }
+                memcpy(s->data + s->len, item, n);
+                s->len += n;
+        }
+        if (kind == TTYHUB_TEST_STREAM_HDLC)
+                s->data[s->len++] = 0x7E;
+}
+
+/*
+ * Receive state of the mock tty
+ */
+
+/* the mock tty driver accepts everything written unless the room left is
+   limited */
+static int ttyhub_test_tty_room = -1;
+
+static ssize_t ttyhub_test_tty_write(struct tty_struct *tty, const u8 *buf,
+                        size_t count)
+{
+        if (ttyhub_test_tty_room >= 0 && count > ttyhub_test_tty_room)
+                return ttyhub_test_tty_room;
+        return count;
+}
+
+static const struct tty_operations ttyhub_test_tty_ops = {
+        .write = ttyhub_test_tty_write,
+};
+
+static struct ttyhub_state *ttyhub_test_state_new(struct kunit *test,
+                        struct ttyhub_test_log *log, unsigned int subsystems)
+{
+        struct ttyhub_test_ctx *ctx = test->priv;
+        struct ttyhub_state *state;
+        int i, err;
+
+        state = ttyhub_state_create(ctx->tty);
+        KUNIT_ASSERT_NOT_NULL(test, state);
+        ctx->tty->disc_data = state;
+
+        ttyhub_test_log_current = log;
+        for (i=0; i < ARRAY_SIZE(ctx->index); i++) {
+                if (!(subsystems & 1 << i))
+                        continue;
+                err = ttyhub_subsystem_enable(state, ctx->index[i], NULL);
+                if (err < 0) {
+                        ttyhub_state_destroy(state);
+                        KUNIT_ASSERT_EQ(test, err, 0);
+                }
+        }
+        return state;
+}
+
+/*
+ * Feed data to the line discipline in chunks ending at the offsets in cuts.
+ * Like the flip buffer, bytes not accepted are passed again together with
+ * the next chunk.
+ *
+ * Returns the number of bytes accepted.
+ */
+static int ttyhub_test_feed(struct tty_struct *tty, const u8 *data,
+                        const u8 *fp, int len, const int *cuts, int ncuts)
+{
+        int k, n, end, pos = 0;
+
+        for (k=0; k <= ncuts; k++) {
+                end = k < ncuts ? cuts[k] : len;
+                while (pos < end) {
+                        n = ttyhub_ldisc_receive_buf(tty, data + pos,
+                                        fp ? fp + pos : NULL, end - pos);
+                        if (n == 0)
+                                break;
+                        pos += n;
+                }
+        }
+        return pos;
+}
+
+/* feed a stream in the given chunks to a new state - returns nonzero when
+   the frames delivered are the frames expected */
+static int ttyhub_test_run(struct kunit *test, struct ttyhub_test_stream *s,
+                        const u8 *fp, const int *cuts, int ncuts)
+{
+        struct ttyhub_test_ctx *ctx = test->priv;
+        struct ttyhub_test_log log;
+        struct ttyhub_state *state;
+        int pos, ok;
+
+        ttyhub_test_log_init(test, &log, s->expect.size);
+        state = ttyhub_test_state_new(test, &log, s->subsystems);
+        pos = ttyhub_test_feed(ctx->tty, s->data, fp, s->len, cuts, ncuts);
+        ok = pos == s->len && ttyhub_test_log_equal(&log, &s->expect) &&
+                state->timed_discards == 0;
+        if (fp)
+                ok = ok && log.frame_errors == 1 &&
+                        state->errors_parity == 1 &&
+                        state->frames_aborted == 1;
+        ttyhub_state_destroy(state);
+        kunit_kfree(test, log.buf);
+        return ok;
+}
+
+/*
+ * Test cases
+ */
+
+static const int ttyhub_test_kinds[] = {
+        TTYHUB_TEST_STREAM_MIX, TTYHUB_TEST_STREAM_HDLC };
+
+static void ttyhub_test_whole(struct kunit *test)
+{
+        struct ttyhub_test_stream s;
+        int i;
+
+        for (i=0; i < ARRAY_SIZE(ttyhub_test_kinds); i++) {
+                ttyhub_test_gen(test, &s, ttyhub_test_kinds[i], 1 + i, 4096,
+                                -1);
+                KUNIT_EXPECT_GT(test, s.expect.frames, 50UL);
+                KUNIT_EXPECT_TRUE_MSG(test, ttyhub_test_run(test, &s, NULL,
+                                        NULL, 0), "stream kind %d",
+                                ttyhub_test_kinds[i]);
+        }
+}
+
+/* every split of a short stream into two or three chunks */
+static void ttyhub_test_split_all(struct kunit *test)
+{
+        struct ttyhub_test_stream s;
+        int i, a, b, cuts[2];
+
+        for (i=0; i < ARRAY_SIZE(ttyhub_test_kinds); i++) {
+                ttyhub_test_gen(test, &s, ttyhub_test_kinds[i], 7 + i, 96,
+                                -1);
+                for (a=1; a < s.len; a++) {
+                        for (b=a; b < s.len; b++) {
+                                cuts[0] = a;
+                                cuts[1] = b;
+                                if (!ttyhub_test_run(test, &s, NULL, cuts,
+                                                        2)) {
+                                        KUNIT_FAIL(test, "stream kind %d "
+                                                "split at %d and %d",
+                                                ttyhub_test_kinds[i], a, b);
+                                        return;
+                                }
+                        }
+                }
+        }
+}
+
+/* chunks of every size from one byte to the probe buffer size and beyond */
+static void ttyhub_test_split_uniform(struct kunit *test)
+{
+        struct ttyhub_test_stream s;
+        int i, c, k, ncuts, *cuts;
+
+        cuts = kunit_kcalloc(test, 1024, sizeof(*cuts), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, cuts);
+
+        for (i=0; i < ARRAY_SIZE(ttyhub_test_kinds); i++) {
+                ttyhub_test_gen(test, &s, ttyhub_test_kinds[i], 13 + i, 1024,
+                                -1);
+                for (c=1; c <= 2 * probe_buf_size + 1; c++) {
+                        ncuts = 0;
+                        for (k=c; k < s.len; k += c)
+                                cuts[ncuts++] = k;
+                        KUNIT_EXPECT_TRUE_MSG(test, ttyhub_test_run(test, &s,
+                                                NULL, cuts, ncuts),
+                                        "stream kind %d chunk size %d",
+                                        ttyhub_test_kinds[i], c);
+                }
+        }
+}
+
+/* random chunk sizes between 1 and 80 bytes */
+static void ttyhub_test_split_random(struct kunit *test)
+{
+        struct ttyhub_test_stream s;
+        int i, j, k, ncuts, *cuts;
+        u32 seed = 42;
+
+        cuts = kunit_kcalloc(test, 4096, sizeof(*cuts), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, cuts);
+
+        for (i=0; i < ARRAY_SIZE(ttyhub_test_kinds); i++) {
+                ttyhub_test_gen(test, &s, ttyhub_test_kinds[i], 21 + i, 4096,
+                                -1);
+                for (j=0; j < 200; j++) {
+                        ncuts = 0;
+                        k = 1 + ttyhub_test_rand(&seed) % 80;
+                        for (; k < s.len; k += 1 + ttyhub_test_rand(&seed) % 80)
+                                cuts[ncuts++] = k;
+                        if (!ttyhub_test_run(test, &s, NULL, cuts, ncuts)) {
+                                KUNIT_FAIL(test, "stream kind %d random "
+                                        "split %d", ttyhub_test_kinds[i], j);
+                                return;
+                        }
+                }
+        }
+}
+
+/* a byte flagged with a parity error aborts its frame only */
+static void ttyhub_test_line_error(struct kunit *test)
+{
+        struct ttyhub_test_stream s;
+        int c, k, ncuts, *cuts;
+        u8 *fp;
+
+        ttyhub_test_gen(test, &s, TTYHUB_TEST_STREAM_MIX, 31, 512, 5);
+        KUNIT_ASSERT_GE(test, s.error_off, 0);
+        cuts = kunit_kcalloc(test, s.len, sizeof(*cuts), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, cuts);
+        fp = kunit_kzalloc(test, s.len, GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, fp);
+        fp[s.error_off] = TTY_PARITY;
+
+        for (c=1; c <= 64; c++) {
+                ncuts = 0;
+                for (k=c; k < s.len; k += c)
+                        cuts[ncuts++] = k;
+                KUNIT_EXPECT_TRUE_MSG(test, ttyhub_test_run(test, &s, fp,
+                                        cuts, ncuts), "chunk size %d", c);
+        }
+}
+
+/* a subsystem disabled mid-frame finishes the frame, the others go on */
+static void ttyhub_test_disable_async(struct kunit *test)
+{
+        static const u8 head[] = "L05ab";
+        static const u8 tail[] = "cdeF02xyL01q";
+        struct ttyhub_test_ctx *ctx = test->priv;
+        struct ttyhub_test_log log, expect;
+        struct ttyhub_state *state;
+        int l = ctx->index[0];
+
+        ttyhub_test_log_init(test, &expect, 64);
+        ttyhub_test_log_append(&expect, 'L', "L05abcde", 8);
+        ttyhub_test_log_append(&expect, 'F', "F02xy", 5);
+
+        ttyhub_test_log_init(test, &log, 64);
+        state = ttyhub_test_state_new(test, &log, TTYHUB_TEST_ALL);
+        ttyhub_test_feed(ctx->tty, head, NULL, sizeof(head) - 1, NULL, 0);
+        KUNIT_EXPECT_EQ(test, state->recv_subsys, l);
+
+        KUNIT_EXPECT_EQ(test, ttyhub_subsystem_disable_async(state, l), 0);
+        KUNIT_EXPECT_EQ(test, ttyhub_subsystem_enable(state, l, NULL),
+                        -EBUSY);
+
+        /* the rest of the frame completes it, the L frame after the F frame
+           is skipped as garbage */
+        ttyhub_test_feed(ctx->tty, tail, NULL, sizeof(tail) - 1, NULL, 0);
+        flush_delayed_work(&state->drain_work);
+        KUNIT_EXPECT_EQ(test, state->draining, 0);
+        KUNIT_EXPECT_EQ(test, state->frames_aborted, 0UL);
+        KUNIT_EXPECT_TRUE(test, ttyhub_test_log_equal(&log, &expect));
+
+        KUNIT_EXPECT_EQ(test, ttyhub_subsystem_enable(state, l, NULL), 0);
+        ttyhub_state_destroy(state);
+}
+
+/* a single enabled subsystem is fed by ttyhub_receive_single(), which must
+   deliver the same frames for every chunk size */
+static void ttyhub_test_single(struct kunit *test)
+{
+        static const int kinds[] = {
+                TTYHUB_TEST_STREAM_L, TTYHUB_TEST_STREAM_HDLC };
+        static const unsigned int masks[] = { TTYHUB_TEST_L, TTYHUB_TEST_H };
+        static const int mock[] = { 0, 3 };
+        struct ttyhub_test_ctx *ctx = test->priv;
+        struct ttyhub_test_stream s;
+        struct ttyhub_test_log log;
+        struct ttyhub_state *state;
+        int i, c, k, ncuts, *cuts;
+
+        cuts = kunit_kcalloc(test, 1024, sizeof(*cuts), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, cuts);
+
+        for (i=0; i < ARRAY_SIZE(kinds); i++) {
+                ttyhub_test_log_init(test, &log, 0);
+                state = ttyhub_test_state_new(test, &log, masks[i]);
+                KUNIT_EXPECT_EQ(test, state->single, ctx->index[mock[i]]);
+                ttyhub_subsystem_enable(state, ctx->index[1], NULL);
+                KUNIT_EXPECT_EQ(test, state->single, -1);
+                ttyhub_subsystem_disable(state, ctx->index[1]);
+                KUNIT_EXPECT_EQ(test, state->single, ctx->index[mock[i]]);
+                ttyhub_state_destroy(state);
+
+                ttyhub_test_gen(test, &s, kinds[i], 41 + i, 1024, -1);
+                s.subsystems = masks[i];
+                for (c=1; c <= 2 * probe_buf_size + 1; c++) {
+                        ncuts = 0;
+                        for (k=c; k < s.len; k += c)
+                                cuts[ncuts++] = k;
+                        KUNIT_EXPECT_TRUE_MSG(test, ttyhub_test_run(test, &s,
+                                                NULL, cuts, ncuts),
+                                        "stream kind %d chunk size %d",
+                                        kinds[i], c);
+                }
+        }
+}
+
+/* ttys with the same subsystems and critical budgets share one dispatch
+   plan, which is rebuilt when a budget makes them differ */
+static void ttyhub_test_plan(struct kunit *test)
+{
+        struct ttyhub_qos_config config = { .flags = TTYHUB_QOS_CRITICAL };
+        struct ttyhub_test_ctx *ctx = test->priv;
+        struct ttyhub_test_log log;
+        struct ttyhub_state *a, *b;
+        struct ttyhub_plan *plan;
+        int l = ctx->index[0], h = ctx->index[3];
+
+        ttyhub_test_log_init(test, &log, 0);
+        a = ttyhub_test_state_new(test, &log, TTYHUB_TEST_L | TTYHUB_TEST_H);
+        b = ttyhub_state_create(ctx->tty);
+        KUNIT_ASSERT_NOT_NULL(test, b);
+        KUNIT_EXPECT_EQ(test, ttyhub_subsystem_enable(b, h, NULL), 0);
+        KUNIT_EXPECT_EQ(test, ttyhub_subsystem_enable(b, l, NULL), 0);
+
+        plan = rcu_access_pointer(a->plan);
+        KUNIT_ASSERT_NOT_NULL(test, plan);
+        KUNIT_EXPECT_PTR_EQ(test, rcu_access_pointer(b->plan), plan);
+        KUNIT_EXPECT_EQ(test, plan->users, 2);
+        KUNIT_EXPECT_EQ(test, plan->nr, 2);
+        KUNIT_EXPECT_EQ(test, plan->entries[0].index, l);
+
+        /* a critical budget moves H to the front on b only */
+        config.subsys = h;
+        KUNIT_EXPECT_EQ(test, ttyhub_qos_set(b, &config), 0);
+        KUNIT_EXPECT_PTR_NE(test, rcu_access_pointer(b->plan), plan);
+        KUNIT_EXPECT_EQ(test, rcu_access_pointer(b->plan)->entries[0].index,
+                        h);
+        KUNIT_EXPECT_EQ(test, plan->users, 1);
+
+        config.flags = 0;
+        KUNIT_EXPECT_EQ(test, ttyhub_qos_set(b, &config), 0);
+        KUNIT_EXPECT_PTR_EQ(test, rcu_access_pointer(b->plan), plan);
+        KUNIT_EXPECT_EQ(test, plan->users, 2);
+
+        ttyhub_state_destroy(b);
+        KUNIT_EXPECT_EQ(test, plan->users, 1);
+        ttyhub_state_destroy(a);
+}
+
+/* the echo of data written is stripped before probing, the data received
+   before and after it is not changed */
+static void ttyhub_test_echo(struct kunit *test)
+{
+        static const u8 tx[] = "L03xyzF01q";
+        static const u8 bad[] = "L03xyQL01a";
+        static const int bad_cut[] = { 5 };
+        struct ttyhub_echo_config config = { .size = 16 };
+        struct ttyhub_test_ctx *ctx = test->priv;
+        struct ttyhub_test_stream s;
+        struct ttyhub_test_log log, expect;
+        struct ttyhub_state *state;
+        int c, k, half, len, ncuts, *cuts;
+        u8 *rest;
+
+        ttyhub_test_gen(test, &s, TTYHUB_TEST_STREAM_MIX, 51, 512, -1);
+        half = s.len / 2;
+        len = sizeof(tx) - 1 + s.len - half;
+        rest = kunit_kzalloc(test, len, GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, rest);
+        memcpy(rest, tx, sizeof(tx) - 1);
+        memcpy(rest + sizeof(tx) - 1, s.data + half, s.len - half);
+        cuts = kunit_kcalloc(test, s.len, sizeof(*cuts), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, cuts);
+
+        for (c=1; c <= 32; c++) {
+                ttyhub_test_log_init(test, &log, s.expect.size);
+                state = ttyhub_test_state_new(test, &log, TTYHUB_TEST_ALL);
+                KUNIT_ASSERT_EQ(test, ttyhub_echo_set(state, &config), 0);
+
+                KUNIT_EXPECT_EQ(test, ttyhub_write(ctx->tty, tx, 8), 8);
+                ttyhub_test_feed(ctx->tty, tx, NULL, 8, NULL, 0);
+
+                ncuts = 0;
+                for (k=c; k < half; k += c)
+                        cuts[ncuts++] = k;
+                ttyhub_test_feed(ctx->tty, s.data, NULL, half, cuts, ncuts);
+
+                /* the echo wraps around in the ring buffer */
+                ttyhub_write(ctx->tty, tx, 6);
+                ttyhub_write(ctx->tty, tx + 6, 4);
+                ncuts = 0;
+                for (k=c; k < len; k += c)
+                        cuts[ncuts++] = k;
+                ttyhub_test_feed(ctx->tty, rest, NULL, len, cuts, ncuts);
+
+                KUNIT_EXPECT_TRUE_MSG(test, ttyhub_test_log_equal(&log,
+                                        &s.expect), "chunk size %d", c);
+                KUNIT_EXPECT_EQ(test, state->echo->bytes, 18ULL);
+                KUNIT_EXPECT_EQ(test, state->echo->lost, 0ULL);
+                ttyhub_state_destroy(state);
+                kunit_kfree(test, log.buf);
+        }
+
+        /* a collision gives up the rest of the echo, an echo that doesn't
+           arrive in time is given up as well */
+        ttyhub_test_log_init(test, &expect, 64);
+        ttyhub_test_log_append(&expect, 'L', "L01a", 4);
+        ttyhub_test_log_append(&expect, 'F', "F01q", 4);
+        ttyhub_test_log_init(test, &log, 64);
+        state = ttyhub_test_state_new(test, &log, TTYHUB_TEST_ALL);
+        config.timeout_us = 1000;
+        KUNIT_ASSERT_EQ(test, ttyhub_echo_set(state, &config), 0);
+        ttyhub_write(ctx->tty, tx, sizeof(tx) - 1);
+        ttyhub_test_feed(ctx->tty, bad, NULL, sizeof(bad) - 1, bad_cut, 1);
+        KUNIT_EXPECT_EQ(test, state->echo->bytes, 5ULL);
+        KUNIT_EXPECT_EQ(test, state->echo->lost, 5ULL);
+        ttyhub_write(ctx->tty, tx, 6);
+        msleep(5);
+        ttyhub_test_feed(ctx->tty, tx + 6, NULL, 4, NULL, 0);
+        KUNIT_EXPECT_EQ(test, state->echo->lost, 11ULL);
+        KUNIT_EXPECT_TRUE(test, ttyhub_test_log_equal(&log, &expect));
+        ttyhub_state_destroy(state);
+
+        /* bytes the driver doesn't accept are not expected as echo */
+        ttyhub_test_log_init(test, &expect, 64);
+        ttyhub_test_log_append(&expect, 'F', "F01q", 4);
+        ttyhub_test_log_init(test, &log, 64);
+        state = ttyhub_test_state_new(test, &log, TTYHUB_TEST_ALL);
+        KUNIT_ASSERT_EQ(test, ttyhub_echo_set(state, &config), 0);
+        ttyhub_test_tty_room = 4;
+        KUNIT_EXPECT_EQ(test, ttyhub_write(ctx->tty, tx, 8), 4);
+        ttyhub_test_tty_room = -1;
+        ttyhub_test_feed(ctx->tty, tx, NULL, 4, NULL, 0);
+        ttyhub_test_feed(ctx->tty, tx + 6, NULL, 4, NULL, 0);
+        KUNIT_EXPECT_EQ(test, state->echo->bytes, 4ULL);
+        KUNIT_EXPECT_EQ(test, state->echo->lost, 0ULL);
+        KUNIT_EXPECT_TRUE(test, ttyhub_test_log_equal(&log, &expect));
+        ttyhub_state_destroy(state);
+}
+
+/* frames carry the arrival time of their first and last byte, also when
+   the first byte waited in the probe buffer */
+static void ttyhub_test_timestamps(struct kunit *test)
+{
+        static const u8 head[] = "F0";
+        static const u8 tail[] = "5abcde";
+        struct ttyhub_test_ctx *ctx = test->priv;
+        struct ttyhub_test_log log;
+        struct ttyhub_state *state;
+        ktime_t between;
+
+        ttyhub_test_log_init(test, &log, 64);
+        state = ttyhub_test_state_new(test, &log, TTYHUB_TEST_ALL);
+        ttyhub_test_feed(ctx->tty, head, NULL, sizeof(head) - 1, NULL, 0);
+        between = ktime_get();
+        ttyhub_test_feed(ctx->tty, tail, NULL, sizeof(tail) - 1, NULL, 0);
+        ttyhub_state_destroy(state);
+
+        KUNIT_EXPECT_EQ(test, log.frames, 1UL);
+        KUNIT_EXPECT_LE(test, log.ts_first, between);
+        KUNIT_EXPECT_GE(test, log.ts_last, between);
+}
+
+/*
+ * Microbenchmarks - a 64 KiB stream is received 16 times in chunks of a
+ * fixed size, the result is reported in the test log.
+ */
+static void ttyhub_test_bench(struct kunit *test, int kind,
+                        unsigned int subsystems, const char *name)
+{
+        static const int chunks[] = { 1, 16, 64, 256, 4096 };
+        struct ttyhub_test_ctx *ctx = test->priv;
+        struct ttyhub_test_stream s;
+        struct ttyhub_test_log log;
+        struct ttyhub_state *state;
+        int i, k, round, ncuts, *cuts;
+        u64 start, ns, bytes;
+
+        ttyhub_test_gen(test, &s, kind, 99, 65536, -1);
+        cuts = kunit_kcalloc(test, s.len, sizeof(*cuts), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, cuts);
+
+        for (i=0; i < ARRAY_SIZE(chunks); i++) {
+                ncuts = 0;
+                for (k=chunks[i]; k < s.len; k += chunks[i])
+                        cuts[ncuts++] = k;
+
+                ttyhub_test_log_init(test, &log, 0);
+                state = ttyhub_test_state_new(test, &log, subsystems);
+                start = ktime_get_ns();
+                for (round=0; round < 16; round++)
+                        ttyhub_test_feed(ctx->tty, s.data, NULL, s.len, cuts,
+                                        ncuts);
+                ns = ktime_get_ns() - start;
+                ttyhub_state_destroy(state);
+
+                KUNIT_EXPECT_EQ(test, log.frames, 16 * s.expect.frames);
+                bytes = 16 * (u64)s.len;
+                kunit_info(test, "%s chunk %4d: %llu.%03llu ns/byte, "
+                                "%llu ns/frame\n", name, chunks[i],
+                                div64_u64(ns, bytes),
+                                div64_u64(ns * 1000, bytes) % 1000,
+                                div64_u64(ns, max(log.frames, 1UL)));
+        }
+}
+
+static void ttyhub_test_bench_mix(struct kunit *test)
+{
+        ttyhub_test_bench(test, TTYHUB_TEST_STREAM_MIX, TTYHUB_TEST_ALL,
+                        "mix");
+}
+
+static void ttyhub_test_bench_hdlc(struct kunit *test)
+{
+        ttyhub_test_bench(test, TTYHUB_TEST_STREAM_HDLC, TTYHUB_TEST_ALL,
+                        "hdlc");
+}
+
+/* the same stream with all mock subsystems and with the only one needed -
+   the latter uses ttyhub_receive_single() */
+static void ttyhub_test_bench_single(struct kunit *test)
+{
+        ttyhub_test_bench(test, TTYHUB_TEST_STREAM_L, TTYHUB_TEST_ALL,
+                        "l all");
+        ttyhub_test_bench(test, TTYHUB_TEST_STREAM_L, TTYHUB_TEST_L,
+                        "l single");
+        ttyhub_test_bench(test, TTYHUB_TEST_STREAM_HDLC, TTYHUB_TEST_ALL,
+                        "hdlc all");
+        ttyhub_test_bench(test, TTYHUB_TEST_STREAM_HDLC, TTYHUB_TEST_H,
+                        "hdlc single");
+}
+
+static int ttyhub_test_init(struct kunit *test)
+{
+        struct ttyhub_test_ctx *ctx;
+        int i;
+
+        ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, ctx);
+        ctx->tty = kunit_kzalloc(test, sizeof(*ctx->tty), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, ctx->tty);
+        strscpy(ctx->tty->name, "ttyhubkunit", sizeof(ctx->tty->name));
+        ctx->tty->ops = &ttyhub_test_tty_ops;
+
+        for (i=0; i < ARRAY_SIZE(ctx->index); i++) {
+                ctx->index[i] = ttyhub_register_subsystem(
+                                &ttyhub_test_subsystems[i]);
+                if (ctx->index[i] < 0) {
+                        while (i--)
+                                ttyhub_unregister_subsystem(ctx->index[i]);
+                        return -ENOSPC;
+                }
+        }
+        test->priv = ctx;
+        return 0;
+}
+
+static void ttyhub_test_exit(struct kunit *test)
+{
+        struct ttyhub_test_ctx *ctx = test->priv;
+        int i;
+
+        for (i=0; i < ARRAY_SIZE(ctx->index); i++)
+                ttyhub_unregister_subsystem(ctx->index[i]);
+}
+
+static struct kunit_case ttyhub_test_cases[] = {
+        KUNIT_CASE(ttyhub_test_whole),
+        KUNIT_CASE(ttyhub_test_split_all),
+        KUNIT_CASE(ttyhub_test_split_uniform),
+        KUNIT_CASE(ttyhub_test_split_random),
+        KUNIT_CASE(ttyhub_test_line_error),
+        KUNIT_CASE(ttyhub_test_disable_async),
+        KUNIT_CASE(ttyhub_test_timestamps),
+        KUNIT_CASE(ttyhub_test_single),
+        KUNIT_CASE(ttyhub_test_echo),
+        KUNIT_CASE(ttyhub_test_plan),
+        KUNIT_CASE_SLOW(ttyhub_test_bench_mix),
+        KUNIT_CASE_SLOW(ttyhub_test_bench_hdlc),
+        KUNIT_CASE_SLOW(ttyhub_test_bench_single),
+        {}
+};
+
+static struct kunit_suite ttyhub_test_suite = {
+        .name = "ttyhub",
+        .init = ttyhub_test_init,
+        .exit = ttyhub_test_exit,
+        .test_cases = ttyhub_test_cases,
+};
+kunit_test_suite(ttyhub_test_suite);
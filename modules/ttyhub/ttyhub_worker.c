@@ -0,0 +1,171 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Workers pass complete frames to a subsystem on a CPU of its choice. The
+ * receive path of the tty is the only producer and the worker thread the
+ * only consumer of a ring of frame pointers, so neither side takes a lock:
+ * each side owns one index and publishes it with release semantics.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
+#include <linux/log2.h>
+#include <linux/err.h>
+#include "ttyhub_worker.h"
+
+static int worker_ring_size = 256;
+module_param(worker_ring_size, int, 0);
+MODULE_PARM_DESC(worker_ring_size, "Number of frames queued for a subsystem "
+                "worker before frames are dropped (rounded up to a power of "
+                "two)");
+
+struct ttyhub_worker {
+        struct task_struct *task;
+        struct ttyhub_subsystem *subs;
+        void *data;
+
+        /* written by the producer only */
+        unsigned int head ____cacheline_aligned_in_smp;
+
+        /* written by the worker thread only */
+        unsigned int tail ____cacheline_aligned_in_smp;
+
+        unsigned int mask;
+        struct ttyhub_frame *ring[];
+};
+
+/*
+ * This is a helper function for ttyhub_worker_thread().
+ *
+ * Returns the oldest frame in the ring or NULL if the ring is empty.
+ */
+static struct ttyhub_frame *ttyhub_worker_dequeue(struct ttyhub_worker *worker)
+{
+        unsigned int tail = worker->tail;
+        struct ttyhub_frame *frame;
+
+        if (tail == smp_load_acquire(&worker->head))
+                return NULL;
+        frame = worker->ring[tail & worker->mask];
+        smp_store_release(&worker->tail, tail + 1);
+        return frame;
+}
+
+static int ttyhub_worker_thread(void *arg)
+{
+        struct ttyhub_worker *worker = arg;
+        struct ttyhub_frame *frame;
+
+        while (1) {
+                /* the state is set before checking the ring, so a frame
+                   queued meanwhile wakes the thread up again */
+                set_current_state(TASK_INTERRUPTIBLE);
+                frame = ttyhub_worker_dequeue(worker);
+                if (frame == NULL) {
+                        if (kthread_should_stop())
+                                break;
+                        schedule();
+                        continue;
+                }
+                __set_current_state(TASK_RUNNING);
+                worker->subs->receive_frame(worker->data, frame);
+        }
+        __set_current_state(TASK_RUNNING);
+        return 0;
+}
+
+/*
+ * Create a worker passing frames to the receive_frame() operation of a
+ * subsystem. The worker thread is bound to the CPU given by the subsystem.
+ *
+ * Returns the new worker or an ERR_PTR() value.
+ */
+struct ttyhub_worker *ttyhub_worker_create(struct ttyhub_subsystem *subs,
+                        void *data, const char *tty_name)
+{
+        struct ttyhub_worker *worker;
+        unsigned int size;
+
+        if (subs->receive_frame == NULL || subs->worker_cpu < 0 ||
+                        subs->worker_cpu >= nr_cpu_ids ||
+                        !cpu_online(subs->worker_cpu))
+                return ERR_PTR(-EINVAL);
+
+        size = roundup_pow_of_two(worker_ring_size > 0 ?
+                        worker_ring_size : 1);
+        worker = kzalloc(sizeof(*worker) + size * sizeof(worker->ring[0]),
+                        GFP_KERNEL);
+        if (worker == NULL)
+                return ERR_PTR(-ENOMEM);
+        worker->subs = subs;
+        worker->data = data;
+        worker->mask = size - 1;
+
+        worker->task = kthread_create(ttyhub_worker_thread, worker,
+                        "ttyhub/%s/%s", tty_name, subs->name);
+        if (IS_ERR(worker->task)) {
+                int err = PTR_ERR(worker->task);
+                kfree(worker);
+                return ERR_PTR(err);
+        }
+        kthread_bind(worker->task, subs->worker_cpu);
+        wake_up_process(worker->task);
+
+        return worker;
+}
+
+/*
+ * Stop the worker thread. Frames queued when the thread has stopped are
+ * dropped.
+ */
+void ttyhub_worker_destroy(struct ttyhub_worker *worker)
+{
+        struct ttyhub_frame *frame;
+
+        kthread_stop(worker->task);
+        while ((frame = ttyhub_worker_dequeue(worker)) != NULL)
+                ttyhub_frame_put(frame);
+        kfree(worker);
+}
+
+/*
+ * Queue a complete frame for the worker. The reference to the frame is
+ * passed on to the worker.
+ * Only one caller at a time may queue frames to a worker - the receive lock
+ * of the tty serializes all callers.
+ *
+ * Returns zero on success or -ENOBUFS if the ring is full - the frame is not
+ * queued in that case.
+ */
+int ttyhub_worker_queue(struct ttyhub_worker *worker,
+                        struct ttyhub_frame *frame)
+{
+        unsigned int head = worker->head;
+
+        if (head - smp_load_acquire(&worker->tail) > worker->mask)
+                return -ENOBUFS;
+        worker->ring[head & worker->mask] = frame;
+        smp_store_release(&worker->head, head + 1);
+        wake_up_process(worker->task);
+        return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef _TTYHUB_WORKER_H
+#define _TTYHUB_WORKER_H
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ttyhub.h"
+
+struct ttyhub_worker;
+
+extern struct ttyhub_worker *ttyhub_worker_create(
+                        struct ttyhub_subsystem *subs, void *data,
+                        const char *tty_name);
+extern void ttyhub_worker_destroy(struct ttyhub_worker *worker);
+extern int ttyhub_worker_queue(struct ttyhub_worker *worker,
+                        struct ttyhub_frame *frame);
+
+#endif /* _TTYHUB_WORKER_H */
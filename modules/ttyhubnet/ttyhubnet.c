@@ -0,0 +1,425 @@
+/* ttyhub network device subsystem
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/tty.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/timekeeping.h>
+#include "ttyhub.h"
+MODULE_AUTHOR("Alexander F. Mayer");
+MODULE_LICENSE("GPL");
+
+/* every packet on the serial line is preceded by a 4 byte header:
+ *      2 sync bytes (0xA5 0x5A) and the payload length (big endian)
+ * the payload is an IPv4 or IPv6 packet */
+#define TTYHUBNET_SYNC0         0xA5
+#define TTYHUBNET_SYNC1         0x5A
+#define TTYHUBNET_HDR_LEN       4
+
+static int mtu = 1500;
+module_param(mtu, int, 0);
+MODULE_PARM_DESC(mtu, "Maximum packet size on the serial line");
+
+static int napi_weight = 16;
+module_param(napi_weight, int, 0);
+MODULE_PARM_DESC(napi_weight, "Maximum number of packets per NAPI poll");
+
+struct ttyhubnet_data {
+        struct tty_struct *tty;
+        struct net_device *dev;
+
+        /* remaining bytes of the frame currently received */
+        int receive_remain;
+};
+
+struct ttyhubnet_priv {
+        struct ttyhubnet_data *data;
+        struct napi_struct napi;
+
+        /* received frames waiting for the NAPI poll */
+        spinlock_t rx_lock;
+        struct list_head rx_frames;
+
+        /* transmit buffer - one packet at a time is written to the tty */
+        struct work_struct tx_work;
+        spinlock_t tx_lock;
+        unsigned char *tx_buf;
+        unsigned char *tx_head;
+        int tx_left;
+};
+
+static int subsys_number = -1;
+static struct ttyhub_subsystem subs;
+
+static __be16 ttyhubnet_protocol(const unsigned char *payload)
+{
+        switch (payload[0] >> 4) {
+        case 4:
+                return htons(ETH_P_IP);
+        case 6:
+                return htons(ETH_P_IPV6);
+        }
+        return 0;
+}
+
+/*
+ * Write as much of the transmit buffer to the tty as the driver accepts.
+ * When the whole packet has been written the transmit queue is woken up.
+ *
+ * Locks:
+ *      The transmit lock (priv->tx_lock) must be held by the caller.
+ */
+static void ttyhubnet_tx_push(struct ttyhubnet_priv *priv)
+{
+        struct tty_struct *tty = priv->data->tty;
+        struct net_device *dev = priv->data->dev;
+        int written;
+
+        if (priv->tx_left <= 0) {
+                clear_bit(TTY_DO_WRITE_WAKEUP, &tty->flags);
+                netif_wake_queue(dev);
+                return;
+        }
+
+        set_bit(TTY_DO_WRITE_WAKEUP, &tty->flags);
+        written = ttyhub_write(tty, priv->tx_head, priv->tx_left);
+        if (written < 0)
+                written = 0;
+        priv->tx_head += written;
+        priv->tx_left -= written;
+        dev->stats.tx_bytes += written;
+}
+
+static void ttyhubnet_tx_work(struct work_struct *work)
+{
+        struct ttyhubnet_priv *priv =
+                container_of(work, struct ttyhubnet_priv, tx_work);
+
+        spin_lock_bh(&priv->tx_lock);
+        ttyhubnet_tx_push(priv);
+        spin_unlock_bh(&priv->tx_lock);
+}
+
+/* net device operations */
+static int ttyhubnet_open(struct net_device *dev)
+{
+        struct ttyhubnet_priv *priv = netdev_priv(dev);
+
+        /* tx_work queued by a write_wakeup() may still be pushing */
+        spin_lock_bh(&priv->tx_lock);
+        priv->tx_left = 0;
+        spin_unlock_bh(&priv->tx_lock);
+        napi_enable(&priv->napi);
+        netif_start_queue(dev);
+        return 0;
+}
+
+static int ttyhubnet_stop(struct net_device *dev)
+{
+        struct ttyhubnet_priv *priv = netdev_priv(dev);
+
+        netif_stop_queue(dev);
+        napi_disable(&priv->napi);
+        cancel_work_sync(&priv->tx_work);
+        return 0;
+}
+
+static netdev_tx_t ttyhubnet_start_xmit(struct sk_buff *skb,
+                        struct net_device *dev)
+{
+        struct ttyhubnet_priv *priv = netdev_priv(dev);
+
+        if (skb->len > mtu) {
+                dev->stats.tx_dropped++;
+                goto exit;
+        }
+
+        spin_lock_bh(&priv->tx_lock);
+        priv->tx_buf[0] = TTYHUBNET_SYNC0;
+        priv->tx_buf[1] = TTYHUBNET_SYNC1;
+        priv->tx_buf[2] = skb->len >> 8;
+        priv->tx_buf[3] = skb->len & 0xFF;
+        skb_copy_bits(skb, 0, priv->tx_buf + TTYHUBNET_HDR_LEN, skb->len);
+        priv->tx_head = priv->tx_buf;
+        priv->tx_left = skb->len + TTYHUBNET_HDR_LEN;
+        dev->stats.tx_packets++;
+
+        /* one packet in flight - the queue is woken up when it is written */
+        netif_stop_queue(dev);
+        ttyhubnet_tx_push(priv);
+        spin_unlock_bh(&priv->tx_lock);
+
+exit:
+        dev_kfree_skb(skb);
+        return NETDEV_TX_OK;
+}
+
+static const struct net_device_ops ttyhubnet_netdev_ops = {
+        .ndo_open       = ttyhubnet_open,
+        .ndo_stop       = ttyhubnet_stop,
+        .ndo_start_xmit = ttyhubnet_start_xmit,
+};
+
+/*
+ * NAPI poll function.
+ * Received frames are turned into socket buffers and passed to GRO.
+ */
+static int ttyhubnet_poll(struct napi_struct *napi, int budget)
+{
+        struct ttyhubnet_priv *priv =
+                container_of(napi, struct ttyhubnet_priv, napi);
+        struct net_device *dev = priv->data->dev;
+        struct ttyhub_frame *frame;
+        struct sk_buff *skb;
+        int len, done = 0;
+
+        while (done < budget) {
+                spin_lock_bh(&priv->rx_lock);
+                if (list_empty(&priv->rx_frames)) {
+                        spin_unlock_bh(&priv->rx_lock);
+                        break;
+                }
+                frame = list_first_entry(&priv->rx_frames, struct ttyhub_frame,
+                                list);
+                list_del(&frame->list);
+                spin_unlock_bh(&priv->rx_lock);
+
+                len = frame->len - TTYHUBNET_HDR_LEN;
+                skb = napi_alloc_skb(napi, len);
+                if (skb == NULL) {
+                        dev->stats.rx_dropped++;
+                        ttyhub_frame_put(frame);
+                        continue;
+                }
+                skb_put_data(skb, frame->data + TTYHUBNET_HDR_LEN, len);
+                /* stamp the packet with the arrival of its last byte rather
+                   than with the time it is polled */
+                skb->tstamp = ktime_mono_to_real(frame->ts_last);
+                ttyhub_frame_put(frame);
+
+                skb->protocol = ttyhubnet_protocol(skb->data);
+                skb_reset_network_header(skb);
+                skb->ip_summed = CHECKSUM_NONE;
+                dev->stats.rx_packets++;
+                dev->stats.rx_bytes += len;
+                napi_gro_receive(napi, skb);
+                done++;
+        }
+
+        if (done < budget)
+                napi_complete_done(napi, done);
+
+        return done;
+}
+
+static void ttyhubnet_setup(struct net_device *dev)
+{
+        dev->netdev_ops = &ttyhubnet_netdev_ops;
+        dev->type = ARPHRD_NONE;
+        dev->hard_header_len = 0;
+        dev->addr_len = 0;
+        dev->mtu = mtu;
+        dev->min_mtu = 68;
+        dev->max_mtu = mtu;
+        dev->tx_queue_len = 100;
+        dev->flags = IFF_POINTOPOINT | IFF_NOARP | IFF_MULTICAST;
+}
+
+/* ttyhub subsystem operations */
+int ttyhubnet_attach(void **data, struct tty_struct *tty)
+{
+        struct ttyhubnet_data *d;
+        struct ttyhubnet_priv *priv;
+        struct net_device *dev;
+        int err = -ENOMEM;
+
+        d = kzalloc(sizeof(*d), GFP_KERNEL);
+        if (d == NULL)
+                goto error_exit;
+        d->tty = tty;
+
+        dev = alloc_netdev(sizeof(*priv), "thn%d", NET_NAME_UNKNOWN,
+                        ttyhubnet_setup);
+        if (dev == NULL)
+                goto error_free_data;
+        d->dev = dev;
+
+        priv = netdev_priv(dev);
+        priv->data = d;
+        spin_lock_init(&priv->rx_lock);
+        INIT_LIST_HEAD(&priv->rx_frames);
+        INIT_WORK(&priv->tx_work, ttyhubnet_tx_work);
+        spin_lock_init(&priv->tx_lock);
+        priv->tx_buf = kmalloc(mtu + TTYHUBNET_HDR_LEN, GFP_KERNEL);
+        if (priv->tx_buf == NULL)
+                goto error_free_netdev;
+        netif_napi_add_weight(dev, &priv->napi, ttyhubnet_poll, napi_weight);
+
+        err = register_netdev(dev);
+        if (err < 0)
+                goto error_del_napi;
+
+        printk(KERN_INFO "ttyhubnet: %s attached to %s\n", dev->name,
+                tty->name);
+        *data = d;
+        return 0;
+
+error_del_napi:
+        netif_napi_del(&priv->napi);
+        kfree(priv->tx_buf);
+error_free_netdev:
+        free_netdev(dev);
+error_free_data:
+        kfree(d);
+error_exit:
+        printk(KERN_ERR "ttyhubnet: can't attach to %s (err = %d)\n",
+                tty->name, err);
+        return err;
+}
+
+void ttyhubnet_detach(void *data)
+{
+        struct ttyhubnet_data *d = (struct ttyhubnet_data *)data;
+        struct ttyhubnet_priv *priv = netdev_priv(d->dev);
+        struct ttyhub_frame *frame, *tmp;
+
+        unregister_netdev(d->dev);
+        cancel_work_sync(&priv->tx_work);
+        netif_napi_del(&priv->napi);
+
+        list_for_each_entry_safe(frame, tmp, &priv->rx_frames, list) {
+                list_del(&frame->list);
+                ttyhub_frame_put(frame);
+        }
+
+        kfree(priv->tx_buf);
+        free_netdev(d->dev);
+        kfree(d);
+}
+
+int ttyhubnet_probe_data(void *data, const unsigned char *cp, int count)
+{
+        struct ttyhubnet_data *d = (struct ttyhubnet_data *)data;
+        int len;
+
+        if (cp[0] != TTYHUBNET_SYNC0 || cp[1] != TTYHUBNET_SYNC1)
+                return 0;
+
+        len = cp[2] << 8 | cp[3];
+        if (len == 0 || len > mtu)
+                return 0;
+
+        d->receive_remain = len + TTYHUBNET_HDR_LEN;
+        return 1;
+}
+
+int ttyhubnet_do_receive(void *data, const unsigned char *cp, int count)
+{
+        struct ttyhubnet_data *d = (struct ttyhubnet_data *)data;
+        int ret;
+
+        if (d->receive_remain > count) {
+                d->receive_remain -= count;
+                return -1;
+        }
+
+        ret = d->receive_remain;
+        d->receive_remain = 0;
+        return ret;
+}
+
+void ttyhubnet_receive_frame(void *data, struct ttyhub_frame *frame)
+{
+        struct ttyhubnet_data *d = (struct ttyhubnet_data *)data;
+        struct ttyhubnet_priv *priv = netdev_priv(d->dev);
+
+        if (!netif_running(d->dev) ||
+                        !ttyhubnet_protocol(frame->data + TTYHUBNET_HDR_LEN)) {
+                d->dev->stats.rx_dropped++;
+                ttyhub_frame_put(frame);
+                return;
+        }
+
+        spin_lock_bh(&priv->rx_lock);
+        list_add_tail(&frame->list, &priv->rx_frames);
+        spin_unlock_bh(&priv->rx_lock);
+
+        napi_schedule(&priv->napi);
+}
+
+/* write_wakeup() may be called from within the driver's write() - the next
+   part of the packet is written from a work item */
+void ttyhubnet_write_wakeup(void *data)
+{
+        struct ttyhubnet_data *d = (struct ttyhubnet_data *)data;
+        struct ttyhubnet_priv *priv = netdev_priv(d->dev);
+
+        schedule_work(&priv->tx_work);
+}
+
+/* module init/exit functions */
+static int __init ttyhubnet_init(void)
+{
+        int status;
+        printk(KERN_INFO "ttyhubnet: initializing\n");
+
+        if (mtu < 68)
+                mtu = 68;
+        if (mtu > 0xFFFF)
+                mtu = 0xFFFF;
+
+        subs.name = "ttyhubnet";
+        subs.owner = THIS_MODULE;
+        subs.attach = ttyhubnet_attach;
+        subs.detach = ttyhubnet_detach;
+        subs.probe_data = ttyhubnet_probe_data;
+        subs.do_receive = ttyhubnet_do_receive;
+        subs.receive_frame = ttyhubnet_receive_frame;
+        subs.write_wakeup = ttyhubnet_write_wakeup;
+        subs.probe_data_minimum_bytes = TTYHUBNET_HDR_LEN;
+        subs.frame_max_size = mtu + TTYHUBNET_HDR_LEN;
+
+        status = ttyhub_register_subsystem(&subs);
+        if (status < 0) {
+                printk(KERN_ERR "ttyhubnet: could not register subsystem\n");
+                return -EINVAL;
+        }
+        subsys_number = status;
+        return 0;
+}
+
+static void __exit ttyhubnet_exit(void)
+{
+        int status = 0;
+
+        if (subsys_number >= 0)
+                status = ttyhub_unregister_subsystem(subsys_number);
+
+        if (status != 0)
+                printk("ttyhubnet: could not unregister subsystem\n");
+}
+
+module_init(ttyhubnet_init);
+module_exit(ttyhubnet_exit);
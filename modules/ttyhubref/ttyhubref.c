@@ -0,0 +1,538 @@
+/* ttyhub reference protocols
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Subsystems receiving the reference protocols (see ttyhub_ref.h) - one
+ * subsystem for every common shape of framing:
+ *      ref_fixed       frames of fixed_size bytes
+ *      ref_lenpfx      frames with a length field
+ *      ref_delim       frames ending with a delimiter
+ *      ref_sized       frames skipped by ttyhub after probe_size()
+ * The subsystems check every frame and count what they see, but never log
+ * on the receive path unless verbose is set. Together with the reference
+ * traffic of ttyhubvuart (source=2) they are the standard workload for
+ * measuring ttyhub.
+ *
+ * The counters of all ttys are shown in debugfs (ttyhubref/stats), writing
+ * to that file resets them.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/tty.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "ttyhub.h"
+#include "ttyhub_ref.h"
+MODULE_AUTHOR("Alexander F. Mayer");
+MODULE_LICENSE("GPL");
+
+static int protocols = (1 << TTYHUB_REF_PROTOCOLS) - 1;
+module_param(protocols, int, 0);
+MODULE_PARM_DESC(protocols, "Bit mask of the subsystems registered (1 = "
+                "ref_fixed, 2 = ref_lenpfx, 4 = ref_delim, 8 = ref_sized)");
+
+static int fixed_size = TTYHUB_REF_FIXED_SIZE;
+module_param(fixed_size, int, 0);
+MODULE_PARM_DESC(fixed_size, "Size of ref_fixed frames");
+
+static int delim_max = TTYHUB_REF_SIZE_MAX;
+module_param(delim_max, int, 0);
+MODULE_PARM_DESC(delim_max, "Bytes after which a ref_delim frame without "
+                "delimiter is aborted");
+
+static int frames = 0;
+module_param(frames, int, 0);
+MODULE_PARM_DESC(frames, "Check complete frames assembled by ttyhub "
+                "(receive_frame) instead of the data passed to do_receive");
+
+static int verbose = 0;
+module_param(verbose, int, 0644);
+MODULE_PARM_DESC(verbose, "Log every frame failing the checks");
+
+struct ttyhubref_stats {
+        unsigned long frames;
+        unsigned long bytes;
+
+        /* frames failing the checks */
+        unsigned long bad;
+
+        /* frames missing according to the sequence numbers */
+        unsigned long lost;
+
+        /* ref_delim frames without delimiter within delim_max bytes */
+        unsigned long aborted;
+};
+
+struct ttyhubref_data {
+        struct list_head list;
+        struct tty_struct *tty;
+        int proto;
+        struct ttyhubref_stats stats;
+
+        /* frame currently received */
+        int pos;
+        int len;
+        int bad;
+        u8 seq;
+        u8 sum;
+        unsigned char last[2];
+
+        /* sequence number expected next */
+        int seq_valid;
+        u8 seq_next;
+};
+
+static const char *ttyhubref_names[TTYHUB_REF_PROTOCOLS] = {
+        "ref_fixed", "ref_lenpfx", "ref_delim", "ref_sized" };
+
+static struct ttyhub_subsystem ttyhubref_subs[TTYHUB_REF_PROTOCOLS];
+static int ttyhubref_subsys_number[TTYHUB_REF_PROTOCOLS];
+
+/* all attached instances and the counters of detached ones - protected by
+   ttyhubref_lock */
+static LIST_HEAD(ttyhubref_instances);
+static struct ttyhubref_stats ttyhubref_detached[TTYHUB_REF_PROTOCOLS];
+static DEFINE_MUTEX(ttyhubref_lock);
+
+static struct dentry *ttyhubref_debugfs;
+
+static void ttyhubref_stats_add(struct ttyhubref_stats *to,
+                        const struct ttyhubref_stats *from)
+{
+        to->frames += from->frames;
+        to->bytes += from->bytes;
+        to->bad += from->bad;
+        to->lost += from->lost;
+        to->aborted += from->aborted;
+}
+
+/*
+ * Account a frame that has ended. The sequence number of a bad frame can't
+ * be trusted, so it is assumed to be the one expected.
+ */
+static void ttyhubref_frame_end(struct ttyhubref_data *d, int len, u8 seq,
+                        int bad)
+{
+        d->stats.frames++;
+        d->stats.bytes += len;
+        if (bad) {
+                d->stats.bad++;
+                if (verbose)
+                        printk_ratelimited(KERN_WARNING "ttyhubref: %s: bad "
+                                        "%s frame (%d bytes)\n",
+                                        tty_name(d->tty),
+                                        ttyhubref_names[d->proto], len);
+                d->seq_next++;
+                return;
+        }
+        if (d->seq_valid && seq != d->seq_next)
+                d->stats.lost += (u8)(seq - d->seq_next);
+        d->seq_next = seq + 1;
+        d->seq_valid = 1;
+}
+
+/*
+ * Check the data of a ref_fixed or ref_lenpfx frame, which may arrive in
+ * any number of parts.
+ * This is a helper function for ttyhubref_check().
+ */
+static int ttyhubref_check_binary(struct ttyhubref_data *d,
+                        const unsigned char *cp, int count)
+{
+        int hdr = d->proto == TTYHUB_REF_FIXED ? 1 : 2;
+        int i, n = min(count, d->len - d->pos);
+
+        for (i=0; i < n; i++, d->pos++) {
+                d->sum += cp[i];
+                if (d->pos > hdr && d->pos < d->len - 1) {
+                        if (cp[i] != ttyhub_ref_payload(d->seq, d->pos))
+                                d->bad = 1;
+                }
+                else if (d->pos == hdr)
+                        d->seq = cp[i];
+        }
+
+        if (d->pos < d->len)
+                return -1;
+        ttyhubref_frame_end(d, d->len, d->seq, d->bad || d->sum != 0xFF);
+        return n;
+}
+
+/*
+ * Check the data of a ref_delim frame. Whether a byte belongs to the
+ * payload or to the sum is known two bytes later, so the payload is checked
+ * with a delay of two bytes.
+ * This is a helper function for ttyhubref_check().
+ */
+static int ttyhubref_check_delim(struct ttyhubref_data *d,
+                        const unsigned char *cp, int count)
+{
+        int i, hi, lo;
+        u8 sum;
+
+        for (i=0; i < count; i++, d->pos++) {
+                if (d->pos == 0)
+                        continue;
+                if (cp[i] == TTYHUB_REF_DELIMITER)
+                        goto frame_end;
+                if (d->pos >= delim_max - 1) {
+                        /* give up - the next frame is searched after the
+                           byte reaching the limit */
+                        d->stats.aborted++;
+                        return i + 1;
+                }
+                if (d->pos <= 2) {
+                        hi = hex_to_bin(cp[i]);
+                        if (hi < 0)
+                                d->bad = 1;
+                        d->seq = d->seq << 4 | (hi & 0xF);
+                }
+                else if (d->pos >= 5 && d->last[0] !=
+                                ttyhub_ref_delim_payload(d->seq, d->pos - 2))
+                        d->bad = 1;
+                d->sum += cp[i];
+                d->last[0] = d->last[1];
+                d->last[1] = cp[i];
+        }
+        return -1;
+
+frame_end:
+        d->pos++;
+        if (d->pos < TTYHUB_REF_DELIM_MIN) {
+                ttyhubref_frame_end(d, d->pos, 0, 1);
+                return i + 1;
+        }
+        hi = hex_to_bin(d->last[0]);
+        lo = hex_to_bin(d->last[1]);
+        sum = d->sum - d->last[0] - d->last[1];
+        if (hi < 0 || lo < 0 || sum != (hi << 4 | lo))
+                d->bad = 1;
+        ttyhubref_frame_end(d, d->pos, d->seq, d->bad);
+        return i + 1;
+}
+
+/*
+ * Check the data of the frame currently received.
+ *
+ * Returns the number of bytes up to the end of the frame or -1 if the
+ * frame continues after cp.
+ */
+static int ttyhubref_check(struct ttyhubref_data *d, const unsigned char *cp,
+                        int count)
+{
+        if (d->proto == TTYHUB_REF_DELIM)
+                return ttyhubref_check_delim(d, cp, count);
+        return ttyhubref_check_binary(d, cp, count);
+}
+
+/*
+ * Find the end of the frame currently received without checking it - the
+ * complete frame is checked by ttyhubref_receive_frame().
+ *
+ * Returns the number of bytes up to the end of the frame or -1 if the
+ * frame continues after cp.
+ */
+static int ttyhubref_delimit(struct ttyhubref_data *d, const unsigned char *cp,
+                        int count)
+{
+        const unsigned char *end;
+        int n, limit;
+
+        if (d->proto != TTYHUB_REF_DELIM) {
+                n = d->len - d->pos;
+                if (count < n) {
+                        d->pos += count;
+                        return -1;
+                }
+                return n;
+        }
+
+        limit = delim_max - d->pos;
+        n = min(count, limit);
+        end = memchr(cp, TTYHUB_REF_DELIMITER, n);
+        if (end)
+                return end - cp + 1;
+        if (n == limit)
+                /* aborted - counted by ttyhubref_receive_frame() */
+                return n;
+        d->pos += n;
+        return -1;
+}
+
+static int ttyhubref_attach(void **data, struct tty_struct *tty, int proto)
+{
+        struct ttyhubref_data *d;
+
+        d = kzalloc(sizeof(*d), GFP_KERNEL);
+        if (d == NULL)
+                return -ENOMEM;
+        d->tty = tty;
+        d->proto = proto;
+
+        mutex_lock(&ttyhubref_lock);
+        list_add_tail(&d->list, &ttyhubref_instances);
+        mutex_unlock(&ttyhubref_lock);
+
+        *data = d;
+        return 0;
+}
+
+static int ttyhubref_fixed_attach(void **data, struct tty_struct *tty)
+{
+        return ttyhubref_attach(data, tty, TTYHUB_REF_FIXED);
+}
+
+static int ttyhubref_lenpfx_attach(void **data, struct tty_struct *tty)
+{
+        return ttyhubref_attach(data, tty, TTYHUB_REF_LENPFX);
+}
+
+static int ttyhubref_delim_attach(void **data, struct tty_struct *tty)
+{
+        return ttyhubref_attach(data, tty, TTYHUB_REF_DELIM);
+}
+
+static int ttyhubref_sized_attach(void **data, struct tty_struct *tty)
+{
+        return ttyhubref_attach(data, tty, TTYHUB_REF_SIZED);
+}
+
+static void ttyhubref_detach(void *data)
+{
+        struct ttyhubref_data *d = data;
+
+        mutex_lock(&ttyhubref_lock);
+        list_del(&d->list);
+        ttyhubref_stats_add(&ttyhubref_detached[d->proto], &d->stats);
+        mutex_unlock(&ttyhubref_lock);
+        kfree(d);
+}
+
+static int ttyhubref_probe_data(void *data, const unsigned char *cp, int count)
+{
+        struct ttyhubref_data *d = data;
+
+        switch (d->proto) {
+        case TTYHUB_REF_FIXED:
+                if (cp[0] != TTYHUB_REF_SYNC_FIXED)
+                        return 0;
+                d->len = fixed_size;
+                break;
+        case TTYHUB_REF_LENPFX:
+                if (cp[0] != TTYHUB_REF_SYNC_LENPFX ||
+                                cp[1] < TTYHUB_REF_LENPFX_MIN)
+                        return 0;
+                d->len = cp[1];
+                break;
+        case TTYHUB_REF_DELIM:
+                if (cp[0] != TTYHUB_REF_SYNC_DELIM)
+                        return 0;
+                d->len = 0;
+                break;
+        default:
+                /* ref_sized frames are never received */
+                return 0;
+        }
+
+        d->pos = 0;
+        d->bad = 0;
+        d->seq = 0;
+        d->sum = 0;
+        return 1;
+}
+
+static int ttyhubref_probe_size(void *data, const unsigned char *cp, int count)
+{
+        struct ttyhubref_data *d = data;
+
+        if (count < TTYHUB_REF_SIZED_MIN || cp[0] != TTYHUB_REF_SYNC_SIZED ||
+                        cp[1] < TTYHUB_REF_SIZED_MIN)
+                return 0;
+
+        /* only the header is checked, ttyhub skips the rest */
+        ttyhubref_frame_end(d, cp[1], cp[2], 0);
+        return cp[1];
+}
+
+static int ttyhubref_do_receive(void *data, const unsigned char *cp, int count)
+{
+        struct ttyhubref_data *d = data;
+
+        if (frames)
+                return ttyhubref_delimit(d, cp, count);
+        return ttyhubref_check(d, cp, count);
+}
+
+static void ttyhubref_receive_frame(void *data, struct ttyhub_frame *frame)
+{
+        struct ttyhubref_data *d = data;
+
+        d->pos = 0;
+        d->bad = 0;
+        d->seq = 0;
+        d->sum = 0;
+        if (ttyhubref_check(d, frame->data, frame->len) < 0)
+                /* frame truncated by ttyhub */
+                ttyhubref_frame_end(d, frame->len, 0, 1);
+        ttyhub_frame_put(frame);
+}
+
+static int ttyhubref_stats_show(struct seq_file *m, void *v)
+{
+        struct ttyhubref_stats total[TTYHUB_REF_PROTOCOLS];
+        struct ttyhubref_data *d;
+        struct ttyhubref_stats *s;
+        int i;
+
+        mutex_lock(&ttyhubref_lock);
+        memcpy(total, ttyhubref_detached, sizeof(total));
+        list_for_each_entry(d, &ttyhubref_instances, list) {
+                s = &d->stats;
+                seq_printf(m, "%s %s: frames %lu bytes %lu bad %lu lost %lu "
+                                "aborted %lu\n", tty_name(d->tty),
+                                ttyhubref_names[d->proto], s->frames,
+                                s->bytes, s->bad, s->lost, s->aborted);
+                ttyhubref_stats_add(&total[d->proto], s);
+        }
+        mutex_unlock(&ttyhubref_lock);
+
+        for (i=0; i < TTYHUB_REF_PROTOCOLS; i++) {
+                if (!(protocols & 1 << i))
+                        continue;
+                s = &total[i];
+                seq_printf(m, "total %s: frames %lu bytes %lu bad %lu lost "
+                                "%lu aborted %lu\n", ttyhubref_names[i],
+                                s->frames, s->bytes, s->bad, s->lost,
+                                s->aborted);
+        }
+        return 0;
+}
+
+static int ttyhubref_stats_open(struct inode *inode, struct file *file)
+{
+        return single_open(file, ttyhubref_stats_show, inode->i_private);
+}
+
+static ssize_t ttyhubref_stats_write(struct file *file,
+                        const char __user *buf, size_t count, loff_t *ppos)
+{
+        struct ttyhubref_data *d;
+
+        mutex_lock(&ttyhubref_lock);
+        memset(ttyhubref_detached, 0, sizeof(ttyhubref_detached));
+        list_for_each_entry(d, &ttyhubref_instances, list) {
+                memset(&d->stats, 0, sizeof(d->stats));
+                d->seq_valid = 0;
+        }
+        mutex_unlock(&ttyhubref_lock);
+        return count;
+}
+
+static const struct file_operations ttyhubref_stats_fops = {
+        .owner = THIS_MODULE,
+        .open = ttyhubref_stats_open,
+        .read = seq_read,
+        .llseek = seq_lseek,
+        .release = single_release,
+        .write = ttyhubref_stats_write,
+};
+
+/* Unregister the subsystems registered so far. */
+static void ttyhubref_unregister(void)
+{
+        int i;
+
+        for (i=0; i < TTYHUB_REF_PROTOCOLS; i++) {
+                if (ttyhubref_subsys_number[i] < 0)
+                        continue;
+                if (ttyhub_unregister_subsystem(ttyhubref_subsys_number[i]))
+                        printk(KERN_ERR "ttyhubref: could not unregister "
+                                        "subsystem '%s'\n",
+                                        ttyhubref_names[i]);
+                ttyhubref_subsys_number[i] = -1;
+        }
+}
+
+static int __init ttyhubref_init(void)
+{
+        static int (*const attach[TTYHUB_REF_PROTOCOLS])(void **,
+                        struct tty_struct *) = {
+                ttyhubref_fixed_attach, ttyhubref_lenpfx_attach,
+                ttyhubref_delim_attach, ttyhubref_sized_attach };
+        struct ttyhub_subsystem *subs;
+        int i, status;
+
+        if (fixed_size < TTYHUB_REF_FIXED_MIN ||
+                        fixed_size > TTYHUB_REF_SIZE_MAX ||
+                        delim_max < TTYHUB_REF_DELIM_MIN) {
+                printk(KERN_ERR "ttyhubref: invalid module parameters\n");
+                return -EINVAL;
+        }
+
+        for (i=0; i < TTYHUB_REF_PROTOCOLS; i++)
+                ttyhubref_subsys_number[i] = -1;
+
+        for (i=0; i < TTYHUB_REF_PROTOCOLS; i++) {
+                if (!(protocols & 1 << i))
+                        continue;
+                subs = &ttyhubref_subs[i];
+                subs->name = ttyhubref_names[i];
+                subs->owner = THIS_MODULE;
+                subs->attach = attach[i];
+                subs->detach = ttyhubref_detach;
+                subs->probe_data = ttyhubref_probe_data;
+                subs->do_receive = ttyhubref_do_receive;
+                subs->probe_data_minimum_bytes =
+                        i == TTYHUB_REF_LENPFX ? 2 : 1;
+                if (i == TTYHUB_REF_SIZED)
+                        subs->probe_size = ttyhubref_probe_size;
+                else if (frames) {
+                        subs->receive_frame = ttyhubref_receive_frame;
+                        subs->frame_max_size = max(delim_max,
+                                        TTYHUB_REF_SIZE_MAX);
+                }
+
+                status = ttyhub_register_subsystem(subs);
+                if (status < 0) {
+                        printk(KERN_ERR "ttyhubref: could not register "
+                                        "subsystem '%s'\n", subs->name);
+                        ttyhubref_unregister();
+                        return -EINVAL;
+                }
+                ttyhubref_subsys_number[i] = status;
+        }
+
+        ttyhubref_debugfs = debugfs_create_dir("ttyhubref", NULL);
+        debugfs_create_file("stats", 0600, ttyhubref_debugfs, NULL,
+                        &ttyhubref_stats_fops);
+        return 0;
+}
+
+static void __exit ttyhubref_exit(void)
+{
+        debugfs_remove_recursive(ttyhubref_debugfs);
+        ttyhubref_unregister();
+}
+
+module_init(ttyhubref_init);
+module_exit(ttyhubref_exit);
@@ -0,0 +1,632 @@
+/* ttyhub
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Virtual serial ports for benchmarking ttyhub without hardware. A traffic
+ * generator per port pushes data through the flip buffer of the port exactly
+ * like the interrupt handler of a real UART would, so only the tty buffer
+ * code and the line discipline are measured.
+ *
+ * Every port has a directory in debugfs (ttyhubvuart/ttyHV<n>):
+ *      run     write 1 to start and 0 to stop the generator
+ *      replay  data written here is replayed when source=1
+ *      stats   counters of the current or last run - bytes_per_sec is the
+ *              rate of the bytes the line discipline has consumed
+ * Data written to the tty itself is counted and dropped.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/tty.h>
+#include <linux/tty_driver.h>
+#include <linux/tty_flip.h>
+#include <linux/serial.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include "ttyhub_ref.h"
+MODULE_AUTHOR("Alexander F. Mayer");
+MODULE_LICENSE("GPL");
+
+/* largest chunk passed to the flip buffer at once */
+#define TTYHUBVUART_CHUNK_MAX   4096
+
+/* bytes generated per run of the generator without a rate limit */
+#define TTYHUBVUART_BURST       65536
+
+static int ports = 2;
+module_param(ports, int, 0);
+MODULE_PARM_DESC(ports, "Number of virtual serial ports");
+
+static int rate = 0;
+module_param(rate, int, 0644);
+MODULE_PARM_DESC(rate, "Baud rate equivalent of the generated traffic with "
+                "10 bits per byte (0 = as fast as the line discipline "
+                "accepts data)");
+
+static int chunk_min = 1;
+module_param(chunk_min, int, 0644);
+MODULE_PARM_DESC(chunk_min, "Minimum bytes pushed to the flip buffer at once");
+
+static int chunk_max = 64;
+module_param(chunk_max, int, 0644);
+MODULE_PARM_DESC(chunk_max, "Maximum bytes pushed to the flip buffer at once");
+
+static int error_rate = 0;
+module_param(error_rate, int, 0644);
+MODULE_PARM_DESC(error_rate, "Bytes per million flagged with a parity error");
+
+static int garbage_ratio = 0;
+module_param(garbage_ratio, int, 0644);
+MODULE_PARM_DESC(garbage_ratio, "Percentage of synthetic items that are "
+                "garbage instead of frames");
+
+static int source = 0;
+module_param(source, int, 0644);
+MODULE_PARM_DESC(source, "Generated traffic: 0 = synthetic testsubsys0 "
+                "frames, 1 = replay of the data written to debugfs, 2 = "
+                "reference protocol frames (see ttyhubref)");
+
+static int ref_protocols = (1 << TTYHUB_REF_PROTOCOLS) - 1;
+module_param(ref_protocols, int, 0644);
+MODULE_PARM_DESC(ref_protocols, "Bit mask of the reference protocols "
+                "generated when source=2 (1 = fixed, 2 = lenpfx, 4 = delim, "
+                "8 = sized)");
+
+static int ref_fixed_size = TTYHUB_REF_FIXED_SIZE;
+module_param(ref_fixed_size, int, 0644);
+MODULE_PARM_DESC(ref_fixed_size, "Size of the fixed reference frames, must "
+                "match fixed_size of ttyhubref");
+
+static int replay_size = 65536;
+module_param(replay_size, int, 0);
+MODULE_PARM_DESC(replay_size, "Size of the replay buffer of every port");
+
+struct ttyhubvuart_port {
+        struct tty_port port;
+        int index;
+
+        struct delayed_work gen_work;
+        int running;
+        u64 start_ns;
+
+        /* synthetic item currently generated */
+        unsigned char item[TTYHUB_REF_SIZE_MAX + 1];
+        int item_len;
+        int item_pos;
+        u8 ref_seq[TTYHUB_REF_PROTOCOLS];
+
+        /* captured data - protected by lock */
+        spinlock_t lock;
+        unsigned char *replay;
+        int replay_len;
+        int replay_pos;
+
+        unsigned char buf[TTYHUBVUART_CHUNK_MAX];
+        unsigned char flags[TTYHUBVUART_CHUNK_MAX];
+
+        /* statistics of the current run */
+        u64 bytes_pushed;
+        u64 chunks;
+        u64 stalls;
+        u64 errors_flagged;
+        u64 garbage_bytes;
+        u64 frames;
+        u64 last_ns;
+        u64 tx_bytes;
+};
+
+static struct tty_driver *ttyhubvuart_driver;
+static struct ttyhubvuart_port *ttyhubvuart_ports;
+static struct dentry *ttyhubvuart_debugfs;
+
+static u32 ttyhubvuart_random(u32 below)
+{
+        return below ? get_random_u32_below(below) : 0;
+}
+
+/*
+ * Create the next reference protocol frame.
+ * This is a helper function for ttyhubvuart_next_item().
+ */
+static void ttyhubvuart_next_ref_frame(struct ttyhubvuart_port *p)
+{
+        int mask = ref_protocols & ((1 << TTYHUB_REF_PROTOCOLS) - 1);
+        int proto, size;
+
+        if (mask == 0)
+                mask = 1 << TTYHUB_REF_FIXED;
+        do
+                proto = ttyhubvuart_random(TTYHUB_REF_PROTOCOLS);
+        while (!(mask & 1 << proto));
+
+        if (proto == TTYHUB_REF_FIXED)
+                size = ref_fixed_size;
+        else
+                size = 1 + ttyhubvuart_random(TTYHUB_REF_SIZE_MAX);
+        p->item_len = ttyhub_ref_build(proto, p->ref_seq[proto]++, size,
+                        p->item);
+}
+
+/*
+ * Create the next synthetic item - either a frame recognized by testsubsys0
+ * or ttyhubref or a run of garbage that never starts a frame.
+ */
+static void ttyhubvuart_next_item(struct ttyhubvuart_port *p)
+{
+        int i, len;
+
+        p->item_pos = 0;
+
+        if (ttyhubvuart_random(100) < garbage_ratio) {
+                len = 1 + ttyhubvuart_random(8);
+                for (i=0; i < len; i++) {
+                        p->item[i] = ttyhubvuart_random(256);
+                        if (p->item[i] == '!' ||
+                                        ttyhub_ref_is_sync(p->item[i]))
+                                p->item[i] = '?';
+                }
+                p->item_len = len;
+                p->garbage_bytes += len;
+                return;
+        }
+
+        p->frames++;
+        if (source == 2) {
+                ttyhubvuart_next_ref_frame(p);
+                return;
+        }
+        switch (ttyhubvuart_random(3)) {
+        case 0:
+                memcpy(p->item, "!AAA", 4);
+                p->item_len = 4;
+                break;
+        case 1:
+                /* "!B" and the decimal frame length */
+                len = 4 + ttyhubvuart_random(96);
+                p->item[0] = '!';
+                p->item[1] = 'B';
+                p->item[2] = '0' + len / 10;
+                p->item[3] = '0' + len % 10;
+                for (i=4; i < len; i++)
+                        p->item[i] = 'a' + ttyhubvuart_random(26);
+                p->item_len = len;
+                break;
+        default:
+                /* "!CCC" and payload up to '$' */
+                len = 5 + ttyhubvuart_random(100);
+                memcpy(p->item, "!CCC", 4);
+                for (i=4; i < len - 1; i++)
+                        p->item[i] = 'a' + ttyhubvuart_random(26);
+                p->item[len - 1] = '$';
+                p->item_len = len;
+                break;
+        }
+}
+
+/* Fill the chunk buffer with count bytes of generated traffic. */
+static void ttyhubvuart_fill(struct ttyhubvuart_port *p, int count)
+{
+        int n, done = 0;
+
+        if (source == 1) {
+                spin_lock(&p->lock);
+                if (p->replay_len == 0) {
+                        memset(p->buf, 0, count);
+                        spin_unlock(&p->lock);
+                        return;
+                }
+                while (done < count) {
+                        if (p->replay_pos >= p->replay_len)
+                                p->replay_pos = 0;
+                        n = min(count - done, p->replay_len - p->replay_pos);
+                        memcpy(p->buf + done, p->replay + p->replay_pos, n);
+                        p->replay_pos += n;
+                        done += n;
+                }
+                spin_unlock(&p->lock);
+                return;
+        }
+
+        while (done < count) {
+                if (p->item_pos >= p->item_len)
+                        ttyhubvuart_next_item(p);
+                n = min(count - done, p->item_len - p->item_pos);
+                memcpy(p->buf + done, p->item + p->item_pos, n);
+                p->item_pos += n;
+                done += n;
+        }
+}
+
+/*
+ * Push one chunk to the flip buffer. The chunk never exceeds the space left
+ * in the flip buffer, so no generated data is lost.
+ *
+ * Returns the number of bytes pushed, zero if the flip buffer is full.
+ */
+static int ttyhubvuart_push_chunk(struct ttyhubvuart_port *p, int budget)
+{
+        int lo = clamp(chunk_min, 1, TTYHUBVUART_CHUNK_MAX);
+        int hi = clamp(chunk_max, lo, TTYHUBVUART_CHUNK_MAX);
+        int i, count;
+
+        count = lo + ttyhubvuart_random(hi - lo + 1);
+        count = min3(count, budget, (int)tty_buffer_space_avail(&p->port));
+        if (count <= 0)
+                return 0;
+
+        ttyhubvuart_fill(p, count);
+        if (error_rate > 0) {
+                for (i=0; i < count; i++) {
+                        if (ttyhubvuart_random(1000000) < error_rate) {
+                                p->flags[i] = TTY_PARITY;
+                                p->errors_flagged++;
+                        }
+                        else
+                                p->flags[i] = TTY_NORMAL;
+                }
+                count = tty_insert_flip_string_flags(&p->port, p->buf,
+                                p->flags, count);
+        }
+        else
+                count = tty_insert_flip_string(&p->port, p->buf, count);
+
+        p->bytes_pushed += count;
+        p->chunks++;
+        return count;
+}
+
+/* Generator work - pushes the traffic due since the last run. */
+static void ttyhubvuart_gen_work(struct work_struct *work)
+{
+        struct ttyhubvuart_port *p = container_of(to_delayed_work(work),
+                        struct ttyhubvuart_port, gen_work);
+        u64 now = ktime_get_ns();
+        s64 budget = TTYHUBVUART_BURST;
+        int n, stalled = 0;
+
+        if (!p->running)
+                return;
+
+        if (rate > 0) {
+                budget = (s64)(div_u64(div_u64(now - p->start_ns,
+                                NSEC_PER_USEC) * rate, 10 * USEC_PER_SEC) -
+                                p->bytes_pushed);
+                budget = min_t(s64, budget, TTYHUBVUART_BURST);
+        }
+
+        while (budget > 0) {
+                n = ttyhubvuart_push_chunk(p, budget);
+                if (n == 0) {
+                        /* backpressure from the line discipline */
+                        p->stalls++;
+                        stalled = 1;
+                        break;
+                }
+                budget -= n;
+        }
+        tty_flip_buffer_push(&p->port);
+        p->last_ns = ktime_get_ns();
+
+        queue_delayed_work(system_unbound_wq, &p->gen_work,
+                        rate > 0 || stalled ? 1 : 0);
+}
+
+static void ttyhubvuart_start(struct ttyhubvuart_port *p)
+{
+        if (p->running)
+                return;
+        p->bytes_pushed = 0;
+        p->chunks = 0;
+        p->stalls = 0;
+        p->errors_flagged = 0;
+        p->garbage_bytes = 0;
+        p->frames = 0;
+        p->item_len = 0;
+        p->item_pos = 0;
+        p->start_ns = ktime_get_ns();
+        p->last_ns = p->start_ns;
+        p->running = 1;
+        queue_delayed_work(system_unbound_wq, &p->gen_work, 0);
+}
+
+static void ttyhubvuart_stop(struct ttyhubvuart_port *p)
+{
+        p->running = 0;
+        cancel_delayed_work_sync(&p->gen_work);
+}
+
+static ssize_t ttyhubvuart_run_write(struct file *file,
+                        const char __user *ubuf, size_t count, loff_t *ppos)
+{
+        struct ttyhubvuart_port *p = file->private_data;
+        int run, err;
+
+        err = kstrtoint_from_user(ubuf, count, 0, &run);
+        if (err)
+                return err;
+        if (run)
+                ttyhubvuart_start(p);
+        else
+                ttyhubvuart_stop(p);
+        return count;
+}
+
+static ssize_t ttyhubvuart_run_read(struct file *file, char __user *ubuf,
+                        size_t count, loff_t *ppos)
+{
+        struct ttyhubvuart_port *p = file->private_data;
+        char buf[4];
+        int len;
+
+        len = snprintf(buf, sizeof(buf), "%d\n", p->running);
+        return simple_read_from_buffer(ubuf, count, ppos, buf, len);
+}
+
+static const struct file_operations ttyhubvuart_run_fops = {
+        .owner = THIS_MODULE,
+        .open = simple_open,
+        .read = ttyhubvuart_run_read,
+        .write = ttyhubvuart_run_write,
+};
+
+/* Writing at offset zero replaces the replay data, later writes append - a
+   write beyond the end of the data is refused, so no gap is replayed. */
+static ssize_t ttyhubvuart_replay_write(struct file *file,
+                        const char __user *ubuf, size_t count, loff_t *ppos)
+{
+        struct ttyhubvuart_port *p = file->private_data;
+        unsigned char *chunk;
+        loff_t pos = *ppos;
+
+        if (pos < 0 || pos >= replay_size)
+                return -ENOSPC;
+        count = min_t(size_t, count, replay_size - pos);
+
+        chunk = memdup_user(ubuf, count);
+        if (IS_ERR(chunk))
+                return PTR_ERR(chunk);
+
+        spin_lock(&p->lock);
+        if (pos > p->replay_len) {
+                spin_unlock(&p->lock);
+                kfree(chunk);
+                return -EINVAL;
+        }
+        memcpy(p->replay + pos, chunk, count);
+        p->replay_len = pos + count;
+        p->replay_pos = 0;
+        spin_unlock(&p->lock);
+
+        kfree(chunk);
+        *ppos = pos + count;
+        return count;
+}
+
+static const struct file_operations ttyhubvuart_replay_fops = {
+        .owner = THIS_MODULE,
+        .open = simple_open,
+        .write = ttyhubvuart_replay_write,
+};
+
+/*
+ * Count the bytes in the flip buffer of a port that the line discipline has
+ * not consumed yet. The buffer lock keeps flush_to_ldisc() from consuming
+ * and freeing buffers while they are walked; the generator may still append
+ * data meanwhile.
+ */
+static u64 ttyhubvuart_pending(struct ttyhubvuart_port *p)
+{
+        struct tty_buffer *b;
+        u64 pending = 0;
+
+        tty_buffer_lock_exclusive(&p->port);
+        for (b = p->port.buf.head; b; b = smp_load_acquire(&b->next))
+                pending += READ_ONCE(b->used) - b->read;
+        tty_buffer_unlock_exclusive(&p->port);
+        return pending;
+}
+
+static int ttyhubvuart_stats_show(struct seq_file *m, void *v)
+{
+        struct ttyhubvuart_port *p = m->private;
+        u64 elapsed_ns = p->last_ns - p->start_ns;
+        u64 elapsed_us = div_u64(elapsed_ns, NSEC_PER_USEC);
+        /* the counter is read first - bytes pushed while the buffers are
+           walked can only make the figure smaller, never too large */
+        u64 pushed = READ_ONCE(p->bytes_pushed);
+        u64 pending = ttyhubvuart_pending(p);
+        u64 consumed = pushed > pending ? pushed - pending : 0;
+
+        seq_printf(m, "running: %d\n", p->running);
+        seq_printf(m, "bytes_pushed: %llu\n", pushed);
+        seq_printf(m, "bytes_consumed: %llu\n", consumed);
+        seq_printf(m, "chunks: %llu\n", p->chunks);
+        seq_printf(m, "stalls: %llu\n", p->stalls);
+        seq_printf(m, "errors_flagged: %llu\n", p->errors_flagged);
+        seq_printf(m, "garbage_bytes: %llu\n", p->garbage_bytes);
+        seq_printf(m, "frames: %llu\n", p->frames);
+        seq_printf(m, "tx_bytes: %llu\n", p->tx_bytes);
+        seq_printf(m, "elapsed_ns: %llu\n", elapsed_ns);
+        seq_printf(m, "bytes_per_sec: %llu\n", elapsed_us ?
+                        div64_u64(consumed * USEC_PER_SEC,
+                                elapsed_us) : 0);
+        return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ttyhubvuart_stats);
+
+static int ttyhubvuart_install(struct tty_driver *driver,
+                        struct tty_struct *tty)
+{
+        return tty_port_install(&ttyhubvuart_ports[tty->index].port, driver,
+                        tty);
+}
+
+static int ttyhubvuart_open(struct tty_struct *tty, struct file *filp)
+{
+        return tty_port_open(tty->port, tty, filp);
+}
+
+static void ttyhubvuart_close(struct tty_struct *tty, struct file *filp)
+{
+        tty_port_close(tty->port, tty, filp);
+}
+
+static ssize_t ttyhubvuart_write(struct tty_struct *tty, const u8 *buf,
+                        size_t count)
+{
+        ttyhubvuart_ports[tty->index].tx_bytes += count;
+        return count;
+}
+
+static unsigned int ttyhubvuart_write_room(struct tty_struct *tty)
+{
+        return TTYHUBVUART_BURST;
+}
+
+static const struct tty_operations ttyhubvuart_ops = {
+        .install = ttyhubvuart_install,
+        .open = ttyhubvuart_open,
+        .close = ttyhubvuart_close,
+        .write = ttyhubvuart_write,
+        .write_room = ttyhubvuart_write_room,
+};
+
+static const struct tty_port_operations ttyhubvuart_port_ops = {
+};
+
+/* Free the first count ports, which must have been initialized. */
+static void ttyhubvuart_free_ports(int count)
+{
+        int i;
+
+        for (i=0; i < count; i++) {
+                tty_port_destroy(&ttyhubvuart_ports[i].port);
+                vfree(ttyhubvuart_ports[i].replay);
+        }
+        vfree(ttyhubvuart_ports);
+}
+
+static int __init ttyhubvuart_init(void)
+{
+        struct ttyhubvuart_port *p;
+        struct device *dev;
+        struct dentry *dir;
+        char name[16];
+        int i, err;
+
+        if (ports <= 0 || replay_size <= 0) {
+                printk(KERN_ERR "ttyhubvuart: invalid module parameters\n");
+                return -EINVAL;
+        }
+
+        ttyhubvuart_ports = vzalloc(sizeof(*ttyhubvuart_ports) * ports);
+        if (ttyhubvuart_ports == NULL)
+                return -ENOMEM;
+
+        for (i=0; i < ports; i++) {
+                p = &ttyhubvuart_ports[i];
+                p->index = i;
+                tty_port_init(&p->port);
+                p->port.ops = &ttyhubvuart_port_ops;
+                spin_lock_init(&p->lock);
+                INIT_DELAYED_WORK(&p->gen_work, ttyhubvuart_gen_work);
+                p->replay = vzalloc(replay_size);
+                if (p->replay == NULL) {
+                        ttyhubvuart_free_ports(i + 1);
+                        return -ENOMEM;
+                }
+        }
+
+        ttyhubvuart_driver = tty_alloc_driver(ports, TTY_DRIVER_REAL_RAW |
+                        TTY_DRIVER_DYNAMIC_DEV);
+        if (IS_ERR(ttyhubvuart_driver)) {
+                err = PTR_ERR(ttyhubvuart_driver);
+                goto error_free_ports;
+        }
+        ttyhubvuart_driver->driver_name = "ttyhubvuart";
+        ttyhubvuart_driver->name = "ttyHV";
+        ttyhubvuart_driver->type = TTY_DRIVER_TYPE_SERIAL;
+        ttyhubvuart_driver->subtype = SERIAL_TYPE_NORMAL;
+        ttyhubvuart_driver->init_termios = tty_std_termios;
+        ttyhubvuart_driver->init_termios.c_cflag = B115200 | CS8 | CREAD |
+                CLOCAL;
+        tty_set_operations(ttyhubvuart_driver, &ttyhubvuart_ops);
+
+        err = tty_register_driver(ttyhubvuart_driver);
+        if (err)
+                goto error_put_driver;
+
+        ttyhubvuart_debugfs = debugfs_create_dir("ttyhubvuart", NULL);
+        for (i=0; i < ports; i++) {
+                p = &ttyhubvuart_ports[i];
+                dev = tty_port_register_device(&p->port, ttyhubvuart_driver,
+                                i, NULL);
+                if (IS_ERR(dev)) {
+                        err = PTR_ERR(dev);
+                        goto error_unregister;
+                }
+
+                snprintf(name, sizeof(name), "ttyHV%d", i);
+                dir = debugfs_create_dir(name, ttyhubvuart_debugfs);
+                debugfs_create_file("run", 0600, dir, p,
+                                &ttyhubvuart_run_fops);
+                debugfs_create_file("replay", 0200, dir, p,
+                                &ttyhubvuart_replay_fops);
+                debugfs_create_file("stats", 0400, dir, p,
+                                &ttyhubvuart_stats_fops);
+        }
+
+        printk(KERN_INFO "ttyhubvuart: %d virtual serial ports\n", ports);
+        return 0;
+
+error_unregister:
+        debugfs_remove_recursive(ttyhubvuart_debugfs);
+        for (i--; i >= 0; i--)
+                tty_unregister_device(ttyhubvuart_driver, i);
+        tty_unregister_driver(ttyhubvuart_driver);
+error_put_driver:
+        tty_driver_kref_put(ttyhubvuart_driver);
+error_free_ports:
+        ttyhubvuart_free_ports(ports);
+        return err;
+}
+
+static void __exit ttyhubvuart_exit(void)
+{
+        int i;
+
+        debugfs_remove_recursive(ttyhubvuart_debugfs);
+        for (i=0; i < ports; i++) {
+                ttyhubvuart_stop(&ttyhubvuart_ports[i]);
+                tty_unregister_device(ttyhubvuart_driver, i);
+        }
+        tty_unregister_driver(ttyhubvuart_driver);
+        tty_driver_kref_put(ttyhubvuart_driver);
+        ttyhubvuart_free_ports(ports);
+}
+
+module_init(ttyhubvuart_init);
+module_exit(ttyhubvuart_exit);
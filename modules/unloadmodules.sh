@@ -1,4 +1,6 @@
 #!/bin/sh
+rmmod ttyhubvuart
+rmmod ttyhubnet
+rmmod ttyhubref
 rmmod testsubsys0
 rmmod ttyhub
-
@@ -14,6 +14,24 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+/*
+ * Usage:
+ *      ttyhub-control <tty> [subsystem number]
+ *              Attach ttyhub to the tty, enable the subsystem and keep the
+ *              tty open.
+ *      ttyhub-control <tty> replay <file> <subsystems> [repeat] [chunk size]
+ *              Attach ttyhub to the tty, enable the comma separated
+ *              subsystems and pass the file to the receive state machine
+ *              with the TTYHUB_INJECT ioctl (needs CAP_SYS_ADMIN). A file
+ *              in the capture format keeps its chunk boundaries, any other
+ *              file is split into chunks of chunk size bytes (default
+ *              4096). With 'pty' as tty a new pseudo terminal is used,
+ *              so no serial hardware is needed.
+ *
+ * Capture format: the magic "TTYHUBC1" followed by records of a 32 bit
+ * chunk length in host byte order and the bytes of the chunk.
+ */
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -21,10 +39,186 @@
 #include <sys/time.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <string.h>
 #include "../modules/include/ttyhub_ioctl.h"
 
+#define CAPTURE_MAGIC "TTYHUBC1"
+
+/*
+ * Read a replay file into memory, either with the chunk boundaries of the
+ * capture format or split into chunks of chunk_size bytes. Records of zero
+ * bytes are skipped, a capture ending within a record is refused.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+static int load_replay(const char *filename, unsigned int chunk_size,
+                struct ttyhub_inject *inj)
+{
+        FILE *f;
+        unsigned char *data = NULL;
+        __u32 *chunks = NULL;
+        void *pNew;
+        __u32 len = 0, nr_chunks = 0, n;
+        size_t size = 0, max_chunks = 0, got;
+        char magic[8];
+        int capture;
+
+        f = fopen(filename, "rb");
+        if (f == NULL)
+        {
+                printf("Error: can't open '%s' - errno = %d\n", filename,
+                        errno);
+                return -1;
+        }
+        capture = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) == 0;
+        if (!capture)
+                rewind(f);
+
+        while (1)
+        {
+                if (capture)
+                {
+                        got = fread(&n, 1, sizeof(n), f);
+                        if (got == 0)
+                                break;
+                        if (got < sizeof(n))
+                        {
+                                printf("Error: '%s' ends within a record\n",
+                                        filename);
+                                goto error;
+                        }
+                        /* nothing was received - there is no chunk */
+                        if (n == 0)
+                                continue;
+                }
+                else
+                {
+                        /* the last chunk fills up to TTYHUB_INJECT_MAX */
+                        n = chunk_size;
+                        if (n > TTYHUB_INJECT_MAX - len)
+                                n = TTYHUB_INJECT_MAX - len;
+                        if (n == 0 && fgetc(f) == EOF)
+                                break;
+                }
+                if (n > TTYHUB_INJECT_MAX - len || n == 0)
+                {
+                        printf("Error: more than %d bytes to replay\n",
+                                TTYHUB_INJECT_MAX);
+                        goto error;
+                }
+                if (len + n > size)
+                {
+                        size = (len + n) * 2;
+                        pNew = realloc(data, size);
+                        if (pNew == NULL)
+                                goto error;
+                        data = pNew;
+                }
+                got = fread(data + len, 1, n, f);
+                if (capture && got < n)
+                {
+                        printf("Error: '%s' ends within a record\n",
+                                filename);
+                        goto error;
+                }
+                n = got;
+                if (n == 0)
+                        break;
+                if (nr_chunks == max_chunks)
+                {
+                        max_chunks = max_chunks ? max_chunks * 2 : 1024;
+                        pNew = realloc(chunks, max_chunks * sizeof(*chunks));
+                        if (pNew == NULL)
+                                goto error;
+                        chunks = pNew;
+                }
+                chunks[nr_chunks++] = n;
+                len += n;
+        }
+        fclose(f);
+
+        if (len == 0)
+        {
+                printf("Error: '%s' holds no data\n", filename);
+                free(data);
+                free(chunks);
+                return -1;
+        }
+        memset(inj, 0, sizeof(*inj));
+        inj->data = (unsigned long)data;
+        inj->len = len;
+        inj->chunks = (unsigned long)chunks;
+        inj->nr_chunks = nr_chunks;
+        return 0;
+
+error:
+        fclose(f);
+        free(data);
+        free(chunks);
+        return -1;
+}
+
+/*
+ * Replay a file to the receive state machine of a tty and print how long
+ * receiving took.
+ *
+ * Returns the exit code of the program.
+ */
+static int replay(int fd, const char *filename, unsigned int repeat,
+                unsigned int chunk_size)
+{
+        struct ttyhub_inject inj;
+        unsigned long long bytes;
+        int retVal;
+
+        if (load_replay(filename, chunk_size, &inj) < 0)
+                return 1;
+        inj.repeat = repeat;
+
+        retVal = ioctl(fd, TTYHUB_INJECT, &inj);
+        printf("ioctl(%d, TTYHUB_INJECT, %u bytes in %u chunks x %u) "
+                "returned %d - errno = %d.\n", fd, inj.len, inj.nr_chunks,
+                repeat, retVal, errno);
+        free((void *)(unsigned long)inj.data);
+        free((void *)(unsigned long)inj.chunks);
+        if (retVal == -1)
+                return 1;
+
+        bytes = (unsigned long long)inj.len * repeat;
+        printf("accepted %llu of %llu bytes\n",
+                (unsigned long long)inj.accepted, bytes);
+        printf("%llu ns, %llu cycles\n", (unsigned long long)inj.ns,
+                (unsigned long long)inj.cycles);
+        if (inj.accepted)
+                printf("%.3f ns/byte, %.3f cycles/byte, %.1f MB/s\n",
+                        (double)inj.ns / inj.accepted,
+                        (double)inj.cycles / inj.accepted,
+                        inj.ns ? inj.accepted * 1000.0 / inj.ns : 0.0);
+        return 0;
+}
+
+/*
+ * Open a new pseudo terminal and return its slave side. The master side
+ * stays open until the program exits.
+ */
+static int open_pty(void)
+{
+        int master;
+
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1)
+        {
+                printf("Error: can't create pty - errno = %d\n", errno);
+                return -1;
+        }
+        printf("using pty '%s'\n", ptsname(master));
+        return open(ptsname(master), O_RDWR | O_NOCTTY);
+}
+
 int main(int argc, char *argv[])
 {
         int retVal;
@@ -34,17 +228,45 @@ int main(int argc, char *argv[])
         char *pFilename = NULL;
         char filenamebuf[256];
         int subsystem = 0;
+        char *pSubsystems = NULL;
+        unsigned int repeat = 1;
+        unsigned int chunk_size = 4096;
 
         printf("TTYHUB control\n");
 
-        if (argc != 2)
+        if (argc >= 5 && argc <= 7 && strcmp(argv[2], "replay") == 0)
+        {
+                pSubsystems = argv[4];
+                if (argc >= 6)
+                        repeat = atoi(argv[5]);
+                if (argc == 7)
+                        chunk_size = atoi(argv[6]);
+                if (repeat == 0 || chunk_size == 0)
+                {
+                        printf("Error: repeat and chunk size must not be "
+                                "zero\n");
+                        return 1;
+                }
+        }
+        else if (argc != 2 && argc != 3)
         {
                 printf("Error: Missing TTY filename (e.g. 'ttyS0'"
                         " or '/dev/ttyS0')\n");
+                printf("Usage: %s <tty> [subsystem number]\n", argv[0]);
+                printf("       %s <tty> replay <file> <subsystems> [repeat] "
+                        "[chunk size]\n", argv[0]);
                 return 1;
         }
 
-        if (argv[1][0] == '/')
+        if (argc == 3)
+                subsystem = atoi(argv[2]);
+
+        if (strcmp(argv[1], "pty") == 0)
+        {
+                /* new pseudo terminal */
+                pFilename = "pty";
+        }
+        else if (argv[1][0] == '/')
         {
                 /* absolute path */
                 pFilename = argv[1];
@@ -56,7 +278,10 @@ int main(int argc, char *argv[])
                 pFilename = filenamebuf;
         }
 
-        fd = open(pFilename, O_RDONLY | O_NOCTTY);
+        if (strcmp(pFilename, "pty") == 0)
+                fd = open_pty();
+        else
+                fd = open(pFilename, O_RDONLY | O_NOCTTY);
         printf("open('%s') returned %d - errno = %d\n", pFilename, fd, errno);
         if (fd == -1)
                 return 1;
@@ -67,9 +292,27 @@ int main(int argc, char *argv[])
         if (retVal == -1)
                 return 1;
 
+        if (pSubsystems)
+        {
+                /* enable all subsystems and replay the file */
+                char *pToken = strtok(pSubsystems, ",");
+                while (pToken)
+                {
+                        subsystem = atoi(pToken);
+                        retVal = ioctl(fd, TTYHUB_SUBSYS_ENABLE, &subsystem);
+                        printf("ioctl(%d, TTYHUB_SUBSYS_ENABLE, %d) returned "
+                                "%d - errno = %d.\n", fd, subsystem, retVal,
+                                errno);
+                        if (retVal == -1)
+                                return 1;
+                        pToken = strtok(NULL, ",");
+                }
+                return replay(fd, argv[3], repeat, chunk_size);
+        }
+
         retVal = ioctl(fd, TTYHUB_SUBSYS_ENABLE, &subsystem);
-        printf("ioctl(%d, TTYHUB_SUBSYS_ENABLE, 0) returned %d - "
-                "errno = %d.\n", fd, retVal, errno);
+        printf("ioctl(%d, TTYHUB_SUBSYS_ENABLE, %d) returned %d - "
+                "errno = %d.\n", fd, subsystem, retVal, errno);
         if (retVal == -1)
                 return 1;
 